@@ -12,13 +12,19 @@ LDFLAGS     += -L$(LIB_DIR) -l$(PACKAGE)
 tests       := $(SOURCES:%.cpp=$(TEST_DIR)/%)
 tests       := $(tests:%.c=$(TEST_DIR)/%)
 
+# STUB_SOURCES are linked into the tests named in STUB_TESTS, e.g. for what the library expects from an application
+stub_objects := $(call from_sources,$(STUB_SOURCES),$(OBJ_DIR),.o)
+OBJ_DEPS    += $(stub_objects:%.o=%.d)
+
 all : $(tests)
 
 $(tests) : $(TEST_DIR)/% : $(OBJ_DIR)/%.o $(LIB_DEPS) | $(TEST_DIR)/
-	$(LINK) $(CPPFLAGS) $(CXXFLAGS)  $< -o $@ $(LDFLAGS)
+	$(LINK) $(CPPFLAGS) $(CXXFLAGS)  $(filter %.o,$^) -o $@ $(LDFLAGS)
+
+$(STUB_TESTS:%=$(TEST_DIR)/%) : $(stub_objects)
 
 clean:
-	-rm -rf $(OBJECTS) $(OBJ_DEPS)
+	-rm -rf $(OBJECTS) $(OBJ_DEPS) $(stub_objects)
 
 clear: clean
 	-rm -rf $(TEST_DIR)
@@ -90,7 +90,7 @@ struct Stream : public ParamSet {
     Param<string>   rate_control;
     Param<int>      max_bitrate;
     Param<bool>     osd;
-
+    Param<int>      gop_cache;      // KB of the current GOP kept for new RTSP clients, -1 for server default
 
     Stream() : ParamSet("stream"),     
                PARAM(id,            0,      VerifyRange(0, COUNT - 1)),
@@ -105,7 +105,8 @@ struct Stream : public ParamSet {
                PARAM(profile,       "main", VerifyEnum("base", "main", "high")),
                PARAM(rate_control,  "cbr", VerifyEnum("cbr", "vbr", "cq")),
                PARAM(max_bitrate,  12000, VerifyRange(100, 15000)),
-               PARAM(osd, false)
+               PARAM(osd, false),
+               PARAM(gop_cache,     -1,     VerifyRange(-1, 16384))
     {}
 };
 
@@ -19,6 +19,10 @@
 #include <sbl/sbl_exception.h>
 #include <sbl/sbl_logger.h>
 #include <rtsp/rtsp.h>
+#include <rtsp/rtsp_source.h>
+#include <rtsp/event_buffer.h>
+#include <rtsp/hls_packager.h>
+#include <rtsp/metrics.h>
 #include "cgi_server.h"
 
 
@@ -439,6 +443,76 @@ void Server::cmd_test() {
     }
 }
 
+//! Process event? command
+//! action=add saves event clips of all streams, as motion does; get and send take stream 'id',
+//! send replies with the clip of the last event, or with the video buffered now if 'live' is set
+void Server::cmd_event() {
+    RTSP::Server* rtsp_server = RTSP::application()->rtsp_server();
+    CGI_ERROR(!rtsp_server, "RTSP server is not running");
+    Action action = get_action(ACTION_GET | ACTION_SEND | ACTION_ADD);
+    if (action == ACTION_ADD) {
+        CGI_ERROR(_arg_map.size(), "no arguments allowed with action=add");
+        _reply << "clips=" << rtsp_server->trigger_event() << eol();
+        return;
+    }
+    int id = convert<int>(get_arg("id"));
+    CGI_ERROR(id < 0 || id >= Stream::COUNT, "incorrect stream id %d", id);
+    bool live = find_arg("live") && convert<int>(get_arg("live"));
+    CGI_ERROR(_arg_map.size(), "no arguments other then 'id' and 'live' allowed");
+    RTSP::EventBuffer* buffer = rtsp_server->get_source(id)->event_buffer();
+    CGI_ERROR(!buffer, "event buffer is not enabled for stream %d", id);
+    if (action == ACTION_GET) {
+        _reply << "id="         << id << eol()
+               << "event_time=" << buffer->event_time() << eol()
+               << "buffered="   << std::fixed << std::setprecision(1) << buffer->length() << eol();
+        return;
+    }
+    CGI_ERROR(!buffer->clip(_content, live), "no video buffered for stream %d", id);
+    _content_buffer = reinterpret_cast<char*>(&_content[0]);
+    _content_size   = _content.size();
+    _content_type   = Gateway::RAW;
+    std::ostringstream filename;
+    filename << "event-" << id << '-' << (live ? time(NULL) : buffer->event_time()) << ".264";
+    _reply_filename = filename.str();
+}
+
+//! Process hls? command
+//! 'file' of stream 'id' is index.m3u8, the playlist, or a file it lists; the playlist lists them
+//! as hls?id=<id>&file=<name>, relative to itself, so that they go through the same front end
+void Server::cmd_hls() {
+    RTSP::Server* rtsp_server = RTSP::application()->rtsp_server();
+    CGI_ERROR(!rtsp_server, "RTSP server is not running");
+    int id = convert<int>(get_arg("id"));
+    CGI_ERROR(id < 0 || id >= Stream::COUNT, "incorrect stream id %d", id);
+    const char* file = get_arg("file");
+    CGI_ERROR(_arg_map.size(), "no arguments other then 'id' and 'file' allowed");
+    RTSP::HlsPackager* packager = rtsp_server->get_source(id)->hls_packager();
+    CGI_ERROR(!packager, "HLS is not enabled for stream %d", id);
+    if (strcmp(file, "index.m3u8") == 0) {
+        std::ostringstream prefix;
+        prefix << "hls?id=" << id << "&file=";
+        std::string playlist;
+        CGI_ERROR(!packager->playlist(playlist, prefix.str().c_str()), "no video packaged for stream %d yet", id);
+        _content.assign(playlist.begin(), playlist.end());
+        _content_type = Gateway::PLAYLIST;
+    } else {
+        CGI_ERROR(!packager->file(file, _content), "no file %s for stream %d", file, id);
+        _content_type = Gateway::MP4;
+    }
+    _content_buffer = reinterpret_cast<char*>(&_content[0]);
+    _content_size   = _content.size();
+}
+
+//! Process stats? command
+//! Streaming metrics of stream 'name' and of its clients, of all streams if there is no name;
+//! they are read without holding up the streaming threads
+void Server::cmd_stats() {
+    CGI_ERROR(!RTSP::application()->rtsp_server(), "RTSP server is not running");
+    const char* name = find_arg("name") ? get_arg("name") : NULL;
+    CGI_ERROR(_arg_map.size(), "no arguments other then 'name' allowed");
+    CGI_ERROR(!RTSP::Metrics::registry().print(_reply, name), "no stream %s", name);
+}
+
 //! Class constructor
 Server::Server(const Options& options, const SDKManager::Options& sdk_options) :
     _options(options), _initialized(false), _fatal_error(false), _logged(_options.logged), 
@@ -463,6 +537,9 @@ Server::Server(const Options& options, const SDKManager::Options& sdk_options) :
     ("roi",         &Server::cmd_roi)
     ("raw_command", &Server::cmd_raw_command)
     ("test",        &Server::cmd_test)
+    ("event",       &Server::cmd_event)
+    ("hls",         &Server::cmd_hls)
+    ("stats",       &Server::cmd_stats)
     )
 {
     try {
@@ -692,7 +769,8 @@ unsigned int Server::read_reply() {
 //! insert "OK" if reply stream is empty
 const char* Server::reply() {
     if (content_type() == Gateway::JPEG || content_type() == Gateway::RAW 
-      || content_type() == Gateway::LOGFILE || content_type() == Gateway::STATUS_FILE)
+      || content_type() == Gateway::LOGFILE || content_type() == Gateway::STATUS_FILE
+      || content_type() == Gateway::PLAYLIST || content_type() == Gateway::MP4)
         return _content_buffer;
     _content_size = read_reply();
     if (_content_size == 0 && content_type() != Gateway::STATUS_FILE) {
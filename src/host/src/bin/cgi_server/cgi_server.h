@@ -107,6 +107,9 @@ private:
     void cmd_roi();
     void cmd_raw_command();
     void cmd_test();
+    void cmd_event();
+    void cmd_hls();
+    void cmd_stats();
 
     typedef void (Server::*CmdFun)();
     typedef std::map<const char*, CmdFun, StrCompare> CmdMap;
@@ -128,6 +131,7 @@ private:
     ArgMap              _arg_map;
     MVSender            _mv_sender;
     string              _reply_filename;
+    std::vector<uint8_t> _content;          // event clip, HLS playlist or segment being sent
     time_t              _boot_time;
     Mutex               _mutex;
     Temperature         _temperature;
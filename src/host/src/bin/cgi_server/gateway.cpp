@@ -138,6 +138,8 @@ const char* Gateway::content_type(Type type) {
     if (type == JPEG) return "video/jpeg";
     if (type == HTML) return "text/html";
     if (type == RAW)  return "application/octet-stream";
+    if (type == PLAYLIST) return "application/vnd.apple.mpegurl";
+    if (type == MP4)  return "video/mp4";
     SBL_ASSERT(0);
 }
 
@@ -155,6 +157,11 @@ void Gateway::reply(Type type, const char* buffer, int size, const char* reply_f
                      t.tm_hour, t.tm_min, t.tm_sec);
     } else if (type == RAW || type == LOGFILE) {
         offs += snprintf(_buffer + offs, _buffer_size - offs, "Content-Disposition: attachment; filename=\"%s\"\r\n", reply_filename);
+    } else if (type == PLAYLIST) {
+        // playlist changes with every segment, media files never do once they are listed
+        offs += snprintf(_buffer + offs, _buffer_size - offs, "Cache-Control: max-age=1\r\n");
+    } else if (type == MP4) {
+        offs += snprintf(_buffer + offs, _buffer_size - offs, "Cache-Control: max-age=3600\r\n");
     }
     SBL_MSG(MSG::SERVER, "Gateway reply is:\n%s", _buffer);
     offs += snprintf(_buffer + offs, _buffer_size - offs, "\r\n");
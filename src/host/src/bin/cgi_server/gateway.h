@@ -22,7 +22,7 @@ namespace CGI {
 //! Handles are interactions with fcgi library
 class Gateway {
 public:
-    enum Type {TEXT, JPEG, HTML, RAW, LOGFILE, STATUS_FILE}; //!< Type of the output
+    enum Type {TEXT, JPEG, HTML, RAW, LOGFILE, STATUS_FILE, PLAYLIST, MP4}; //!< Type of the output
     enum Method { UNKNOWN_METHOD, GET, POST };  //!< HTML method used (CGI server doesn't use PUT
     Gateway();                                  //!< Allocates _buffer
     bool        accept();                       //!< Wrapper around FCGX_Accept
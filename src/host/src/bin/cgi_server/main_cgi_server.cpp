@@ -50,6 +50,41 @@ public:
                                rtsp.packet_size > 9000 ? 9000 :
                                rtsp.packet_size;
         getenv("CGI_SERVER_PACKET_GAP", rtsp.packet_gap);
+        getenv("CGI_SERVER_PACING_RATE", rtsp.pacing_rate);
+        getenv("CGI_SERVER_PACING_BURST", rtsp.pacing_burst);
+        if (getenv("CGI_SERVER_PACE_CLIENTS", value))
+            rtsp.pace_clients = value;
+        if (getenv("CGI_SERVER_TXTIME", value))
+            rtsp.txtime = value;
+        getenv("CGI_SERVER_GOP_CACHE", rtsp.gop_cache_size);
+        getenv("CGI_SERVER_GOP_CACHE_SPEED", rtsp.gop_cache_speed);
+        if (getenv("CGI_SERVER_GOP_CACHE_REBASE", value))
+            rtsp.gop_cache_rebase = value;
+        getenv("CGI_SERVER_MULTICAST", rtsp.multicast_address);
+        getenv("CGI_SERVER_MULTICAST_PORT", rtsp.multicast_port);
+        getenv("CGI_SERVER_MULTICAST_TTL", rtsp.multicast_ttl);
+        if (getenv("CGI_SERVER_FILE_INDEX", value))
+            rtsp.file_index = value;
+        if (getenv("CGI_SERVER_UDP_BATCH", value))
+            rtsp.udp_batch = value;
+        getenv("CGI_SERVER_RTSP_THREADS", rtsp.reactors);
+        if (getenv("CGI_SERVER_SEND_QUEUE", rtsp.send_queue_size) && rtsp.send_queue_size < rtsp.min_send_queue_size())
+            rtsp.send_queue_size = rtsp.min_send_queue_size();
+        getenv("CGI_SERVER_FRAME_POOL", rtsp.frame_pool_size);
+        if (getenv("CGI_SERVER_STAP_A", value))
+            rtsp.stap_a = value;
+        getenv("CGI_SERVER_RECORD_DIR", rtsp.record_dir);
+        getenv("CGI_SERVER_RECORD_SEGMENT", rtsp.record_segment_time);
+        getenv("CGI_SERVER_RECORD_SEGMENT_SIZE", rtsp.record_segment_size);
+        getenv("CGI_SERVER_RECORD_RETENTION", rtsp.record_retention);
+        getenv("CGI_SERVER_RECORD_RETENTION_TIME", rtsp.record_retention_time);
+        getenv("CGI_SERVER_RECORD_QUEUE", rtsp.record_queue_size);
+        getenv("CGI_SERVER_EVENT_BUFFER", rtsp.event_buffer_size);
+        getenv("CGI_SERVER_EVENT_TIME", rtsp.event_buffer_time);
+        getenv("CGI_SERVER_EVENT_MOTION", sdk.motion_threshold);
+        getenv("CGI_SERVER_HLS", rtsp.hls_segment_time);
+        getenv("CGI_SERVER_HLS_SEGMENTS", rtsp.hls_segments);
+        getenv("CGI_SERVER_HLS_PART", rtsp.hls_part_time);
         getenv("CGI_SERVER_BCAST", cgi.net_recovery);
 
         set_rtsp_verbosity();
@@ -183,6 +218,35 @@ const char* Options::_usage = "\n"
     "   CGI_SERVER_VERBOSITY    verbosity level in the log file\n"
     "   CGI_SERVER_ROMFILE      path to the firmware rom file\n"
     "   CGI_SERVER_WATCHDOG     watchdog timeout, 0 to disable\n"
+    "   CGI_SERVER_UDP_BATCH    0 to send RTP over UDP one packet per syscall\n"
+    "   CGI_SERVER_RTSP_THREADS number of threads serving RTSP connections (default 2)\n"
+    "   CGI_SERVER_SEND_QUEUE   send queue size in bytes for each RTP over TCP client\n"
+    "   CGI_SERVER_FRAME_POOL   memory in bytes preallocated for video frames (default 4M)\n"
+    "   CGI_SERVER_STAP_A       0 to send SPS/PPS/SEI in their own RTP packets, not in STAP-A\n"
+    "   CGI_SERVER_PACING_RATE  pace RTP to this percentage of stream bitrate (default 0, off)\n"
+    "   CGI_SERVER_PACING_BURST bytes that may be sent back to back when pacing (default 16K)\n"
+    "   CGI_SERVER_PACE_CLIENTS 1 to pace each client separately, rather than the whole stream\n"
+    "   CGI_SERVER_TXTIME       1 to let the kernel pace UDP clients (SO_TXTIME)\n"
+    "   CGI_SERVER_GOP_CACHE    bytes of the current GOP cached per stream for new clients (default 0, off)\n"
+    "   CGI_SERVER_GOP_CACHE_SPEED  cached frames sent per live frame to a new client (default 4, 0 all at once)\n"
+    "   CGI_SERVER_GOP_CACHE_REBASE 0 to keep original timestamps of cached frames\n"
+    "   CGI_SERVER_MULTICAST    first multicast group address, enables multicast (default off)\n"
+    "   CGI_SERVER_MULTICAST_PORT   RTP port of the first multicast group (default 20000)\n"
+    "   CGI_SERVER_MULTICAST_TTL    multicast time to live (default 16)\n"
+    "   CGI_SERVER_FILE_INDEX   1 to save the index of each streamed file next to it (<file>.idx)\n"
+    "   CGI_SERVER_RECORD_DIR   record live H.264 streams to segments in this directory (default off)\n"
+    "   CGI_SERVER_RECORD_SEGMENT   seconds per recorded segment (default 60)\n"
+    "   CGI_SERVER_RECORD_SEGMENT_SIZE  bytes per recorded segment, at most (default 64M)\n"
+    "   CGI_SERVER_RECORD_RETENTION MB of recorded segments kept per stream (default 0, no limit)\n"
+    "   CGI_SERVER_RECORD_RETENTION_TIME    hours recorded segments are kept (default 0, no limit)\n"
+    "   CGI_SERVER_RECORD_QUEUE bytes of frames waiting to be recorded (default 4M)\n"
+    "   CGI_SERVER_EVENT_BUFFER bytes of recent video buffered per stream for event clips (default 0, off)\n"
+    "   CGI_SERVER_EVENT_TIME   seconds of video kept before an event (default 10)\n"
+    "   CGI_SERVER_EVENT_MOTION motion that saves event clips (default 0, only event?action=add): motion value\n"
+    "                           (1-255) of a macroblock, or number of blocks moving in the motion map\n"
+    "   CGI_SERVER_HLS          seconds per HLS segment, packages live streams for hls?id=<id>&file=index.m3u8 (default 0, off)\n"
+    "   CGI_SERVER_HLS_SEGMENTS segments listed in the HLS playlist (default 6)\n"
+    "   CGI_SERVER_HLS_PART     ms per low latency HLS partial segment (default 0, whole segments only)\n"
     ;
 
 int main(int argc, char* argv[]) {
@@ -98,7 +98,8 @@ SDKManager::Options::Options() :
     sct_timeout(5),
     sdk_log_filename("cgi_sdk.log"),
     sd_video_std(SDVR_VIDEO_STD_NONE),
-    use_fosd(true)
+    use_fosd(true),
+    motion_threshold(0)
 {
     memset(&chan_buf_counts, 0, sizeof(chan_buf_counts));
     chan_buf_counts.max_buf_count = 0;
@@ -120,7 +121,7 @@ SDKManager::Options::Options() :
 // Class constructors
 SDKManager::SDKManager(Server *server, const Options& options) : _initialized(false), _board_index(0),
         _camera_handle(INVALID_CHAN_HANDLE), _options(options), _server(server), _callback_buffer(NULL),
-        _drop_count(0), _frame_count(0), _block_callback(false), _sensor_rate(0)  {}
+        _drop_count(0), _frame_count(0), _block_callback(false), _sensor_rate(0), _motion_time(0)  {}
 
 bool SDKManager::init() {
     try {
@@ -751,6 +752,15 @@ void SDKManager::reset(ParamState& param_state) {
     SBL_MSG(MSG::SDK, "Reset completed\n");
 }
 
+// Copy the frame into RTSP frame pool and give the buffer back to SDK right away,
+// so that a slow network doesn't drain encoder buffer pool.
+static void rtsp_send_sdk_frame(sdvr_av_buffer_t* av_frame, unsigned int chan_num, int stream_id,
+                                uint8_t* payload, int payload_size, uint32_t timestamp, RTSP::EncoderType encoder) {
+    RTSP::FrameRef frame = rtsp_copy_frame(payload, payload_size);
+    sdvr_release_av_buffer(av_frame);
+    rtsp_send_frame(chan_num, stream_id, frame, timestamp, encoder);
+}
+
 /*
  * This method is called by the SDK A/V callback to send the given video
  * buffer bit-stream or motion value to the client requesting the buffer.
@@ -804,28 +814,66 @@ void SDKManager::send_frame(sdvr_chan_handle_t sdk_chan_handle, sdvr_frame_type_
         _frame_count++;
     case SDVR_FRAME_H264_SPS:
     case SDVR_FRAME_H264_PPS:
-        rtsp_send_frame(chan_num, stream_id, frame_payload, frame_payload_size, timestamp, RTSP::H264);
-        sdvr_release_av_buffer(av_frame);
+        rtsp_send_sdk_frame(av_frame, chan_num, stream_id, frame_payload, frame_payload_size, timestamp, RTSP::H264);
         break;
     case SDVR_FRAME_MPEG4_I:
     case SDVR_FRAME_MPEG4_P:
         _frame_count++;
     case SDVR_FRAME_MPEG4_VOL:
-        rtsp_send_frame(chan_num, stream_id, frame_payload, frame_payload_size, timestamp, RTSP::MPEG4);
-        sdvr_release_av_buffer(av_frame);
+        rtsp_send_sdk_frame(av_frame, chan_num, stream_id, frame_payload, frame_payload_size, timestamp, RTSP::MPEG4);
         break;
     case SDVR_FRAME_MPEG2_I:
     case SDVR_FRAME_MPEG2_P:
         break;
     case SDVR_FRAME_JPEG:
-        rtsp_send_frame(chan_num, stream_id, frame_payload, frame_payload_size, timestamp, RTSP::MJPEG);
-        sdvr_release_av_buffer(av_frame);
+        rtsp_send_sdk_frame(av_frame, chan_num, stream_id, frame_payload, frame_payload_size, timestamp, RTSP::MJPEG);
         _frame_count++;
         break;
     case SDVR_FRAME_MOTION_MAP:
         mv_sender().send_mv_packet(frame_payload, frame_payload_size, timestamp);
+        check_motion_map(frame_payload, frame_payload_size);
         sdvr_release_av_buffer(av_frame);
         break;
+    case SDVR_FRAME_MOTION_VALUES:
+        check_motion_values(frame_payload, frame_payload_size);
+        sdvr_release_av_buffer(av_frame);
+        break;
+    }
+}
+
+// Motion map has a bit set for each block that moved, threshold is how many blocks that takes
+void SDKManager::check_motion_map(const sx_uint8* map, int size) {
+    if (_options.motion_threshold <= 0)
+        return;
+    int blocks = 0;
+    for (int n = 0; n < size; n++)
+        for (sx_uint8 bits = map[n]; bits; bits &= bits - 1)
+            blocks++;
+    if (blocks >= _options.motion_threshold)
+        motion_detected("blocks moved", blocks);
+}
+
+// Motion values are 0-255 for each macroblock, threshold is the value one of them has to reach
+void SDKManager::check_motion_values(const sx_uint8* values, int count) {
+    if (_options.motion_threshold <= 0)
+        return;
+    int n = 0;
+    while (n < count && values[n] < _options.motion_threshold)
+        n++;
+    if (n < count)
+        motion_detected("motion value", values[n]);
+}
+
+// Motion keeps coming while something moves, RTSP server is asked at most once a second
+void SDKManager::motion_detected(const char* what, int level) {
+    struct timespec now;
+    if (clock_gettime(CLOCK_MONOTONIC, &now) != 0 || now.tv_sec == _motion_time)
+        return;
+    _motion_time = now.tv_sec;
+    RTSP::Server* rtsp_server = RTSP::application()->rtsp_server();
+    if (rtsp_server) {
+        SBL_MSG(MSG::SDK, "Motion, %s %d, saving event clips", what, level);
+        rtsp_server->trigger_event();
     }
 }
 
@@ -1135,6 +1183,12 @@ void SDKManager::set_stream(Stream& stream) {
     }
     SDK_CALL(sdvr_set_video_encoder_channel_params(_camera_handle, stream_id, &_stream_info[stream_id].video_enc_params));
 
+    if (stream.gop_cache.changed() && stream.gop_cache >= 0) {
+        RTSP::Server* rtsp_server = RTSP::application()->rtsp_server();
+        if (rtsp_server)
+            rtsp_server->set_gop_cache_size(stream_id, stream.gop_cache * 1024);
+    }
+
     // enabling of  encoder should be done as the last step and only if it
     // changes its state. Also, we don't do it at initialization, we want
     // to configure all streams first and enable them later.
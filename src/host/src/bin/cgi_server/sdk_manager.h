@@ -49,6 +49,8 @@ public:
         string               sdk_log_filename;
         sdvr_video_std_e     sd_video_std;
         bool                 use_fosd;
+        int                  motion_threshold;  // motion that saves event clips, 0 not to save them: value a macroblock
+                                                // reaches (1-255) in motion values, blocks that moved in a motion map
         Options();
     };
 
@@ -138,6 +140,12 @@ private:
     static const char*  flash_device(const char* filepath); // get device name from filepath
 
     bool                test_frame_verify(sdvr_av_buffer_t *buffer);
+    // save event clips if motion_threshold blocks of the motion map (bitmap) moved
+    void                check_motion_map(const sx_uint8* map, int size);
+    // save event clips if any of the motion values reaches motion_threshold
+    void                check_motion_values(const sx_uint8* values, int count);
+    // save event clips, at most once a second
+    void                motion_detected(const char* what, int level);
     bool                sdk_error(sdvr_err_e err);
     bool                is_initialized() const { return _initialized; }
     char*               serial_number();
@@ -168,6 +176,7 @@ private:
 
     bool                  _block_callback;
     int                   _sensor_rate;
+    time_t                _motion_time;     // monotonic seconds, when event clips were last saved
 
     static const char*    _local_tar_gz;
     static const char*    _startup;
@@ -0,0 +1,272 @@
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <csignal>
+#include <cstdlib>
+#include <unistd.h>
+#include <time.h>
+#include <sbl/sbl_logger.h>
+#include <sbl/sbl_exception.h>
+#include <rtsp/rtsp.h>
+#include <rtsp/rtsp_client.h>
+#include <rtsp/rtp_receiver.h>
+
+// librtsp carries the server too, which asks the application for its streams; the client serves none
+class NoStreams : public RTSP::Application {
+public:
+    int get_stream_id(unsigned int channel_num, unsigned int stream_num) { return -1; }
+    int get_stream_id(const char* stream_name) { return -1; }
+    void play(int stream_id) {}
+    void teardown(int stream_id) {}
+    int describe(int stream_id, StreamDesc& stream_desc) { return -1; }
+    int pe_id() const { return 0; }
+} no_streams;
+RTSP::Application* RTSP::application() { return &no_streams; }
+
+class Options {
+public:
+    std::vector<const char*> urls;
+    int     streams;
+    int     duration;
+    bool    tcp;
+    int     ramp;
+    int     interval;
+    Options(int argc, char* argv[]) :
+        streams(1), duration(300), tcp(false), ramp(50), interval(10) {
+        int c;
+        while ( (c = getopt(argc, argv, "n:d:tr:i:v:l:h")) != -1 )
+            switch (c) {
+                case 'n':  streams  = strtol(optarg, 0, 0);  break;
+                case 'd':  duration = strtol(optarg, 0, 0);  break;
+                case 't':  tcp      = true;                  break;
+                case 'r':  ramp     = strtol(optarg, 0, 0);  break;
+                case 'i':  interval = strtol(optarg, 0, 0);  break;
+                case 'v' : SBL::Log::set_verbosity(strtol(optarg, 0, 0));          break;
+                case 'l' : if (SBL::Log::open_logfile(optarg) < 0) {
+                                std::cerr << "Error: unable to open logfile " << optarg << std::endl;
+                                exit(1);
+                           }
+                           break;
+                case 'h':
+                default :  std::cout << _usage << std::endl;
+                           exit(1);
+            }
+        for (int n = optind; n < argc; n++)
+            urls.push_back(argv[n]);
+        if (urls.empty() || streams <= 0 || interval <= 0) {
+            std::cout << _usage << std::endl;
+            exit(1);
+        }
+    }
+private:
+    static const char* _usage;
+};
+
+const char* Options::_usage = "\n"
+    "rtsp_client <url> [<url> ...] -n <streams> -d <duration> -t -r <ms> -i <seconds> -v <verbosity> -l <logfile>\n"
+    "Plays <streams> sessions of the urls (rtsp://<host>[:port]/<stream>), taken in turn, and reports\n"
+    "what the viewers get: packets, loss, reordering, jitter and broken frames.\n"
+    "Options:\n"
+    "   -n <int>        : number of concurrent sessions, default 1\n"
+    "   -d <int>        : test duration in seconds, default 300\n"
+    "   -t              : use TCP (default UDP)\n"
+    "   -r <int>        : ms between session starts, default 50\n"
+    "   -i <int>        : seconds between reports, default 10\n"
+    "   -v <int>        : message verbosity (default 1, errors only)\n"
+    "   -l <filename>   : logfile for messages (default stdout)\n"
+    "\n";
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static volatile bool stopped = false;
+
+static void stop(int) {
+    stopped = true;
+}
+
+//! One viewer: a session and its depacketizer, which keeps the counters
+class Viewer : public RTSP::Depacketizer::Sink {
+public:
+    Viewer(const char* url, const RTSP::RemoteClient::Options& options) :
+        depacketizer(this), client(url, &depacketizer, options), playing(false), retry(0), failures(0),
+        last_packets(0), last_progress(0) {}
+    //! NAL units are only counted, by the depacketizer
+    void nal_unit(const uint8_t* data, int size, uint32_t timestamp) {}
+
+    RTSP::Depacketizer  depacketizer;
+    RTSP::RemoteClient  client;
+    bool                playing;
+    double              retry;          // when to open the session again
+    unsigned int        failures;
+    uint64_t            last_packets;   // packets when they last went up
+    double              last_progress;
+};
+
+//! Counters of all viewers
+struct Totals {
+    int         playing;
+    uint64_t    packets;
+    uint64_t    bytes;
+    uint64_t    lost;
+    uint64_t    late;
+    uint64_t    reordered;
+    uint64_t    frames;
+    uint64_t    broken;
+    unsigned int failures;
+    double      jitter_sum;
+    double      jitter_max;
+    Totals(const std::vector<Viewer*>& viewers) : playing(0), packets(0), bytes(0), lost(0), late(0), reordered(0),
+                frames(0), broken(0), failures(0), jitter_sum(0), jitter_max(0) {
+        for (unsigned int n = 0; n < viewers.size(); n++) {
+            const RTSP::Depacketizer::Stats& stats = viewers[n]->depacketizer.stats();
+            playing   += viewers[n]->playing;
+            packets   += stats.packets;
+            bytes     += stats.bytes;
+            lost      += stats.lost;
+            late      += stats.late;
+            reordered += stats.reordered;
+            frames    += stats.access_units;
+            broken    += stats.broken;
+            failures  += viewers[n]->failures;
+            int clock = viewers[n]->client.media().clock;
+            double jitter = clock ? viewers[n]->depacketizer.jitter() * 1000.0 / clock : 0;
+            jitter_sum += jitter;
+            if (jitter > jitter_max)
+                jitter_max = jitter;
+        }
+    }
+};
+
+static void report(std::ostream& str, const char* label, double elapsed, const std::vector<Viewer*>& viewers,
+                   const Totals& last, const RTSP::RtpReceiver& receiver) {
+    Totals totals(viewers);
+    double seconds = elapsed > 0 ? elapsed : 1;
+    str << std::fixed << std::setprecision(2)
+        << label << " t=" << (int) elapsed << " sessions=" << totals.playing << '/' << viewers.size()
+        << " failures=" << totals.failures
+        << " packets=" << totals.packets - last.packets
+        << " mbps=" << (totals.bytes - last.bytes) * 8 / seconds / 1e6
+        << " lost=" << totals.lost - last.lost << " late=" << totals.late - last.late
+        << " reordered=" << totals.reordered - last.reordered
+        << " frames=" << totals.frames - last.frames << " broken=" << totals.broken - last.broken
+        << " jitter_ms=" << (viewers.empty() ? 0 : totals.jitter_sum / viewers.size()) << '/' << totals.jitter_max;
+    if (receiver.stats().packets)
+        str << " packets_per_read=" << (double) receiver.stats().packets / receiver.stats().syscalls;
+    str << std::endl;
+}
+
+static void stop_viewer(Viewer* viewer, RTSP::RtpReceiver& receiver) {
+    if (viewer->client.rtp_fd() >= 0)
+        receiver.remove(viewer->client.rtp_fd());
+    try {
+        viewer->client.close();
+    } catch (SBL::Exception& ex) {
+        SBL_WARN("%s: %s", viewer->client.url(), ex.what());
+    }
+    viewer->depacketizer.reset();
+    viewer->playing = false;
+    viewer->retry   = now() + 1;
+}
+
+static void start_viewer(Viewer* viewer, RTSP::RtpReceiver& receiver) {
+    try {
+        viewer->client.open();
+        if (viewer->client.rtp_fd() >= 0)
+            receiver.add(viewer->client.rtp_fd(), &viewer->depacketizer, viewer->client.media().clock);
+        viewer->playing       = true;
+        viewer->last_progress = now();
+    } catch (SBL::Exception& ex) {
+        SBL_ERROR("%s: %s", viewer->client.url(), ex.what());
+        viewer->failures++;
+        stop_viewer(viewer, receiver);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Options options(argc, argv);
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    RTSP::RemoteClient::Options client_options;
+    client_options.tcp        = options.tcp;
+    client_options.detach_rtp = true;
+    RTSP::RtpReceiver receiver;
+    std::vector<Viewer*> viewers;
+    Totals last(viewers);
+
+    double start = now(), next_start = start, next_report = start + options.interval, next_service = start;
+    while (!stopped && now() < start + options.duration) {
+        double time = now();
+        // sessions start one at a time, so that the server sees a ramp rather than a burst
+        if ((int) viewers.size() < options.streams && time >= next_start) {
+            Viewer* viewer = new Viewer(options.urls[viewers.size() % options.urls.size()], client_options);
+            viewers.push_back(viewer);
+            start_viewer(viewer, receiver);
+            next_start = time + options.ramp / 1000.0;
+        }
+        // UDP media is received here, in batches; the connections only carry keepalives
+        receiver.poll(options.tcp ? 0 : 10);
+        bool service = options.tcp || time >= next_service;
+        for (unsigned int n = 0; n < viewers.size(); n++) {
+            Viewer* viewer = viewers[n];
+            if (!viewer->playing) {
+                if (time >= viewer->retry && !stopped)
+                    start_viewer(viewer, receiver);
+                continue;
+            }
+            if (!service)
+                continue;
+            bool ok = false;
+            try {
+                ok = viewer->client.receive(0);
+            } catch (SBL::Exception& ex) {
+                SBL_ERROR("%s: %s", viewer->client.url(), ex.what());
+            }
+            // client notices media stopping on TCP, UDP media is watched here
+            uint64_t packets = viewer->depacketizer.stats().packets;
+            if (packets != viewer->last_packets) {
+                viewer->last_packets  = packets;
+                viewer->last_progress = time;
+            } else if (ok && time - viewer->last_progress > client_options.timeout) {
+                SBL_ERROR("%s: no media for %d s", viewer->client.url(), client_options.timeout);
+                ok = false;
+            }
+            if (!ok) {
+                viewer->failures++;
+                stop_viewer(viewer, receiver);
+            }
+        }
+        if (service && !options.tcp)
+            next_service = time + 0.5;
+        if (options.tcp)
+            usleep(5000);
+        if (time >= next_report) {
+            report(std::cout, "interval", options.interval, viewers, last, receiver);
+            last = Totals(viewers);
+            next_report += options.interval;
+        }
+    }
+    report(std::cout, "total", now() - start, viewers, Totals(std::vector<Viewer*>()), receiver);
+    for (unsigned int n = 0; n < viewers.size(); n++) {
+        stop_viewer(viewers[n], receiver);
+        delete viewers[n];
+    }
+    return 0;
+}
@@ -2,7 +2,9 @@
 #include <iomanip>
 #include <csignal>
 #include <cctype>
+#include <cstdlib>
 #include <cstring>
+#include <vector>
 #include <rtsp/rtsp.h>
 #include <sbl/sbl_logger.h>
 #include <rtsp/rtsp_server.h>
@@ -22,11 +24,13 @@ struct Options {
     int                 gop_size;
     int                 bitrate;
     char                encoder_type[4];
-    Options(int argc, char* argv[]) : port(554), rom_file(NULL), gop_size(30), bitrate(8000)  {
+    std::vector<char*>  relays;         // name=url of each remote stream to relay
+    bool                relay_tcp;
+    Options(int argc, char* argv[]) : port(554), rom_file(NULL), gop_size(30), bitrate(8000), relay_tcp(false)  {
         strcpy(encoder_type, "h");
         std::cout << "Stretch RTSP server built on " << RTSP::build_date  << std::endl;
         int c;
-        while ( (c = getopt(argc, argv, "r:v:a:p:l:f:s:t:B:g:b:eE:Tkh")) != -1)
+        while ( (c = getopt(argc, argv, "r:v:a:p:l:f:s:t:B:g:b:eE:TkUR:Q:F:AG:P:S:CXK:j:ZM:N:L:ID:d:x:o:H:q:V:W:y:Yh")) != -1)
             switch (c) {
                 case 'r':  rom_file               = optarg;                         break;
                 case 'v' : SBL::Log::set_verbosity(strtol(optarg, 0, 0));           break;
@@ -47,6 +51,37 @@ struct Options {
                 case 'E' : server.increase_time   = strtol(optarg, 0, 0);           break;
                 case 'T' : server.tcp_nodelay     = false;                          break;
                 case 'k' : server.tcp_cork        = true;                           break;
+                case 'U' : server.udp_batch       = false;                          break;
+                case 'R' : server.reactors        = strtol(optarg, 0, 0);           break;
+                case 'Q' : server.send_queue_size = strtol(optarg, 0, 0);           break;
+                case 'F' : server.frame_pool_size = strtol(optarg, 0, 0);           break;
+                case 'A' : server.stap_a          = false;                          break;
+                case 'G' : server.packet_gap      = strtol(optarg, 0, 0);           break;
+                case 'P' : server.pacing_rate     = strtol(optarg, 0, 0);           break;
+                case 'S' : server.pacing_burst    = strtol(optarg, 0, 0);           break;
+                case 'C' : server.pace_clients    = true;                           break;
+                case 'X' : server.txtime          = true;                           break;
+                case 'K' : server.gop_cache_size  = strtol(optarg, 0, 0);           break;
+                case 'j' : server.gop_cache_speed = strtol(optarg, 0, 0);           break;
+                case 'Z' : server.gop_cache_rebase = false;                         break;
+                case 'M' : server.multicast_address = optarg;                       break;
+                case 'N' : server.multicast_port  = strtol(optarg, 0, 0);           break;
+                case 'L' : server.multicast_ttl   = strtol(optarg, 0, 0);           break;
+                case 'I' : server.file_index      = true;                           break;
+                case 'D' : server.record_dir      = optarg;                         break;
+                case 'd' : server.record_segment_time = strtol(optarg, 0, 0);       break;
+                case 'x' : server.record_segment_size = strtol(optarg, 0, 0);       break;
+                case 'o' : server.record_retention = strtol(optarg, 0, 0);          break;
+                case 'H' : server.record_retention_time = strtol(optarg, 0, 0);     break;
+                case 'q' : server.record_queue_size = strtol(optarg, 0, 0);         break;
+                case 'V' : server.event_buffer_size = strtol(optarg, 0, 0);         break;
+                case 'W' : server.event_buffer_time = strtol(optarg, 0, 0);         break;
+                case 'y' : if (!strchr(optarg, '=')) {
+                                std::cerr << "Error: relay must be given as <name>=<url>: " << optarg << std::endl;
+                                exit(1);
+                           }
+                           relays.push_back(optarg);                                break;
+                case 'Y' : relay_tcp = true;                                        break;
                 case 'l' : if (SBL::Log::open_logfile(optarg) < 0) {
                                 std::cerr << "Error: unable to open logfile " << optarg << std::endl;
                                 exit(1);
@@ -57,6 +92,11 @@ struct Options {
                            RTSP::Server::print_verbosity_levels(std::cerr);
                 default  : exit(1);
             }
+        if (server.send_queue_size < server.min_send_queue_size()) {
+            std::cerr << "Error: -Q must be at least " << server.min_send_queue_size() << " bytes for packets of "
+                      << server.packet_size << " bytes" << std::endl;
+            exit(1);
+        }
         // for SVC, adjust GOP size to be multiple of 4
         if (server.temporal_levels)
             while (gop_size & 3)
@@ -79,6 +119,33 @@ const char* Options::usage = "\n"
     "       -B <int>        : set TCP socket buffer size\n"
     "       -T              : do not set TCP socket TCP_NODELAY flag\n"
     "       -k              : set TCP socket TCP_CORK flag\n"
+    "       -U              : send UDP packets one by one (do not batch with sendmmsg/GSO)\n"
+    "       -R <int>        : number of threads serving RTSP connections, default 2\n"
+    "       -Q <int>        : send queue size (bytes) for each RTP over TCP client, at least one packet, default 128K\n"
+    "       -F <int>        : memory (bytes) preallocated for frames, default 4M\n"
+    "       -A              : send SPS/PPS/SEI in their own packets (do not aggregate into STAP-A)\n"
+    "       -G <int>        : gap between packets in nanoseconds, default 0 (no gap)\n"
+    "       -P <int>        : pace packets to this percentage of stream bitrate, default 0 (no pacing)\n"
+    "       -S <int>        : bytes that may be sent back to back when pacing, default 16K\n"
+    "       -C              : pace each client separately, rather than the whole stream\n"
+    "       -X              : with -C, let the kernel pace UDP clients (SO_TXTIME, needs fq qdisc)\n"
+    "       -K <int>        : bytes of the current GOP cached for new clients, default 0 (no cache)\n"
+    "       -j <int>        : cached frames sent per live frame to a new client, 0 for all at once, default 4\n"
+    "       -Z              : keep original timestamps of cached frames (player starts behind live)\n"
+    "       -M <address>    : allow multicast, first stream goes to this group (ex. 239.192.0.1), next ones follow\n"
+    "       -N <port>       : RTP port of the first multicast group, default 20000\n"
+    "       -L <int>        : multicast time to live, default 16\n"
+    "       -I              : save the index of each streamed file next to it (<file>.idx) and reuse it\n"
+    "       -D <dir>        : record live H.264 streams to segments in this directory\n"
+    "       -d <int>        : seconds per recorded segment, default 60\n"
+    "       -x <int>        : bytes per recorded segment, at most, default 64M\n"
+    "       -o <int>        : MB of recorded segments kept per stream, default 0 (no limit)\n"
+    "       -H <int>        : hours recorded segments are kept, default 0 (no limit)\n"
+    "       -q <int>        : bytes of frames waiting to be recorded, default 4M\n"
+    "       -V <int>        : bytes of recent video buffered per stream for event clips (rtsp://<ip>/event/<stream>), default 0\n"
+    "       -W <int>        : seconds of video kept before an event, default 10\n"
+    "       -y <name>=<url> : relay remote stream (rtsp://<host>[:port]/<path>) as stream <name>, may be repeated\n"
+    "       -Y              : pull relayed streams over TCP, default UDP\n"
     "       -e              : enable congestion control\n"
     "       -E <int>        : when congestion control is enabled, seconds to wait before increasing rate\n"
     "       -h              : print this message\n"
@@ -105,6 +172,11 @@ int main(int argc, char* argv[]) {
     SBL::Exception::enable_backtrace(true);
     Options options(argc, argv);
     RTSP::Server* server = RTSP::Server::create(options.port, options.server);
+    for (unsigned int n = 0; n < options.relays.size(); n++) {
+        char* url = strchr(options.relays[n], '=');
+        *url++ = '\0';
+        server->add_relay(options.relays[n], url, options.relay_tcp);
+    }
     sdk_setup(options.rom_file, options.encoder_type, options.gop_size, options.bitrate);
     do {
         if (options.server.temporal_levels) {
@@ -14,7 +14,9 @@ void sdk_setup(char * romfile_path, char* streams, int gop_size, int bitrate, in
 
 #else
 #define SBL_MSG_SDK 32
+#ifndef NO_A2A
 #include "a2a_communications.h"
+#endif
 #include <sdk/sdvr_sdk.h>
 
 int init_a2a(int init);
@@ -81,13 +83,18 @@ static void sdk_callback(sdvr_chan_handle_t handle, sdvr_frame_type_e frame_type
             sdvr_av_buf_sequence(av_buffer, &seq_number, &frame_number, &drop_count);
             SBL_MSG(SBL_MSG_SDK, "Seq=%d, Frame_num=%d, drop_count=%d", seq_number, frame_number, drop_count);
 
-            rtsp_send_frame(chan_num, stream_id, frame, frame_size, timestamp, encoder_type);
+            // copy the frame and give the buffer back to SDK right away, slow network must not starve the encoder
+            RTSP::FrameRef copy = rtsp_copy_frame(frame, frame_size);
+            sdvr_release_av_buffer(av_buffer);
+            av_buffer = NULL;
+            rtsp_send_frame(chan_num, stream_id, copy, timestamp, encoder_type);
         }
             break;
         default: SBL_WARN("Received unknown frame type %d, ignoring", frame_type);
             break;
     }
-    sdvr_release_av_buffer(av_buffer);
+    if (av_buffer)
+        sdvr_release_av_buffer(av_buffer);
 }
 
 static void __set_sdk_params(int bEnableDebug)
@@ -334,11 +341,13 @@ static void __setBoardVideoStd(sdvr_board_settings_t *boardSetting)
 
 // Init the SDK, load firmware, create channel(s) and enable streaming.
 void sdk_setup(char * romfile_path, char* streams, int gop_size, int bitrate, int quality) {
+#ifndef NO_A2A
     if (application.pe_id() == 1) {
         RTSP::A2aCommunications::create();
         _boardConfig.num_video_encoders_per_camera = MAX_STREAM_COUNT;
         return;
     }
+#endif
     if (romfile_path == NULL || romfile_path[0] == '\0') {
         fatal("Missing rom file path\n");
     }
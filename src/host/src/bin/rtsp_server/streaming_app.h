@@ -2,7 +2,10 @@
 #ifndef _STREAMING_APP_H
 #define _STREAMING_APP_H
 #include <cstdio>
+#include <rtsp/rtsp.h>
+#ifndef NO_A2A
 #include "a2a_communications.h"
+#endif
 
 
 //! A dummy application, which is used in standalone rtsp_server and rtp_streamer
@@ -0,0 +1,107 @@
+#pragma once
+#ifndef _RTSP_BUFFER_WRITER_H
+#define _RTSP_BUFFER_WRITER_H
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <stdint.h>
+#include <cstring>
+
+namespace RTSP {
+
+//! Writes text into a fixed buffer, the way ostream would, but without allocating.
+/*! Buffer is always kept \0 terminated. Whatever doesn't fit is dropped and the writer
+    is marked as overflowed, so that the caller checks once, at the end. */
+class BufferWriter {
+public:
+    //! Writer constructor
+    // @param   buffer  buffer to write into
+    // @param   size    buffer size, including the terminating \0
+    BufferWriter(char* buffer, int size) : _buffer(buffer), _size(size), _length(0), _overflow(false) {
+        _buffer[0] = '\0';
+    }
+    //! Start over, from the beginning of the buffer
+    void reset() { _length = 0; _overflow = false; _buffer[0] = '\0'; }
+    //! Written text
+    const char* data() const { return _buffer; }
+    //! Length of the written text
+    int  size()  const { return _length; }
+    //! false if something didn't fit
+    bool ok()    const { return !_overflow; }
+
+    //! Append size bytes
+    BufferWriter& write(const char* str, int size) {
+        if (_length + size >= _size) {
+            _overflow = true;
+            size = _size - 1 - _length;
+        }
+        memcpy(_buffer + _length, str, size);
+        _length += size;
+        _buffer[_length] = '\0';
+        return *this;
+    }
+    BufferWriter& operator<<(const char* str)  { return write(str, strlen(str)); }
+    BufferWriter& operator<<(const BufferWriter& writer) { return write(writer.data(), writer.size()); }
+    BufferWriter& operator<<(char c)           { return write(&c, 1); }
+    BufferWriter& operator<<(int value)        { return value < 0 ? *this << '-' << 0u - value : *this << unsigned(value); }
+    BufferWriter& operator<<(unsigned int value) {
+        char digits[10];
+        int  n = sizeof digits;
+        do {
+            digits[--n] = '0' + value % 10;
+            value /= 10;
+        } while (value);
+        return write(digits + n, sizeof digits - n);
+    }
+    BufferWriter& operator<<(unsigned long long value) {
+        char digits[20];
+        int  n = sizeof digits;
+        do {
+            digits[--n] = '0' + value % 10;
+            value /= 10;
+        } while (value);
+        return write(digits + n, sizeof digits - n);
+    }
+    //! Append value in hex, zero padded to width digits
+    BufferWriter& hex(unsigned int value, int width, bool upper = false) {
+        const char* xdigits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+        char digits[8];
+        int  n = sizeof digits;
+        do {
+            digits[--n] = xdigits[value & 0xf];
+            value >>= 4;
+        } while (value || sizeof digits - n < (unsigned) width);
+        return write(digits + n, sizeof digits - n);
+    }
+    //! Append data in base64
+    BufferWriter& base64(const uint8_t* data, int size) {
+        static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        for (int i = 0; i < size; i += 3) {
+            uint32_t bits = data[i] << 16 | (i + 1 < size ? data[i + 1] << 8 : 0) | (i + 2 < size ? data[i + 2] : 0);
+            char quad[4] = {table[bits >> 18], table[bits >> 12 & 0x3f],
+                            i + 1 < size ? table[bits >> 6 & 0x3f] : '=',
+                            i + 2 < size ? table[bits & 0x3f]      : '='};
+            write(quad, sizeof quad);
+        }
+        return *this;
+    }
+private:
+    char*   _buffer;
+    int     _size;
+    int     _length;
+    bool    _overflow;
+};
+
+}
+#endif
@@ -0,0 +1,210 @@
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <cstring>
+#include <sbl/sbl_logger.h>
+#include "rtsp_impl.h"
+#include "depacketizer.h"
+
+namespace RTSP {
+
+enum { RTP_HEADER_SIZE = 12, STAP_A = 24, FU_A = 28 };
+
+static uint32_t get32(const uint8_t* data) {
+    return data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+}
+
+Depacketizer::Depacketizer(Sink* sink) : _sink(sink), _slots(WINDOW), _held(0), _started(false), _ssrc(0), _next(0),
+        _fu_active(false), _transit_valid(false), _transit(0), _jitter(0),
+        _au_open(false), _au_timestamp(0), _au_broken(false) {
+    memset(&_stats, 0, sizeof _stats);
+    for (int n = 0; n < WINDOW; n++)
+        _slots[n].full = false;
+}
+
+void Depacketizer::add(const uint8_t* packet, int size, uint32_t arrival) {
+    if (size < RTP_HEADER_SIZE || packet[0] >> 6 != 2) {
+        _stats.invalid++;
+        return;
+    }
+    _stats.packets++;
+    _stats.bytes += size;
+    uint16_t seq  = packet[2] << 8 | packet[3];
+    uint32_t ssrc = get32(packet + 8);
+    // J += (|D| - J) / 16, kept times 16 so that it stays an integer
+    int32_t transit = arrival - get32(packet + 4);
+    if (_transit_valid && ssrc == _ssrc) {
+        int32_t d = transit - _transit;
+        _jitter += (d < 0 ? -d : d) - ((_jitter + 8) >> 4);
+    }
+    _transit       = transit;
+    _transit_valid = true;
+
+    int16_t ahead = seq - _next;
+    if (_started && (ssrc != _ssrc || ahead < -WINDOW)) {
+        SBL_MSG(MSG::SOURCE, "RTP stream restarted, ssrc %08x seq %d, was ssrc %08x seq %d", ssrc, seq, _ssrc, _next);
+        flush();
+        _started = false;
+        _stats.restarts++;
+    }
+    if (!_started) {
+        _started = true;
+        _ssrc    = ssrc;
+        _next    = seq;
+        ahead    = 0;
+    }
+    if (ahead < 0) {
+        _stats.late++;
+        return;
+    }
+    if (ahead == 0) {
+        if (_held)
+            _stats.reordered++;
+        decode(packet, size);
+        _next++;
+        while (_held && _slots[_next % WINDOW].full)
+            advance();
+        return;
+    }
+    // no room to wait for the missing ones any more
+    while ((int16_t) (seq - _next) >= WINDOW)
+        advance();
+    Slot& slot = _slots[seq % WINDOW];
+    if (slot.full) {
+        _stats.late++;
+        return;
+    }
+    slot.data.assign(packet, packet + size);
+    slot.full = true;
+    _held++;
+    // it may have been the last one the window waited for
+    while (_held && _slots[_next % WINDOW].full)
+        advance();
+}
+
+// Decode the packet due next if it is held, or count it lost
+void Depacketizer::advance() {
+    Slot& slot = _slots[_next % WINDOW];
+    if (slot.full) {
+        slot.full = false;
+        _held--;
+        decode(&slot.data[0], slot.data.size());
+    } else {
+        _stats.lost++;
+        _au_broken = true;
+        if (_fu_active) {
+            _fu_active = false;
+            _stats.dropped++;
+        }
+    }
+    _next++;
+}
+
+void Depacketizer::flush() {
+    while (_held)
+        advance();
+}
+
+void Depacketizer::reset() {
+    for (int n = 0; n < WINDOW; n++)
+        _slots[n].full = false;
+    _held          = 0;
+    _started       = false;
+    _fu_active     = false;
+    _transit_valid = false;
+    _au_open       = false;
+    _au_broken     = false;
+}
+
+void Depacketizer::emit(const uint8_t* data, int size, uint32_t timestamp) {
+    if (size <= 0) {
+        _stats.invalid++;
+        return;
+    }
+    _stats.nal_units++;
+    _sink->nal_unit(data, size, timestamp);
+}
+
+void Depacketizer::end_access_unit() {
+    _stats.access_units++;
+    if (_au_broken)
+        _stats.broken++;
+    _sink->access_unit(_au_timestamp, !_au_broken);
+    _au_open   = false;
+    _au_broken = false;
+}
+
+void Depacketizer::decode(const uint8_t* packet, int size) {
+    uint32_t timestamp = get32(packet + 4);
+    int offset = RTP_HEADER_SIZE + 4 * (packet[0] & 0x0f);
+    if (packet[0] & 0x10 && offset + 4 <= size)
+        offset += 4 + 4 * (packet[offset + 2] << 8 | packet[offset + 3]);
+    if (packet[0] & 0x20)
+        size -= packet[size - 1];
+    // the marker of the last one was lost, or the sender doesn't set it
+    if (_au_open && timestamp != _au_timestamp)
+        end_access_unit();
+    _au_open      = true;
+    _au_timestamp = timestamp;
+    if (offset < size)
+        decode_payload(packet + offset, size - offset, timestamp);
+    else
+        _stats.invalid++;
+    if (packet[1] & 0x80)
+        end_access_unit();
+}
+
+void Depacketizer::decode_payload(const uint8_t* payload, int length, uint32_t timestamp) {
+    switch (payload[0] & 0x1f) {
+        case STAP_A:
+            for (int n = 1; n + 2 <= length; ) {
+                int unit = payload[n] << 8 | payload[n + 1];
+                n += 2;
+                if (unit == 0 || n + unit > length) {
+                    _stats.invalid++;
+                    break;
+                }
+                emit(payload + n, unit, timestamp);
+                n += unit;
+            }
+            break;
+        case FU_A:
+            if (length < 2) {
+                _stats.invalid++;
+                break;
+            }
+            if (payload[1] & 0x80) {
+                if (_fu_active)
+                    _stats.dropped++;
+                _fu.clear();
+                _fu.push_back((payload[0] & 0xe0) | (payload[1] & 0x1f));
+                _fu_active = true;
+            } else if (!_fu_active)
+                break;      // start was lost, and counted when it was
+            _fu.insert(_fu.end(), payload + 2, payload + length);
+            if (payload[1] & 0x40) {
+                _fu_active = false;
+                emit(&_fu[0], _fu.size(), timestamp);
+            }
+            break;
+        case 0: case 25: case 26: case 27: case 29: case 30: case 31:
+            // STAP-B, MTAP and FU-B are for interleaved mode only
+            _stats.invalid++;
+            break;
+        default:
+            emit(payload, length, timestamp);
+    }
+}
+
+}
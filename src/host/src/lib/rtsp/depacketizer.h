@@ -0,0 +1,102 @@
+#pragma once
+#ifndef _RTSP_DEPACKETIZER_H
+#define _RTSP_DEPACKETIZER_H
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <stdint.h>
+#include <vector>
+
+namespace RTSP {
+
+//! Reassembles H.264 NAL units from RTP packets: single NAL unit packets, STAP-A and FU-A (RFC 6184).
+/*! Packets are put back in sequence order thru a reorder buffer of WINDOW packets. A packet that
+    comes ahead of a missing one waits there; when the buffer runs out of room the missing packets
+    count as lost and decoding moves on. Packets behind the ones decoded are dropped as late (or
+    duplicate), except for a jump back by more than the window, which restarts the stream, as does
+    a new SSRC. A NAL unit missing a fragment is dropped whole. Access units end at the marker bit,
+    or when the timestamp changes; a lost packet marks the one it may have belonged to as broken.\n
+    Jitter is the interarrival jitter of RFC 3550, from arrival times given in timestamp units.
+    Nothing is allocated per packet once the buffers have grown to the largest packet and NAL unit. */
+class Depacketizer {
+public:
+    //! Receiver of NAL units
+    class Sink {
+    public:
+        //! NAL unit without start code, valid only during the call
+        virtual void nal_unit(const uint8_t* data, int size, uint32_t timestamp) = 0;
+        //! End of an access unit, at its marker bit or the first packet of the next one
+        //  @param  complete    false if a packet that may have been part of it was lost
+        virtual void access_unit(uint32_t timestamp, bool complete) {}
+        virtual ~Sink() {}
+    };
+    //! Counters, kept across restarts of the stream
+    struct Stats {
+        uint64_t        packets;
+        uint64_t        bytes;
+        unsigned int    lost;
+        unsigned int    reordered;      //!< packets that filled a gap
+        unsigned int    late;           //!< behind the ones decoded already, or duplicates
+        unsigned int    invalid;        //!< not RTP, or payload not decodable
+        unsigned int    restarts;       //!< new SSRC or sequence numbers
+        unsigned int    nal_units;
+        unsigned int    dropped;        //!< NAL units missing a fragment
+        unsigned int    access_units;
+        unsigned int    broken;         //!< access units missing packets
+    };
+    enum { WINDOW = 64 };   //!< packets held in the reorder buffer, power of 2
+
+    //! Create a depacketizer sending NAL units to the sink
+    Depacketizer(Sink* sink);
+    //! Add an RTP packet
+    //  @param  arrival time it came, in timestamp units
+    void add(const uint8_t* packet, int size, uint32_t arrival);
+    //! Decode packets held in the reorder buffer, as if the missing ones were lost
+    void flush();
+    //! Forget the stream, the next packet starts it over; counters stay
+    void reset();
+    //! Counters
+    const Stats& stats() const { return _stats; }
+    //! Interarrival jitter, in timestamp units
+    uint32_t jitter() const { return _jitter >> 4; }
+private:
+    struct Slot {
+        std::vector<uint8_t> data;
+        bool        full;
+    };
+    Sink*               _sink;
+    std::vector<Slot>   _slots;         // reorder buffer, packet n is in slot n % WINDOW
+    int                 _held;          // packets in the reorder buffer
+    bool                _started;
+    uint32_t            _ssrc;
+    uint16_t            _next;          // sequence number to decode next
+    std::vector<uint8_t> _fu;           // NAL unit being reassembled
+    bool                _fu_active;
+    bool                _transit_valid;
+    int32_t             _transit;       // arrival - timestamp of the last packet
+    uint32_t            _jitter;        // times 16, as RFC 3550 keeps it
+    bool                _au_open;       // NAL units of _au_timestamp were decoded
+    uint32_t            _au_timestamp;
+    bool                _au_broken;     // a packet was lost since the last access unit ended
+    Stats               _stats;
+
+    void advance();
+    void decode(const uint8_t* packet, int size);
+    void decode_payload(const uint8_t* payload, int length, uint32_t timestamp);
+    void emit(const uint8_t* data, int size, uint32_t timestamp);
+    void end_access_unit();
+};
+
+}
+#endif
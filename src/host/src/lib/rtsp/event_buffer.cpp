@@ -0,0 +1,177 @@
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <cstring>
+#include <sbl/sbl_logger.h>
+#include <sbl/sbl_exception.h>
+#include "rtsp_impl.h"
+#include "event_buffer.h"
+
+namespace RTSP {
+
+static const uint8_t START_CODE[4] = {0, 0, 0, 1};
+
+EventBuffer::EventBuffer(int max_bytes, int seconds, int ts_clock) : _data(new uint8_t[max_bytes]), _max_bytes(max_bytes),
+        _seconds(seconds), _span(seconds * ts_clock), _ts_clock(ts_clock), _frames((seconds + 1) * SLOTS_PER_SECOND),
+        _first(0), _count(0), _write(0), _bytes(0), _waiting(true), _event_time(0),
+        _added(0), _dropped(0), _overflows(0), _events(0), _exports(0) {
+    _trigger_time.tv_sec  = 0;
+    _trigger_time.tv_nsec = 0;
+}
+
+EventBuffer::~EventBuffer() {
+    delete[] _data;
+}
+
+// Frames are kept in the order they came; the next one goes after the newest, or to the start of the ring
+// if it doesn't fit before the end. Return false if there is no room before the oldest frame.
+bool EventBuffer::place(int size, uint32_t& offset) {
+    if (_count == 0) {
+        _write = 0;
+        offset = 0;
+        return size <= _max_bytes;
+    }
+    uint32_t head = frame(0).offset;
+    if (_write > head) {
+        if (size <= _max_bytes - (int) _write) {
+            offset = _write;
+            return true;
+        }
+        offset = 0;
+        return size <= (int) head;
+    }
+    offset = _write;
+    return size <= (int) (head - _write);
+}
+
+void EventBuffer::drop_gop() {
+    do {
+        _bytes -= frame(0).size;
+        _first  = (_first + 1) % _frames.size();
+        _count--;
+    } while (_count > 0 && !frame(0).key);
+    _dropped++;
+}
+
+void EventBuffer::add(const uint8_t* data, int size, uint32_t timestamp, bool key) {
+    if (size <= 0)
+        return;
+    _lock.lock();
+    if (key)
+        _waiting = false;
+    if (_waiting) {
+        _lock.unlock();
+        return;
+    }
+    if (_count == (int) _frames.size())
+        drop_gop();
+    uint32_t offset;
+    while (!place(size, offset) && _count > 0)
+        drop_gop();
+    // dropping ate into the GOP being added, or the frame alone is larger than the ring
+    if (_count == 0 && (!key || size > _max_bytes)) {
+        SBL_MSG(MSG::SOURCE, "GOP larger than event buffer (%d bytes), not buffered", _max_bytes);
+        _waiting = true;
+        _overflows++;
+        _lock.unlock();
+        return;
+    }
+    memcpy(_data + offset, data, size);
+    Frame& entry    = frame(_count++);
+    entry.offset    = offset;
+    entry.size      = size;
+    entry.timestamp = timestamp;
+    entry.key       = key;
+    _write  = offset + size;
+    _bytes += size;
+    _added++;
+    // oldest GOP goes when the next one alone covers seconds
+    for (;;) {
+        int next = 1;
+        while (next < _count && !frame(next).key)
+            next++;
+        if (next == _count || (int32_t) (timestamp - frame(next).timestamp) < (int32_t) _span)
+            break;
+        drop_gop();
+    }
+    _lock.unlock();
+}
+
+// Frames are copied out in the order they came, with start codes; call with _lock held
+void EventBuffer::copy(std::vector<uint8_t>& out) {
+    out.clear();
+    out.reserve(_bytes + _count * sizeof START_CODE);
+    for (int n = 0; n < _count; n++) {
+        const Frame& entry = frame(n);
+        out.insert(out.end(), START_CODE, START_CODE + sizeof START_CODE);
+        out.insert(out.end(), _data + entry.offset, _data + entry.offset + entry.size);
+    }
+}
+
+bool EventBuffer::trigger() {
+    struct timespec now;
+    SBL_PERROR(::clock_gettime(CLOCK_MONOTONIC, &now) < 0);
+    _lock.lock();
+    if (_count == 0 || (_events && now.tv_sec - _trigger_time.tv_sec < _seconds)) {
+        _lock.unlock();
+        return false;
+    }
+    // capacity stays from the first event on, later ones don't allocate
+    copy(_event);
+    _trigger_time = now;
+    _event_time   = time(NULL);
+    _events++;
+    int frames = _count;
+    _lock.unlock();
+    SBL_MSG(MSG::SOURCE, "Event clip saved, %d frames, %d bytes", frames, (int) _event.size());
+    return true;
+}
+
+int EventBuffer::clip(std::vector<uint8_t>& out, bool live) {
+    _lock.lock();
+    if (live || !_events)
+        copy(out);
+    else
+        out = _event;
+    if (!out.empty())
+        _exports++;
+    _lock.unlock();
+    return out.size();
+}
+
+double EventBuffer::length() {
+    _lock.lock();
+    double seconds = _count ? double(frame(_count - 1).timestamp - frame(0).timestamp) / _ts_clock : 0;
+    _lock.unlock();
+    return seconds;
+}
+
+void EventBuffer::print_stats(std::ostream& str, const char* stream_name) {
+    double seconds = length();
+    _lock.lock();
+    str << "event_buffer stream="   << stream_name
+        << " frames="               << _count
+        << " bytes="                << _bytes
+        << " max_bytes="            << _max_bytes
+        << " seconds="              << seconds
+        << " added="                << _added
+        << " dropped_gops="         << _dropped
+        << " overflows="            << _overflows
+        << " events="               << _events
+        << " exports="              << _exports
+        << "\n";
+    _lock.unlock();
+}
+
+}
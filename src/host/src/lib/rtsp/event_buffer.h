@@ -0,0 +1,97 @@
+#pragma once
+#ifndef _RTSP_EVENT_BUFFER_H
+#define _RTSP_EVENT_BUFFER_H
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <stdint.h>
+#include <ctime>
+#include <ostream>
+#include <vector>
+#include <sbl/sbl_thread.h>
+
+namespace RTSP {
+
+//! Recent frames of a live H.264 stream, so that the footage from before an event can be kept.
+/*! Frames are copied into a ring allocated once, when the buffer is created; nothing is allocated
+    per frame. The ring always starts with a key frame (SPS): the oldest GOPs are dropped to make
+    room, and once there is more than seconds of video after the next GOP start. A GOP larger
+    than the whole ring is not buffered.\n
+    trigger() freezes the buffered frames as the event clip, which is then exported with clip().
+    Frames are added by the streaming thread; trigger() and clip() may be called from any thread. */
+class EventBuffer {
+public:
+    //! Buffer constructor
+    // @param   max_bytes   size of the ring
+    // @param   seconds     video kept before an event
+    // @param   ts_clock    timestamp clock in Hz
+    EventBuffer(int max_bytes, int seconds, int ts_clock = 90000);
+    ~EventBuffer();
+    //! Add a frame (NAL unit without start code), key frame starts a GOP
+    void add(const uint8_t* data, int size, uint32_t timestamp, bool key);
+    //! Freeze the buffered frames as the event clip. Triggers within seconds of the last one are
+    //! ignored, the clip already covers them; returns false for those and when nothing is buffered.
+    bool trigger();
+    //! Copy the clip of the last event, or the frames buffered now if live or there was no event,
+    //! as Annex B byte stream; return its size, 0 if there is nothing to export
+    int  clip(std::vector<uint8_t>& out, bool live = false);
+    //! Time of the last event, 0 if there was none
+    time_t event_time() const { return _event_time; }
+    //! Seconds of video buffered now
+    double length();
+    //! Size of the ring
+    int  max_bytes() const { return _max_bytes; }
+    //! Print buffer size and counters, on one line
+    void print_stats(std::ostream& str, const char* stream_name);
+private:
+    enum { SLOTS_PER_SECOND = 256 };    // frames (NAL units) buffered per second of video, at most
+    struct Frame {
+        uint32_t    offset;     // in the ring
+        uint32_t    size;
+        uint32_t    timestamp;
+        bool        key;
+    };
+    SBL::Mutex          _lock;
+    uint8_t*            _data;
+    int                 _max_bytes;
+    int                 _seconds;
+    uint32_t            _span;          // seconds in timestamp ticks
+    int                 _ts_clock;
+    std::vector<Frame>  _frames;        // ring of frame slots
+    int                 _first;         // oldest frame
+    int                 _count;
+    uint32_t            _write;         // where the next frame goes, end of the newest one
+    int                 _bytes;
+    bool                _waiting;       // for a key frame, at start and after an overflow
+    std::vector<uint8_t> _event;        // clip of the last event, Annex B
+    time_t              _event_time;
+    struct timespec     _trigger_time;  // monotonic, of the last event
+    // counters
+    unsigned int        _added;
+    unsigned int        _dropped;       // GOPs dropped from the ring
+    unsigned int        _overflows;     // GOPs too large for the ring
+    unsigned int        _events;
+    unsigned int        _exports;
+
+    Frame& frame(int n) { return _frames[(_first + n) % _frames.size()]; }
+    bool place(int size, uint32_t& offset);
+    void drop_gop();
+    void copy(std::vector<uint8_t>& out);
+
+    EventBuffer(const EventBuffer&);            // not implemented
+    EventBuffer& operator=(const EventBuffer&); // not implemented
+};
+
+}
+#endif
@@ -0,0 +1,211 @@
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sbl/sbl_logger.h>
+#include <sbl/sbl_exception.h>
+#include "file_index.h"
+#include "nal_scanner.h"
+#include "rtsp.h"
+
+namespace RTSP {
+
+static const char SIDECAR_MAGIC[4] = {'H', '2', '6', '4'};
+
+Errcode FileIndex::open(const char* filename, bool sidecar) {
+    close();
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+        SBL_ERROR("Unable to open file %s for streaming", filename);
+        return NOT_FOUND;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0 || (off_t) (size_t) st.st_size != st.st_size) {
+        SBL_ERROR("File %s is not a regular file that can be mapped", filename);
+        ::close(fd);
+        return BAD_REQUEST;
+    }
+    void* data = ::mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        SBL_ERROR("Unable to map file %s: %s", filename, strerror(errno));
+        return NOT_FOUND;
+    }
+    _data = (const uint8_t*) data;
+    _file_size = st.st_size;
+    _mtime = st.st_mtime;
+    _mapped = true;
+    return index(filename, sidecar);
+}
+
+Errcode FileIndex::open(const uint8_t* data, uint64_t size, const char* name) {
+    close();
+    _data = data;
+    _file_size = size;
+    _mtime = 0;
+    return index(name, false);
+}
+
+Errcode FileIndex::index(const char* name, bool sidecar) {
+    std::string index_name = std::string(name) + ".idx";
+    if (!sidecar || !load(index_name)) {
+        scan(_data, _file_size, _entries);
+        if (sidecar && !_entries.empty())
+            save(index_name);
+    }
+    if (_entries.empty()) {
+        SBL_ERROR("File %s is not H264 elementary stream", name);
+        close();
+        return BAD_REQUEST;
+    }
+    find_access_units();
+    SBL_MSG(MSG::SOURCE, "File %s indexed, %d NAL units, %d access units, %d key frames", name,
+            count(), access_unit_count(), key_frame_count());
+    return OK;
+}
+
+void FileIndex::close() {
+    if (_data && _mapped)
+        SBL_PERROR(::munmap((void*) _data, _file_size) < 0);
+    _data = NULL;
+    _mapped = false;
+    _file_size = 0;
+    _entries.clear();
+    _access_units.clear();
+    _key_frames.clear();
+}
+
+// first_mb_in_slice, the first field of a slice header, is ue(v) coded right after the NAL header
+static unsigned int first_mb_in_slice(const uint8_t* nal, uint32_t size) {
+    uint32_t bits = 0;
+    for (uint32_t n = 1; n <= 4; n++)
+        bits = bits << 8 | (n < size ? nal[n] : 0);
+    int zeros = bits ? __builtin_clz(bits) : 32;
+    if (zeros > 15)
+        return 0;
+    return (bits >> (31 - 2 * zeros)) - 1;
+}
+
+// Access unit starts with SEI, SPS, PPS, AUD or NAL types 14-18 following a slice, or with a slice of a new
+// picture following a slice. Slices of a picture go up in first_mb_in_slice and are all IDR or all not.
+void FileIndex::scan(const uint8_t* data, uint64_t size, std::vector<Entry>& entries) {
+    NalScanner scanner(data, size);
+    NalUnit nal;
+    int  slice = 0;             // type of the previous NAL unit if it was a slice, 0 otherwise
+    unsigned int first_mb = 0;  // first_mb_in_slice of the previous slice
+    int  access_unit = -1;      // entry starting the current access unit
+    while (scanner.next(nal)) {
+        Entry entry;
+        entry.offset   = nal.offset;
+        entry.size     = nal.size;
+        entry.header   = nal.header;
+        entry.flags    = 0;
+        entry.reserved = 0;
+        int  type = nal.type();
+        bool is_slice = type >= 1 && type <= 5;
+        bool new_picture = false;
+        if (is_slice) {
+            unsigned int mb = first_mb_in_slice(data + nal.offset, nal.size);
+            new_picture = mb <= first_mb || (type == 5) != (slice == 5);
+            first_mb = mb;
+        }
+        if (access_unit < 0 || (slice && (new_picture || (type >= 6 && type <= 9) || (type >= 14 && type <= 18)))) {
+            entry.flags |= ACCESS_UNIT;
+            access_unit = entries.size();
+        }
+        entries.push_back(entry);
+        if (type == 5)
+            entries[access_unit].flags |= KEY_FRAME;
+        slice = is_slice ? type : 0;
+    }
+}
+
+// First entry starts an access unit even if the scan didn't flag it (saved index)
+void FileIndex::find_access_units() {
+    _access_units.clear();
+    _key_frames.clear();
+    for (unsigned int n = 0; n < _entries.size(); n++) {
+        if (n && !(_entries[n].flags & ACCESS_UNIT))
+            continue;
+        if (_entries[n].flags & KEY_FRAME)
+            _key_frames.push_back(_access_units.size());
+        _access_units.push_back(n);
+    }
+}
+
+int FileIndex::find_key_frame(int unit) const {
+    if (_key_frames.empty())
+        return -1;
+    std::vector<int>::const_iterator it = std::upper_bound(_key_frames.begin(), _key_frames.end(), unit);
+    return it == _key_frames.begin() ? 0 : it - _key_frames.begin() - 1;
+}
+
+// Saved index is used only if it was made for this very file
+bool FileIndex::load(const std::string& filename) {
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    if (!file)
+        return false;
+    Sidecar header;
+    if (!file.read((char*) &header, sizeof header) || memcmp(header.magic, SIDECAR_MAGIC, sizeof header.magic)
+        || header.version != SIDECAR_VERSION || header.entry_size != sizeof(Entry)
+        || header.file_size != _file_size || header.mtime != _mtime || header.count > _file_size / 4) {
+        SBL_MSG(MSG::SOURCE, "Index %s is out of date, rebuilding it", filename.c_str());
+        return false;
+    }
+    _entries.resize(header.count);
+    if (header.count && !file.read((char*) &_entries[0], header.count * sizeof(Entry))) {
+        _entries.clear();
+        return false;
+    }
+    for (unsigned int n = 0; n < _entries.size(); n++)
+        if (_entries[n].size == 0 || _entries[n].offset + _entries[n].size > _file_size) {
+            SBL_WARN("Index %s is corrupt, rebuilding it", filename.c_str());
+            _entries.clear();
+            return false;
+        }
+    SBL_MSG(MSG::SOURCE, "Loaded index %s", filename.c_str());
+    return true;
+}
+
+// Index is written next to the file and renamed, so that readers never see it half written
+void FileIndex::save(const std::string& filename) const {
+    std::string temp = filename + ".tmp";
+    Sidecar header;
+    memcpy(header.magic, SIDECAR_MAGIC, sizeof header.magic);
+    header.version    = SIDECAR_VERSION;
+    header.entry_size = sizeof(Entry);
+    header.count      = _entries.size();
+    header.file_size  = _file_size;
+    header.mtime      = _mtime;
+    std::ofstream file(temp.c_str(), std::ios::binary | std::ios::trunc);
+    file.write((const char*) &header, sizeof header);
+    file.write((const char*) &_entries[0], _entries.size() * sizeof(Entry));
+    file.close();
+    if (!file || ::rename(temp.c_str(), filename.c_str()) < 0) {
+        SBL_WARN("Unable to save index %s", filename.c_str());
+        ::unlink(temp.c_str());
+        return;
+    }
+    SBL_MSG(MSG::SOURCE, "Saved index %s", filename.c_str());
+}
+
+}
@@ -0,0 +1,110 @@
+#pragma once
+#ifndef _RTSP_FILE_INDEX_H
+#define _RTSP_FILE_INDEX_H
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "rtsp_impl.h"
+
+namespace RTSP {
+
+//! H.264 elementary stream file, mapped read-only, with an index of its NAL units.
+/*! The file is scanned for start codes once, when it is opened. Each NAL unit is then found
+    in constant time and its data is read straight from the mapping, without copying.
+    The index may be saved next to the file (<file>.idx), so that the next open skips the scan;
+    the saved index is used only if the file has the same size and modification time.
+    Data already in memory (an event clip) is indexed the same way. */
+class FileIndex {
+public:
+    //! Flags of an index entry
+    enum {
+        ACCESS_UNIT = 1,    //!< NAL unit starts an access unit (a picture with its SPS/PPS/SEI)
+        KEY_FRAME   = 2     //!< access unit started by this NAL unit has an IDR picture
+    };
+    //! Index entry, one per NAL unit
+    struct Entry {
+        uint64_t    offset;     //!< offset of the NAL unit in the file, past the start code
+        uint32_t    size;       //!< NAL unit size, without the start code
+        uint8_t     header;     //!< NAL unit header (first byte)
+        uint8_t     flags;      //!< ACCESS_UNIT, KEY_FRAME
+        uint16_t    reserved;
+    };
+
+    FileIndex() : _data(NULL), _file_size(0), _mapped(false) {}
+    ~FileIndex() { close(); }
+
+    //! Map the file and index it.
+    /*! @param  sidecar     load the index from <filename>.idx if it is up to date, save it there otherwise
+        @return OK, NOT_FOUND if the file can't be opened, BAD_REQUEST if it has no NAL units */
+    Errcode open(const char* filename, bool sidecar = false);
+    //! Index data already in memory (a clip), which must stay there until close()
+    /*! @param  name    for messages
+        @return OK, BAD_REQUEST if there are no NAL units */
+    Errcode open(const uint8_t* data, uint64_t size, const char* name);
+    //! Unmap the file and drop the index
+    void close();
+
+    //! Number of NAL units
+    int count() const { return _entries.size(); }
+    //! Index entry of the n-th NAL unit
+    const Entry& operator[](int n) const { return _entries[n]; }
+    //! NAL unit data, inside the mapping
+    const uint8_t* data(const Entry& entry) const { return _data + entry.offset; }
+    //! Number of access units (pictures)
+    int access_unit_count() const { return _access_units.size(); }
+    //! Index entry that starts the n-th access unit
+    int access_unit(int n) const { return _access_units[n]; }
+    //! Number of access units that start with an IDR picture
+    int key_frame_count() const { return _key_frames.size(); }
+    //! Index entry that starts the n-th key frame access unit
+    int key_frame(int n) const { return _access_units[_key_frames[n]]; }
+    //! Access unit number of the n-th key frame
+    int key_frame_unit(int n) const { return _key_frames[n]; }
+    //! Last key frame at or before access unit number unit, the first one if there is none before it.
+    //! Returns the key frame number, -1 if there are no key frames; binary search, O(log n).
+    int find_key_frame(int unit) const;
+    //! Size of the mapped file
+    uint64_t file_size() const { return _file_size; }
+
+    //! Find NAL units in data, appending them to entries
+    static void scan(const uint8_t* data, uint64_t size, std::vector<Entry>& entries);
+private:
+    enum { SIDECAR_VERSION = 1 };
+    struct Sidecar {            // header of the saved index, followed by the entries
+        char        magic[4];
+        uint32_t    version;
+        uint32_t    entry_size;
+        uint32_t    count;
+        uint64_t    file_size;
+        int64_t     mtime;
+    };
+    const uint8_t*      _data;
+    uint64_t            _file_size;
+    int64_t             _mtime;
+    bool                _mapped;        // data is a mapping of the file, rather than held by the caller
+    std::vector<Entry>  _entries;
+    std::vector<int>    _access_units;  // entry of each access unit
+    std::vector<int>    _key_frames;    // access unit number of each key frame
+
+    bool load(const std::string& filename);
+    void save(const std::string& filename) const;
+    void find_access_units();
+    Errcode index(const char* name, bool sidecar);
+};
+
+}
+#endif
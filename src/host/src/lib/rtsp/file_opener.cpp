@@ -0,0 +1,109 @@
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <sbl/sbl_logger.h>
+#include <sbl/sbl_exception.h>
+#include "file_opener.h"
+#include "file_source.h"
+#include "rtp_streamer.h"
+#include "rtsp.h"
+
+namespace RTSP {
+
+FileOpener::FileOpener(const Server::Options* options) : _options(options), _opening(NULL), _running(true) {
+    create_thread();
+}
+
+FileOpener::~FileOpener() {
+    _lock.lock();
+    _running = false;
+    _lock.signal();
+    _lock.unlock();
+    join_thread();
+}
+
+void FileOpener::open(const char* name, FileWaiter* waiter) {
+    Request request;
+    request.name   = name;
+    request.waiter = waiter;
+    _lock.lock();
+    _queue.push_back(request);
+    // opener thread checks the queue before it waits, so it needs waking only when it was empty
+    if (_queue.size() == 1)
+        _lock.signal();
+    _lock.unlock();
+}
+
+void FileOpener::cancel(FileWaiter* waiter) {
+    _lock.lock();
+    for (std::deque<Request>::iterator it = _queue.begin(); it != _queue.end(); ++it) {
+        if (it->waiter == waiter) {
+            _queue.erase(it);
+            break;
+        }
+    }
+    if (_opening == waiter)
+        _opening = NULL;
+    _lock.unlock();
+}
+
+// file source is not shared, each session plays (and seeks) the file on its own
+Source* FileOpener::create(const char* name, const Server::Options& options) {
+    Source* source = FileSource::create(name, new Streamer(options.packet_size, -1, -1, options.stap_a), options.fps,
+                                        options.ts_clock, options.file_index);
+    SBL_MSG(MSG::SERVER, "Created file source %p for stream %s", source, name);
+    return source;
+}
+
+void FileOpener::close(Source* source) {
+    Streamer* streamer = source->streamer();
+    source->teardown();
+    delete source;
+    delete streamer;
+}
+
+// Waiter is called with the lock held, so that cancel() doesn't return while it is being called
+void FileOpener::start_thread() {
+    _lock.lock();
+    for (;;) {
+        while (_queue.empty() && _running)
+            _lock.wait();
+        if (!_running)
+            break;
+        Request request = _queue.front();
+        _queue.pop_front();
+        _opening = request.waiter;
+        _lock.unlock();
+        Source* source  = NULL;
+        Errcode errcode = OK;
+        try {
+            source = create(request.name.c_str(), *_options);
+        } catch (Errcode err) {
+            errcode = err;
+        } catch (SBL::Exception& ex) {
+            SBL_WARN("Unable to open file %s: %s", request.name.c_str(), ex.what());
+            errcode = INTERNAL_SERVER_ERROR;
+        }
+        _lock.lock();
+        if (_opening)
+            _opening->file_opened(source, errcode);
+        else if (source)
+            close(source);
+        _opening = NULL;
+    }
+    _lock.unlock();
+    SBL_MSG(MSG::SERVER, "File opener thread terminating");
+}
+
+}
@@ -0,0 +1,74 @@
+#pragma once
+#ifndef _RTSP_FILE_OPENER_H
+#define _RTSP_FILE_OPENER_H
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <string>
+#include <deque>
+#include <sbl/sbl_thread.h>
+#include "rtsp_server.h"
+#include "rtsp_impl.h"
+
+namespace RTSP {
+class Source;
+
+//! Whoever waits for a file source to be opened by FileOpener
+class FileWaiter {
+public:
+    //! Called once the file is open, from the opener thread; source is NULL if opening failed with errcode.
+    //! It is not called any more once FileOpener::cancel() returns.
+    virtual void file_opened(Source* source, Errcode errcode) = 0;
+protected:
+    virtual ~FileWaiter() {}
+};
+
+//! Opens file sources in its own thread, so that reactors don't wait while a file is read and indexed.
+/*! Files are opened one at a time, in the order they were asked for. Each request gets a source of its
+    own, the same file asked for twice is opened twice. Talker waiting for its file is parked, the way
+    it waits for SPS/PPS. */
+class FileOpener : public SBL::Thread {
+public:
+    //! Create the opener and start its thread
+    //  @param  options server options, read each time a file is opened
+    FileOpener(const Server::Options* options);
+    //! Stop the thread; files not opened yet are not, and their waiters are not called
+    ~FileOpener();
+
+    //! Queue the file to be opened for the waiter, which waits for one file at a time
+    void open(const char* name, FileWaiter* waiter);
+    //! Forget the waiter's file: it is not opened, or closed once it is
+    void cancel(FileWaiter* waiter);
+
+    //! Open a file source in the calling thread, it is owned by the caller. Throws Errcode if it can't be opened.
+    static Source* create(const char* name, const Server::Options& options);
+
+    //! Thread entry function
+    void start_thread();
+private:
+    struct Request {
+        std::string name;
+        FileWaiter* waiter;
+    };
+    const Server::Options*  _options;
+    SBL::Mutex              _lock;      // guards the queue and _opening
+    std::deque<Request>     _queue;
+    FileWaiter*             _opening;   // waiter of the file being opened, NULL if none or cancelled
+    volatile bool           _running;
+
+    static void close(Source* source);
+};
+
+}
+#endif
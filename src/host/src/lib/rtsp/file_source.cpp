@@ -12,7 +12,6 @@
 *  and conditions, you may not use any of these items and must immediately   *
 *  destroy any copies you have made.                                         *
 \****************************************************************************/
-#include <cstring>
 #include <sys/select.h>
 #include <sbl/sbl_logger.h>
 #include <sbl/sbl_exception.h>
@@ -21,12 +20,19 @@
 
 namespace RTSP {
 
-FileSource* FileSource::create(const char* filename, Streamer* streamer, int fps, int ts_clock, int buffer_size) {
+FileSource* FileSource::create(const char* filename, Streamer* streamer, int fps, int ts_clock, bool save_index) {
     SBL_ASSERT(streamer);
-    FileSource* fs = new FileSource(filename, streamer, fps, ts_clock, buffer_size);
+    return checked(new FileSource(filename, streamer, fps, ts_clock, save_index), streamer);
+}
+
+FileSource* FileSource::create(const char* name, std::vector<uint8_t>& clip, Streamer* streamer, int fps, int ts_clock) {
+    SBL_ASSERT(streamer);
+    return checked(new FileSource(name, clip, streamer, fps, ts_clock), streamer);
+}
+
+FileSource* FileSource::checked(FileSource* fs, Streamer* streamer) {
     Errcode errcode = fs->_errcode;
     if (errcode != OK) {
-        delete fs->_buffer;
         delete streamer;
         delete fs;
         throw errcode;
@@ -34,113 +40,109 @@ FileSource* FileSource::create(const char* filename, Streamer* streamer, int fps
     return fs;
 }
 
-FileSource::FileSource(const char* filename, Streamer* streamer, int fps, int ts_clock, int buffer_size) :
-    Source(filename, streamer), _ts_delta(0), _tick(0), _period(ONE_SECOND / fps), 
-    _buffer(NULL), _buffer_size(buffer_size), _frame(0), _frame_size(0), _have_bytes(0), _errcode(OK) {
-        
+FileSource::FileSource(const char* filename, Streamer* streamer, int fps, int ts_clock, bool save_index) :
+    Source(filename, streamer), _ts_delta(0), _tick(0), _period(ONE_SECOND / fps), _fps(fps), _unit(0), _scale(1),
+    _running(false), _errcode(OK) {
+
     _ts_delta = ts_clock / fps;
-    SBL_ASSERT(buffer_size > BUFFER_HDR);
-    _buffer = new uint8_t[_buffer_size];
+    _errcode = _index.open(filename, save_index);
+    if (_errcode != OK)
+        return;
+    SBL_MSG(MSG::SOURCE, "FileSource %s, fps=%d, ts_clock=%d, %d NAL units",
+                name(), fps, ts_clock, _index.count());
+    check_param_sets();
+}
+
+FileSource::FileSource(const char* name, std::vector<uint8_t>& clip, Streamer* streamer, int fps, int ts_clock) :
+    Source(name, streamer), _ts_delta(ts_clock / fps), _tick(0), _period(ONE_SECOND / fps), _fps(fps), _unit(0), _scale(1),
+    _running(false), _errcode(BAD_REQUEST) {
 
-    _file.open(filename);
-    if (!_file) {
-        SBL_ERROR("Unable to open file %s for streaming", filename);
-        _errcode = NOT_FOUND;
+    _clip.swap(clip);
+    if (_clip.empty())
         return;
-    }
-    SBL_MSG(MSG::SOURCE, "FileSource %s, fps=%d, ts_clock=%d, buffer_size=%d", 
-                name(), fps,    ts_clock,   _ts_delta, _buffer_size);
-    _buffer += BUFFER_HDR;
-    _buffer_size -= BUFFER_HDR;
-    _file.read((char*) _buffer, _buffer_size);
-    _have_bytes = _file.gcount();
-    if (!is_nal_header(_buffer)) {
-        SBL_ERROR("File %s is not H264 elementary stream", filename);
-        _errcode = BAD_REQUEST;
+    _errcode = _index.open(&_clip[0], _clip.size(), name);
+    if (_errcode != OK)
         return;
-    }
-    _frame = _buffer + 4;
-    _have_bytes -= 4;
-    _frame_size = frame_size(_frame, _have_bytes);
-    if (frame_type(_frame[0]) != 's') {
-        SBL_ERROR("File %s does not have SPS frame", filename);
+    SBL_MSG(MSG::SOURCE, "FileSource %s from a clip of %d bytes, fps=%d, ts_clock=%d, %d NAL units",
+                name, (int) _clip.size(), fps, ts_clock, _index.count());
+    check_param_sets();
+}
+
+void FileSource::check_param_sets() {
+    if (frame_type(_index[0].header) != 's') {
+        SBL_ERROR("File %s does not have SPS frame", name());
         _errcode = BAD_REQUEST;
         return;
     }
-    save_sps(_frame, _frame_size);
-    uint8_t *pps = _frame + _frame_size + 4;
-    if (!is_nal_header(pps - 4)) {
-        SBL_ERROR("File %s is missing PPS", filename);
+    if (_index.count() < 2 || frame_type(_index[1].header) != 'p') {
+        SBL_ERROR("File %s does not have PPS frame", name());
         _errcode = BAD_REQUEST;
         return;
     }
-    if (frame_type(pps[0]) != 'p') {
-        SBL_ERROR("File %s does not have PPS frame", filename);
-        _errcode = BAD_REQUEST;
-    }
-    save_pps(pps, frame_size(pps, _have_bytes - _frame_size - 4));
-}
-
-int FileSource::frame_size(uint8_t* frame, int size) {
-    for (int count = 0; count < size; ++count) {
-        if (is_nal_header(frame + count))
-            return count;
-    }
-    return 0;
+    save_sps(_index.data(_index[0]), _index[0].size);
+    save_pps(_index.data(_index[1]), _index[1].size);
 }
 
 void FileSource::start_thread() {
-    // _timestamp and _tick initialization. This cannot be done in constructor, 
+    // _tick initialization. This cannot be done in constructor, 
     // because thread may be started way after constructor was called.
-    _playing = true;
     struct timespec time;
     SBL_PERROR(::clock_gettime(CLOCK_REALTIME, &time) < 0);
     _tick = time.tv_nsec;
     play_file();
-    _file.close();
-    delete[] (_buffer - BUFFER_HDR);
     SBL_MSG(MSG::SOURCE, "FileSource %s closed, terminating thread", name());
 }
 
+// Access units are sent one period apart. At scale 1 all of them are, in order; at any other scale
+// only key frames are: after each period playback moves scale access units, and the key frame at or
+// before that position is sent, unless it was the last one sent.
 void FileSource::play_file() {
-    do {
-        bool sps_pps = save_if_sps_pps(_frame, _frame_size);
-        SBL_MSG(MSG::SOURCE, "source %s, frame %c, size %d, ts %d", name(), frame_type(_frame[0]), _frame_size, _timestamp); 
-        streamer()->send_frame(_frame, _frame_size, _timestamp);
-        next_frame();
-        if (!sps_pps)
-            wait();
-    } while (_playing);
+    const int units = _index.access_unit_count();
+    double position = _unit;
+    int    sent = -1;
+    while (_playing) {
+        if (_scale == 1) {
+            send_unit(_unit);
+            if (++_unit == units) {
+                SBL_MSG(MSG::SOURCE, "Stream %s, rewinding input file", name());
+                _unit = 0;
+            }
+        } else {
+            int key = _index.find_key_frame(int(position));
+            if (key >= 0 && key != sent) {
+                send_unit(_index.key_frame_unit(key));
+                sent = key;
+            }
+            position += _scale;
+            if (position >= units)
+                position -= units;
+            else if (position < 0)
+                position += units;
+            _unit = int(position);
+        }
+        wait();
+    }
 }
 
-void FileSource::next_frame() {
-    _frame += _frame_size + 4;
-    _have_bytes -= _frame_size + 4;
-    _frame_size = frame_size(_frame, _have_bytes);
-    if (_frame_size)
-        return;
-    if (_file.eof() && _have_bytes > 0) {
-        _frame_size = _have_bytes; // pretend there is NAL after end of file
-    } else if (_file.eof() && _have_bytes <= 0) {
-        SBL_MSG(MSG::SOURCE, "Stream %s, rewinding input file", name());
-        _file.clear();
-        _file.seekg(0);
-        _file.read((char*) _buffer, _buffer_size);
-        _frame = _buffer + 4;
-        _have_bytes = _file.gcount() - 4;
-        SBL_ASSERT(_have_bytes > 0);
-        _frame_size = frame_size(_frame, _have_bytes);
-    } else {
-        if (_have_bytes < 0)
-            _have_bytes = 0;
-        memmove(_buffer, _frame, _have_bytes);
-        _frame = _buffer;
-
-        _file.read((char*) _frame + _have_bytes, _buffer_size - _have_bytes);
-        _have_bytes += _file.gcount();
-        _frame_size = frame_size(_frame, _have_bytes);
-        if (_frame_size == 0)
-            _frame_size = _have_bytes;
+// VCL NAL unit, a slice of a picture
+static bool is_slice(uint8_t header) {
+    int type = header & 0x1F;
+    return type >= 1 && type <= 5;
+}
+
+// NAL units of an access unit share the timestamp, its last slice ends the picture
+void FileSource::send_unit(int unit) {
+    int begin = _index.access_unit(unit);
+    int end   = unit + 1 < _index.access_unit_count() ? _index.access_unit(unit + 1) : _index.count();
+    int last  = end - 1;
+    while (last > begin && !is_slice(_index[last].header))
+        last--;
+    for (int n = begin; n < end; n++) {
+        const FileIndex::Entry& nal = _index[n];
+        const uint8_t* frame = _index.data(nal);
+        save_if_sps_pps(frame, nal.size);
+        SBL_MSG(MSG::SOURCE, "source %s, frame %c, size %d, ts %d", name(), frame_type(nal.header), nal.size, _timestamp); 
+        streamer()->send_frame(frame, nal.size, _timestamp, n >= last);
     }
 }
 
@@ -161,10 +163,32 @@ void FileSource::wait() {
     SBL_PERROR(::pselect(0, NULL, NULL, NULL, &time, NULL) < 0);
 }
 
-void FileSource::teardown() {
-    _playing = false;
-    join_thread();
-    SBL_MSG(MSG::SOURCE, "File source %s teardown", name());
+void FileSource::stop(int unit) {
+    if (_running) {
+        _playing = false;
+        join_thread();
+        _running = false;
+    }
+    if (unit >= 0)
+        _unit = unit;
+    int key = _index.find_key_frame(_unit);
+    if (key >= 0)
+        _unit = _index.key_frame_unit(key);
+    SBL_MSG(MSG::SOURCE, "File source %s stopped, next access unit %d", name(), _unit);
+}
+
+double FileSource::seek(double npt) {
+    int unit = int(npt * _fps + 1e-6);
+    RTSP_ASSERT(unit < _index.access_unit_count(), INVALID_RANGE);
+    stop(unit);
+    SBL_MSG(MSG::SOURCE, "File source %s, seek to %.3f starts at access unit %d", name(), npt, _unit);
+    return position();
+}
+
+double FileSource::set_scale(double scale) {
+    stop();
+    _scale = scale > 1 || scale < 0 ? scale : 1;
+    return _scale;
 }
 
 }
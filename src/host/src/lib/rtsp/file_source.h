@@ -16,38 +16,62 @@
 *  destroy any copies you have made.                                         *
 \****************************************************************************/
 
-#include <fstream>
 #include <sbl/sbl_thread.h>
 #include "rtsp_impl.h"
 #include "rtp_streamer.h"
 #include "rtsp_source.h"
+#include "file_index.h"
 
 namespace RTSP {
 
 //! Reads data from a file and generates frames for streaming.
 /*! It derives both from a Thread and a Source, because a
-    separate thread must run for each file source. */
+    separate thread must run for each file source. The file is mapped into memory and
+    indexed when the source is created; NAL units are sent straight from the mapping,
+    one access unit per frame period, rewinding at the end of the file.\n
+    Each session gets a source of its own, so that it can pause, seek and change scale.
+    Playback always (re)starts at a key frame, found in the index by binary search. */
 class FileSource : public SBL::Thread, public Source {
 public:
-    //! FileSource needs fps, ts_clock and buffer_size specs. Constructors open the file
-    //  reads and caches sps/pps and returns.
-    //  @param buffer_size is size of buffer allocated for reading from file
+    //! FileSource needs fps and ts_clock specs. Constructors map and index the file,
+    //  cache sps/pps and return.
     //  @param fps is frame per second, common values are 25 and 30
     //  @param ts_clock is timestamp clock frequency, typically 90000 (90 KHz).
-    static FileSource* create(const char* filename, Streamer* streamer,            // 1 MB
-                              int fps = 30, int ts_clock = 90000, int buffer_size = 1000000);
+    //  @param save_index reuse the index saved next to the file (<file>.idx), or save it there
+    static FileSource* create(const char* filename, Streamer* streamer,
+                              int fps = 30, int ts_clock = 90000, bool save_index = false);
+    //! Same, for a clip in memory (H.264 Annex B, see EventBuffer::clip()). The source takes
+    //  the data over, clip is left empty.
+    static FileSource* create(const char* name, std::vector<uint8_t>& clip, Streamer* streamer,
+                              int fps = 30, int ts_clock = 90000);
     //! Playing means starting a new thread to send out file contents
     void play()     { 
-        if (!_playing) {
-            SBL_MSG(MSG::SOURCE, "Starting to play file %s", name());
+        if (!_running) {
+            SBL_MSG(MSG::SOURCE, "Starting to play file %s at %d", name(), _unit);
+            _running = _playing = true;
             create_thread(); 
         }
     }
     //! Thread entry function
     void start_thread(); 
 
-    //! Deallocate buffers and close files (cannot be done in destructor since this runs in threads)
-    void teardown();
+    //! Stop the thread; the file stays mapped until the source is deleted
+    void teardown() { stop(); }
+
+    //! Stop the thread, play() resumes from the key frame at or before where it stopped
+    void pause()    { stop(); }
+
+    //! Stop the thread and move to the key frame at or before npt seconds; throws INVALID_RANGE past the end
+    double seek(double npt);
+
+    //! Stop the thread and change the scale: 1, or key frames only for above 1 and for reverse (negative)
+    double set_scale(double scale);
+
+    //! Where playback (re)starts, in seconds
+    double position() const { return double(_unit) / _fps; }
+
+    //! Length of the file, in seconds
+    double duration() const { return double(_index.access_unit_count()) / _fps; }
 
     //! FileSource doesn't use send_frame, since it call streamer->send_frame from its thread loop
     void send_frame(uint8_t* frame, int size, uint32_t timestamp, EncoderType encoder) {}
@@ -61,23 +85,26 @@ public:
         _stream_desc.bitrate = 8000;
     }
 private:
-    enum {BUFFER_HDR = 256, ONE_SECOND = 1000000000, PAYLOAD_TYPE = 96 };
-    std::ifstream   _file;          // file we are reading from
+    enum {ONE_SECOND = 1000000000, PAYLOAD_TYPE = 96 };
+    FileIndex       _index;         // mapped file and its NAL units
+    std::vector<uint8_t> _clip;     // data of a clip source, instead of the file
     uint32_t        _ts_delta;      // timestamp increment per frame, in nanoseconds
     uint32_t        _tick;          // current frame tick
     uint32_t        _period;        // FPS period
-    uint8_t*        _buffer;        // buffer were file content is read
-    uint32_t        _buffer_size;
-    uint8_t*        _frame;         // pointer to frame to send
-    uint32_t        _frame_size;
-    int             _have_bytes;    // how many bytes left in buffer
+    int             _fps;
+    int             _unit;          // next access unit to send
+    double          _scale;
+    bool            _running;       // thread was created and not yet joined
     Errcode         _errcode;
 
-    void        next_frame();       // set up next frame to send
-    static int  frame_size(uint8_t*, int);       // compute next frame size
     void        wait();             // wait _period and update _timestamp
+    void        stop(int unit = -1);    // join the thread, move to the key frame at or before unit (where it stopped)
+    void        send_unit(int unit);
 
-    FileSource(const char* filename, Streamer* streamer, int fps, int ts_clock, int buffer_size);
+    FileSource(const char* filename, Streamer* streamer, int fps, int ts_clock, bool save_index);
+    FileSource(const char* name, std::vector<uint8_t>& clip, Streamer* streamer, int fps, int ts_clock);
+    void check_param_sets();        // sets _errcode unless the stream starts with SPS and PPS
+    static FileSource* checked(FileSource* source, Streamer* streamer);
     int payload_type() const { return PAYLOAD_TYPE; }
     void play_file();
 };
@@ -0,0 +1,124 @@
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <cstring>
+#include <new>
+#include <sbl/sbl_exception.h>
+#include <sbl/sbl_logger.h>
+#include "rtsp_impl.h"
+#include "frame_buffer.h"
+
+namespace RTSP {
+
+void FrameBuffer::set_size(int size) {
+    SBL_THROW_IF(size < 0 || size > _capacity, "Frame size %d, buffer capacity is %d", size, _capacity);
+    _size = size;
+}
+
+void FrameBuffer::release() {
+    if (__sync_sub_and_fetch(&_refs, 1) == 0)
+        _pool->recycle(this);
+}
+
+FramePool::FramePool(int pool_size) : _in_use(0), _heap_allocs(0) {
+    // each class gets the same share of memory, but at least one slot
+    int share = pool_size / CLASSES;
+    int slot_size = MIN_SLOT;
+    for (int n = 0; n < CLASSES; n++, slot_size *= 4) {
+        SizeClass& size_class = _classes[n];
+        size_class.slot_size = slot_size;
+        int slots = share / slot_size > 0 ? share / slot_size : 1;
+        size_class.slots = slots;
+        size_class.slab  = new uint8_t[slots * slot_size];
+        size_class.free.reserve(slots);
+        for (int slot = slots - 1; slot >= 0; slot--)
+            size_class.free.push_back(size_class.slab + slot * slot_size);
+        SBL_MSG(MSG::SOURCE, "Frame pool, %d slots of %d bytes", slots, slot_size);
+    }
+}
+
+FramePool::~FramePool() {
+    if (_in_use)
+        SBL_ERROR("Frame pool destroyed with %d buffers in use", _in_use);
+    for (int n = 0; n < CLASSES; n++)
+        delete[] _classes[n].slab;
+}
+
+int FramePool::overhead() {
+    // keep frame data 16-byte aligned
+    return (sizeof(FrameBuffer) + 15) / 16 * 16;
+}
+
+FrameRef FramePool::alloc(int size) {
+    uint8_t* slot = NULL;
+    int      size_class;
+    _lock.lock();
+    for (size_class = 0; size_class < CLASSES; size_class++) {
+        SizeClass& candidate = _classes[size_class];
+        if (candidate.slot_size - overhead() >= size && !candidate.free.empty()) {
+            slot = candidate.free.back();
+            candidate.free.pop_back();
+            break;
+        }
+    }
+    _lock.unlock();
+    int capacity;
+    if (slot) {
+        __sync_fetch_and_add(&_in_use, 1);
+        capacity = _classes[size_class].slot_size - overhead();
+    } else {
+        __sync_fetch_and_add(&_heap_allocs, 1);
+        SBL_MSG(MSG::SOURCE, "Frame pool exhausted, allocating %d bytes from heap", size);
+        size_class = -1;
+        capacity = size;
+        slot = new uint8_t[overhead() + size];
+    }
+    return FrameRef(new (slot) FrameBuffer(this, size_class, slot + overhead(), capacity));
+}
+
+FrameRef FramePool::copy(const uint8_t* frame, int size) {
+    FrameRef ref = alloc(size);
+    memcpy(ref.data(), frame, size);
+    ref->set_size(size);
+    return ref;
+}
+
+void FramePool::recycle(FrameBuffer* buffer) {
+    int size_class = buffer->_size_class;
+    uint8_t* slot = reinterpret_cast<uint8_t*>(buffer);
+    buffer->~FrameBuffer();
+    if (size_class < 0) {
+        delete[] slot;
+        return;
+    }
+    _lock.lock();
+    _classes[size_class].free.push_back(slot);
+    _lock.unlock();
+    __sync_fetch_and_sub(&_in_use, 1);
+}
+
+void FramePool::print_stats(std::ostream& str) {
+    _lock.lock();
+    for (int n = 0; n < CLASSES; n++) {
+        const SizeClass& size_class = _classes[n];
+        str << "frame_pool_slot=" << size_class.slot_size - overhead()
+            << " free="           << size_class.free.size()
+            << " total="          << size_class.slots
+            << "\n";
+    }
+    _lock.unlock();
+    str << "frame_pool_heap_allocs=" << _heap_allocs << "\n";
+}
+
+}
@@ -0,0 +1,145 @@
+#pragma once
+#ifndef _RTSP_FRAME_BUFFER_H
+#define _RTSP_FRAME_BUFFER_H
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <stdint.h>
+#include <ostream>
+#include <vector>
+#include <sbl/sbl_thread.h>
+
+namespace RTSP {
+class FramePool;
+
+//! Reference counted encoded frame.
+/*! Frame is filled once, right after it is allocated, and from then on it is shared,
+    read-only, by everybody who holds a FrameRef to it. When the last reference goes away,
+    the buffer returns to its FramePool. */
+class FrameBuffer {
+public:
+    //! Frame data
+    uint8_t*  data()     const { return _data; }
+    //! Frame size in bytes
+    int       size()     const { return _size; }
+    //! Maximum frame size this buffer can hold
+    int       capacity() const { return _capacity; }
+    //! Set frame size after data was written in
+    void      set_size(int size);
+    //! Return true if buffer comes from preallocated slab, false if from heap
+    bool      is_pooled() const { return _size_class >= 0; }
+    //! Add a reference
+    void      retain()  { __sync_fetch_and_add(&_refs, 1); }
+    //! Drop a reference, buffer goes back to the pool when it was the last one
+    void      release();
+private:
+    friend class FramePool;
+    FrameBuffer(FramePool* pool, int size_class, uint8_t* data, int capacity) :
+        _refs(1), _pool(pool), _size_class(size_class), _data(data), _size(0), _capacity(capacity) {}
+    FrameBuffer(const FrameBuffer&);            // not implemented
+    FrameBuffer& operator=(const FrameBuffer&); // not implemented
+
+    volatile int    _refs;
+    FramePool*      _pool;
+    int             _size_class;    // -1 for heap buffers
+    uint8_t*        _data;
+    int             _size;
+    int             _capacity;
+};
+
+//! Smart pointer to FrameBuffer, copying it just adds a reference
+class FrameRef {
+public:
+    //! Empty reference
+    FrameRef() : _buffer(NULL) {}
+    //! Take over a reference (doesn't add one)
+    explicit FrameRef(FrameBuffer* buffer) : _buffer(buffer) {}
+    //! Share a frame
+    FrameRef(const FrameRef& ref) : _buffer(ref._buffer) { if (_buffer) _buffer->retain(); }
+    //! Share a frame, release the old one
+    FrameRef& operator=(const FrameRef& ref) {
+        if (ref._buffer)
+            ref._buffer->retain();
+        reset();
+        _buffer = ref._buffer;
+        return *this;
+    }
+    //! Release the frame
+    ~FrameRef() { reset(); }
+    //! Drop the reference
+    void reset() {
+        if (_buffer)
+            _buffer->release();
+        _buffer = NULL;
+    }
+    //! Return true if reference points to a frame
+    bool         is_valid() const { return _buffer != NULL; }
+    //! Frame data
+    uint8_t*     data()     const { return _buffer->data(); }
+    //! Frame size in bytes
+    int          size()     const { return _buffer->size(); }
+    //! Underlying buffer
+    FrameBuffer* get()      const { return _buffer; }
+    //! Underlying buffer
+    FrameBuffer* operator->() const { return _buffer; }
+private:
+    FrameBuffer* _buffer;
+};
+
+//! Preallocated slab pool of FrameBuffers.
+/*! Memory is split between a few size classes (4K to 1M), each one a single slab cut into
+    equal slots. Frame goes to the smallest class that fits; when that one is exhausted, to
+    the next larger one and then to the heap, so allocation never fails. Heap allocations are
+    counted, so that the pool can be sized from statistics.\n
+    Class is thread safe: frames are allocated in SDK callback and may be released from any thread. */
+class FramePool {
+public:
+    //! Create a pool
+    //! @param  pool_size   total memory (bytes) to preallocate
+    FramePool(int pool_size);
+    //! Frees the slabs, all buffers must have been released
+    ~FramePool();
+    //! Allocate an empty buffer for a frame of up to size bytes
+    FrameRef alloc(int size);
+    //! Allocate a buffer and copy a frame into it
+    FrameRef copy(const uint8_t* frame, int size);
+    //! Number of pooled buffers currently in use
+    int      in_use()      const { return _in_use; }
+    //! Number of allocations that had to go to the heap, since creation
+    unsigned int heap_allocs() const { return _heap_allocs; }
+    //! Print slab usage, one line per size class
+    void     print_stats(std::ostream& str);
+private:
+    friend class FrameBuffer;
+    enum {CLASSES = 5, MIN_SLOT = 4096 /* each class is 4 times larger */};
+    struct SizeClass {
+        int                     slot_size;  // bytes per slot, including FrameBuffer
+        int                     slots;
+        uint8_t*                slab;
+        std::vector<uint8_t*>   free;
+    };
+    SizeClass       _classes[CLASSES];
+    SBL::Mutex      _lock;
+    volatile int    _in_use;
+    unsigned int    _heap_allocs;
+
+    // Bytes taken by FrameBuffer at the start of each slot
+    static int  overhead();
+    void        recycle(FrameBuffer* buffer);
+    FramePool(const FramePool&);            // not implemented
+    FramePool& operator=(const FramePool&); // not implemented
+};
+
+}
+#endif
@@ -0,0 +1,73 @@
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <sbl/sbl_logger.h>
+#include "rtsp_impl.h"
+#include "gop_cache.h"
+
+namespace RTSP {
+
+GopCache::GopCache(FramePool* pool, int max_bytes) : _pool(pool), _max_bytes(max_bytes), _bytes(0),
+        _overflow(true), _stale(false), _gop(0), _hits(0), _misses(0) {
+}
+
+void GopCache::clear() {
+    _entries.clear();
+    _bytes = 0;
+    _gop++;
+}
+
+void GopCache::add(const uint8_t* data, int size, uint32_t timestamp, bool key, const FrameRef& owner) {
+    if (_stale) {
+        _stale    = false;
+        _overflow = true;
+        clear();
+    }
+    if (key) {
+        clear();
+        _overflow = false;
+    }
+    if (_overflow || _max_bytes <= 0)
+        return;
+    if (_bytes + size > _max_bytes) {
+        SBL_MSG(MSG::SOURCE, "GOP cache full (%d frames, %d bytes), disabled until next key frame", count(), _bytes);
+        clear();
+        _overflow = true;
+        return;
+    }
+    _entries.resize(_entries.size() + 1);
+    Entry& entry = _entries.back();
+    if (owner.is_valid() && data >= owner.data() && data + size <= owner.data() + owner.size()) {
+        entry.frame = owner;
+        entry.data  = data;
+    } else {
+        entry.frame = _pool->copy(data, size);
+        entry.data  = entry.frame.data();
+    }
+    entry.size      = size;
+    entry.timestamp = timestamp;
+    _bytes += size;
+}
+
+void GopCache::print_stats(std::ostream& str, const char* stream_name) const {
+    str << "gop_cache stream="  << stream_name
+        << " frames="           << count()
+        << " bytes="            << _bytes
+        << " max_bytes="        << _max_bytes
+        << " hits="             << _hits
+        << " misses="           << _misses
+        << "\n";
+}
+
+}
@@ -0,0 +1,81 @@
+#pragma once
+#ifndef _RTSP_GOP_CACHE_H
+#define _RTSP_GOP_CACHE_H
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <stdint.h>
+#include <ostream>
+#include <vector>
+#include "frame_buffer.h"
+
+namespace RTSP {
+
+//! Frames of the current GOP of a live stream, so that new clients don't have to wait for the next I-frame.
+/*! Holds everything from the last key frame (SPS for H.264) thru the latest frame. Frames that came
+    from the frame pool are shared, others are copied into it. When the GOP grows over the limit,
+    the cache is emptied and stays unusable until the next key frame.\n
+    Cache is filled and read by the streaming thread only, except for invalidate(). */
+class GopCache {
+public:
+    //! Cached frame
+    struct Entry {
+        FrameRef        frame;      //!< buffer holding the data
+        const uint8_t*  data;       //!< frame (NAL unit for H.264), inside the buffer
+        int             size;       //!< frame size
+        uint32_t        timestamp;  //!< RTP timestamp the frame came with
+    };
+    //! Cache constructor
+    // @param   pool        pool to copy frames into, when they don't come from it already
+    // @param   max_bytes   limit on cached frame data, 0 disables caching
+    GopCache(FramePool* pool, int max_bytes);
+    //! Change the limit, takes effect with the next frame
+    void set_max_bytes(int max_bytes) { _max_bytes = max_bytes; }
+    //! Limit on cached frame data
+    int  max_bytes() const { return _max_bytes; }
+    //! Add a frame, key frame starts a new GOP
+    // @param   owner   buffer data points into, if it came from the frame pool (may be empty)
+    void add(const uint8_t* data, int size, uint32_t timestamp, bool key, const FrameRef& owner);
+    //! Return true if the cache holds a GOP from its start
+    bool is_usable() const { return !_stale && !_entries.empty(); }
+    //! Stream stopped, cached frames are outdated. May be called from any thread.
+    void invalidate() { _stale = true; }
+    //! Number of cached frames
+    int  count() const { return _entries.size(); }
+    //! Cached frame, 0 is the key frame
+    const Entry& entry(int index) const { return _entries[index]; }
+    //! Number of GOPs started so far, cached frames are only valid within one
+    unsigned int gop() const { return _gop; }
+    //! Count a client that started from the cache
+    void hit()  { _hits++; }
+    //! Count a client that had to wait for the next key frame
+    void miss() { _misses++; }
+    //! Print cache size and counters, on one line
+    void print_stats(std::ostream& str, const char* stream_name) const;
+private:
+    FramePool*          _pool;
+    int                 _max_bytes;
+    int                 _bytes;
+    bool                _overflow;      // GOP didn't fit, wait for the next one
+    volatile bool       _stale;         // set by invalidate(), cache is emptied with the next frame
+    unsigned int        _gop;
+    unsigned int        _hits;
+    unsigned int        _misses;
+    std::vector<Entry>  _entries;
+
+    void clear();
+};
+
+}
+#endif
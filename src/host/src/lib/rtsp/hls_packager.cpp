@@ -0,0 +1,551 @@
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <sbl/sbl_logger.h>
+#include "rtsp_impl.h"
+#include "hls_packager.h"
+
+namespace RTSP {
+
+// ISO BMFF boxes are written big endian, sizes patched in when the box is closed
+
+static void put16(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+static void put32(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+static void put64(std::vector<uint8_t>& out, uint64_t value) {
+    put32(out, value >> 32);
+    put32(out, value);
+}
+
+static void put_zeros(std::vector<uint8_t>& out, int count) {
+    out.insert(out.end(), count, 0);
+}
+
+static void set32(std::vector<uint8_t>& out, size_t offset, uint32_t value) {
+    out[offset]     = value >> 24;
+    out[offset + 1] = value >> 16;
+    out[offset + 2] = value >> 8;
+    out[offset + 3] = value;
+}
+
+static size_t open_box(std::vector<uint8_t>& out, const char* type) {
+    size_t start = out.size();
+    put32(out, 0);
+    out.insert(out.end(), type, type + 4);
+    return start;
+}
+
+static size_t open_full_box(std::vector<uint8_t>& out, const char* type, int version, uint32_t flags) {
+    size_t start = open_box(out, type);
+    put32(out, version << 24 | flags);
+    return start;
+}
+
+static void close_box(std::vector<uint8_t>& out, size_t start) {
+    set32(out, start, out.size() - start);
+}
+
+static void put_matrix(std::vector<uint8_t>& out) {
+    static const uint32_t UNITY[9] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+    for (int n = 0; n < 9; n++)
+        put32(out, UNITY[n]);
+}
+
+// Exp-Golomb reader of an RBSP, reads zeros past the end and remembers it did
+class BitReader {
+public:
+    BitReader(const std::vector<uint8_t>& data) : _data(data), _bit(0), _overrun(false) {}
+    uint32_t bits(int count) {
+        uint32_t value = 0;
+        while (count--) {
+            value <<= 1;
+            if (_bit < _data.size() * 8)
+                value |= (_data[_bit / 8] >> (7 - _bit % 8)) & 1;
+            else
+                _overrun = true;
+            _bit++;
+        }
+        return value;
+    }
+    uint32_t ue() {
+        int zeros = 0;
+        while (!bits(1) && !_overrun && zeros < 32)
+            zeros++;
+        return ((1u << zeros) - 1) + bits(zeros);
+    }
+    int32_t se() {
+        uint32_t value = ue();
+        return value & 1 ? (int32_t) ((value + 1) / 2) : -(int32_t) (value / 2);
+    }
+    bool overrun() const { return _overrun; }
+private:
+    const std::vector<uint8_t>& _data;
+    size_t  _bit;
+    bool    _overrun;
+};
+
+bool HlsPackager::parse_sps(const uint8_t* data, int size, SpsInfo& info) {
+    if (size < 4 || (data[0] & 0x1f) != 7)
+        return false;
+    // drop emulation prevention bytes
+    std::vector<uint8_t> rbsp;
+    rbsp.reserve(size);
+    for (int n = 1; n < size; n++) {
+        if (n >= 3 && data[n] == 3 && data[n - 1] == 0 && data[n - 2] == 0)
+            continue;
+        rbsp.push_back(data[n]);
+    }
+    BitReader sps(rbsp);
+    info.profile          = sps.bits(8);
+    sps.bits(16);           // constraint flags, level
+    sps.ue();               // seq_parameter_set_id
+    info.chroma_format    = 1;
+    info.bit_depth_luma   = 8;
+    info.bit_depth_chroma = 8;
+    switch (info.profile) {
+        case 100: case 110: case 122: case 244: case 44: case 83: case 86: case 118: case 128: case 138: case 139: case 134: case 135:
+            info.chroma_format = sps.ue();
+            if (info.chroma_format == 3)
+                sps.bits(1);    // separate_colour_plane_flag
+            info.bit_depth_luma   = sps.ue() + 8;
+            info.bit_depth_chroma = sps.ue() + 8;
+            sps.bits(1);        // qpprime_y_zero_transform_bypass_flag
+            if (sps.bits(1)) {
+                for (int list = 0; list < (info.chroma_format == 3 ? 12 : 8); list++) {
+                    if (!sps.bits(1))
+                        continue;
+                    int last = 8, next = 8;
+                    for (int n = 0; n < (list < 6 ? 16 : 64) && next; n++) {
+                        next = (last + sps.se() + 256) % 256;
+                        last = next ? next : last;
+                    }
+                }
+            }
+    }
+    sps.ue();               // log2_max_frame_num_minus4
+    uint32_t poc_type = sps.ue();
+    if (poc_type == 0)
+        sps.ue();           // log2_max_pic_order_cnt_lsb_minus4
+    else if (poc_type == 1) {
+        sps.bits(1);
+        sps.se();
+        sps.se();
+        uint32_t cycle = sps.ue();
+        for (uint32_t n = 0; n < cycle && !sps.overrun(); n++)
+            sps.se();
+    }
+    sps.ue();               // max_num_ref_frames
+    sps.bits(1);            // gaps_in_frame_num_value_allowed_flag
+    uint32_t width_mbs  = sps.ue() + 1;
+    uint32_t height_map = sps.ue() + 1;
+    uint32_t frame_mbs_only = sps.bits(1);
+    if (!frame_mbs_only)
+        sps.bits(1);        // mb_adaptive_frame_field_flag
+    sps.bits(1);            // direct_8x8_inference_flag
+    uint32_t crop_left = 0, crop_right = 0, crop_top = 0, crop_bottom = 0;
+    if (sps.bits(1)) {
+        crop_left   = sps.ue();
+        crop_right  = sps.ue();
+        crop_top    = sps.ue();
+        crop_bottom = sps.ue();
+    }
+    if (sps.overrun())
+        return false;
+    int crop_x = info.chroma_format == 1 || info.chroma_format == 2 ? 2 : 1;
+    int crop_y = (info.chroma_format == 1 ? 2 : 1) * (2 - frame_mbs_only);
+    info.width  = width_mbs * 16 - crop_x * (crop_left + crop_right);
+    info.height = (2 - frame_mbs_only) * height_map * 16 - crop_y * (crop_top + crop_bottom);
+    return info.width > 0 && info.height > 0;
+}
+
+HlsPackager::HlsPackager(const Options& options) : _options(options), _ring(options.segments + 1),
+        _sequence(options.first_sequence), _first(options.first_sequence), _open(false),
+        _init_version(0), _discontinuity(0), _target(options.segment_time * options.ts_clock),
+        _au_timestamp(0), _au_key(false), _decode_time(0), _part_start(0), _part_duration(0), _segment_duration(0),
+        _last_duration(options.ts_clock / 30), _fragment(0),
+        _access_units(0), _skipped(0), _resets(0), _requests(0), _misses(0) {
+}
+
+void HlsPackager::add(const uint8_t* data, int size, uint32_t timestamp) {
+    if (size <= 0)
+        return;
+    if (!_au.empty() && timestamp != _au_timestamp)
+        finish_access_unit(timestamp);
+    int type = data[0] & 0x1f;
+    switch (type) {
+        case 7: _sps.assign(data, data + size);   return;
+        case 8: _pps.assign(data, data + size);   return;
+        case 9:                                   return;   // access unit delimiter, samples are delimited by the container
+    }
+    if (_au.empty()) {
+        _au_timestamp = timestamp;
+        _au_key       = false;
+    }
+    if (type == 5)
+        _au_key = true;
+    put32(_au, size);
+    _au.insert(_au.end(), data, data + size);
+}
+
+// The access unit lasts until the next one starts; it goes into the part being gathered,
+// after the segment is cut or the init segment renewed, if it is a key frame
+void HlsPackager::finish_access_unit(uint32_t timestamp) {
+    int32_t duration = timestamp - _au_timestamp;
+    if (duration <= 0 || duration > _options.ts_clock)
+        duration = _last_duration;
+    _last_duration = duration;
+    if (_au_key && !_sps.empty() && !_pps.empty() && (_sps != _init_sps || _pps != _init_pps)) {
+        SpsInfo sps;
+        if (parse_sps(&_sps[0], _sps.size(), sps)) {
+            if (_open)
+                close_segment();
+            write_init(sps);
+        } else
+            SBL_WARN("HLS packager can't parse SPS, waiting for another one");
+    } else if (_au_key && _open && _segment_duration >= _options.segment_time * (uint32_t) _options.ts_clock)
+        close_segment();
+    if (!_open) {
+        if (!_au_key || _init.empty()) {
+            _au.clear();
+            _skipped++;
+            return;
+        }
+        open_segment();
+    }
+    if (_samples.empty())
+        _part_start = _decode_time;
+    Sample sample = { (uint32_t) _au.size(), (uint32_t) duration, _au_key };
+    _samples.push_back(sample);
+    _mdat.insert(_mdat.end(), _au.begin(), _au.end());
+    _au.clear();
+    _access_units++;
+    _decode_time      += duration;
+    _part_duration    += duration;
+    _segment_duration += duration;
+    // parts may not be longer than part_time, the next sample is expected to last as long as this one
+    if (_options.part_time && (_part_duration + duration) * 1000ull > (uint64_t) _options.part_time * _options.ts_clock)
+        close_part();
+}
+
+void HlsPackager::write_init(const SpsInfo& sps) {
+    _lock.lock();
+    if (!_init.empty()) {
+        // segments so far need the old init segment, they go
+        _first = _sequence;
+        _discontinuity++;
+        _resets++;
+    }
+    _init_sps = _sps;
+    _init_pps = _pps;
+    _init_version++;
+    _init.clear();
+    size_t ftyp = open_box(_init, "ftyp");
+    _init.insert(_init.end(), "iso6", "iso6" + 4);
+    put32(_init, 0);
+    _init.insert(_init.end(), "iso6mp41", "iso6mp41" + 8);
+    close_box(_init, ftyp);
+
+    size_t moov = open_box(_init, "moov");
+    size_t mvhd = open_full_box(_init, "mvhd", 0, 0);
+    put_zeros(_init, 8);                // creation, modification time
+    put32(_init, _options.ts_clock);
+    put32(_init, 0);                    // duration
+    put32(_init, 0x00010000);           // rate
+    put16(_init, 0x0100);               // volume
+    put_zeros(_init, 10);
+    put_matrix(_init);
+    put_zeros(_init, 24);
+    put32(_init, 2);                    // next track id
+    close_box(_init, mvhd);
+
+    size_t trak = open_box(_init, "trak");
+    size_t tkhd = open_full_box(_init, "tkhd", 0, 3);   // enabled, in movie
+    put_zeros(_init, 8);
+    put32(_init, 1);                    // track id
+    put_zeros(_init, 4 + 4 + 8 + 2 + 2 + 2 + 2);        // reserved, duration, reserved, layer, group, volume, reserved
+    put_matrix(_init);
+    put32(_init, sps.width << 16);
+    put32(_init, sps.height << 16);
+    close_box(_init, tkhd);
+
+    size_t mdia = open_box(_init, "mdia");
+    size_t mdhd = open_full_box(_init, "mdhd", 0, 0);
+    put_zeros(_init, 8);
+    put32(_init, _options.ts_clock);
+    put32(_init, 0);
+    put16(_init, 0x55c4);               // und
+    put16(_init, 0);
+    close_box(_init, mdhd);
+    size_t hdlr = open_full_box(_init, "hdlr", 0, 0);
+    put32(_init, 0);
+    _init.insert(_init.end(), "vide", "vide" + 4);
+    put_zeros(_init, 12);
+    const char name[] = "VideoHandler";
+    _init.insert(_init.end(), name, name + sizeof name);
+    close_box(_init, hdlr);
+
+    size_t minf = open_box(_init, "minf");
+    size_t vmhd = open_full_box(_init, "vmhd", 0, 1);
+    put_zeros(_init, 8);
+    close_box(_init, vmhd);
+    size_t dinf = open_box(_init, "dinf");
+    size_t dref = open_full_box(_init, "dref", 0, 0);
+    put32(_init, 1);
+    close_box(_init, open_full_box(_init, "url ", 0, 1));  // media is in the same file
+    close_box(_init, dref);
+    close_box(_init, dinf);
+
+    size_t stbl = open_box(_init, "stbl");
+    size_t stsd = open_full_box(_init, "stsd", 0, 0);
+    put32(_init, 1);
+    size_t avc1 = open_box(_init, "avc1");
+    put_zeros(_init, 6);
+    put16(_init, 1);                    // data reference index
+    put_zeros(_init, 16);
+    put16(_init, sps.width);
+    put16(_init, sps.height);
+    put32(_init, 0x00480000);           // 72 dpi
+    put32(_init, 0x00480000);
+    put32(_init, 0);
+    put16(_init, 1);                    // frame count
+    put_zeros(_init, 32);               // compressor name
+    put16(_init, 0x0018);               // depth
+    put16(_init, 0xffff);
+    size_t avcc = open_box(_init, "avcC");
+    _init.push_back(1);
+    _init.insert(_init.end(), _sps.begin() + 1, _sps.begin() + 4);  // profile, compatibility, level
+    _init.push_back(0xff);              // 4 byte NAL unit lengths
+    _init.push_back(0xe1);              // one SPS
+    put16(_init, _sps.size());
+    _init.insert(_init.end(), _sps.begin(), _sps.end());
+    _init.push_back(1);
+    put16(_init, _pps.size());
+    _init.insert(_init.end(), _pps.begin(), _pps.end());
+    if (sps.profile == 100 || sps.profile == 110 || sps.profile == 122 || sps.profile == 144) {
+        _init.push_back(0xfc | sps.chroma_format);
+        _init.push_back(0xf8 | (sps.bit_depth_luma - 8));
+        _init.push_back(0xf8 | (sps.bit_depth_chroma - 8));
+        _init.push_back(0);
+    }
+    close_box(_init, avcc);
+    close_box(_init, avc1);
+    close_box(_init, stsd);
+    // samples are all in fragments
+    const char* tables[] = { "stts", "stsc", "stco" };
+    for (int n = 0; n < 3; n++) {
+        size_t table = open_full_box(_init, tables[n], 0, 0);
+        put32(_init, 0);
+        close_box(_init, table);
+    }
+    size_t stsz = open_full_box(_init, "stsz", 0, 0);
+    put32(_init, 0);
+    put32(_init, 0);
+    close_box(_init, stsz);
+    close_box(_init, stbl);
+    close_box(_init, minf);
+    close_box(_init, mdia);
+    close_box(_init, trak);
+
+    size_t mvex = open_box(_init, "mvex");
+    size_t trex = open_full_box(_init, "trex", 0, 0);
+    put32(_init, 1);                    // track id
+    put32(_init, 1);                    // sample description index
+    put_zeros(_init, 12);               // default duration, size, flags
+    close_box(_init, trex);
+    close_box(_init, mvex);
+    close_box(_init, moov);
+    unsigned int version = _init_version;
+    _lock.unlock();
+    SBL_MSG(MSG::SOURCE, "HLS init segment %u, %dx%d, profile %d", version, sps.width, sps.height, sps.profile);
+}
+
+void HlsPackager::open_segment() {
+    _lock.lock();
+    Segment& segment = _ring[_sequence % _ring.size()];
+    segment.sequence = _sequence;
+    segment.duration = 0;
+    segment.complete = false;
+    segment.data.clear();
+    segment.parts.clear();
+    _open = true;
+    _lock.unlock();
+    _segment_duration = 0;
+}
+
+// Part is one movie fragment: moof with a single track run, then mdat with its samples
+void HlsPackager::close_part() {
+    if (_samples.empty())
+        return;
+    _lock.lock();
+    Segment& segment = _ring[_sequence % _ring.size()];
+    std::vector<uint8_t>& out = segment.data;
+    size_t moof = open_box(out, "moof");
+    size_t mfhd = open_full_box(out, "mfhd", 0, 0);
+    put32(out, ++_fragment);
+    close_box(out, mfhd);
+    size_t traf = open_box(out, "traf");
+    size_t tfhd = open_full_box(out, "tfhd", 0, 0x020000);    // default base is moof
+    put32(out, 1);
+    close_box(out, tfhd);
+    size_t tfdt = open_full_box(out, "tfdt", 1, 0);
+    put64(out, _part_start);
+    close_box(out, tfdt);
+    size_t trun = open_full_box(out, "trun", 0, 0x000701);    // data offset, sample durations, sizes and flags
+    put32(out, _samples.size());
+    size_t data_offset = out.size();
+    put32(out, 0);
+    for (unsigned int n = 0; n < _samples.size(); n++) {
+        put32(out, _samples[n].duration);
+        put32(out, _samples[n].size);
+        put32(out, _samples[n].key ? 0x02000000 : 0x01010000);  // depends on no other sample / non-sync
+    }
+    close_box(out, trun);
+    close_box(out, traf);
+    close_box(out, moof);
+    set32(out, data_offset, out.size() - moof + 8);
+    put32(out, _mdat.size() + 8);
+    out.insert(out.end(), "mdat", "mdat" + 4);
+    out.insert(out.end(), _mdat.begin(), _mdat.end());
+    Part part = { (uint32_t) out.size(), _part_duration, _samples[0].key };
+    segment.parts.push_back(part);
+    _lock.unlock();
+    _samples.clear();
+    _mdat.clear();
+    _part_duration = 0;
+}
+
+void HlsPackager::close_segment() {
+    close_part();
+    _lock.lock();
+    Segment& segment = _ring[_sequence % _ring.size()];
+    segment.duration = _segment_duration;
+    segment.complete = true;
+    if (_segment_duration > _target)
+        _target = _segment_duration;
+    _sequence++;
+    _open = false;
+    _lock.unlock();
+}
+
+// Segment of the sequence number if it is still in the ring, complete or not; call with _lock held
+HlsPackager::Segment* HlsPackager::find(uint32_t sequence) {
+    if (sequence - _first > _sequence - _first || _sequence - sequence > (uint32_t) _options.segments)
+        return NULL;
+    Segment& segment = _ring[sequence % _ring.size()];
+    return segment.sequence == sequence && (segment.complete || _open) ? &segment : NULL;
+}
+
+bool HlsPackager::playlist(std::string& out, const char* prefix) {
+    std::ostringstream str;
+    str << std::fixed << std::setprecision(3);
+    _lock.lock();
+    uint32_t first = _sequence - _first > (uint32_t) _options.segments ? _sequence - _options.segments : _first;
+    Segment* open = _open ? find(_sequence) : NULL;
+    if (first == _sequence && !(open && open->parts.size())) {
+        _lock.unlock();
+        return false;
+    }
+    double clock = _options.ts_clock;
+    str << "#EXTM3U\n"
+        << "#EXT-X-VERSION:6\n"
+        << "#EXT-X-INDEPENDENT-SEGMENTS\n"
+        << "#EXT-X-TARGETDURATION:" << (_target + _options.ts_clock - 1) / _options.ts_clock << "\n";
+    if (_options.part_time)
+        str << "#EXT-X-PART-INF:PART-TARGET="              << _options.part_time / 1000.0 << "\n"
+            << "#EXT-X-SERVER-CONTROL:PART-HOLD-BACK="     << 3 * _options.part_time / 1000.0 << "\n";
+    str << "#EXT-X-MEDIA-SEQUENCE:" << first << "\n";
+    if (_discontinuity)
+        str << "#EXT-X-DISCONTINUITY-SEQUENCE:" << _discontinuity << "\n";
+    str << "#EXT-X-MAP:URI=\"" << prefix << "init" << _init_version << ".mp4\"\n";
+    // parts are listed for the last three target durations
+    uint32_t parts_from = _sequence;
+    for (uint32_t listed = 0; parts_from != first && listed < 3 * _target; )
+        listed += _ring[--parts_from % _ring.size()].duration;
+    for (uint32_t sequence = first; sequence != _sequence + (open ? 1 : 0); sequence++) {
+        const Segment& segment = _ring[sequence % _ring.size()];
+        for (unsigned int n = 0; _options.part_time && sequence - parts_from <= _sequence - parts_from && n < segment.parts.size(); n++) {
+            str << "#EXT-X-PART:DURATION=" << segment.parts[n].duration / clock
+                << ",URI=\"" << prefix << "seg" << sequence << '.' << n << ".m4s\"";
+            if (segment.parts[n].independent)
+                str << ",INDEPENDENT=YES";
+            str << "\n";
+        }
+        if (segment.complete)
+            str << "#EXTINF:" << segment.duration / clock << ",\n"
+                << prefix << "seg" << sequence << ".m4s\n";
+    }
+    _lock.unlock();
+    out = str.str();
+    return true;
+}
+
+int HlsPackager::file(const char* name, std::vector<uint8_t>& out) {
+    unsigned int version, sequence, part;
+    int end = 0;
+    out.clear();
+    _lock.lock();
+    _requests++;
+    if (sscanf(name, "init%u.mp4%n", &version, &end) == 1 && !name[end] && version == _init_version) {
+        out = _init;
+    } else if (sscanf(name, "seg%u.%u.m4s%n", &sequence, &part, &end) == 2 && !name[end]) {
+        Segment* segment = find(sequence);
+        if (segment && part < segment->parts.size())
+            out.assign(segment->data.begin() + (part ? segment->parts[part - 1].end : 0),
+                       segment->data.begin() + segment->parts[part].end);
+    } else if (sscanf(name, "seg%u.m4s%n", &sequence, &end) == 1 && !name[end]) {
+        Segment* segment = find(sequence);
+        if (segment && segment->complete)
+            out = segment->data;
+    }
+    if (out.empty())
+        _misses++;
+    _lock.unlock();
+    return out.size();
+}
+
+void HlsPackager::print_stats(std::ostream& str, const char* stream_name) {
+    _lock.lock();
+    size_t bytes = 0;
+    for (unsigned int n = 0; n < _ring.size(); n++)
+        bytes += _ring[n].data.capacity();
+    uint32_t segments = std::min(_sequence - _first, (uint32_t) _options.segments);
+    str << "hls stream="        << stream_name
+        << " sequence="         << _sequence
+        << " segments="         << segments
+        << " ring_bytes="       << bytes
+        << " init_version="     << _init_version
+        << " access_units="     << _access_units
+        << " skipped="          << _skipped
+        << " resets="           << _resets
+        << " requests="         << _requests
+        << " misses="           << _misses
+        << "\n";
+    _lock.unlock();
+}
+
+}
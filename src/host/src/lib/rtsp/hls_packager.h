@@ -0,0 +1,132 @@
+#pragma once
+#ifndef _RTSP_HLS_PACKAGER_H
+#define _RTSP_HLS_PACKAGER_H
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <stdint.h>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <sbl/sbl_thread.h>
+
+namespace RTSP {
+
+//! Packages a live H.264 stream as fragmented MP4 segments and an HLS playlist, for HTTP distribution.
+/*! Access units (NAL units with the same timestamp) are written as samples of a single track.
+    Segments start with a key frame and are cut at the first key frame after segment_time; with
+    part_time set, each segment is a run of partial segments (low latency HLS), one movie fragment
+    each, cut after part_time. The latest segments are kept in a ring of segment slots, allocated
+    as the first segments are built and reused afterwards.\n
+    SPS and PPS go to the init segment. When they change, the segments packaged so far are dropped
+    and the playlist starts over with a new init segment and the next discontinuity sequence.\n
+    Files are named index.m3u8 (the playlist), init<version>.mp4, seg<sequence>.m4s and
+    seg<sequence>.<part>.m4s; none of the media files changes once listed, so they may be cached.
+    Frames are added by the streaming thread; playlist() and file() may be called from any thread. */
+class HlsPackager {
+public:
+    //! Packager options
+    struct Options {
+        int         segment_time;   //!< seconds per segment, at least
+        int         segments;       //!< segments listed in the playlist
+        int         part_time;      //!< ms per partial segment, 0 for whole segments only
+        int         ts_clock;       //!< timestamp clock in Hz, also the track timescale
+        uint32_t    first_sequence; //!< media sequence number of the first segment
+        Options() : segment_time(2), segments(6), part_time(0), ts_clock(90000), first_sequence(0) {}
+    };
+    //! What init segment needs from the SPS
+    struct SpsInfo {
+        int profile;
+        int chroma_format;
+        int bit_depth_luma;
+        int bit_depth_chroma;
+        int width;
+        int height;
+    };
+    //! Packager constructor
+    HlsPackager(const Options& options);
+    //! Add a NAL unit (without start code)
+    void add(const uint8_t* data, int size, uint32_t timestamp);
+    //! Render the playlist, media files are listed as prefix + name; return false if nothing is packaged yet
+    bool playlist(std::string& out, const char* prefix);
+    //! Copy a file listed in the playlist, return its size, 0 if there is no such file (any more)
+    int  file(const char* name, std::vector<uint8_t>& out);
+    //! Print ring size and counters, on one line
+    void print_stats(std::ostream& str, const char* stream_name);
+    //! Parse SPS (NAL unit without start code), return false if it is not one or is cut short
+    static bool parse_sps(const uint8_t* data, int size, SpsInfo& info);
+private:
+    struct Sample {
+        uint32_t    size;
+        uint32_t    duration;
+        bool        key;
+    };
+    struct Part {
+        uint32_t    end;            // in segment data
+        uint32_t    duration;
+        bool        independent;    // starts with a key frame
+    };
+    struct Segment {
+        uint32_t    sequence;
+        uint32_t    duration;
+        bool        complete;
+        std::vector<uint8_t> data;  // movie fragments, one per part
+        std::vector<Part>    parts;
+    };
+    Options             _options;
+    SBL::Mutex          _lock;              // guards the ring, init segment and sequence numbers
+    std::vector<Segment> _ring;             // segment n is in slot n % size, one more than listed for the open one
+    uint32_t            _sequence;          // of the open (or next) segment
+    uint32_t            _first;             // oldest segment that may be listed, later ones after a reset
+    bool                _open;
+    std::vector<uint8_t> _init;
+    unsigned int        _init_version;
+    unsigned int        _discontinuity;
+    uint32_t            _target;            // longest segment, ticks
+    // streaming thread only
+    std::vector<uint8_t> _sps;
+    std::vector<uint8_t> _pps;
+    std::vector<uint8_t> _init_sps;         // parameter sets the init segment has
+    std::vector<uint8_t> _init_pps;
+    std::vector<uint8_t> _au;               // access unit being gathered, NAL units with 4 byte lengths
+    uint32_t            _au_timestamp;
+    bool                _au_key;
+    std::vector<uint8_t> _mdat;             // samples of the part being gathered
+    std::vector<Sample> _samples;
+    uint64_t            _decode_time;       // of the next sample
+    uint64_t            _part_start;        // decode time of the first sample of the part
+    uint32_t            _part_duration;
+    uint32_t            _segment_duration;
+    uint32_t            _last_duration;
+    uint32_t            _fragment;          // movie fragment sequence number
+    // counters
+    unsigned int        _access_units;
+    unsigned int        _skipped;           // access units before the first key frame
+    unsigned int        _resets;
+    unsigned int        _requests;
+    unsigned int        _misses;
+
+    void finish_access_unit(uint32_t timestamp);
+    void open_segment();
+    void close_part();
+    void close_segment();
+    void write_init(const SpsInfo& sps);
+    Segment* find(uint32_t sequence);
+
+    HlsPackager(const HlsPackager&);            // not implemented
+    HlsPackager& operator=(const HlsPackager&); // not implemented
+};
+
+}
+#endif
@@ -17,6 +17,8 @@
 \****************************************************************************/
 #include "rtsp.h"
 #include "rtsp_source.h"
+#include "gop_cache.h"
+#include "nal_scanner.h"
 
 namespace RTSP {
 
@@ -34,14 +36,16 @@ public:
         _timestamp = timestamp;
         _stream_desc.encoder_type = encoder;
         switch (encoder_type()) {
-            case H264: 
-                SBL_THROW_IF(size < NAL_HEADER_SIZE || !is_nal_header(frame), "bad NAL header, size=%d, header=%02x%02x%02x%02x",
+            case H264: {
+                int start_code = NalScanner::start_code_size(frame, size);
+                SBL_THROW_IF(start_code == 0 || start_code == size, "bad NAL header, size=%d, header=%02x%02x%02x%02x",
                              size, frame[0], frame[1], frame[2], frame[3]);
-                frame += NAL_HEADER_SIZE;
-                size  -= NAL_HEADER_SIZE;
+                frame += start_code;
+                size  -= start_code;
                 SBL_MSG(MSG::SOURCE, "H264 source %d, frame %c, size %d, ts %d", _stream_id, frame_type(frame[0]), size, timestamp);
                 save_if_sps_pps(frame, size);
                 break;
+            }
             case MJPEG:
                 SBL_MSG(MSG::SOURCE, "MJPEG source %d, frame size %d, ts %d", _stream_id, size, timestamp);
                 break;
@@ -53,6 +57,8 @@ public:
             default: 
                 SBL_THROW_IF(_playing, "Unknown encoder type");
         }
+        cache_frame(frame, size, timestamp);
+        record_frame(frame, size, timestamp);
         if (_playing) {
             streamer()->send_frame(frame, size, timestamp);
             SBL_MSG(MSG::SOURCE, "frame sent");
@@ -70,6 +76,8 @@ public:
         SBL_INFO("Tearing down stream %d", _stream_id);
         _playing = false; 
         application()->teardown(_stream_id);
+        if (gop_cache())
+            gop_cache()->invalidate();
     }
 
     //! Server must know if we are Live or FileSource
@@ -0,0 +1,232 @@
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <algorithm>
+#include <cstring>
+#include "rtsp_impl.h"
+#include "metrics.h"
+#include "buffer_writer.h"
+
+namespace RTSP {
+
+void Histogram::add(unsigned int value) {
+    int bucket = 0;
+    for (unsigned int bound = FIRST_BOUND; value >= bound && bucket < BUCKETS - 1; bound <<= 1)
+        bucket++;
+    _count[bucket].add(1);
+    _sum.add(value);
+}
+
+uint64_t Histogram::count() const {
+    uint64_t total = 0;
+    for (int n = 0; n < BUCKETS; n++)
+        total += count(n);
+    return total;
+}
+
+unsigned int Histogram::percentile(int percent) const {
+    uint64_t counts[BUCKETS];
+    uint64_t total = 0;
+    for (int n = 0; n < BUCKETS; n++)
+        total += counts[n] = count(n);
+    if (!total)
+        return 0;
+    uint64_t wanted = (total * percent + 99) / 100;
+    uint64_t below  = 0;
+    int n = 0;
+    for (; n < BUCKETS - 1; n++)
+        if ((below += counts[n]) >= wanted)
+            break;
+    return bound(n);
+}
+
+ClientMetrics::ClientMetrics(int id, const char* transport, StreamMetrics* stream) : id(id), transport(transport), stream(stream),
+        rtcp_reports(0), rtcp_fraction_lost(0), rtcp_lost(0), rtcp_jitter(0) {}
+
+void ClientMetrics::add(const SendStats& sent) {
+    if (sent.packets) {
+        frames.add(1);
+        packets.add(sent.packets);
+        bytes.add(sent.bytes);
+        stream->packets.add(sent.packets);
+        stream->bytes.add(sent.bytes);
+    }
+    if (sent.syscalls) {
+        syscalls.add(sent.syscalls);
+        stream->syscalls.add(sent.syscalls);
+    }
+    if (sent.would_block) {
+        would_block.add(sent.would_block);
+        stream->would_block.add(sent.would_block);
+    }
+    if (sent.partial_writes) {
+        partial_writes.add(sent.partial_writes);
+        stream->partial_writes.add(sent.partial_writes);
+    }
+}
+
+void ClientMetrics::drop_packets(unsigned int count) {
+    dropped_packets.add(count);
+    stream->dropped_packets.add(count);
+}
+
+void ClientMetrics::drop_frame() {
+    dropped_frames.add(1);
+    stream->dropped_frames.add(1);
+}
+
+void ClientMetrics::rtcp_report(uint32_t fraction_lost, int32_t cumulative_lost, uint32_t jitter) {
+    rtcp_fraction_lost = fraction_lost;
+    rtcp_lost          = cumulative_lost;
+    rtcp_jitter        = jitter;
+    rtcp_reports++;
+}
+
+Metrics& Metrics::registry() {
+    static Metrics metrics;
+    return metrics;
+}
+
+StreamMetrics* Metrics::add_stream(const char* name) {
+    StreamMetrics* stream = new StreamMetrics;
+    _lock.lock();
+    stream->name = name;
+    _streams.push_back(stream);
+    _lock.unlock();
+    return stream;
+}
+
+void Metrics::set_name(StreamMetrics* stream, const char* name) {
+    _lock.lock();
+    stream->name = name;
+    _lock.unlock();
+}
+
+void Metrics::remove_stream(StreamMetrics* stream) {
+    _lock.lock();
+    _streams.erase(std::remove(_streams.begin(), _streams.end(), stream), _streams.end());
+    _lock.unlock();
+    // clients left behind by the streamer are never deleted, nor are their counters used any more
+    for (unsigned int n = 0; n < stream->clients.size(); n++)
+        delete stream->clients[n];
+    delete stream;
+}
+
+ClientMetrics* Metrics::add_client(StreamMetrics* stream, int id, const char* transport) {
+    ClientMetrics* client = new ClientMetrics(id, transport, stream);
+    _lock.lock();
+    stream->clients.push_back(client);
+    _lock.unlock();
+    return client;
+}
+
+void Metrics::remove_client(ClientMetrics* client) {
+    std::vector<ClientMetrics*>& clients = client->stream->clients;
+    _lock.lock();
+    clients.erase(std::remove(clients.begin(), clients.end(), client), clients.end());
+    _lock.unlock();
+    delete client;
+}
+
+// streams without a source yet have no name, they are only printed in the full list
+StreamMetrics* Metrics::find(const char* name) const {
+    for (unsigned int n = 0; n < _streams.size(); n++)
+        if (_streams[n]->name == name)
+            return _streams[n];
+    return NULL;
+}
+
+bool Metrics::print(std::ostream& str, const char* name) {
+    _lock.lock();
+    StreamMetrics* found = name ? find(name) : NULL;
+    for (unsigned int n = 0; n < _streams.size(); n++) {
+        const StreamMetrics& stream = *_streams[n];
+        if (found && &stream != found)
+            continue;
+        write(str, stream);
+        for (unsigned int c = 0; c < stream.clients.size(); c++)
+            write(str, *stream.clients[c]);
+    }
+    _lock.unlock();
+    return found || !name;
+}
+
+bool Metrics::print(BufferWriter& writer, const char* name, int client_id) {
+    _lock.lock();
+    StreamMetrics* stream = find(name);
+    if (stream) {
+        write(writer, *stream);
+        for (unsigned int c = 0; c < stream->clients.size(); c++)
+            if (stream->clients[c]->id == client_id)
+                write(writer, *stream->clients[c]);
+    }
+    _lock.unlock();
+    return stream;
+}
+
+// Written the same way to a stream and to a BufferWriter; counters are cast, so that BufferWriter
+// has one 64 bit overload to pick, whatever uint64_t is
+template<class Writer>
+void Metrics::write(Writer& out, const StreamMetrics& stream) {
+    // receiver reports are per client, stream shows the total lost and the worst jitter
+    unsigned long long rtcp_lost = 0;
+    unsigned int       jitter    = 0;
+    for (unsigned int n = 0; n < stream.clients.size(); n++) {
+        const ClientMetrics& client = *stream.clients[n];
+        rtcp_lost += client.rtcp_lost > 0 ? (unsigned long long) client.rtcp_lost : 0;
+        jitter     = std::max(jitter, (unsigned int) client.rtcp_jitter);
+    }
+    const Histogram& latency = stream.send_latency;
+    uint64_t frames = latency.count();
+    out << "metrics stream="    << stream.name.c_str()
+        << " sessions="         << stream.sessions
+        << " frames_in="        << (unsigned long long) stream.frames_in.value()
+        << " frames_out="       << (unsigned long long) stream.frames_out.value()
+        << " packets="          << (unsigned long long) stream.packets.value()
+        << " bytes="            << (unsigned long long) stream.bytes.value()
+        << " syscalls="         << (unsigned long long) stream.syscalls.value()
+        << " would_block="      << (unsigned long long) stream.would_block.value()
+        << " partial_writes="   << (unsigned long long) stream.partial_writes.value()
+        << " dropped_packets="  << (unsigned long long) stream.dropped_packets.value()
+        << " dropped_frames="   << (unsigned long long) stream.dropped_frames.value()
+        << " rtcp_lost="        << rtcp_lost
+        << " rtcp_jitter_ms="   << jitter / 90
+        << " send_us_mean="     << (unsigned long long) (frames ? latency.sum() / frames : 0)
+        << " send_us_p50="      << latency.percentile(50)
+        << " send_us_p90="      << latency.percentile(90)
+        << " send_us_p99="      << latency.percentile(99)
+        << "\n";
+}
+
+template<class Writer>
+void Metrics::write(Writer& out, const ClientMetrics& client) {
+    out << "metrics client="    << client.id
+        << " stream="           << client.stream->name.c_str()
+        << " transport="        << client.transport
+        << " frames="           << (unsigned long long) client.frames.value()
+        << " packets="          << (unsigned long long) client.packets.value()
+        << " bytes="            << (unsigned long long) client.bytes.value()
+        << " syscalls="         << (unsigned long long) client.syscalls.value()
+        << " would_block="      << (unsigned long long) client.would_block.value()
+        << " partial_writes="   << (unsigned long long) client.partial_writes.value()
+        << " dropped_packets="  << (unsigned long long) client.dropped_packets.value()
+        << " dropped_frames="   << (unsigned long long) client.dropped_frames.value()
+        << " rtcp_reports="     << (unsigned int) client.rtcp_reports
+        << " rtcp_loss_pct="    << (unsigned int) client.rtcp_fraction_lost * 100 / 256
+        << " rtcp_lost="        << (int) client.rtcp_lost
+        << " rtcp_jitter_ms="   << (unsigned int) client.rtcp_jitter / 90
+        << "\n";
+}
+
+}
@@ -0,0 +1,164 @@
+#pragma once
+#ifndef _RTSP_METRICS_H
+#define _RTSP_METRICS_H
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <sbl/sbl_thread.h>
+
+namespace RTSP {
+
+class BufferWriter;
+
+//! Counter that is added to and read without a lock, from any thread
+class Counter {
+public:
+    Counter() : _value(0) {}
+    //! Add to the counter
+    void     add(uint64_t n)    { __sync_fetch_and_add(&_value, n); }
+    //! Current value, read in one piece even where 64 bits take two loads
+    uint64_t value() const      { return __sync_fetch_and_add(const_cast<volatile uint64_t*>(&_value), 0); }
+private:
+    volatile uint64_t _value;
+};
+
+//! Latency histogram with fixed, power of two buckets, so that adding is a few shifts and one atomic add
+/*! Bucket n holds values below bound(n), the last one holds everything else. */
+class Histogram {
+public:
+    enum {BUCKETS = 16, FIRST_BOUND = 64};
+    //! Count a value
+    void     add(unsigned int value);
+    //! Upper bound of a bucket
+    static unsigned int bound(int bucket) { return FIRST_BOUND << bucket; }
+    //! Values counted in a bucket
+    uint64_t count(int bucket) const { return _count[bucket].value(); }
+    //! Values counted in all buckets
+    uint64_t count() const;
+    //! Sum of the values, for the mean
+    uint64_t sum()   const { return _sum.value(); }
+    //! Upper bound of the bucket holding the given percentile, 0 if nothing was counted
+    unsigned int percentile(int percent) const;
+private:
+    Counter     _count[BUCKETS];
+    Counter     _sum;
+};
+
+//! What a client sent since the end of the previous frame, tallied without atomics by the thread sending
+struct SendStats {
+    unsigned int    packets;        //!< RTP packets handed to the socket or to the send queue
+    unsigned int    bytes;          //!< their bytes, interleaved prefix included
+    unsigned int    syscalls;       //!< send calls made
+    unsigned int    would_block;    //!< send calls that failed with EAGAIN
+    unsigned int    partial_writes; //!< send calls that took only a part of the data (TCP)
+    SendStats() { clear(); }
+    void clear() { packets = bytes = syscalls = would_block = partial_writes = 0; }
+    //! Add system call counters of another tally
+    void add_io(const SendStats& other) {
+        syscalls        += other.syscalls;
+        would_block     += other.would_block;
+        partial_writes  += other.partial_writes;
+    }
+};
+
+struct StreamMetrics;
+
+//! Counters of one client (or multicast group), owned by the registry so that they are read without the streamer
+struct ClientMetrics {
+    int             id;             //!< talker id, -1 for a multicast group
+    const char*     transport;      //!< "udp", "tcp" or "multicast"
+    StreamMetrics*  stream;         //!< stream client plays
+    Counter         frames;         //!< frames client got at least one packet of
+    Counter         packets;
+    Counter         bytes;
+    Counter         syscalls;
+    Counter         would_block;
+    Counter         partial_writes;
+    Counter         dropped_packets;//!< packets dropped because the client was too slow
+    Counter         dropped_frames; //!< frames missed while waiting for an I-frame after a drop
+    // latest receiver report, as the client sent it
+    volatile uint32_t rtcp_reports;
+    volatile uint32_t rtcp_fraction_lost;   //!< lost since the previous report, in 1/256
+    volatile int32_t  rtcp_lost;            //!< cumulative number of packets lost
+    volatile uint32_t rtcp_jitter;          //!< interarrival jitter, in timestamp units
+    ClientMetrics(int id, const char* transport, StreamMetrics* stream);
+    //! Add a frame worth of sending, to the client and its stream; call from the streaming thread
+    void add(const SendStats& sent);
+    //! Count packets dropped, may be called from any thread
+    void drop_packets(unsigned int count);
+    //! Count a frame the client missed
+    void drop_frame();
+    //! Take the numbers of a receiver report, call from the thread receiving RTCP
+    void rtcp_report(uint32_t fraction_lost, int32_t cumulative_lost, uint32_t jitter);
+};
+
+//! Counters of one stream, and of the clients playing it
+struct StreamMetrics {
+    std::string     name;
+    Counter         frames_in;      //!< frames streamer was given
+    Counter         frames_out;     //!< frames at least one client got a packet of
+    Counter         packets;        //!< packets of all clients
+    Counter         bytes;
+    Counter         syscalls;
+    Counter         would_block;
+    Counter         partial_writes;
+    Counter         dropped_packets;
+    Counter         dropped_frames;
+    Histogram       send_latency;   //!< time (us) to hand a frame to all clients, pacing included
+    volatile int    sessions;       //!< clients attached, every multicast member counted
+    std::vector<ClientMetrics*> clients;    // guarded by the registry lock
+    StreamMetrics() : sessions(0) {}
+};
+
+//! Registry of streaming metrics of all streams and their clients.
+/*! Counters are updated by the streaming threads without locking, mostly once per frame. Streams and
+    clients are added and removed under the registry lock, which is all readers take, so that querying
+    never holds up a Streamer or waits for one.\n
+    Output is one line of key=value pairs per stream, followed by a line per client. */
+class Metrics {
+public:
+    //! The registry of the process
+    static Metrics& registry();
+    //! Add a stream, counters stay valid until remove_stream()
+    StreamMetrics* add_stream(const char* name);
+    //! Name the stream, once its source is known
+    void           set_name(StreamMetrics* stream, const char* name);
+    //! Remove a stream, along with clients still in it
+    void           remove_stream(StreamMetrics* stream);
+    //! Add a client of a stream, counters stay valid until remove_client()
+    ClientMetrics* add_client(StreamMetrics* stream, int id, const char* transport);
+    //! Remove a client
+    void           remove_client(ClientMetrics* client);
+    //! Print metrics of the stream with the given name and of its clients, of all streams if name is NULL
+    // @return  false if there is no such stream
+    bool           print(std::ostream& str, const char* name = NULL);
+    //! Print metrics of a stream and of one of its clients (none if id is not found), without allocating
+    // @return  false if there is no such stream
+    bool           print(BufferWriter& writer, const char* name, int client_id);
+private:
+    SBL::Mutex                   _lock;
+    std::vector<StreamMetrics*>  _streams;
+
+    Metrics() {}
+    StreamMetrics* find(const char* name) const;
+    template<class Writer> static void write(Writer& out, const StreamMetrics& stream);
+    template<class Writer> static void write(Writer& out, const ClientMetrics& client);
+};
+
+}
+#endif
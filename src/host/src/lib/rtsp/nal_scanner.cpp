@@ -0,0 +1,131 @@
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <cstring>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include "nal_scanner.h"
+
+namespace RTSP {
+
+NalScanner::NalScanner(const uint8_t* data, size_t size) : _data(data), _end(data + size) {
+    _nal = find_start_code(_data, _end);
+    if (_nal != _end)
+        _nal += 3;
+}
+
+bool NalScanner::next(NalUnit& unit) {
+    while (_nal < _end) {
+        const uint8_t* nal  = _nal;
+        const uint8_t* stop = find_start_code(nal, _end);
+        _nal = stop == _end ? _end : stop + 3;
+        while (stop > nal && stop[-1] == 0)
+            stop--;
+        if (stop > nal) {
+            unit.offset = nal - _data;
+            unit.size   = stop - nal;
+            unit.header = nal[0];
+            return true;
+        }
+    }
+    return false;
+}
+
+void NalScanner::scan(const uint8_t* data, size_t size, std::vector<NalUnit>& units) {
+    NalScanner scanner(data, size);
+    NalUnit unit;
+    while (scanner.next(unit))
+        units.push_back(unit);
+}
+
+// Start code ends with 01, which is rare in compressed data (emulation prevention keeps 00 00 01 out of it),
+// so each block is first checked for 01 bytes, and only then for the two zeros before them.
+// Vector loops look for start codes beginning in [p, p + 64), reading up to p + 66.
+const uint8_t* NalScanner::find_start_code(const uint8_t* p, const uint8_t* end) {
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one  = _mm256_set1_epi8(1);
+    for (; p + 66 <= end; p += 64) {
+        __m256i ones0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (p + 2)), one);
+        __m256i ones1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (p + 34)), one);
+        if (_mm256_testz_si256(_mm256_or_si256(ones0, ones1), _mm256_or_si256(ones0, ones1)))
+            continue;
+        uint64_t mask = (uint32_t) _mm256_movemask_epi8(ones0) | (uint64_t) (uint32_t) _mm256_movemask_epi8(ones1) << 32;
+        for (int n = 0; n < 64; n += 32) {
+            __m256i zeros = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (p + n)), zero),
+                                             _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (p + n + 1)), zero));
+            mask &= ~((uint64_t) (uint32_t) ~_mm256_movemask_epi8(zeros) << n);
+        }
+        if (mask)
+            return p + __builtin_ctzll(mask);
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one  = _mm_set1_epi8(1);
+    for (; p + 66 <= end; p += 64) {
+        __m128i ones0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (p + 2)), one);
+        __m128i ones1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (p + 18)), one);
+        __m128i ones2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (p + 34)), one);
+        __m128i ones3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (p + 50)), one);
+        if (!_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(ones0, ones1), _mm_or_si128(ones2, ones3))))
+            continue;
+        uint64_t mask = (uint64_t) _mm_movemask_epi8(ones0)       | (uint64_t) _mm_movemask_epi8(ones1) << 16
+                      | (uint64_t) _mm_movemask_epi8(ones2) << 32 | (uint64_t) _mm_movemask_epi8(ones3) << 48;
+        for (int n = 0; n < 64; n += 16) {
+            __m128i zeros = _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (p + n)), zero),
+                                          _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (p + n + 1)), zero));
+            mask &= ~((uint64_t) (~_mm_movemask_epi8(zeros) & 0xffff) << n);
+        }
+        if (mask)
+            return p + __builtin_ctzll(mask);
+    }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    // NEON has no movemask, blocks with a 01 byte are checked byte by byte
+    const uint8x16_t one = vdupq_n_u8(1);
+    for (; p + 18 <= end; p += 16) {
+        uint8x16_t ones = vceqq_u8(vld1q_u8(p + 2), one);
+        uint64x2_t any  = vreinterpretq_u64_u8(ones);
+        if (!(vgetq_lane_u64(any, 0) | vgetq_lane_u64(any, 1)))
+            continue;
+        for (int n = 0; n < 16; n++)
+            if (p[n + 2] == 1 && p[n + 1] == 0 && p[n] == 0)
+                return p + n;
+    }
+#endif
+    // what is left, or all of it without vector instructions
+    for (p += 2; p < end && (p = (const uint8_t*) memchr(p, 1, end - p)) != NULL; p++) {
+        if (p[-1] == 0 && p[-2] == 0)
+            return p - 2;
+    }
+    return end;
+}
+
+const char* NalScanner::implementation() {
+#if defined(__AVX2__)
+    return "avx2";
+#elif defined(__SSE2__)
+    return "sse2";
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    return "neon";
+#else
+    return "memchr";
+#endif
+}
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+#ifndef _RTSP_NAL_SCANNER_H
+#define _RTSP_NAL_SCANNER_H
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+
+namespace RTSP {
+
+//! NAL unit found in a buffer
+struct NalUnit {
+    size_t      offset;     //!< offset of the NAL header in the buffer, past the start code
+    uint32_t    size;       //!< NAL unit size, without the start code and trailing zeros
+    uint8_t     header;     //!< NAL unit header (first byte)
+    //! nal_unit_type
+    int type() const { return header & 0x1f; }
+};
+
+//! Finds NAL units in H.264 Annex B byte stream.
+/*! Start codes are 00 00 01; zeros before them (00 00 00 01, trailing_zero_8bits) end the previous NAL unit.
+    Bytes before the first start code are skipped. Search is done 64 bytes at a time with SSE2 or AVX2,
+    16 with NEON, whichever the compiler targets, and with memchr() for the 01 byte elsewhere. */
+class NalScanner {
+public:
+    //! Scanner of size bytes of data
+    NalScanner(const uint8_t* data, size_t size);
+    //! Find the next NAL unit, return false at the end of data
+    bool next(NalUnit& unit);
+
+    //! Find all NAL units in data, in one pass, appending them to units
+    static void scan(const uint8_t* data, size_t size, std::vector<NalUnit>& units);
+    //! Find the first start code (00 00 01) in [p, end), return pointer to its first byte or end
+    static const uint8_t* find_start_code(const uint8_t* p, const uint8_t* end);
+    //! Size of the start code data begins with, 3 or 4; 0 if there is none
+    static int start_code_size(const uint8_t* data, int size) {
+        if (size >= 3 && data[0] == 0 && data[1] == 0) {
+            if (data[2] == 1)
+                return 3;
+            if (size >= 4 && data[2] == 0 && data[3] == 1)
+                return 4;
+        }
+        return 0;
+    }
+    //! Instruction set the scanner was built for
+    static const char* implementation();
+private:
+    const uint8_t*  _data;
+    const uint8_t*  _end;
+    const uint8_t*  _nal;   // next NAL unit, past its start code
+};
+
+}
+#endif
@@ -0,0 +1,73 @@
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <cerrno>
+#include <ctime>
+#include <sbl/sbl_logger.h>
+#include "rtsp_impl.h"
+#include "pacer.h"
+
+namespace {
+const uint64_t ONE_SECOND = 1000ULL * 1000 * 1000;
+}
+
+namespace RTSP {
+
+uint64_t Pacer::transfer(int size) const {
+    return _rate > 0 ? size * ONE_SECOND / _rate : 0;
+}
+
+uint64_t Pacer::schedule(int size) {
+    if (!is_enabled())
+        return 0;
+    uint64_t current = now();
+    uint64_t start   = current;
+    // bucket drains at the target rate, idle time is not saved up
+    if (_due < current)
+        _due = current;
+    uint64_t fits = _due + transfer(size);
+    if (_rate > 0 && fits > current + transfer(_burst))
+        start = fits - transfer(_burst);
+    // gap is counted from when the previous packet was due, so oversleeping is made up
+    if (_next > start)
+        start = _next;
+    _due  = fits;
+    _next = start + _gap;
+    return start > current ? start : 0;
+}
+
+void Pacer::wait(int size) {
+    uint64_t start = schedule(size);
+    if (start) {
+        SBL_MSG(MSG::STREAMER, "Pacing, waiting %d ns", int(start - now()));
+        sleep_until(start);
+    }
+}
+
+uint64_t Pacer::now() {
+    struct timespec now;
+    if (::clock_gettime(CLOCK_MONOTONIC, &now) != 0)
+        SBL_ERROR("clock_gettime failed");
+    return now.tv_sec * ONE_SECOND + now.tv_nsec;
+}
+
+void Pacer::sleep_until(uint64_t time) {
+    struct timespec until;
+    until.tv_sec  = time / ONE_SECOND;
+    until.tv_nsec = time % ONE_SECOND;
+    while (::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR)
+        ;
+}
+
+}
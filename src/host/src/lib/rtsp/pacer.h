@@ -0,0 +1,61 @@
+#pragma once
+#ifndef _RTSP_PACER_H
+#define _RTSP_PACER_H
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <stdint.h>
+
+namespace RTSP {
+
+//! Token bucket that spaces out RTP packets.
+/*! Two limits, both optional: a fixed gap between packets, and a target rate, at which up to burst
+    bytes may go out back to back. When a packet can't go right away, schedule() returns the
+    CLOCK_MONOTONIC time when it is due, and wait() sleeps until then. Time not used while idle is
+    not saved up beyond the burst, and oversleeping is made up by sending the next packets sooner.\n
+    Pacer is not thread safe, it belongs to a single Streamer or Client. */
+class Pacer {
+public:
+    //! Pacer constructor, pacing is off until set() is called
+    Pacer() : _gap(0), _rate(0), _burst(0), _due(0), _next(0) {}
+    //! Set pacing parameters, they may change at any time
+    // @param   gap     nanoseconds between packets, 0 for none
+    // @param   rate    target rate in bytes per second, 0 for none
+    // @param   burst   bytes that may be sent without waiting, when pacing to rate
+    void set(int gap, int rate, int burst) { _gap = gap; _rate = rate; _burst = burst; }
+    //! Take pacing parameters of another pacer, but keep own schedule
+    void set(const Pacer& pacer) { set(pacer._gap, pacer._rate, pacer._burst); }
+    //! Return true if either gap or rate is set
+    bool is_enabled() const { return _gap > 0 || _rate > 0; }
+    //! Reserve time for a packet of a given size, return when it may go out, or 0 for now
+    uint64_t schedule(int size);
+    //! Wait until a packet of a given size may go out
+    void wait(int size);
+    //! Return CLOCK_MONOTONIC time in nanoseconds
+    static uint64_t now();
+    //! Sleep until given CLOCK_MONOTONIC time in nanoseconds
+    static void sleep_until(uint64_t time);
+private:
+    int         _gap;
+    int         _rate;
+    int         _burst;
+    uint64_t    _due;       // when all packets scheduled so far would be out, sent at the target rate
+    uint64_t    _next;      // earliest start of the next packet, a gap after the previous one
+
+    // time needed to send a given number of bytes at the target rate
+    uint64_t transfer(int size) const;
+};
+
+}
+#endif
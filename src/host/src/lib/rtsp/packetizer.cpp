@@ -0,0 +1,404 @@
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include "packetizer.h"
+
+/*
+      RTP header according to RFC 3550
+       0                   1                   2                   3
+       0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+      +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+      |V=2|P|X|  CC   |M|     PT      |       sequence number         |
+      +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+      |                           timestamp                           |
+      +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+      |           synchronization source (SSRC) identifier            |
+      +=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
+   Marker bit (M): 1 bit
+      Set for the very last packet of the access unit indicated by the
+      RTP timestamp, in line with the normal use of the M bit in video
+      formats, to allow an efficient playout buffer handling.  For
+      aggregation packets (STAP and MTAP), the marker bit in the RTP
+      header MUST be set to the value that the marker bit of the last
+      NAL unit of the aggregation packet would have been if it were
+      transported in its own RTP packet.  Decoders MAY use this bit as
+      an early indication of the last packet of an access unit but MUST
+      NOT rely on this property.
+
+         Informative note: Only one M bit is associated with an
+         aggregation packet carrying multiple NAL units.  Thus, if a
+         gateway has re-packetized an aggregation packet into several
+         packets, it cannot reliably set the M bit of those packets.
+
+   Payload type (PT): 7 bits
+      The assignment of an RTP payload type for this new packet format
+      is outside the scope of this document and will not be specified
+      here.  The assignment of a payload type has to be performed either
+      through the profile used or in a dynamic way.
+
+   Sequence number (SN): 16 bits
+      Set and used in accordance with RFC 3550.  For the single NALU and
+      non-interleaved packetization mode, the sequence number is used to
+      determine decoding order for the NALU.
+
+   Timestamp: 32 bits
+      The RTP timestamp is set to the sampling timestamp of the content.
+      A 90 kHz clock rate MUST be used.
+
+      If the NAL unit has no timing properties of its own (e.g.,
+      parameter set and SEI NAL units), the RTP timestamp is set to the
+      RTP timestamp of the primary coded picture of the access unit in
+      which the NAL unit is included, according to Section 7.4.1.2 of
+      [1].
+
+
+    RTP payload format for single NAL unit packet.
+     0                   1                   2                   3
+     0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+    |F|NRI|  Type   |                                               |
+    +-+-+-+-+-+-+-+-+                                               |
+    |                                                               |
+    |               Bytes 2..n of a single NAL unit                 |
+    |                                                               |
+    |                               +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+    |                               :...OPTIONAL RTP padding        |
+    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+
+   RTP payload format for FU-As (Fragmented Unit A).  An FU-A
+   consists of a fragmentation unit indicator of one octet, a
+   fragmentation unit header of one octet, and a fragmentation unit
+   payload.
+
+     0                   1                   2                   3
+     0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+    | FU indicator  |   FU header   |                               |
+    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+                               |
+    |                                                               |
+    |                         FU payload                            |
+    |                                                               |
+    |                               +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+    |                               :...OPTIONAL RTP padding        |
+    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+   The FU indicator octet has the following format:
+
+       +---------------+
+       |0|1|2|3|4|5|6|7|
+       +-+-+-+-+-+-+-+-+
+       |F|NRI|  Type   |
+       +---------------+
+
+   Values equal to 28 and 29 in the type field of the FU indicator octet
+   identify an FU-A and an FU-B, respectively.  The use of the F bit is
+   described in Section 5.3.  The value of the NRI field MUST be set
+   according to the value of the NRI field in the fragmented NAL unit.
+
+   The FU header has the following format:
+
+      +---------------+
+      |0|1|2|3|4|5|6|7|
+      +-+-+-+-+-+-+-+-+
+      |S|E|R|  Type   |
+      +---------------+
+
+   S:     1 bit
+          When set to one, the Start bit indicates the start of a
+          fragmented NAL unit.  When the following FU payload is not the
+          start of a fragmented NAL unit payload, the Start bit is set
+          to zero.
+
+   E:     1 bit
+          When set to one, the End bit indicates the end of a fragmented
+          NAL unit, i.e., the last byte of the payload is also the last
+          byte of the fragmented NAL unit.  When the following FU
+          payload is not the last fragment of a fragmented NAL unit, the
+          End bit is set to zero.
+
+   R:     1 bit
+          The Reserved bit MUST be equal to 0 and MUST be ignored by the
+          receiver.
+
+   Type:  5 bits
+          The NAL unit payload type as defined in Table 7-1 of [1].
+*/
+
+namespace RTSP {
+
+Packetizer::Packetizer(int packet_size, uint32_t ssrc, bool aggregate) :
+        _packet_size(packet_size), _ssrc(ssrc), _payload_type(0), _timestamp(0), _seq_number(0), _first_nal(0),
+        _aggregate(aggregate), _held_count(0), _held_nal(0), _held_flags(0), _held_marker(false), _held_timestamp(0) {
+    _held.reserve(packet_size);
+    _sent.reserve(packet_size);
+}
+
+void Packetizer::begin(int payload_type, uint32_t timestamp, uint16_t seq_number) {
+    _payload_type = payload_type;
+    _seq_number   = seq_number;
+    _first_nal    = 0;
+    _packets.clear();
+    // held NAL units belong to the previous access unit, they can't wait for this one
+    if (_held_count && _held_timestamp != timestamp) {
+        _timestamp = _held_timestamp;
+        flush();
+    }
+    _timestamp    = timestamp;
+}
+
+/*
+   Section 10.12 of RFC 2326
+   Stream data such as RTP packets is encapsulated by an ASCII dollar
+   sign (24 hexadecimal), followed by a one-byte channel identifier,
+   followed by the length of the encapsulated binary data as a binary,
+   two-byte integer in network byte order. The stream data follows
+   immediately afterwards, without a CRLF, but including the upper-layer
+   protocol headers. Each $ block contains exactly one upper-layer
+   protocol data unit, e.g., one RTP packet.
+*/
+Packet& Packetizer::add(const uint8_t* payload, int payload_size, int payload_header_size, bool marker) {
+    _packets.resize(_packets.size() + 1);
+    Packet& packet = _packets.back();
+    packet.header_size  = Packet::RTP_HEADER + payload_header_size;
+    packet.payload      = payload;
+    packet.payload_size = payload_size;
+    packet.last         = false;
+
+    int size = packet.size();
+    packet.header[0] = '$';
+    packet.header[1] = 0;
+    packet.header[2] = size >> 8;
+    packet.header[3] = size;
+
+    uint8_t* rtp = packet.rtp_header();
+    rtp[0]  = RTP_VERSION_NUMBER << 6;
+    rtp[1]  = (marker ? 0x80 : 0) | _payload_type;
+    rtp[2]  = _seq_number >> 8;
+    rtp[3]  = _seq_number;
+    rtp[4]  = _timestamp >> 24;
+    rtp[5]  = _timestamp >> 16;
+    rtp[6]  = _timestamp >> 8;
+    rtp[7]  = _timestamp;
+    rtp[8]  = _ssrc >> 24;
+    rtp[9]  = _ssrc >> 16;
+    rtp[10] = _ssrc >> 8;
+    rtp[11] = _ssrc;
+    _seq_number++;
+    return packet;
+}
+
+/*
+   RTP payload format for STAP-A (Single-Time Aggregation Packet), RFC 6184, 5.7.1
+
+     0                   1                   2                   3
+     0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+    |                          RTP Header                           |
+    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+    |STAP-A NAL HDR |         NALU 1 Size           | NALU 1 HDR    |
+    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+    |                         NALU 1 Data                           |
+    :                                                               :
+    +               +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+    |               | NALU 2 Size                   | NALU 2 HDR    |
+    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+    |                         NALU 2 Data                           |
+    :                                                               :
+    |                               +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+    |                               :...OPTIONAL RTP padding        |
+    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+   The value of F bit MUST be 0 if all F bits of the aggregated NAL units are zero; otherwise,
+   it MUST be 1. The value of NRI MUST be the maximum of all the NAL units carried in the
+   aggregation packet.
+*/
+bool Packetizer::hold(const uint8_t* nal, int size, bool marker) {
+    if (STAP_A_HEADER + int(_held.size()) + NALU_SIZE + size > _packet_size)
+        return false;
+    if (_held_count == 0) {
+        _held_nal       = nal[0];
+        _held_flags     = 0;
+        _held_timestamp = _timestamp;
+    }
+    _held.push_back(size >> 8);
+    _held.push_back(size);
+    _held.insert(_held.end(), nal, nal + size);
+    uint8_t nri = nal[0] & NAL_NRI_MASK;
+    _held_flags = (_held_flags | (nal[0] & NAL_F_BIT))
+                | (nri > (_held_flags & NAL_NRI_MASK) ? nri : _held_flags & NAL_NRI_MASK);
+    _held_marker = marker;
+    _held_count++;
+    return true;
+}
+
+void Packetizer::flush() {
+    if (_held_count == 0)
+        return;
+    // packets point into _sent, so _held can take new NAL units right away
+    _held.swap(_sent);
+    _held.clear();
+    if (_packets.empty())
+        _first_nal = _held_nal;
+    if (_held_count == 1) {
+        add(&_sent[NALU_SIZE], _sent.size() - NALU_SIZE, 0, _held_marker);
+    } else {
+        uint8_t* header = add(&_sent[0], _sent.size(), STAP_A_HEADER, _held_marker).rtp_header();
+        header[Packet::RTP_HEADER] = _held_flags | NAL_TYPE_STAP_A;
+    }
+    _held_count = 0;
+}
+
+void Packetizer::h264(const uint8_t* nal, int size, bool last_slice) {
+    int  type          = nal[0] & NAL_TYPE_MASK;
+    // marker bit goes on the last packet of an access unit, which ends with its last slice
+    bool marker        = type >= NAL_SLICE && type <= NAL_IDR && last_slice;
+    bool non_vcl       = type == NAL_SPS || type == NAL_PPS || type == NAL_SEI || type == NAL_AUD;
+    if (_aggregate && non_vcl) {
+        // wait for the rest of the access unit, start over if it doesn't fit with the held ones
+        if (!hold(nal, size, marker)) {
+            flush();
+            if (!hold(nal, size, marker))
+                h264_single(nal, size, marker);
+        }
+    } else if (_held_count && hold(nal, size, marker)) {
+        // small picture goes out together with held NAL units
+        flush();
+    } else {
+        flush();
+        h264_single(nal, size, marker);
+    }
+    if (!_packets.empty())
+        _packets.back().last = true;
+}
+
+void Packetizer::h264_single(const uint8_t* nal, int size, bool marker) {
+    int  type          = nal[0] & NAL_TYPE_MASK;
+    if (_packets.empty())
+        _first_nal = nal[0];
+    if (size <= _packet_size) {
+        add(nal, size, 0, marker);
+    } else {
+        // FU indicator and FU header replace the NAL header, which is not sent
+        uint8_t fu_indicator = (nal[0] & ~NAL_TYPE_MASK) | NAL_TYPE_FU_A;
+        uint8_t fu_header    = type | NAL_START_BIT;
+        const uint8_t* payload = nal + 1;
+        int remaining = size - 1;
+        while (remaining > 0) {
+            int  chunk = remaining < _packet_size ? remaining : _packet_size;
+            bool last  = chunk == remaining;
+            // Start and End bits can't be both set, split the fragment in two
+            if (last && (fu_header & NAL_START_BIT)) {
+                chunk /= 2;
+                last = false;
+            }
+            if (last)
+                fu_header |= NAL_END_BIT;
+            uint8_t* header = add(payload, chunk, FU_INDICATOR + FU_HEADER, last && marker).rtp_header();
+            header[Packet::RTP_HEADER]     = fu_indicator;
+            header[Packet::RTP_HEADER + 1] = fu_header;
+            fu_header &= ~NAL_START_BIT;
+            payload   += chunk;
+            remaining -= chunk;
+        }
+    }
+}
+
+void Packetizer::mpeg4(const uint8_t* frame, int size) {
+    bool starter = size > 3 && frame[3] == MPEG4_VOS;
+    if (size <= _packet_size) {
+        add(frame, size, 0, !starter);
+    } else {
+        for (int offset = 0; offset < size; offset += _packet_size) {
+            int chunk = size - offset < _packet_size ? size - offset : _packet_size;
+            add(frame + offset, chunk, 0, offset + chunk == size);
+        }
+    }
+    _packets.back().last = true;
+}
+
+/*
+    JPEG Header, RFC 2435
+
+    0                   1                   2                   3
+    0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+   | Type-specific |              Fragment Offset                  |
+   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+   |      Type     |       Q       |     Width     |     Height    |
+   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+Type-specific: 8 bits
+
+   Interpretation depends on the value of the type field.  If no
+   interpretation is specified, this field MUST be zeroed on
+   transmission and ignored on reception.
+
+Fragment Offset: 24 bits
+   The Fragment Offset is the offset in bytes of the current packet in
+   the JPEG frame data. This value is encoded in network byte order
+   (most significant byte first). The Fragment Offset plus the length of
+   the payload data in the packet MUST NOT exceed 2^24 bytes.
+
+Type: 8 bits
+   The type field specifies the information that would otherwise be
+   present in a JPEG abbreviated table-specification as well as the
+   additional JFIF-style parameters not defined by JPEG.  Types 0-63 are
+   reserved as fixed, well-known mappings to be defined by this document
+   and future revisions of this document.  Types 64-127 are the same as
+   types 0-63, except that restart markers are present in the JPEG data
+   and a Restart Marker header appears immediately following the main
+   JPEG header.  Types 128-255 are free to be dynamically defined by a
+   session setup protocol (which is beyond the scope of this document).
+
+Q: 8 bits
+   The Q field defines the quantization tables for this frame.  Q values
+   0-127 indicate the quantization tables are computed using an
+   algorithm determined by the Type field (see below).  Q values 128-255
+   indicate that a Quantization Table header appears after the main JPEG
+   header (and the Restart Marker header, if present) in the first
+   packet of the frame (fragment offset 0).  This header can be used to
+   explicitly specify the quantization tables in-band.
+
+Width: 8 bits
+   This field encodes the width of the image in 8-pixel multiples (e.g.,
+   a width of 40 denotes an image 320 pixels wide).  The maximum width
+   is 2040 pixels.
+
+Height: 8 bits
+   This field encodes the height of the image in 8-pixel multiples
+   (e.g., a height of 30 denotes an image 240 pixels tall). When
+   encoding interlaced video, this is the height of a video field, since
+   fields are individually JPEG encoded. The maximum height is 2040
+   pixels.
+*/
+void Packetizer::mjpeg(const uint8_t* frame, int size, int quality, int width, int height) {
+    int offset = 0;
+    do {
+        int chunk = size - offset < _packet_size ? size - offset : _packet_size;
+        uint8_t* header = add(frame + offset, chunk, MJPEG_HEADER, offset + chunk == size).rtp_header()
+                          + Packet::RTP_HEADER;
+        header[0] = 0;
+        header[1] = offset >> 16;
+        header[2] = offset >> 8;
+        header[3] = offset;
+        header[4] = MJPEG_TYPE;
+        header[5] = quality;
+        header[6] = width  / 8;
+        header[7] = height / 8;
+        offset += chunk;
+    } while (offset < size);
+    _packets.back().last = true;
+}
+
+}
@@ -0,0 +1,134 @@
+#pragma once
+#ifndef _RTSP_PACKETIZER_H
+#define _RTSP_PACKETIZER_H
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <stdint.h>
+#include <vector>
+
+namespace RTSP {
+
+//! Descriptor of a single RTP packet.
+/*! Header is built by Packetizer, payload points into the frame, which is never written to.
+    Header is preceded by RFC 2326 interleaved prefix ('$', channel, size), so that TCP clients
+    can send it as is and UDP clients just skip it. */
+struct Packet {
+    //! Sizes and offsets
+    enum {PREFIX        = 4,                //!< interleaved prefix size
+          RTP_HEADER    = 12,               //!< RTP header size
+          RTP_SEQ_NUM   = 2,                //!< offset of sequence number in RTP header
+          MAX_HEADER    = RTP_HEADER + 8    //!< RTP header and the largest payload header (MJPEG)
+         };
+    uint8_t         header[PREFIX + MAX_HEADER];    //!< interleaved prefix, RTP header and payload header
+    int             header_size;    //!< RTP header and payload header size, without prefix
+    const uint8_t*  payload;        //!< payload, in the frame
+    int             payload_size;   //!< payload size
+    bool            last;           //!< true for the last packet of the frame
+    //! RTP header
+    uint8_t*        rtp_header()    { return header + PREFIX; }
+    //! RTP packet size
+    int             size() const    { return header_size + payload_size; }
+};
+
+//! Packets of one frame
+typedef std::vector<Packet> Packets;
+
+//! Cuts a frame into RTP packets, without copying or modifying it.
+/*! Packet list is rebuilt for each frame, but its memory is reused, so there is no
+    allocation once the largest frame went thru.\n
+    All packets stay valid, and point into the frame, until the next begin().\n
+    With aggregation on, small SPS, PPS, SEI and AUD NAL units are not sent on their own, but copied
+    and held until the next NAL unit of the same access unit, which then goes out with them in one
+    STAP-A packet (RFC 6184, 5.7.1). */
+class Packetizer {
+public:
+    //! Packetizer constructor
+    // @param   packet_size  maximum payload per packet
+    // @param   ssrc         synchronization source for all packets
+    // @param   aggregate    aggregate small non-VCL H.264 NAL units into STAP-A packets
+    Packetizer(int packet_size, uint32_t ssrc, bool aggregate = false);
+    //! Start a new frame, its packets get consecutive sequence numbers starting with seq_number
+    /*! NAL units held from an earlier access unit (different timestamp) are flushed into this frame's packets */
+    void begin(int payload_type, uint32_t timestamp, uint16_t seq_number);
+    //! Packetize H.264 NAL unit (without start code), as single NAL unit packet, STAP-A or FU-A fragments (RFC 6184)
+    /*! May produce no packets at all, if the NAL unit is held for aggregation. Marker bit goes on the last
+        packet of a slice (VCL NAL unit) that is the last one of its picture.
+        @param  last_slice  no more slices of the picture follow, false for all but the last slice */
+    void h264 (const uint8_t* nal, int size, bool last_slice = true);
+    //! Packetize MPEG4 frame (RFC 3016)
+    void mpeg4(const uint8_t* frame, int size);
+    //! Packetize JPEG frame (RFC 2435)
+    // @param   quality, width, height  go to JPEG header, width and height are in pixels
+    void mjpeg(const uint8_t* frame, int size, int quality, int width, int height);
+    //! Packets of the current frame
+    const Packets& packets() const { return _packets; }
+    //! Maximum payload per packet
+    int  packet_size() const { return _packet_size; }
+    //! NAL unit header of the first NAL unit carried by the current packets (H.264 only)
+    uint8_t first_nal() const { return _first_nal; }
+    //! True if there are NAL units held for aggregation
+    bool has_held() const { return _held_count > 0; }
+private:
+    enum {FU_INDICATOR  = 1,        // size of FU-A Indicator in bytes
+          FU_HEADER     = 1,        // size of FU-A Header in bytes
+          MJPEG_HEADER  = 8,
+          MJPEG_TYPE    = 1,
+          NAL_SLICE     = 1,        // VCL NAL unit types are NAL_SLICE to NAL_IDR
+          NAL_IDR       = 5,
+          NAL_SPS       = 7,
+          NAL_PPS       = 8,
+          NAL_SEI       = 6,
+          NAL_AUD       = 9,
+          NAL_TYPE_STAP_A = 24,     // Single-Time Aggregation Packet
+          STAP_A_HEADER = 1,        // STAP-A NAL unit header
+          NALU_SIZE     = 2,        // size field preceding each NAL unit in STAP-A
+          NAL_F_BIT     = 0x80,     // forbidden_zero_bit
+          NAL_NRI_MASK  = 0x60,
+          NAL_TYPE_FU_A = 28,       // Fragmentation Unit A
+          NAL_TYPE_MASK = 0x1F,     // Mask to get NAL Type from NAL Header (5 bits)
+          NAL_START_BIT = 1 << 7,   // Start and End bit in FU Header
+          NAL_END_BIT   = 1 << 6,
+          MPEG4_VOS     = 0xB0,     // visual object sequence start code
+          RTP_VERSION_NUMBER = 2
+         };
+    int         _packet_size;
+    uint32_t    _ssrc;
+    int         _payload_type;
+    uint32_t    _timestamp;
+    uint16_t    _seq_number;        // sequence number of the next packet
+    Packets     _packets;
+    uint8_t     _first_nal;
+    // aggregation
+    bool                 _aggregate;
+    std::vector<uint8_t> _held;             // held NAL units, each preceded by its size, as in STAP-A
+    std::vector<uint8_t> _sent;             // previously held NAL units, referenced by current packets
+    int                  _held_count;
+    uint8_t              _held_nal;         // header of the first held NAL unit
+    uint8_t              _held_flags;       // F bit and the highest NRI of held NAL units
+    bool                 _held_marker;      // marker bit of the last held NAL unit
+    uint32_t             _held_timestamp;
+
+    // Append a packet, write its prefix and RTP header. Payload header is left to the caller.
+    Packet& add(const uint8_t* payload, int payload_size, int payload_header_size, bool marker);
+    // Copy NAL unit to held ones, if it is small enough to share a STAP-A packet with them
+    bool hold(const uint8_t* nal, int size, bool marker);
+    // Send held NAL units, as STAP-A if there is more than one
+    void flush();
+    // Single NAL unit packet or FU-A fragments
+    void h264_single(const uint8_t* nal, int size, bool marker);
+};
+
+}
+#endif
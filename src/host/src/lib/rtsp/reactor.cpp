@@ -0,0 +1,212 @@
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <ctime>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sbl/sbl_exception.h>
+#include <sbl/sbl_logger.h>
+#include "rtsp_impl.h"
+#include "reactor.h"
+
+namespace RTSP {
+
+Reactor::Reactor(int id) : _id(id), _epoll(-1), _handler_count(0) {
+    _epoll = ::epoll_create(MAX_EVENTS);
+    SBL_PERROR(_epoll < 0);
+    SBL_PERROR(::pipe(_wakeup) != 0);
+    for (int n = 0; n < 2; n++)
+        SBL_PERROR(::fcntl(_wakeup[n], F_SETFL, O_NONBLOCK) != 0);
+    struct epoll_event event;
+    memset(&event, 0, sizeof event);
+    event.events   = EPOLLIN;
+    event.data.ptr = NULL;
+    SBL_PERROR(::epoll_ctl(_epoll, EPOLL_CTL_ADD, _wakeup[0], &event) != 0);
+    SBL_MSG(MSG::SERVER, "Created reactor %d", id);
+}
+
+Reactor::~Reactor() {
+    ::close(_epoll);
+    ::close(_wakeup[0]);
+    ::close(_wakeup[1]);
+}
+
+void Reactor::add(Handler* handler) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof event);
+    event.events   = EPOLLIN;
+    event.data.ptr = handler;
+    SBL_PERROR(::epoll_ctl(_epoll, EPOLL_CTL_ADD, handler->fd(), &event) != 0);
+    __sync_fetch_and_add(&_handler_count, 1);
+    SBL_MSG(MSG::SERVER, "Reactor %d, added handler %p for socket %d", _id, handler, handler->fd());
+}
+
+void Reactor::remove(Handler* handler) {
+    if (is_removed(handler))
+        return;
+    // kernel drops closed sockets on its own, so ignore errors here
+    struct epoll_event event;
+    ::epoll_ctl(_epoll, EPOLL_CTL_DEL, handler->fd(), &event);
+    cancel_timer(handler);
+    _removed.push_back(handler);
+    __sync_fetch_and_sub(&_handler_count, 1);
+    SBL_MSG(MSG::SERVER, "Reactor %d, removed handler %p for socket %d", _id, handler, handler->fd());
+}
+
+void Reactor::watch(Handler* handler, bool readable, bool writable) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof event);
+    event.events   = (readable ? EPOLLIN : 0) | (writable ? EPOLLOUT : 0);
+    event.data.ptr = handler;
+    SBL_PERROR(::epoll_ctl(_epoll, EPOLL_CTL_MOD, handler->fd(), &event) != 0);
+}
+
+bool Reactor::is_removed(Handler* handler) const {
+    return std::find(_removed.begin(), _removed.end(), handler) != _removed.end();
+}
+
+void Reactor::set_timer(Handler* handler, int ms) {
+    cancel_timer(handler);
+    Timer timer = {handler, now_ms() + ms};
+    _timers.push_back(timer);
+}
+
+void Reactor::cancel_timer(Handler* handler) {
+    for (unsigned int n = 0; n < _timers.size(); n++)
+        if (_timers[n].handler == handler) {
+            _timers.erase(_timers.begin() + n);
+            return;
+        }
+}
+
+// Pipe has room for plenty of bytes, if it is full the reactor is woken up anyway
+void Reactor::wake(Handler* handler) {
+    _wake_lock.lock();
+    if (std::find(_woken.begin(), _woken.end(), handler) == _woken.end())
+        _woken.push_back(handler);
+    _wake_lock.unlock();
+    char byte = 0;
+    if (::write(_wakeup[1], &byte, 1) < 0 && errno != EAGAIN)
+        SBL_WARN("Reactor %d, unable to wake up: %s", _id, strerror(errno));
+}
+
+void Reactor::wakeup() {
+    char buffer[64];
+    while (::read(_wakeup[0], buffer, sizeof buffer) > 0)
+        ;
+    std::vector<Handler*> woken;
+    _wake_lock.lock();
+    woken.swap(_woken);
+    _wake_lock.unlock();
+    for (std::vector<Handler*>::iterator it = woken.begin(); it != woken.end(); ++it)
+        if (!is_removed(*it))
+            call(*it, WAKEUP);
+}
+
+// Handler is deleted, wake() may have been called for it after it was removed, but not any more
+void Reactor::forget_woken(Handler* handler) {
+    _wake_lock.lock();
+    _woken.erase(std::remove(_woken.begin(), _woken.end(), handler), _woken.end());
+    _wake_lock.unlock();
+}
+
+int Reactor::next_timeout() const {
+    if (_timers.empty())
+        return -1;
+    uint64_t due = _timers[0].due;
+    for (unsigned int n = 1; n < _timers.size(); n++)
+        due = std::min(due, _timers[n].due);
+    uint64_t now = now_ms();
+    return due > now ? int(due - now) : 0;
+}
+
+// Expired timers are taken out first, handlers may set new ones
+void Reactor::expire_timers() {
+    uint64_t now = now_ms();
+    std::vector<Handler*> expired;
+    for (unsigned int n = 0; n < _timers.size(); )
+        if (_timers[n].due <= now) {
+            expired.push_back(_timers[n].handler);
+            _timers.erase(_timers.begin() + n);
+        } else
+            n++;
+    for (std::vector<Handler*>::iterator it = expired.begin(); it != expired.end(); ++it)
+        if (!is_removed(*it))
+            call(*it, TIMER);
+}
+
+void Reactor::call(Handler* handler, Callback callback, uint32_t events) {
+    bool keep = false;
+    try {
+        switch (callback) {
+            case EVENTS:
+                // hang up and errors are reported whatever handler waits for, reading finds out about them
+                keep = !(events & EPOLLOUT) || handler->on_writable();
+                if (keep && events & ~EPOLLOUT)
+                    keep = handler->on_readable();
+                break;
+            case TIMER:  keep = handler->on_timer();    break;
+            case WAKEUP: keep = handler->on_wakeup();   break;
+        }
+    } catch (SBL::Exception& ex) {
+        SBL_ERROR("Reactor %d, handler %p failed: %s", _id, handler, ex.what());
+    } catch (...) {
+        SBL_ERROR("Reactor %d, handler %p failed with unknown exception", _id, handler);
+    }
+    if (!keep)
+        remove(handler);
+}
+
+uint64_t Reactor::now_ms() {
+    struct timespec now;
+    SBL_PERROR(::clock_gettime(CLOCK_MONOTONIC, &now) != 0);
+    return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+void Reactor::start_thread() {
+    SBL_INFO("RTSP reactor %d running", _id);
+    struct epoll_event events[MAX_EVENTS];
+    do {
+        int count = ::epoll_wait(_epoll, events, MAX_EVENTS, next_timeout());
+        if (count < 0) {
+            if (errno != EINTR)
+                SBL_ERROR("Reactor %d, epoll_wait failed: %s", _id, strerror(errno));
+            continue;
+        }
+        for (int n = 0; n < count; n++) {
+            Handler* handler = static_cast<Handler*>(events[n].data.ptr);
+            if (!handler)
+                wakeup();
+            // a handler could have been removed by another handler in this batch
+            else if (!is_removed(handler))
+                call(handler, EVENTS, events[n].events);
+        }
+        expire_timers();
+        // destructors may remove more handlers
+        while (!_removed.empty()) {
+            std::vector<Handler*> removed;
+            removed.swap(_removed);
+            for (std::vector<Handler*>::iterator it = removed.begin(); it != removed.end(); ++it) {
+                delete *it;
+                forget_woken(*it);
+            }
+        }
+    } while (1);
+}
+
+}
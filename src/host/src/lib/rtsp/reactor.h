@@ -0,0 +1,106 @@
+#pragma once
+#ifndef _RTSP_REACTOR_H
+#define _RTSP_REACTOR_H
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <stdint.h>
+#include <vector>
+#include <sbl/sbl_thread.h>
+
+namespace RTSP {
+
+//! Event loop built on epoll, dispatches socket events to handlers.
+/*! Server runs a small fixed number of reactors, which between them own the listening
+    socket, all RTSP control connections and all RTCP receive sockets. This keeps the
+    number of threads constant, no matter how many clients are connected.\n
+    Handler callbacks are always called from the reactor thread, so a handler
+    doesn't need any locking against itself. Besides socket events, a handler can
+    have the reactor call it back after a timeout, or when another thread wakes it up.
+*/
+class Reactor : public SBL::Thread {
+public:
+    //! Anything that waits for a socket to become readable (or writable)
+    class Handler {
+    public:
+        //! Virtual destructor, reactor deletes handlers it removes
+        virtual ~Handler() {}
+        //! Socket (file descriptor) to wait on
+        virtual int  fd() const = 0;
+        //! Called when socket is readable. Return false to have the handler removed and deleted.
+        virtual bool on_readable() = 0;
+        //! Called when socket is writable, only while the handler waits for that (see watch()).
+        //! Return false to have the handler removed and deleted.
+        virtual bool on_writable() { return true; }
+        //! Called when the timer set with set_timer() expires. Return false to have the handler removed and deleted.
+        virtual bool on_timer() { return true; }
+        //! Called after wake() was called for the handler. Return false to have the handler removed and deleted.
+        virtual bool on_wakeup() { return true; }
+    };
+    //! Create a reactor
+    //! @param  id  reactor number, used only in messages
+    Reactor(int id);
+    //! Closes epoll descriptor
+    ~Reactor();
+    //! Start dispatching events to the handler. Can be called from any thread.
+    void add(Handler* handler);
+    //! Stop dispatching events to the handler and delete it once current events are processed.
+    //! Must be called from the reactor thread.
+    void remove(Handler* handler);
+    //! Change what the handler waits for, by default it is only for the socket to become readable.
+    //! Can be called from any thread.
+    void watch(Handler* handler, bool readable, bool writable);
+    //! Call handler's on_timer() once, ms from now; handler has one timer, this replaces it.
+    //! Must be called from the reactor thread.
+    void set_timer(Handler* handler, int ms);
+    //! Cancel the handler's timer, if it has one. Must be called from the reactor thread.
+    void cancel_timer(Handler* handler);
+    //! Call handler's on_wakeup() from the reactor thread. Can be called from any thread, but
+    //! not once the handler is deleted, so whoever calls it has to be told first.
+    void wake(Handler* handler);
+    //! Number of handlers currently registered
+    int  handler_count() const { return _handler_count; }
+    //! Reactor id
+    int  id() const { return _id; }
+    //! Dispatch events forever, normally called in reactor's own thread
+    void start_thread();
+private:
+    enum {MAX_EVENTS = 16};
+    enum Callback {EVENTS, TIMER, WAKEUP};
+    struct Timer {
+        Handler*    handler;
+        uint64_t    due;                    // ms, monotonic clock
+    };
+    int                     _id;
+    int                     _epoll;
+    int                     _wakeup[2];     // pipe, written to by wake(), registered with epoll without a handler
+    volatile int            _handler_count;
+    std::vector<Handler*>   _removed;       // handlers to delete after current batch of events
+    std::vector<Timer>      _timers;
+    std::vector<Handler*>   _woken;         // handlers wake() was called for, guarded by _wake_lock
+    SBL::Mutex              _wake_lock;
+
+    bool is_removed(Handler* handler) const;
+    // call handler back, remove it if it asks for that or fails
+    void call(Handler* handler, Callback callback, uint32_t events = 0);
+    // ms until the first timer expires, -1 if there are none
+    int  next_timeout() const;
+    void expire_timers();
+    void wakeup();
+    void forget_woken(Handler* handler);
+    static uint64_t now_ms();
+};
+
+}
+#endif
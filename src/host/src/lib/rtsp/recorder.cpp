@@ -0,0 +1,392 @@
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sbl/sbl_logger.h>
+#include <sbl/sbl_exception.h>
+#include "recorder.h"
+#include "rtsp.h"
+
+namespace RTSP {
+
+static const char    KEY_MAGIC[4]   = {'K', 'E', 'Y', 'S'};
+static const uint8_t START_CODE[4]  = {0, 0, 0, 1};
+
+Recorder::Recorder(const Options& options, FramePool* pool) : _options(options), _pool(pool), _track_count(0),
+        _queue(QUEUE_SLOTS), _head(0), _count(0), _queued(0), _writing(0), _running(true) {
+    if (::mkdir(_options.dir.c_str(), 0755) < 0 && errno != EEXIST)
+        SBL_ERROR("Unable to create recording directory %s: %s", _options.dir.c_str(), strerror(errno));
+    create_thread();
+    SBL_INFO("Recording to %s, %d s or %d bytes per segment", _options.dir.c_str(), _options.segment_time, _options.segment_size);
+}
+
+Recorder::~Recorder() {
+    _lock.lock();
+    _running = false;
+    _lock.signal();
+    _lock.unlock();
+    join_thread();
+    for (int n = 0; n < _track_count; n++) {
+        free(_tracks[n]->buffer);
+        delete _tracks[n];
+    }
+}
+
+// Only '/' would get in the way in a file name
+int Recorder::add_track(const char* name) {
+    if (_track_count == MAX_TRACKS) {
+        SBL_WARN("Unable to record stream %s, recorder has %d streams already", name, MAX_TRACKS);
+        return -1;
+    }
+    Track* track = new Track;
+    track->name = name;
+    std::replace(track->name.begin(), track->name.end(), '/', '_');
+    track->waiting  = true;
+    track->fd       = -1;
+    track->size     = 0;
+    track->start    = 0;
+    track->direct   = false;
+    track->buffered = 0;
+    track->kept     = 0;
+    track->frames = track->dropped = track->created = track->errors = 0;
+    track->bytes  = 0;
+    void* buffer;
+    if (posix_memalign(&buffer, ALIGNMENT, WRITE_SIZE) != 0) {
+        SBL_WARN("Unable to allocate recording buffer for stream %s", name);
+        delete track;
+        return -1;
+    }
+    track->buffer = (uint8_t*) buffer;
+    scan_segments(track);
+    retain(track);
+    // frame thread reads the slot without the lock, it is written before the track number is returned
+    _lock.lock();
+    int id = _track_count;
+    _tracks[id] = track;
+    _track_count++;
+    _lock.unlock();
+    SBL_MSG(MSG::SOURCE, "Recording stream %s as track %d, %d segments kept from before", track->name.c_str(), id,
+            (int) track->segments.size());
+    return id;
+}
+
+// Only the frame thread of the stream touches waiting and dropped, so they need no lock
+void Recorder::record(int id, const uint8_t* data, int size, uint32_t timestamp, const FrameRef& owner) {
+    Track* track = _tracks[id];
+    bool key = (data[0] & 0x1f) == 7;
+    if (track->waiting && !key)
+        return;
+    FrameRef frame = owner;
+    if (!owner.is_valid() || data < owner.data() || data + size > owner.data() + owner.size()) {
+        frame = _pool->copy(data, size);
+        data  = frame.data();
+    }
+    _lock.lock();
+    bool full = _count == QUEUE_SLOTS || _queued + size > _options.queue_size;
+    if (!full) {
+        Pending& pending = _queue[(_head + _count) % QUEUE_SLOTS];
+        pending.frame     = frame;
+        pending.data      = data;
+        pending.size      = size;
+        pending.timestamp = timestamp;
+        pending.time      = now();
+        pending.track     = track;
+        _queued += size;
+        // recorder thread checks the queue before it waits, so it needs waking only when it was empty
+        if (_count++ == 0)
+            _lock.signal();
+    }
+    _lock.unlock();
+    if (full) {
+        if (!track->waiting)
+            SBL_WARN("Recorder falling behind, stream %s skips to its next key frame", track->name.c_str());
+        track->waiting = true;
+        track->dropped++;
+        return;
+    }
+    track->waiting = false;
+}
+
+void Recorder::flush() {
+    for (;;) {
+        _lock.lock();
+        bool done = _count == 0 && _writing == 0;
+        _lock.unlock();
+        if (done)
+            return;
+        usleep(1000);
+    }
+}
+
+// Frames are taken off the queue in batches, so that the lock isn't held while writing
+void Recorder::start_thread() {
+    std::vector<Pending> batch;
+    batch.reserve(BATCH_SIZE);
+    _lock.lock();
+    for (;;) {
+        while (_count == 0 && _running)
+            _lock.wait();
+        if (_count == 0)
+            break;
+        int bytes = 0;
+        while (_count > 0 && (int) batch.size() < BATCH_SIZE) {
+            Pending& pending = _queue[_head];
+            batch.push_back(pending);
+            bytes += pending.size;
+            pending.frame.reset();
+            _head = (_head + 1) % QUEUE_SLOTS;
+            _count--;
+        }
+        _writing = batch.size();
+        _lock.unlock();
+        for (unsigned int n = 0; n < batch.size(); n++)
+            write(batch[n].track, batch[n]);
+        batch.clear();
+        _lock.lock();
+        _writing = 0;
+        _queued -= bytes;
+    }
+    _lock.unlock();
+    for (int n = 0; n < _track_count; n++)
+        close_segment(_tracks[n]);
+    SBL_MSG(MSG::SOURCE, "Recorder thread terminating");
+}
+
+// New segment starts at a key frame, once the current one is long enough; there is none until the first key frame
+void Recorder::write(Track* track, const Pending& frame) {
+    bool key = (frame.data[0] & 0x1f) == 7;
+    if (key && (track->fd < 0 || track->size >= (uint64_t) _options.segment_size
+                || frame.time - track->start >= (uint32_t) _options.segment_time * 1000)) {
+        close_segment(track);
+        open_segment(track, frame.time);
+    }
+    if (track->fd < 0)
+        return;
+    if (key) {
+        KeyFrame entry = { track->size, frame.timestamp, frame.time - track->start };
+        track->keys.push_back(entry);
+    }
+    append(track, START_CODE, sizeof START_CODE);
+    append(track, frame.data, frame.size);
+    track->frames++;
+}
+
+void Recorder::append(Track* track, const uint8_t* data, int size) {
+    while (size > 0 && track->fd >= 0) {
+        int n = std::min(size, WRITE_SIZE - track->buffered);
+        memcpy(track->buffer + track->buffered, data, n);
+        track->buffered += n;
+        track->size     += n;
+        data += n;
+        size -= n;
+        if (track->buffered == WRITE_SIZE)
+            write_buffer(track, WRITE_SIZE);
+    }
+}
+
+// On error the segment is given up, the next key frame starts a new one
+bool Recorder::write_buffer(Track* track, int size) {
+    const uint8_t* data = track->buffer;
+    while (size > 0) {
+        ssize_t n = ::write(track->fd, data, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            SBL_ERROR("Unable to write segment %s: %s", track->segment.c_str(), n < 0 ? strerror(errno) : "no space");
+            ::close(track->fd);
+            track->fd = -1;
+            track->errors++;
+            return false;
+        }
+        data += n;
+        size -= n;
+        track->bytes += n;
+    }
+    track->buffered = 0;
+    return true;
+}
+
+// Segments started within the same millisecond (a burst written after a stall) take the next free one,
+// so that names stay unique and in order
+void Recorder::open_segment(Track* track, uint32_t time) {
+    struct timespec ts;
+    SBL_PERROR(::clock_gettime(CLOCK_REALTIME, &ts) < 0);
+    track->fd = -1;
+    for (int attempt = 0; attempt < 1000 && track->fd < 0; attempt++) {
+        struct tm local;
+        localtime_r(&ts.tv_sec, &local);
+        char date[32];
+        strftime(date, sizeof date, "%Y%m%d-%H%M%S", &local);
+        char ms[8];
+        snprintf(ms, sizeof ms, "-%03d", int(ts.tv_nsec / 1000000));
+        track->segment = _options.dir + '/' + track->name + '-' + date + ms + ".264";
+        track->direct  = false;
+#ifdef O_DIRECT
+        // not every file system takes O_DIRECT (tmpfs doesn't), those get buffered writes
+        track->fd = ::open(track->segment.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_DIRECT, 0644);
+        track->direct = track->fd >= 0;
+        if (track->fd < 0 && errno == EINVAL)
+#endif
+            track->fd = ::open(track->segment.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (track->fd >= 0 || errno != EEXIST)
+            break;
+        ts.tv_nsec += 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_nsec -= 1000000000;
+            ts.tv_sec++;
+        }
+    }
+    if (track->fd < 0) {
+        SBL_ERROR("Unable to create segment %s: %s", track->segment.c_str(), strerror(errno));
+        track->errors++;
+        return;
+    }
+    track->size     = 0;
+    track->buffered = 0;
+    track->start    = time;
+    track->keys.clear();
+    track->created++;
+    SBL_MSG(MSG::SOURCE, "Recording stream %s to %s%s", track->name.c_str(), track->segment.c_str(),
+            track->direct ? " (direct)" : "");
+}
+
+// O_DIRECT writes whole blocks, so the last one is padded and the file cut back to size
+void Recorder::close_segment(Track* track) {
+    if (track->fd < 0)
+        return;
+    if (track->buffered) {
+        int size = track->direct ? (track->buffered + ALIGNMENT - 1) & ~(ALIGNMENT - 1) : track->buffered;
+        memset(track->buffer + track->buffered, 0, size - track->buffered);
+        if (!write_buffer(track, size))
+            return;
+        if (track->direct)
+            SBL_PERROR(::ftruncate(track->fd, track->size) < 0);
+    }
+    ::close(track->fd);
+    track->fd = -1;
+
+    Segment segment = { track->segment, track->size, time(NULL) };
+    std::string key_name = track->segment + ".key";
+    std::ofstream file(key_name.c_str(), std::ios::binary | std::ios::trunc);
+    KeyHeader header;
+    memcpy(header.magic, KEY_MAGIC, sizeof header.magic);
+    header.version  = KEY_VERSION;
+    header.count    = track->keys.size();
+    header.reserved = 0;
+    file.write((const char*) &header, sizeof header);
+    if (!track->keys.empty())
+        file.write((const char*) &track->keys[0], track->keys.size() * sizeof(KeyFrame));
+    if (!file)
+        SBL_WARN("Unable to write key frame index %s", key_name.c_str());
+    else
+        segment.size += sizeof header + track->keys.size() * sizeof(KeyFrame);
+    file.close();
+    track->segments.push_back(segment);
+    track->kept += segment.size;
+    SBL_MSG(MSG::SOURCE, "Segment %s closed, %llu bytes, %d key frames", track->segment.c_str(),
+            (unsigned long long) track->size, (int) track->keys.size());
+    retain(track);
+}
+
+// Segment of the current stream always stays, even if it alone is over the limit
+void Recorder::retain(Track* track) {
+    time_t oldest = _options.retention_time ? time(NULL) - _options.retention_time : 0;
+    while (track->segments.size() > 1 || (!track->segments.empty() && track->fd >= 0)) {
+        const Segment& segment = track->segments.front();
+        if (!(_options.retention_size && track->kept > (uint64_t) _options.retention_size) && segment.end >= oldest)
+            break;
+        SBL_MSG(MSG::SOURCE, "Deleting segment %s", segment.name.c_str());
+        if (::unlink(segment.name.c_str()) < 0 && errno != ENOENT)
+            SBL_WARN("Unable to delete segment %s: %s", segment.name.c_str(), strerror(errno));
+        ::unlink((segment.name + ".key").c_str());
+        track->kept -= segment.size;
+        track->segments.pop_front();
+    }
+}
+
+static bool older(const std::pair<std::string, int>& a, const std::pair<std::string, int>& b) {
+    return a.first < b.first;
+}
+
+// Name is exactly <stream>-yyyymmdd-hhmmss-mmm.264, so that stream "cam" doesn't take the segments of "cam-hd"
+static bool is_segment(const char* name, const std::string& stream) {
+    static const char pattern[] = "-########-######-###.264";
+    if (strncmp(name, stream.c_str(), stream.size()))
+        return false;
+    name += stream.size();
+    if (strlen(name) != sizeof pattern - 1)
+        return false;
+    for (int n = 0; pattern[n]; n++)
+        if (pattern[n] == '#' ? !isdigit((unsigned char) name[n]) : name[n] != pattern[n])
+            return false;
+    return true;
+}
+
+// Segments of this stream left by an earlier run, names sort by time
+void Recorder::scan_segments(Track* track) {
+    DIR* dir = ::opendir(_options.dir.c_str());
+    if (!dir)
+        return;
+    std::vector<std::pair<std::string, int> > names;
+    while (struct dirent* entry = ::readdir(dir)) {
+        if (is_segment(entry->d_name, track->name))
+            names.push_back(std::make_pair(_options.dir + '/' + entry->d_name, 0));
+    }
+    ::closedir(dir);
+    std::sort(names.begin(), names.end(), older);
+    for (unsigned int n = 0; n < names.size(); n++) {
+        struct stat st;
+        if (::stat(names[n].first.c_str(), &st) < 0)
+            continue;
+        Segment segment = { names[n].first, (uint64_t) st.st_size, st.st_mtime };
+        if (::stat((segment.name + ".key").c_str(), &st) == 0)
+            segment.size += st.st_size;
+        track->segments.push_back(segment);
+        track->kept += segment.size;
+    }
+}
+
+void Recorder::print_stats(std::ostream& str) {
+    for (int n = 0; n < _track_count; n++) {
+        const Track* track = _tracks[n];
+        str << "recorder stream="   << track->name
+            << " frames="           << track->frames
+            << " dropped="          << track->dropped
+            << " bytes="            << track->bytes
+            << " segments="         << track->created
+            << " kept="             << track->segments.size()
+            << " kept_bytes="       << track->kept
+            << " errors="           << track->errors
+            << "\n";
+    }
+}
+
+uint32_t Recorder::now() {
+    struct timespec ts;
+    SBL_PERROR(::clock_gettime(CLOCK_MONOTONIC, &ts) < 0);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+}
@@ -0,0 +1,149 @@
+#pragma once
+#ifndef _RTSP_RECORDER_H
+#define _RTSP_RECORDER_H
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <stdint.h>
+#include <ostream>
+#include <string>
+#include <deque>
+#include <vector>
+#include <sbl/sbl_thread.h>
+#include "frame_buffer.h"
+
+namespace RTSP {
+
+//! Records live H.264 streams to local storage, in segments of Annex B byte stream.
+/*! Frames are queued by the thread that streams them and written out by the recorder thread,
+    so the live path never waits for the disk: when the queue is full, frames are dropped and
+    the stream resumes at its next key frame. Frames from the frame pool are queued by reference,
+    others are copied into the pool.\n
+    Each segment starts with a key frame (SPS) and can be streamed as a file. A new one is started
+    at the first key frame after the segment is segment_time seconds or segment_size bytes long;
+    the oldest segments of a stream are deleted to stay within retention_size bytes and retention_time
+    seconds. Segment <dir>/<stream>-<yyyymmdd>-<hhmmss>-<ms>.264 comes with <segment>.key, the offset
+    and time of each of its key frames.\n
+    Data goes to the file in WRITE_SIZE blocks from aligned buffers, with O_DIRECT where the file system
+    supports it, so that recording doesn't fill the page cache. */
+class Recorder : public SBL::Thread {
+public:
+    //! Recorder options
+    struct Options {
+        std::string dir;            //!< directory segments are written to
+        int         segment_time;   //!< seconds per segment
+        int         segment_size;   //!< bytes per segment, at most (unless a single GOP is larger)
+        int64_t     retention_size; //!< bytes of segments kept per stream, 0 for no limit
+        int         retention_time; //!< seconds segments are kept, 0 for no limit
+        int         queue_size;     //!< bytes of frames waiting to be written, for all streams
+        Options() : segment_time(60), segment_size(64 * 1024 * 1024), retention_size(0), retention_time(0),
+                    queue_size(4 * 1024 * 1024) {}
+    };
+    //! Key frame index entry, <segment>.key has a KeyHeader followed by these
+    struct KeyFrame {
+        uint64_t    offset;         //!< offset of the key frame (its start code) in the segment
+        uint32_t    timestamp;      //!< RTP timestamp of the key frame
+        uint32_t    time;           //!< milliseconds since the start of the segment
+    };
+    //! Header of <segment>.key
+    struct KeyHeader {
+        char        magic[4];       //!< "KEYS"
+        uint32_t    version;        //!< KEY_VERSION
+        uint32_t    count;          //!< number of KeyFrame entries that follow
+        uint32_t    reserved;
+    };
+    enum { KEY_VERSION = 1 };
+    enum { MAX_TRACKS = 64 };
+
+    //! Create a recorder and start its thread
+    //  @param  pool    pool to copy frames into, when they don't come from it already
+    Recorder(const Options& options, FramePool* pool);
+    //! Write out everything queued, close the segments and stop the thread
+    ~Recorder();
+
+    //! Add a stream, return its track number for record(), -1 if it can't be recorded (MAX_TRACKS already).
+    //! Segments of an earlier run are taken over for retention.
+    int  add_track(const char* name);
+    //! Queue a frame (H.264 NAL unit, without start code), SPS starts a GOP. Never waits for the disk.
+    //  @param  owner   buffer data points into, if it came from the frame pool (may be empty)
+    void record(int track, const uint8_t* data, int size, uint32_t timestamp, const FrameRef& owner);
+    //! Wait until everything queued so far is written to the segments (not necessarily to the disk)
+    void flush();
+    //! Print counters of each track, one line per track
+    void print_stats(std::ostream& str);
+
+    //! Thread entry function
+    void start_thread();
+private:
+    enum {WRITE_SIZE = 256 * 1024, ALIGNMENT = 4096, QUEUE_SLOTS = 2048, BATCH_SIZE = 64};
+    struct Segment {
+        std::string name;
+        uint64_t    size;
+        time_t      end;            // when it was closed
+    };
+    struct Track {
+        std::string         name;
+        bool                waiting;        // for a key frame, after a drop or at start
+        int                 fd;             // current segment, -1 if none
+        std::string         segment;        // current segment file name
+        uint64_t            size;           // bytes written to the segment so far
+        uint32_t            start;          // ms, when the segment started
+        bool                direct;         // segment is open with O_DIRECT
+        uint8_t*            buffer;         // WRITE_SIZE bytes, aligned
+        int                 buffered;
+        std::vector<KeyFrame> keys;
+        std::deque<Segment> segments;       // closed segments, oldest first
+        uint64_t            kept;           // bytes in segments
+        // counters
+        unsigned int        frames;
+        unsigned int        dropped;
+        unsigned int        created;
+        unsigned int        errors;
+        uint64_t            bytes;
+    };
+    struct Pending {
+        FrameRef        frame;
+        const uint8_t*  data;
+        int             size;
+        uint32_t        timestamp;
+        uint32_t        time;       // ms, when it was queued
+        Track*          track;
+    };
+    Options             _options;
+    FramePool*          _pool;
+    SBL::Mutex          _lock;      // guards the queue and adding tracks
+    Track*              _tracks[MAX_TRACKS];    // fixed, so that record() can look up a track without the lock
+    int                 _track_count;
+    std::vector<Pending> _queue;    // ring of QUEUE_SLOTS
+    int                 _head;      // next to write
+    int                 _count;
+    int                 _queued;    // bytes in queue
+    int                 _writing;   // frames taken off the queue, being written
+    volatile bool       _running;
+
+    void write(Track* track, const Pending& frame);
+    void append(Track* track, const uint8_t* data, int size);
+    bool write_buffer(Track* track, int size);
+    void open_segment(Track* track, uint32_t time);
+    void close_segment(Track* track);
+    void retain(Track* track);
+    void scan_segments(Track* track);
+    static uint32_t now();
+
+    Recorder(const Recorder&);              // not implemented
+    Recorder& operator=(const Recorder&);   // not implemented
+};
+
+}
+#endif
@@ -0,0 +1,151 @@
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <algorithm>
+#include <sbl/sbl_exception.h>
+#include "rtsp_impl.h"
+#include "relay_source.h"
+
+namespace RTSP {
+
+static RemoteClient::Options client_options(bool tcp) {
+    RemoteClient::Options options;
+    options.tcp = tcp;
+    return options;
+}
+
+RelaySource::RelaySource(const char* name, const char* url, bool tcp, Streamer* streamer) :
+        Source(name, streamer), _url(url), _depacketizer(this), _client(url, &_depacketizer, client_options(tcp)),
+        _started(false), _stop(false), _connects(0), _failures(0), _bitrate(0) {
+    _stream_desc.encoder_type = H264;
+    SBL_MSG(MSG::SOURCE, "Created RelaySource %s for %s (%p)", name, url, this);
+}
+
+RelaySource::~RelaySource() {
+    if (!_started)
+        return;
+    _lock.lock();
+    _stop = true;
+    _lock.signal();
+    _lock.unlock();
+    join_thread();
+}
+
+void RelaySource::start() {
+    SBL_ASSERT(!_started);
+    _started = true;
+    create_thread();
+}
+
+void RelaySource::play() {
+    SBL_INFO("Started to play relay %s", name());
+    _playing = true;
+}
+
+void RelaySource::teardown() {
+    SBL_INFO("Tearing down relay %s", name());
+    _playing = false;
+}
+
+void RelaySource::get_stream_desc() {
+    _stream_desc.encoder_type = H264;
+    _stream_desc.bitrate      = _bitrate;
+}
+
+void RelaySource::nal_unit(const uint8_t* data, int size, uint32_t timestamp) {
+    _timestamp = timestamp;
+    SBL_MSG(MSG::SOURCE, "Relay %s, frame %c, size %d, ts %u", name(), frame_type(data[0]), size, timestamp);
+    save_if_sps_pps(data, size);
+    cache_frame(data, size, timestamp);
+    record_frame(data, size, timestamp);
+    if (_playing)
+        streamer()->send_frame(data, size, timestamp);
+}
+
+void RelaySource::start_thread() {
+    int backoff = MIN_BACKOFF;
+    _lock.lock();
+    while (!_stop) {
+        _lock.unlock();
+        unsigned int connects = _connects;
+        run_session();
+        _lock.lock();
+        // a session that got going starts the backoff over
+        if (_connects != connects)
+            backoff = MIN_BACKOFF;
+        if (_stop)
+            break;
+        SBL_WARN("Relay %s: reconnecting in %d s", name(), backoff);
+        _lock.wait(0, backoff);
+        backoff = std::min(2 * backoff, (int) MAX_BACKOFF);
+    }
+    _lock.unlock();
+    SBL_MSG(MSG::SOURCE, "Relay %s thread done", name());
+}
+
+// Play the upstream until it fails or the relay is stopped
+void RelaySource::run_session() {
+    std::string error;
+    try {
+        _client.open();
+        const RemoteClient::Media& media = _client.media();
+        _bitrate = media.bitrate;
+        // parameter sets of the session description, in case the upstream doesn't repeat them in band
+        if (!media.sps.empty())
+            save_if_sps_pps(&media.sps[0], media.sps.size());
+        if (!media.pps.empty())
+            save_if_sps_pps(&media.pps[0], media.pps.size());
+        _connects++;
+        bool stop = false;
+        while (!stop && _client.receive(RECEIVE_MS)) {
+            _lock.lock();
+            stop = _stop;
+            _lock.unlock();
+        }
+        if (!stop)
+            error = "upstream stopped";
+    } catch (SBL::Exception& ex) {
+        error = ex.what();
+    }
+    _depacketizer.flush();
+    _depacketizer.reset();
+    try {
+        _client.close();
+    } catch (SBL::Exception& ex) {
+        SBL_WARN("Relay %s: %s", name(), ex.what());
+    }
+    if (!error.empty()) {
+        SBL_ERROR("Relay %s from %s: %s", name(), _url.c_str(), error.c_str());
+        _lock.lock();
+        _failures++;
+        _error = error;
+        _lock.unlock();
+    }
+}
+
+void RelaySource::print_stats(std::ostream& str) {
+    const Depacketizer::Stats& stats = _depacketizer.stats();
+    _lock.lock();
+    str << "relay stream=" << name() << " url=" << _url << " connects=" << _connects << " failures=" << _failures
+        << " packets=" << stats.packets << " bytes=" << stats.bytes << " lost=" << stats.lost
+        << " reordered=" << stats.reordered << " late=" << stats.late << " invalid=" << stats.invalid
+        << " restarts=" << stats.restarts << " nal_units=" << stats.nal_units << " dropped=" << stats.dropped
+        << " jitter_ms=" << (_client.media().clock ? _depacketizer.jitter() * 1000.0 / _client.media().clock : 0);
+    if (!_error.empty())
+        str << " error=\"" << _error << '"';
+    str << std::endl;
+    _lock.unlock();
+}
+
+}
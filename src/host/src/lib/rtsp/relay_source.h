@@ -0,0 +1,77 @@
+#pragma once
+#ifndef _RTSP_RELAY_SOURCE_H
+#define _RTSP_RELAY_SOURCE_H
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <string>
+#include <sbl/sbl_thread.h>
+#include "rtsp_source.h"
+#include "rtsp_client.h"
+#include "depacketizer.h"
+
+namespace RTSP {
+
+//! Live source restreaming the H.264 video of a remote RTSP server (an upstream camera).
+/*! The relay thread keeps one session with the upstream open, whether anybody watches or not,
+    so that GOP cache, HLS packager and recorder are fed and clients start at once. NAL units
+    come out of the depacketizer and go the way frames of a LiveSource go, to the streamer that
+    fans them out to the clients. When the upstream fails, or goes quiet, the relay reconnects,
+    waiting 1 s after the first failure and twice as long after each next one, up to 30 s. */
+class RelaySource : public Source, public SBL::Thread, public Depacketizer::Sink {
+public:
+    //! Create the relay, it connects once started
+    // @param   name    stream name clients use
+    // @param   url     rtsp url of the upstream stream
+    // @param   tcp     interleave media on the RTSP connection, rather than UDP
+    RelaySource(const char* name, const char* url, bool tcp, Streamer* streamer);
+    //! Stop the thread and close the upstream session
+    ~RelaySource();
+    //! Start the thread that connects to the upstream and feeds the source
+    /*! Call it once the source is set up (GOP cache, event buffer, packager, recorder); they are not
+        guarded against the frames the thread delivers. */
+    void start();
+    //! Frames come from the upstream, not from the application
+    void send_frame(uint8_t* frame, int size, uint32_t timestamp, EncoderType encoder) {}
+    //! Start sending to the streamer
+    void play();
+    //! Stop sending to the streamer; the upstream session stays, and so does the GOP cache
+    void teardown();
+    //! Relay is shared by its clients like a LiveSource
+    bool is_live() const { return true; }
+    //! Stream description comes from the upstream session description
+    void get_stream_desc();
+    //! Print upstream and depacketizer counters, on one line
+    void print_stats(std::ostream& str);
+    //! Called by the depacketizer, on the relay thread
+    void nal_unit(const uint8_t* data, int size, uint32_t timestamp);
+private:
+    enum { MIN_BACKOFF = 1, MAX_BACKOFF = 30, RECEIVE_MS = 200 };
+    std::string     _url;
+    Depacketizer    _depacketizer;
+    RemoteClient    _client;
+    SBL::Mutex      _lock;          // guards _stop and _error, signals stop
+    bool            _started;
+    bool            _stop;
+    std::string     _error;         // why the last session failed
+    unsigned int    _connects;
+    unsigned int    _failures;
+    int             _bitrate;       // from the session description
+
+    void start_thread();
+    void run_session();
+};
+
+}
+#endif
@@ -41,6 +41,7 @@ bool Parser::parse(char* buffer, unsigned int size) {
     report.rr.fraction_lost     = ntohl(report.rr.fraction_lost);
     report.rr.cumulative_lost   = ntohl(report.rr.cumulative_lost);
     report.rr.highest_seq       = ntohl(report.rr.highest_seq);
+    report.rr.jitter            = ntohl(report.rr.jitter);
     report.rr.last_sr           = ntohl(report.rr.last_sr);
     report.rr.delay_last_sr     = ntohl(report.rr.delay_last_sr);
 
@@ -77,20 +78,27 @@ bool Parser::parse(char* buffer, unsigned int size) {
              report.rr.last_sr,
              report.rr.delay_last_sr,
              report.sdes.name);
+    // multicast members share the group client, it shows the latest report of any of them
+    if (_talker && _talker->client())
+        _talker->client()->metrics()->rtcp_report(report.rr.fraction_lost, report.rr.cumulative_lost, report.rr.jitter);
     return true;
 }
 
 
 // This is a simplistic processing, assumes RTCP RR/SDES arrives always in a single UDP packet.
-void Parser::start_thread() {
-    _thread_active = true;
-    SBL_MSG(MSG::RTCP, "Starting thread to listen to RTCP messages for thread %d", id());
-    do {
+bool Parser::on_readable() {
+    try {
         int recv = _socket.recv(_buffer, BUFF_SIZE);
         SBL_MSG(MSG::RTCP, "Received RTCP message size %d", recv);
         if (parse(_buffer, recv) && congestion_control())
             adjust_bitrate();
-    } while (1);
+    } catch (Errcode errcode) {
+        SBL_WARN("RTCP %d, error %d processing packet", id(), errcode);
+    } catch (SBL::Exception& ex) {
+        SBL_WARN("RTCP %d, %s", id(), ex.what());
+    }
+    // Talker owns the parser, it is removed only in Talker::teardown()
+    return true;
 }
 
 bool Parser::congestion_control() const {
@@ -137,16 +145,10 @@ void Parser::adjust_bitrate() {
 }
 
 Parser::~Parser() {
-    SBL_MSG(MSG::RTCP, "Destroying RTCP Parser %d", id());
+    // talker may already be gone, so don't use id() here
+    SBL_MSG(MSG::RTCP, "Destroying RTCP Parser %p", this);
     _socket.close();
 }
 
-void Parser::kill() {
-    if (_thread_active) {
-        SBL_MSG(MSG::RTCP, "Killing RTCP Parser %d", id());
-        kill_thread();
-    }
-}
-
 }
 }
@@ -16,7 +16,7 @@
 *  destroy any copies you have made.                                         *
 \****************************************************************************/
 #include <sbl/sbl_socket.h>
-#include <sbl/sbl_thread.h>
+#include "reactor.h"
 /*
 SR: Sender Report RTCP Packet
 
@@ -159,7 +159,7 @@ SBL_STATIC_ASSERT(sizeof(Sender) == 106);
 SBL_STATIC_ASSERT(sizeof(RR)     == 32);
 
 //! Parses RTCP messages and does rudimentary bitrate control when enabled.
-class Parser : public SBL::Thread {
+class Parser : public Reactor::Handler {
 public:
     //! Last decoded Receiver report. It is overwritten with each received RTCP packet
     Receiver  report;
@@ -168,31 +168,34 @@ public:
     bool parse(char* buffer, unsigned int size);
     //! Associates parser with the control talker. 
     /*! Listens for RTCP packets on the socket, which can be UDP or TCP. Use model is different:
-     *      - for UDP, Parser runs in a separate thread, listening on a socket
-     *      - for TCP, Parser runs in the same thread as Talker, which simple calls parse() function
+     *      - for UDP, Parser is added to talker's Reactor, which calls on_readable() when
+     *        a packet arrives on the socket
+     *      - for TCP, socket is NONE and Talker simply calls parse() function
      *        after receiving a RTCP message.
     */
     Parser(Talker* talker, SBL::Socket socket) : 
-          _talker(talker), _socket(socket), _thread_active(false),
+          _talker(talker), _socket(socket),
           _packet_loss(0) {}
     //! Closes the socket on termination
     ~Parser();
     //! Enable to disable congestion control
     void set_congestion_control(bool enable);
-    //! If Parser runs in a separate thread, kills that thread
-    void kill();
     //! unique ID of this Parser
     int id() const;
+    //! UDP socket, for the reactor
+    int  fd() const { return _socket.id(); }
+    //! Receive and process one UDP RTCP packet
+    bool on_readable();
+    //! True if parser listens on its own UDP socket
+    bool is_udp() const { return _socket.is_valid(); }
 private:
     enum {BUFF_SIZE = 200, INCREASE_PERC = 2};
     Talker*         _talker;
     SBL::Socket     _socket;
     char            _buffer[BUFF_SIZE];
-    bool            _thread_active;
     unsigned int    _packet_loss; 
     int             _last_loss_time;
 
-    void    start_thread();
     void    adjust_bitrate();
     // True if congestion control is enabled
     bool    congestion_control() const;
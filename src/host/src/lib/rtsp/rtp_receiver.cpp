@@ -0,0 +1,186 @@
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <cerrno>
+#include <cstring>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sbl/sbl_logger.h>
+#include <sbl/sbl_exception.h>
+#include "rtsp_impl.h"
+#include "depacketizer.h"
+#include "rtp_receiver.h"
+
+namespace {
+// Same layout as struct mmsghdr, which old glibc doesn't have
+struct MMsgHdr {
+    struct msghdr   msg_hdr;
+    unsigned int    msg_len;
+};
+
+bool would_block(int error) {
+    return error == EAGAIN || error == EWOULDBLOCK || error == EINTR;
+}
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+}
+
+namespace RTSP {
+
+#ifdef __NR_recvmmsg
+bool RtpReceiver::_mmsg_enabled = true;
+#else
+bool RtpReceiver::_mmsg_enabled = false;
+#endif
+
+RtpReceiver::RtpReceiver() : _epoll(-1), _buffers(BATCH * MAX_PACKET), _iov(BATCH) {
+    memset(&_stats, 0, sizeof _stats);
+    _epoll = ::epoll_create(MAX_EVENTS);
+    SBL_PERROR(_epoll < 0);
+    for (int n = 0; n < BATCH; n++) {
+        _iov[n].iov_base = &_buffers[n * MAX_PACKET];
+        _iov[n].iov_len  = MAX_PACKET;
+    }
+}
+
+RtpReceiver::~RtpReceiver() {
+    for (std::map<int, Stream*>::iterator it = _streams.begin(); it != _streams.end(); ++it)
+        delete it->second;
+    ::close(_epoll);
+}
+
+void RtpReceiver::add(int fd, Depacketizer* depacketizer, int clock) {
+    SBL_THROW_IF(_streams.count(fd), "Socket %d is already received", fd);
+    SBL_PERROR(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0);
+    Stream* stream = new Stream;
+    stream->fd           = fd;
+    stream->depacketizer = depacketizer;
+    stream->clock        = clock;
+    struct epoll_event event;
+    memset(&event, 0, sizeof event);
+    event.events   = EPOLLIN;
+    event.data.ptr = stream;
+    if (::epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+        delete stream;
+        SBL_PERROR(true);
+    }
+    _streams[fd] = stream;
+}
+
+void RtpReceiver::remove(int fd) {
+    std::map<int, Stream*>::iterator it = _streams.find(fd);
+    if (it == _streams.end())
+        return;
+    struct epoll_event event;
+    ::epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, &event);
+    delete it->second;
+    _streams.erase(it);
+}
+
+int RtpReceiver::poll(int ms) {
+    struct epoll_event events[MAX_EVENTS];
+    int count = ::epoll_wait(_epoll, events, MAX_EVENTS, ms);
+    if (count < 0) {
+        SBL_PERROR(errno != EINTR);
+        return 0;
+    }
+    if (count > 0)
+        _stats.wakeups++;
+    int packets = 0;
+    for (int n = 0; n < count; n++)
+        packets += receive(static_cast<Stream*>(events[n].data.ptr));
+    return packets;
+}
+
+int RtpReceiver::receive(Stream* stream) {
+    return _mmsg_enabled ? receive_mmsg(stream) : receive_each(stream);
+}
+
+// Arrival time goes to the depacketizer in timestamp units, it only needs differences
+void RtpReceiver::deliver(Stream* stream, const uint8_t* packet, int size, uint64_t now) {
+    uint64_t arrival = now / 1000 * stream->clock / 1000000;
+    _stats.packets++;
+    _stats.bytes += size;
+    stream->depacketizer->add(packet, size, (uint32_t) arrival);
+}
+
+int RtpReceiver::receive_mmsg(Stream* stream) {
+#ifdef __NR_recvmmsg
+    MMsgHdr msgs[BATCH];
+    memset(msgs, 0, sizeof msgs);
+    for (int n = 0; n < BATCH; n++) {
+        msgs[n].msg_hdr.msg_iov    = &_iov[n];
+        msgs[n].msg_hdr.msg_iovlen = 1;
+    }
+    int packets = 0;
+    // a full batch means there may be more waiting
+    for (;;) {
+        int count = ::syscall(__NR_recvmmsg, stream->fd, msgs, BATCH, MSG_DONTWAIT, NULL);
+        _stats.syscalls++;
+        if (count < 0 && errno == ENOSYS && packets == 0) {
+            SBL_INFO("recvmmsg not available, disabling it");
+            _mmsg_enabled = false;
+            return receive_each(stream);
+        }
+        if (count < 0) {
+            if (!would_block(errno))
+                SBL_WARN("Socket %d, recvmmsg error: %s", stream->fd, strerror(errno));
+            return packets;
+        }
+        uint64_t now = now_ns();
+        for (int n = 0; n < count; n++) {
+            if (msgs[n].msg_hdr.msg_flags & MSG_TRUNC) {
+                _stats.truncated++;
+                continue;
+            }
+            deliver(stream, &_buffers[n * MAX_PACKET], msgs[n].msg_len, now);
+        }
+        packets += count;
+        if (count < BATCH)
+            return packets;
+        for (int n = 0; n < BATCH; n++)
+            msgs[n].msg_hdr.msg_flags = 0;
+    }
+#else
+    return receive_each(stream);
+#endif
+}
+
+int RtpReceiver::receive_each(Stream* stream) {
+    int packets = 0;
+    for (;;) {
+        int size = ::recv(stream->fd, &_buffers[0], MAX_PACKET, MSG_DONTWAIT | MSG_TRUNC);
+        _stats.syscalls++;
+        if (size < 0) {
+            if (!would_block(errno))
+                SBL_WARN("Socket %d, recv error: %s", stream->fd, strerror(errno));
+            return packets;
+        }
+        packets++;
+        if (size > MAX_PACKET)
+            _stats.truncated++;
+        else
+            deliver(stream, &_buffers[0], size, now_ns());
+    }
+}
+
+}
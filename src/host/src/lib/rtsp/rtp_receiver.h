@@ -0,0 +1,88 @@
+#pragma once
+#ifndef _RTSP_RTP_RECEIVER_H
+#define _RTSP_RTP_RECEIVER_H
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <stdint.h>
+#include <map>
+#include <vector>
+#include <sys/uio.h>
+
+namespace RTSP {
+class Depacketizer;
+
+//! Receives RTP packets of many UDP streams on one thread, with as few syscalls as possible.
+/*! The receive side of UdpBatch: sockets wait in one epoll set, and each readable socket is
+    drained with recvmmsg(), BATCH packets per syscall, into buffers allocated once. Packets go
+    to the depacketizer of their stream, with the arrival time read once per batch.\n
+    When the kernel says it doesn't support recvmmsg(), it is switched off for the whole process
+    and packets are read one at a time. Nothing is allocated per packet, so a single core can
+    keep up with hundreds of streams. */
+class RtpReceiver {
+public:
+    //! Counters
+    struct Stats {
+        uint64_t        packets;
+        uint64_t        bytes;
+        uint64_t        syscalls;       //!< reads, empty ones included
+        uint64_t        wakeups;        //!< epoll_wait() calls that returned events
+        unsigned int    truncated;      //!< packets larger than MAX_PACKET, dropped
+    };
+    enum { BATCH = 32, MAX_PACKET = 2048 };
+
+    RtpReceiver();
+    //! Closes epoll descriptor, not the sockets
+    ~RtpReceiver();
+    //! Start receiving on a UDP socket
+    // @param   fd              socket, made non-blocking
+    // @param   depacketizer    where packets of the socket go
+    // @param   clock           RTP timestamp clock of the stream in Hz, for arrival times
+    void add(int fd, Depacketizer* depacketizer, int clock);
+    //! Stop receiving on the socket, before it is closed
+    void remove(int fd);
+    //! Wait up to ms milliseconds for packets, and receive all there are
+    //! @return number of packets received
+    int  poll(int ms);
+    //! Number of sockets
+    int  size() const { return _streams.size(); }
+    //! Counters
+    const Stats& stats() const { return _stats; }
+private:
+    enum { MAX_EVENTS = 64 };
+    struct Stream {
+        int             fd;
+        Depacketizer*   depacketizer;
+        int             clock;
+    };
+    int                         _epoll;
+    std::map<int, Stream*>      _streams;
+    std::vector<uint8_t>        _buffers;   // BATCH packets of MAX_PACKET
+    std::vector<struct iovec>   _iov;
+    Stats                       _stats;
+
+    // read the socket until it is empty, return number of packets
+    int  receive(Stream* stream);
+    int  receive_mmsg(Stream* stream);
+    int  receive_each(Stream* stream);
+    void deliver(Stream* stream, const uint8_t* packet, int size, uint64_t now);
+
+    static bool _mmsg_enabled;
+
+    RtpReceiver(const RtpReceiver&);                // not implemented
+    RtpReceiver& operator=(const RtpReceiver&);     // not implemented
+};
+
+}
+#endif
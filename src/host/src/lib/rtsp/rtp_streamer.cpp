@@ -13,152 +13,89 @@
 *  destroy any copies you have made.                                         *
 \****************************************************************************/
 #include <fstream>
+#include <algorithm>
 #include <cstring>
+#include <cerrno>
+#include <ctime>
 #include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include "rtsp_impl.h"
 #include "rtp_streamer.h"
 #include "rtsp_source.h"
 #include "rtsp_talker.h"
 #include "rtcp.h"
-
-/*
-      RTP header according to RFC 3550
-       0                   1                   2                   3
-       0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
-      +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-      |V=2|P|X|  CC   |M|     PT      |       sequence number         |
-      +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-      |                           timestamp                           |
-      +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-      |           synchronization source (SSRC) identifier            |
-      +=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
-   Marker bit (M): 1 bit
-      Set for the very last packet of the access unit indicated by the
-      RTP timestamp, in line with the normal use of the M bit in video
-      formats, to allow an efficient playout buffer handling.  For
-      aggregation packets (STAP and MTAP), the marker bit in the RTP
-      header MUST be set to the value that the marker bit of the last
-      NAL unit of the aggregation packet would have been if it were
-      transported in its own RTP packet.  Decoders MAY use this bit as
-      an early indication of the last packet of an access unit but MUST
-      NOT rely on this property.
-
-         Informative note: Only one M bit is associated with an
-         aggregation packet carrying multiple NAL units.  Thus, if a
-         gateway has re-packetized an aggregation packet into several
-         packets, it cannot reliably set the M bit of those packets.
-
-   Payload type (PT): 7 bits
-      The assignment of an RTP payload type for this new packet format
-      is outside the scope of this document and will not be specified
-      here.  The assignment of a payload type has to be performed either
-      through the profile used or in a dynamic way.
-
-   Sequence number (SN): 16 bits
-      Set and used in accordance with RFC 3550.  For the single NALU and
-      non-interleaved packetization mode, the sequence number is used to
-      determine decoding order for the NALU.
-
-   Timestamp: 32 bits
-      The RTP timestamp is set to the sampling timestamp of the content.
-      A 90 kHz clock rate MUST be used.
-
-      If the NAL unit has no timing properties of its own (e.g.,
-      parameter set and SEI NAL units), the RTP timestamp is set to the
-      RTP timestamp of the primary coded picture of the access unit in
-      which the NAL unit is included, according to Section 7.4.1.2 of
-      [1].
-
-
-    RTP payload format for single NAL unit packet.
-     0                   1                   2                   3
-     0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
-    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-    |F|NRI|  Type   |                                               |
-    +-+-+-+-+-+-+-+-+                                               |
-    |                                                               |
-    |               Bytes 2..n of a single NAL unit                 |
-    |                                                               |
-    |                               +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-    |                               :...OPTIONAL RTP padding        |
-    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-
-
-   RTP payload format for FU-As (Fragmented Unit A).  An FU-A
-   consists of a fragmentation unit indicator of one octet, a
-   fragmentation unit header of one octet, and a fragmentation unit
-   payload.
-
-     0                   1                   2                   3
-     0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
-    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-    | FU indicator  |   FU header   |                               |
-    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+                               |
-    |                                                               |
-    |                         FU payload                            |
-    |                                                               |
-    |                               +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-    |                               :...OPTIONAL RTP padding        |
-    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-
-   The FU indicator octet has the following format:
-
-       +---------------+
-       |0|1|2|3|4|5|6|7|
-       +-+-+-+-+-+-+-+-+
-       |F|NRI|  Type   |
-       +---------------+
-
-   Values equal to 28 and 29 in the type field of the FU indicator octet
-   identify an FU-A and an FU-B, respectively.  The use of the F bit is
-   described in Section 5.3.  The value of the NRI field MUST be set
-   according to the value of the NRI field in the fragmented NAL unit.
-
-   The FU header has the following format:
-
-      +---------------+
-      |0|1|2|3|4|5|6|7|
-      +-+-+-+-+-+-+-+-+
-      |S|E|R|  Type   |
-      +---------------+
-
-   S:     1 bit
-          When set to one, the Start bit indicates the start of a
-          fragmented NAL unit.  When the following FU payload is not the
-          start of a fragmented NAL unit payload, the Start bit is set
-          to zero.
-
-   E:     1 bit
-          When set to one, the End bit indicates the end of a fragmented
-          NAL unit, i.e., the last byte of the payload is also the last
-          byte of the fragmented NAL unit.  When the following FU
-          payload is not the last fragment of a fragmented NAL unit, the
-          End bit is set to zero.
-
-   R:     1 bit
-          The Reserved bit MUST be equal to 0 and MUST be ignored by the
-          receiver.
-
-   Type:  5 bits
-          The NAL unit payload type as defined in Table 7-1 of [1].
-*/
-
+#include "udp_batch.h"
+#include "pacer.h"
+#include "send_queue.h"
+#include "packetizer.h"
+#include "gop_cache.h"
+
+// SO_TXTIME is newer than our toolchain headers (Linux 4.19); older kernels refuse it.
+#ifndef SO_TXTIME
+#define SO_TXTIME   61
+#define SCM_TXTIME  SO_TXTIME
+#endif
+
+namespace {
+// Same layout as struct sock_txtime
+struct SockTxtime {
+    clockid_t   clockid;
+    uint32_t    flags;
+};
+
+// Ask kernel to send packets at the time given with each of them, CLOCK_MONOTONIC is what fq qdisc uses
+bool enable_txtime(SBL::Socket socket) {
+    SockTxtime txtime = {CLOCK_MONOTONIC, 0};
+    if (::setsockopt(socket.id(), SOL_SOCKET, SO_TXTIME, &txtime, sizeof txtime) == 0)
+        return true;
+    SBL_MSG(RTSP::MSG::STREAMER, "SO_TXTIME not supported (%s), pacing by sleeping", strerror(errno));
+    return false;
+}
+}
 
 namespace RTSP {
 
 Client::Client(SBL::Socket sock, Streamer* str, SBL::Socket rtcp_socket, Talker* talker) : _state(STOP),
-        _socket(sock) , _streamer(str), _talker(talker),
+        _socket(sock) , _streamer(str), _talker(talker), _id(talker ? talker->id() : -1),
         _offs(sock.proto() == SBL::Socket::TCP ? 4 : 0),
         _rtcp_socket(rtcp_socket),
         _total_bytes(0), _total_packets(0),
         _last_rtcp_packet(0), _seq_number(0),
-        _temporal_level(0)
-        { SBL_MSG(MSG::STREAMER, "Created client %p with id %d for streamer %p and server %p",
+        _temporal_level(0), _batch(NULL), _queue(NULL),
+        _dropped_packets(0), _skip_count(0), _pacer(NULL), _txtime(false),
+        _replay(0), _replay_gop(0), _replay_wanted(false), _skipping(false),
+        _metrics(Metrics::registry().add_client(str->_metrics, _id,
+                 sock.proto() == SBL::Socket::TCP ? "tcp" : talker ? "udp" : "multicast")),
+        _detached(false), _owns_sockets(false)
+        { const Server::Options* options = application()->rtsp_server()->options();
+          if (sock.proto() == SBL::Socket::UDP && options->udp_batch)
+            _batch = new UdpBatch(str->_packet_size + Packet::MAX_HEADER);
+          if (sock.proto() == SBL::Socket::TCP)
+            _queue = new SendQueue(options->send_queue_size);
+          if (options->pace_clients) {
+            _pacer = new Pacer;
+            if (sock.proto() == SBL::Socket::UDP && options->txtime)
+                _txtime = enable_txtime(sock);
+          }
+          SBL_MSG(MSG::STREAMER, "Created client %p with id %d for streamer %p and server %p",
                     this, id(), str, talker);
         }
 
+Client::~Client() {
+    Metrics::registry().remove_client(_metrics);
+    delete _batch;
+    delete _queue;
+    delete _pacer;
+    if (_owns_sockets) {
+        _socket.close();
+        _rtcp_socket.close();
+    }
+}
+
+// Kept from the start, client may outlive its talker until the sending thread is off it
 int Client::id() const {
-    return _talker->id();
+    return _id;
 }
 
 void Client::increase_level() {
@@ -179,234 +116,290 @@ void Client::reduce_level() {
     }
 }
 
-Streamer::Streamer(int packet_size, int ssrc, int seq_number) : _frame_index(0) {
+Streamer::Streamer(int packet_size, int ssrc, int seq_number, bool stap_a) : _clients(new Clients), _sending(NULL), _client_count(0),
+        _retired_count(0), _group(NULL), _group_size(0), _frame_index(0), _syscalls_saved(0), _frame_start(false),
+        _metrics(Metrics::registry().add_stream("")) {
     _packet_size  = packet_size  == -1 ? 8900   : packet_size;
     _ssrc         = ssrc         == -1 ? rand() : ssrc;
     _seq_number   = seq_number   == -1 ? rand() : seq_number;
-    SBL_MSG(MSG::STREAMER, "Streamer %p: packet_size=%d, ssrc=%x, seq_num=%d", this, _packet_size, _ssrc, _seq_number);
+    _packetizer   = new Packetizer(_packet_size, _ssrc, stap_a);
+    _pacer        = new Pacer;
+    _replayer     = new Packetizer(_packet_size, _ssrc);
+    SBL_MSG(MSG::STREAMER, "Streamer %p: packet_size=%d, ssrc=%x, seq_num=%d, stap_a=%d", this, _packet_size, _ssrc, _seq_number, stap_a);
 }
 
-void Streamer::write_rtp_header(uint8_t* frame, bool last_packet) {
-    RTPHdr hdr;
-    hdr.flags      = htons((RTP_VERSION_NUMBER << 14) | ((last_packet & 1) << 7) | _source->payload_type());
-    hdr.seq_number = htons(_seq_number);
-    hdr.timestamp  = htonl(_timestamp);
-    hdr.ssrc       = htonl(_ssrc);
-    memcpy(frame, &hdr, sizeof hdr);
+Streamer::~Streamer() {
+    // sending thread is gone by now
+    reclaim();
+    delete _clients;
+    delete _packetizer;
+    delete _pacer;
+    delete _replayer;
+    Metrics::registry().remove_stream(_metrics);
 }
 
-inline void Streamer::write_fu_header(uint8_t* frame, bool last_packet) {
-    if (last_packet)              // add End bit
-        _fu_header |= NAL_END_BIT;
-    frame[RTP_HEADER]     = _fu_indicator;
-    frame[RTP_HEADER + 1] = _fu_header;
-    _fu_header &= ~NAL_START_BIT; // reset Start bit
+void Streamer::set_source(Source* source) {
+    _source = source;
+    Metrics::registry().set_name(_metrics, source->name());
 }
 
-inline void Streamer::create_fu_header(uint8_t* frame) {
-    _fu_indicator = (frame[0] & ~NAL_TYPE_MASK) | NAL_TYPE_FU_A;
-    _fu_header    = (frame[0] & NAL_TYPE_MASK)  | NAL_START_BIT;
-}
-
-void Streamer::send_frame(uint8_t* frame, int frame_size, uint32_t timestamp) {
+void Streamer::send_frame(const uint8_t* frame, int frame_size, uint32_t timestamp, bool last_slice) {
+    if (frame_size <= 0)
+        return;
+    _metrics->frames_in.add(1);
     _timestamp = timestamp;
+    _packetizer->begin(_source->payload_type(), timestamp, _seq_number);
     switch (_source->encoder_type()) {
-        case H264:  h264_send_frame(frame, frame_size);
+        case H264:  _frame_type = Source::frame_type(frame[0]);
+                    SBL_MSG(MSG::STREAMER, "H264 Frame '%c', size %d, timestamp %d", _frame_type, frame_size, _timestamp);
+                    if (_frame_type == 's' || _frame_type == 'p' || _frame_type == 'I')
+                        _frame_index = 0;
+                    _packetizer->h264(frame, frame_size, last_slice);
+                    // NAL unit may be held for aggregation, or go out after held ones
+                    if (!_packetizer->packets().empty())
+                        _frame_type = Source::frame_type(_packetizer->first_nal());
                     break;
-        case MJPEG: mjpeg_send_frame(frame, frame_size);
+        case MJPEG: SBL_MSG(MSG::STREAMER, "MJPEG frame size %d, timestamp %d", frame_size, _timestamp);
+                    _packetizer->mjpeg(frame, frame_size, _source->get_quality(), _source->get_width(), _source->get_height());
                     break;
-        case MPEG4: mpeg4_send_frame(frame, frame_size);
+        case MPEG4: _mp4_starter_frame = frame_size > 3 && frame[3] == 0xb0;
+                    SBL_MSG(MSG::STREAMER, "MPEG4 Frame '%d', size %d, timestamp %d", _mp4_starter_frame, frame_size, _timestamp);
+                    _packetizer->mpeg4(frame, frame_size);
                     break;
         default:    SBL_THROW("bad encoder type");
     }
+    const Packets& packets = _packetizer->packets();
+    if (packets.empty()) {
+        _frame_index++;
+        return;
+    }
+    _frame_start = true;
+    uint64_t start = Pacer::now();
+    bool pace_clients = set_pacing();
+    for (Packets::const_iterator it = packets.begin(); it != packets.end(); ++it) {
+        // stream is paced outside the lock, so that clients can still be added or removed
+        if (!pace_clients)
+            _pacer->wait(it->size());
+        send_packet(*it);
+    }
+    // packets point into the frame, nothing may hold on to them after this
+    // source has already put this frame into its GOP cache
+    GopCache* cache = _source->gop_cache();
+    bool sent = false;
+    const Clients& clients = pin();
+    for (Clients::const_iterator it = clients.begin(); it != clients.end(); ++it) {
+        if (cache)
+            replay(*it, cache);
+        sent |= (*it)->end_frame();
+    }
+    unpin();
+    if (sent)
+        _metrics->frames_out.add(1);
+    _metrics->send_latency.add((Pacer::now() - start) / 1000);
+    if (_source->encoder_type() == H264)
+        _frame_index++;
+}
+
+bool Streamer::set_pacing() {
+    const Server::Options* options = application()->rtsp_server()->options();
+    // bitrate is in kbps, rate in bytes per second
+    int rate = options->pacing_rate > 0 ? int(int64_t(_source->get_bitrate()) * 125 * options->pacing_rate / 100) : 0;
+    _pacer->set(options->packet_gap, rate, options->pacing_burst);
+    return options->pace_clients;
+}
+
+// Clients that just started playing get the current GOP from the cache, instead of waiting for the next one.
+// They catch up gop_cache_speed frames at a time, and start getting live frames once they are thru.
+void Streamer::replay(Client* client, GopCache* cache) {
+    if (client->_state == Client::REQUEST && client->_replay_wanted) {
+        client->_replay_wanted = false;
+        if (!cache->is_usable()) {
+            cache->miss();
+            return;
+        }
+        cache->hit();
+        // client was stopped and played again within this frame, what it had batched of it goes
+        if (client->_batch)
+            client->_batch->clear();
+        client->_state      = Client::REPLAY;
+        client->_replay     = 0;
+        client->_replay_gop = cache->gop();
+        SBL_MSG(MSG::STREAMER, "Client %d, starting from GOP cache, %d frames", client->id(), cache->count());
+    }
+    if (client->_state != Client::REPLAY)
+        return;
+    if (client->_replay_gop != cache->gop()) {
+        // new GOP started before client caught up, start over with it, or wait for the next one
+        if (!cache->is_usable()) {
+            client->_state = Client::REQUEST;
+            return;
+        }
+        client->_replay     = 0;
+        client->_replay_gop = cache->gop();
+    }
+    const Server::Options* options = application()->rtsp_server()->options();
+    int      speed  = options->gop_cache_speed;
+    int      end    = speed > 0 && client->_replay + speed < cache->count() ? client->_replay + speed : cache->count();
+    uint32_t latest = cache->entry(cache->count() - 1).timestamp;
+    while (client->_replay < end && client->_state == Client::REPLAY) {
+        const GopCache::Entry& entry = cache->entry(client->_replay++);
+        uint32_t timestamp = entry.timestamp;
+        // rebased timestamps go faster than real time, and meet the live ones when client catches up
+        if (options->gop_cache_rebase)
+            timestamp = _timestamp - (speed > 0 ? (latest - entry.timestamp) / speed : cache->count() - client->_replay);
+        _replayer->begin(_source->payload_type(), timestamp, 0);
+        // cached NAL units of a picture share its timestamp, the next picture has another one
+        bool last_slice = client->_replay == cache->count() || cache->entry(client->_replay).timestamp != entry.timestamp;
+        if (_source->encoder_type() == H264)
+            _replayer->h264(entry.data, entry.size, last_slice);
+        else
+            _replayer->mpeg4(entry.data, entry.size);
+        const Packets& packets = _replayer->packets();
+        for (Packets::const_iterator it = packets.begin(); it != packets.end(); ++it)
+            client->deliver(*it);
+    }
+    if (client->_state == Client::REPLAY && client->_replay == cache->count()) {
+        SBL_MSG(MSG::STREAMER, "Client %d, caught up with live stream", client->id());
+        client->_state = Client::PLAY;
+    }
 }
 
+// Send a single packet to all clients
+void Streamer::send_packet(const Packet& packet) {
+    // clients may be added or removed meanwhile, they just won't be in this snapshot
+    const Clients& clients = pin();
+    for (Clients::const_iterator it = clients.begin(); it != clients.end(); ++it) {
+        (*it)->send(packet);
+    }
+    unpin();
+    _seq_number++;
+    _frame_start = false;
+}
 
-// send a frame
-void Streamer::mpeg4_send_frame(uint8_t* frame, int frame_size) {
-    _mp4_starter_frame = (frame[3]==0xb0);
-    SBL_MSG(MSG::STREAMER, "MPEG4 Frame '%d', size %d, timestamp %d", _mp4_starter_frame, frame_size, _timestamp);
-    if (frame_size <= _packet_size) {
-        // small frame, doesn't need to be fragmented
-        write_rtp_header(frame - RTP_HEADER, !_mp4_starter_frame);
-        send_packet(frame - RTP_HEADER, frame_size + RTP_HEADER, !_mp4_starter_frame);
-    } else {
-        // large frame, will have to be segmented.
-        // move frame pointer back to make place for RTP header bytes
-        frame -= RTP_HEADER;
-        do {
-            bool last_packet = frame_size <= _packet_size;
-            write_rtp_header(frame, last_packet);
-            send_packet(frame, (frame_size < _packet_size ? frame_size : _packet_size)
-                        + RTP_HEADER, last_packet);
-            frame += _packet_size;
-            frame_size -= _packet_size;
-        } while (frame_size > 0);
-    }
-}
-
-void Streamer::h264_send_frame(uint8_t* frame, int frame_size) {
-    _frame_type = Source::frame_type(frame[0]);
-    SBL_MSG(MSG::STREAMER, "H264 Frame '%c', size %d, timestamp %d", _frame_type, frame_size, _timestamp);
-    if (_frame_type == 's' || _frame_type == 'p' || _frame_type == 'I')
-        _frame_index = 0;
-    if (frame_size <= _packet_size) {
-        // small frame, doesn't need to be fragmented
-        write_rtp_header(frame - RTP_HEADER, !(frame_type() == 'p' || frame_type() == 's'));
-        send_packet(frame - RTP_HEADER, frame_size + RTP_HEADER, true);
-    } else {
-        // large frame, will have to be segmented.
-        create_fu_header(frame);
-        // move frame pointer back to make place for RTP header and FU-A (Fragmentation Unit type A) byte
-        // FU-A header is in fact NAL header and is already in the frame, but FU-A indicator is not
-        frame -= RTP_HEADER + FU_INDICATOR;
-        // Only first fragment has FU-A header in the frame, subsequent ones don't and it has to be added
-        int first_fragment = FU_HEADER;
-        do {
-            bool last_packet = frame_size <= _packet_size;
-            write_rtp_header(frame, last_packet && !(frame_type() == 'p' || frame_type() == 's'));
-            // It is unclear if End bit of FU Header should be set for SPS/PPS frames. I *assume* it does.
-            // It probably doesn't matter, because SPS/PPS frames are small and don't need to be fragmented,
-            // therefore they don't use FU Header at all ('small frame' 'if' clause above).
-            write_fu_header(frame, last_packet);
-            send_packet(frame, (frame_size < _packet_size ? frame_size : _packet_size)
-                            + RTP_HEADER + FU_INDICATOR + FU_HEADER, last_packet);
-            frame += _packet_size;
-            frame_size -= _packet_size + first_fragment;
-            first_fragment = 0;
-        } while (frame_size > 0);
-    }
-    _frame_index++;
-}
-/*
-    JPEG Header, RFC 2435
-
-    0                   1                   2                   3
-    0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
-   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-   | Type-specific |              Fragment Offset                  |
-   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-   |      Type     |       Q       |     Width     |     Height    |
-   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-Type-specific: 8 bits
-
-   Interpretation depends on the value of the type field.  If no
-   interpretation is specified, this field MUST be zeroed on
-   transmission and ignored on reception.
-
-Fragment Offset: 24 bits
-   The Fragment Offset is the offset in bytes of the current packet in
-   the JPEG frame data. This value is encoded in network byte order
-   (most significant byte first). The Fragment Offset plus the length of
-   the payload data in the packet MUST NOT exceed 2^24 bytes.
-
-Type: 8 bits
-   The type field specifies the information that would otherwise be
-   present in a JPEG abbreviated table-specification as well as the
-   additional JFIF-style parameters not defined by JPEG.  Types 0-63 are
-   reserved as fixed, well-known mappings to be defined by this document
-   and future revisions of this document.  Types 64-127 are the same as
-   types 0-63, except that restart markers are present in the JPEG data
-   and a Restart Marker header appears immediately following the main
-   JPEG header.  Types 128-255 are free to be dynamically defined by a
-   session setup protocol (which is beyond the scope of this document).
-
-Q: 8 bits
-   The Q field defines the quantization tables for this frame.  Q values
-   0-127 indicate the quantization tables are computed using an
-   algorithm determined by the Type field (see below).  Q values 128-255
-   indicate that a Quantization Table header appears after the main JPEG
-   header (and the Restart Marker header, if present) in the first
-   packet of the frame (fragment offset 0).  This header can be used to
-   explicitly specify the quantization tables in-band.
-
-Width: 8 bits
-   This field encodes the width of the image in 8-pixel multiples (e.g.,
-   a width of 40 denotes an image 320 pixels wide).  The maximum width
-   is 2040 pixels.
-
-Height: 8 bits
-   This field encodes the height of the image in 8-pixel multiples
-   (e.g., a height of 30 denotes an image 240 pixels tall). When
-   encoding interlaced video, this is the height of a video field, since
-   fields are individually JPEG encoded. The maximum height is 2040
-   pixels.
-*/
-void Streamer::mjpeg_send_frame(uint8_t* frame, int frame_size) {
-    SBL_MSG(MSG::STREAMER, "MJPEG frame size %d, timestamp %d", frame_size, _timestamp);
-    frame -= RTP_HEADER + MJPEG_HEADER;
-    uint8_t* frame_start = frame;
+// Snapshot the sending thread goes thru is published in _sending, so that it isn't freed under it.
+// Snapshot is read again after publishing, in case it was replaced in between.
+const Streamer::Clients& Streamer::pin() {
+    Clients* clients;
     do {
-        bool last_packet = frame_size <= _packet_size;
-        write_rtp_header(frame, last_packet);
-        write_mjpeg_header(frame + RTP_HEADER, frame - frame_start);
-        send_packet(frame, (frame_size < _packet_size ? frame_size : _packet_size)
-                        + RTP_HEADER + MJPEG_HEADER, last_packet);
-        frame      += _packet_size;
-        frame_size -= _packet_size;
-    } while (frame_size > 0);
-}
-
-void Streamer::write_mjpeg_header(uint8_t* frame, uint32_t offset) {
-    MJPEGHdr hdr;
-    hdr.fragment_offset = htonl(offset & 0x00FFFFFF);
-    hdr.type    = MJPEG_TYPE;
-    hdr.quality = _source->get_quality();
-    hdr.width   = _source->get_width()  / 8;
-    hdr.height  = _source->get_height() / 8;
-    memcpy(frame, &hdr, sizeof hdr);
-}
-
-/*
-   Section 10.12 of RFC 2326
-   Stream data such as RTP packets is encapsulated by an ASCII dollar
-   sign (24 hexadecimal), followed by a one-byte channel identifier,
-   followed by the length of the encapsulated binary data as a binary,
-   two-byte integer in network byte order. The stream data follows
-   immediately afterwards, without a CRLF, but including the upper-layer
-   protocol headers. Each $ block contains exactly one upper-layer
-   protocol data unit, e.g., one RTP packet.
-*/
-
-// Send a single packet
-void Streamer::send_packet(uint8_t* packet, int tx_size, bool last_packet) {
-    // just in case this is interleaved TCP, prepend rtsp header
-    // this avoid checking and setting it in the loop.
-    *(packet - 4) = '$';
-    *(packet - 3) = '\0';
-    *(packet - 2) = tx_size >> 8;
-    *(packet - 1) = tx_size;
-    // locking so that someobody doesn't add or remove Clients on us while streaming
+        clients  = _clients;
+        _sending = clients;
+        __sync_synchronize();
+    } while (clients != _clients);
+    return *clients;
+}
+
+void Streamer::unpin() {
+    __sync_synchronize();
+    _sending = NULL;
+    __sync_synchronize();
+    if (_retired_count)
+        reclaim();
+}
+
+// Replace client snapshot. Sending thread may be on the old one, for as long as a paced client sleeps;
+// then it is retired, and the sending thread frees it once it is off. Otherwise it goes right away,
+// unless an older one is still retired: the removed client may be in that one too.
+void Streamer::publish(Clients* clients, Client* removed) {
+    Clients* old = _clients;
+    __sync_synchronize();
+    _clients      = clients;
+    _client_count = clients->size();
+    __sync_synchronize();
+    if (_sending != old && _retired.empty()) {
+        delete old;
+        delete removed;
+        return;
+    }
+    if (removed)
+        removed->detach();
+    _retired.push_back(std::make_pair(old, removed));
+    __sync_synchronize();
+    _retired_count = _retired.size();
+}
+
+void Streamer::reclaim() {
     _lock.lock();
-    for (Clients::iterator it = _clients.begin(); it != _clients.end(); ++it) {
-        (*it)->send(packet, tx_size, last_packet);
+    for (unsigned int n = 0; n < _retired.size(); n++) {
+        delete _retired[n].first;
+        delete _retired[n].second;
+    }
+    _retired.clear();
+    _retired_count = 0;
+    _lock.unlock();
+}
+
+void Streamer::print_client_stats(std::ostream& str) {
+    // snapshots are only freed by those holding the lock
+    _lock.lock();
+    const Clients& clients = *_clients;
+    for (Clients::const_iterator it = clients.begin(); it != clients.end(); ++it) {
+        Client* client = *it;
+        str << "client="        << client->id()
+            << " stream="       << (_source ? _source->name() : "")
+            << " transport="    << (client->is_interleaved() ? "tcp" : client->is_group() ? "multicast" : "udp")
+            << " queue_bytes="  << client->queue_bytes()
+            << " queue_packets="<< client->queue_packets()
+            << " dropped="      << client->dropped_packets()
+            << " skips="        << client->skip_count()
+            << " stall_ms="     << client->stall_ms()
+            << "\n";
     }
     _lock.unlock();
-    _seq_number++;
 }
 
 void Streamer::set_temporal_level(unsigned int level) {
     SBL_MSG(MSG::STREAMER, "Streamer %p, setting temporal level to %d", this, level);
-    for (Clients::iterator it = _clients.begin(); it != _clients.end(); ++it) {
+    _lock.lock();
+    const Clients& clients = *_clients;
+    for (Clients::const_iterator it = clients.begin(); it != clients.end(); ++it) {
         (*it)->set_temporal_level(level);
     }
+    _lock.unlock();
 }
 
 Client* Streamer::add_client(SBL::Socket socket, SBL::Socket rtcp_socket, Talker* talker) {
     Client* client = new Client(socket, this, rtcp_socket, talker);
     _lock.lock();
-    _clients.push_back(client);
+    Clients* clients = new Clients(*_clients);
+    clients->push_back(client);
+    publish(clients);
     _lock.unlock();
+    update_sessions();
     SBL_MSG(MSG::STREAMER, "Added client %d to streamer %s", client->id(), _name.c_str());
     return client;
 }
 
+Client* Streamer::join_group(SBL::Socket socket, SBL::Socket rtcp_socket, const Group& group) {
+    if (!_group) {
+        _group      = add_client(socket, rtcp_socket);
+        _group->_owns_sockets = true;
+        _group_info = group;
+        SBL_INFO("Streamer %p, multicast group %s:%d created", this, group.address, group.port);
+    }
+    _group_size++;
+    update_sessions();
+    SBL_MSG(MSG::STREAMER, "Streamer %p, multicast group has %d members", this, _group_size);
+    return _group;
+}
+
 void Streamer::delete_client(Client* client) {
+    // group keeps sending until its last member leaves
+    bool group = client == _group;
+    if (group) {
+        if (--_group_size > 0) {
+            update_sessions();
+            return;
+        }
+        SBL_INFO("Streamer %p, last member left multicast group %s:%d", this, _group_info.address, _group_info.port);
+        _group = NULL;
+    }
     SBL_MSG(MSG::STREAMER, "Removing client %d from streamer %s", client->id(), _name.c_str());
     _lock.lock();
-    _clients.remove(client);
+    Clients* clients = new Clients(*_clients);
+    clients->erase(std::remove(clients->begin(), clients->end(), client), clients->end());
+    publish(clients, client);
     _lock.unlock();
-    delete client;
+    update_sessions();
 }
 
 uint32_t Streamer::timestamp()  {
@@ -414,12 +407,24 @@ uint32_t Streamer::timestamp()  {
     return source()->timestamp();
 }
 
-void Client::send(uint8_t* packet, int size, bool last_packet) {
-    if (_state == REQUEST && !(_streamer->source()->encoder_type() == H264 && _streamer->frame_type() != 's')
+void Client::send(const Packet& packet) {
+    // keep backlog moving, even if this client doesn't take this frame
+    if (_queue && _state != STOP && !drain()) {
+        _state = STOP;
+        SBL_WARN("Switching off client %d due to socket error", id());
+        return;
+    }
+    // client (re)starts at the beginning of an I-frame (or any frame for MJPEG)
+    if (_state == REQUEST && _streamer->_frame_start
+        && !(_streamer->source()->encoder_type() == H264 && _streamer->frame_type() != 's')
         && !(_streamer->source()->encoder_type() == MPEG4 && !_streamer->is_mpeg4_starter_frame())) {
         SBL_MSG(MSG::STREAMER, "Client %d, starting to play", id());
         _state = PLAY;
+        _replay_wanted = false;
+        _skipping = false;
     }
+    if (_state == REQUEST && _skipping && _streamer->_frame_start)
+        _metrics->drop_frame();
     if (_state != PLAY)
         return;
     if (skip_frame(_streamer->frame_index())) {
@@ -427,34 +432,252 @@ void Client::send(uint8_t* packet, int size, bool last_packet) {
                 id(), _streamer->frame_index(), _temporal_level);
         return;
     }
-    // This implements packet gap
-    application()->rtsp_server()->packet_wait();
-    packet[Streamer::RTP_SEQ_NUM]     = _seq_number >> 8;
-    packet[Streamer::RTP_SEQ_NUM + 1] = _seq_number;
+    deliver(packet);
+}
 
-    SBL_MSG(MSG::STREAMER, "Client %d, send packet size %d", id(), size);
-    if (_socket.send(packet - _offs, size + _offs, false)) {
+void Client::deliver(const Packet& packet) {
+    // Batching would defeat pacing, so it is used only when there is no pacing
+    bool batch = _batch && !_streamer->_pacer->is_enabled();
+    if (!batch) {
+        if (_pacer) {
+            _pacer->set(*_streamer->_pacer);
+            if (!_txtime)
+                _pacer->wait(packet.size());
+        }
+        // pacing could have been switched on in the middle of a frame
+        if (_batch && !_batch->empty() && batch_flush() == SEND_ERROR) {
+            _state = STOP;
+            SBL_WARN("Switching off client %d due to socket error", id());
+            return;
+        }
+    }
+    // packet is shared by all clients, so each one patches its sequence number into a copy of the header
+    uint8_t header[Packet::PREFIX + Packet::MAX_HEADER];
+    int     header_size = _offs + packet.header_size;
+    memcpy(header, packet.header + Packet::PREFIX - _offs, header_size);
+    header[_offs + Packet::RTP_SEQ_NUM]     = _seq_number >> 8;
+    header[_offs + Packet::RTP_SEQ_NUM + 1] = _seq_number;
+
+    SBL_MSG(MSG::STREAMER, "Client %d, send packet size %d", id(), packet.size());
+    SendStatus status = batch  ? batch_send(header, header_size, packet)
+                      : _queue ? queue_send(header, header_size, packet)
+                      :          udp_send(header, header_size, packet);
+    if (status == SEND_OK) {
         _seq_number++;
-        _total_bytes += size;
+        _sent.packets++;
+        _sent.bytes += _offs + packet.size();
+        _total_bytes += packet.size();
         _total_packets++;
         uint32_t ts = timestamp();
-        if (last_packet && ts - _last_rtcp_packet > RTCP_INTERVAL) {
+        if (packet.last && ts - _last_rtcp_packet > RTCP_INTERVAL) {
             send_sender_rtcp();
             _last_rtcp_packet = ts;
         }
-    } else {
+    } else if (status == SEND_ERROR) {
         _state = STOP;
         SBL_WARN("Switching off client %d due to socket error", id());
     }
 }
 
+Client::SendStatus Client::batch_send(const uint8_t* header, int header_size, const Packet& packet) {
+    if (!_batch->fits(header_size + packet.payload_size) && batch_flush() == SEND_ERROR)
+        return SEND_ERROR;
+    _batch->add(header, header_size, packet.payload, packet.payload_size);
+    // packets dropped at flush were counted as sent, sequence numbers will show the gap to the client
+    return packet.last && batch_flush() == SEND_ERROR ? SEND_ERROR : SEND_OK;
+}
+
+Client::SendStatus Client::batch_flush() {
+    int packets  = _batch->count();
+    int dropped  = 0;
+    int syscalls = _batch->flush(_socket, dropped);
+    if (syscalls < 0)
+        return SEND_ERROR;
+    _streamer->_syscalls_saved += packets - syscalls;
+    _sent.syscalls += syscalls;
+    _sent.would_block += dropped > 0;
+    SBL_MSG(MSG::STREAMER, "Client %d, sent %d packets in %d syscalls", id(), packets, syscalls);
+    if (dropped) {
+        overflow(dropped);
+        return SEND_DROPPED;
+    }
+    return SEND_OK;
+}
+
+bool Client::drain() {
+    _queue_lock.lock();
+    bool ok = _detached || _queue->drain(_socket);
+    _queue_lock.unlock();
+    return ok;
+}
+
+// Only interleaved clients share their socket with the talker, which closes it once the client is
+// removed; everything sent to it goes thru the send queue, under _queue_lock
+void Client::detach() {
+    _queue_lock.lock();
+    _detached = true;
+    _queue_lock.unlock();
+}
+
+bool Client::is_backlogged() {
+    if (!_queue)
+        return false;
+    _queue_lock.lock();
+    bool backlogged = !_queue->empty();
+    _queue_lock.unlock();
+    return backlogged;
+}
+
+Client::SendStatus Client::queue_send(const uint8_t* header, int header_size, const Packet& packet) {
+    SendStatus status = SEND_ERROR;
+    _queue_lock.lock();
+    if (_detached) {
+        _queue_lock.unlock();
+        return SEND_DROPPED;
+    }
+    switch (_queue->send(_socket, header, header_size, packet.payload, packet.payload_size)) {
+        case SendQueue::SENT:
+        case SendQueue::QUEUED: status = SEND_OK;
+                                break;
+        case SendQueue::FULL:   overflow(_queue->drop() + 1);
+                                status = SEND_DROPPED;
+                                break;
+        case SendQueue::BROKEN: cut_off();
+                                break;
+        default:                break;
+    }
+    _queue_lock.unlock();
+    return status;
+}
+
+Client::SendStatus Client::udp_send(const uint8_t* header, int header_size, const Packet& packet) {
+    struct iovec iov[2];
+    iov[0].iov_base = const_cast<uint8_t*>(header);
+    iov[0].iov_len  = header_size;
+    iov[1].iov_base = const_cast<uint8_t*>(packet.payload);
+    iov[1].iov_len  = packet.payload_size;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = 2;
+    // with SO_TXTIME, packet is handed over right away, and kernel holds it until it's due
+    char control[CMSG_SPACE(sizeof(uint64_t))];
+    if (_txtime) {
+        uint64_t due = _pacer->schedule(packet.size());
+        if (!due)
+            due = Pacer::now();
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof control;
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type  = SCM_TXTIME;
+        cmsg->cmsg_len   = CMSG_LEN(sizeof due);
+        memcpy(CMSG_DATA(cmsg), &due, sizeof due);
+    }
+    _sent.syscalls++;
+    if (::sendmsg(_socket.id(), &msg, MSG_DONTWAIT | MSG_NOSIGNAL) == header_size + packet.payload_size)
+        return SEND_OK;
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        SBL_WARN("Client %d, send error: %s", id(), strerror(errno));
+        return SEND_ERROR;
+    }
+    _sent.would_block++;
+    overflow(1);
+    return SEND_DROPPED;
+}
+
+bool Client::end_frame() {
+    // batch points into the frame, so it can't wait for the next one
+    if (_batch && !_batch->empty()) {
+        if (_state != PLAY) {
+            _batch->clear();
+        } else if (batch_flush() == SEND_ERROR) {
+            _state = STOP;
+            SBL_WARN("Switching off client %d due to socket error", id());
+        }
+    }
+    // send queue counts its syscalls, replies and draining by the talker included
+    if (_queue) {
+        _queue_lock.lock();
+        _sent.add_io(_queue->stats());
+        _queue->clear_stats();
+        _queue_lock.unlock();
+    }
+    bool sent = _sent.packets > 0;
+    if (sent || _sent.syscalls) {
+        _metrics->add(_sent);
+        _sent.clear();
+    }
+    return sent;
+}
+
+void Client::overflow(int dropped) {
+    _dropped_packets += dropped;
+    _metrics->drop_packets(dropped);
+    if (_state == PLAY || _state == REPLAY) {
+        _skip_count++;
+        _state = REQUEST;
+        _skipping = true;
+        _metrics->drop_frame();
+        SBL_WARN("Client %d too slow, dropped %d packets, waiting for next I-frame", id(), dropped);
+    }
+}
+
+// Client can't go on without the rest of the packet, so the connection is shut down, which has the talker tear it down
+void Client::cut_off() {
+    _dropped_packets++;
+    _metrics->drop_packets(1);
+    SBL_WARN("Client %d, send queue too small for the rest of a packet, disconnecting", id());
+    ::shutdown(_socket.id(), SHUT_RDWR);
+}
+
+bool Client::send_control(const char* buffer, int size) {
+    SBL_ASSERT(_queue);
+    _queue_lock.lock();
+    if (_detached) {
+        _queue_lock.unlock();
+        return false;
+    }
+    SendQueue::Status status = _queue->send(_socket, (const uint8_t*) buffer, size, true);
+    if (status == SendQueue::FULL) {
+        // RTSP reply is more important than the video
+        overflow(_queue->drop());
+        status = _queue->send(_socket, (const uint8_t*) buffer, size, true);
+    }
+    if (status == SendQueue::BROKEN)
+        cut_off();
+    _queue_lock.unlock();
+    if (status == SendQueue::FULL)
+        SBL_WARN("Client %d, no room for RTSP message of %d bytes in send queue", id(), size);
+    return status == SendQueue::SENT || status == SendQueue::QUEUED;
+}
+
+int Client::queue_bytes() const {
+    return _queue ? _queue->bytes() : 0;
+}
+
+int Client::queue_packets() const {
+    return _queue ? _queue->packets() : 0;
+}
+
+unsigned int Client::stall_ms() const {
+    return _queue ? _queue->stall_ms() : 0;
+}
+
 void Client::set_temporal_level(unsigned int level) {
     SBL_MSG(MSG::STREAMER, "Client %d, setting temporal level to %d", id(), level);
     _temporal_level = level;
 }
 
 void Client::play() {
+    // another member joined a group that is already streaming, it picks up wherever the group is
+    if (is_group() && _state != STOP) {
+        _streamer->source()->play();
+        return;
+    }
+    // leftovers of a frame interrupted by stop() are dropped by the streaming thread, which owns the batch
     _state = REQUEST;
+    _replay_wanted = true;
     _streamer->source()->play();
 }
 
@@ -511,7 +734,20 @@ void Client::send_sender_rtcp() {
                          _total_packets,
                          timestamp(),
                          hdr.sdes.name);
-    if (!_rtcp_socket.send(buffer - _offs, size + _offs, false))
+    // for TCP, RTCP goes thru the same queue as RTP, so it doesn't cut into a partially sent packet
+    bool sent = true;
+    if (_queue) {
+        _queue_lock.lock();
+        SendQueue::Status status = SendQueue::SENT;
+        if (!_detached)
+            status = _queue->send(_rtcp_socket, (uint8_t*) buffer - _offs, size + _offs);
+        if (status == SendQueue::BROKEN)
+            cut_off();
+        _queue_lock.unlock();
+        sent = status == SendQueue::SENT || status == SendQueue::QUEUED;
+    } else
+        sent = _rtcp_socket.send(buffer - _offs, size + _offs, false);
+    if (!sent)
         SBL_WARN("RTCP Message send failed, socket %d", _rtcp_socket.id());
 }
 
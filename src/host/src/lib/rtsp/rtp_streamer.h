@@ -16,25 +16,50 @@
 *  destroy any copies you have made.                                         *
 \****************************************************************************/
 #include <cstdlib>
-#include <list>
+#include <utility>
+#include <vector>
+#include <ostream>
 #include <sbl/sbl_logger.h>
 #include <sbl/sbl_socket.h>
 #include <sbl/sbl_thread.h>
+#include "metrics.h"
 
 namespace RTSP {
 class Source;
 class Streamer;
 class Talker;
+class UdpBatch;
+class SendQueue;
+class Packetizer;
+class Pacer;
+class GopCache;
+struct Packet;
+
+//! Multicast destination of a stream, shared by all its multicast clients
+struct Group {
+    int     slot;                                   //!< address and port pair, as numbered by the server
+    char    address[SBL::Socket::IP_ADDR_BUFF_SIZE];//!< group address, in 239.1.2.3 notation
+    int     port;                                   //!< RTP port, RTCP goes to the next one
+    int     ttl;                                    //!< multicast time to live
+};
 
 //! Represents a single remote client.
+/*! A multicast group is a Client as well, with no talker of its own; it is shared by all
+    Talkers that asked for multicast, and sends each packet to the group only once. */
 class Client { 
 public:
     //! Client constructor
     // @param   sock    Socket associated with the client
     // @param   str     parent Streamer object
+    // @param   talker  Talker of this client, NULL for multicast group
     Client(SBL::Socket sock, Streamer* str, SBL::Socket rtcp_socket, Talker* talker);
+    //! Client destructor
+    ~Client();
     //! send RTP packet
-    void send(uint8_t* packet, int size, bool last_packet);
+    void send(const Packet& packet);
+    //! called after the last packet of each frame, nothing may refer to the frame after this
+    // @return  true if client got a packet of the frame
+    bool end_frame();
     //! return current timestamp
     uint32_t  timestamp()  const;
     //! return current sequence number
@@ -59,14 +84,40 @@ public:
     void reduce_level();
     //! Unique ID of this client
     int id() const;
+    //! return true if RTP goes thru RTSP (TCP) connection
+    bool is_interleaved() const { return _queue != NULL; }
+    //! return true if this is the multicast group of the stream
+    bool is_group() const { return _talker == NULL; }
+    //! send RTSP reply on interleaved connection, in order with RTP packets, without blocking;
+    //! whatever socket doesn't take at once stays in the send queue, for drain()
+    // @return false if the connection is broken, or too slow to take the reply
+    bool send_control(const char* buffer, int size);
+    //! send whatever is waiting in TCP send queue, return false if connection is broken
+    bool drain();
+    //! return true if TCP send queue holds data that socket didn't take yet
+    bool is_backlogged();
+    //! bytes waiting in the send queue (always 0 for UDP)
+    int  queue_bytes() const;
+    //! packets waiting in the send queue (always 0 for UDP)
+    int  queue_packets() const;
+    //! total time (ms) the send queue was backed up
+    unsigned int stall_ms() const;
+    //! packets dropped because the client was too slow
+    unsigned int dropped_packets() const { return _dropped_packets; }
+    //! how many times client was skipped to the next I-frame
+    unsigned int skip_count() const { return _skip_count; }
+    //! streaming metrics of this client
+    ClientMetrics* metrics() const { return _metrics; }
 private:
-    enum State {STOP, REQUEST, PLAY};
+    enum State {STOP, REQUEST, REPLAY, PLAY};     // REPLAY: catching up from GOP cache
     enum {RTCP_INTERVAL = 5 * 90000, TEMPORAL_LEVELS = 3};
+    enum SendStatus {SEND_OK, SEND_DROPPED, SEND_ERROR};
     State       _state;    
     SBL::Socket _socket;  
     Streamer*   _streamer; 
     Talker*     _talker;
-    // For TCP, additional data must be inserted in front of the frame
+    int         _id;
+    // For TCP, interleaved prefix goes in front of RTP header
     int         _offs;  // so _offs is either 0 or 4.
     // Socket for RTCP packets out
     SBL::Socket _rtcp_socket;
@@ -80,6 +131,49 @@ private:
     uint16_t    _seq_number;
     // current temporal level (0, 1, 2), 0 is full, 2 is 4X
     unsigned int _temporal_level;
+    // UDP packets of the current frame, sent together at the end of frame (NULL for TCP)
+    UdpBatch*   _batch;
+    // TCP send queue, so that slow client doesn't block the others (NULL for UDP)
+    SendQueue*  _queue;
+    unsigned int _dropped_packets;
+    unsigned int _skip_count;
+    // this client's own pacing, when clients are paced separately (NULL otherwise)
+    Pacer*      _pacer;
+    // true if kernel paces this client's packets (SO_TXTIME), rather than us sleeping
+    bool        _txtime;
+    // next GOP cache entry to send while in REPLAY, and GOP it belongs to
+    int         _replay;
+    unsigned int _replay_gop;
+    // client just asked to play, try starting it from the GOP cache
+    bool        _replay_wanted;
+    // client was dropped to the next I-frame, frames until then are counted as dropped
+    bool        _skipping;
+    // sent since the end of the previous frame, added to _metrics at the end of frame
+    SendStats   _sent;
+    ClientMetrics* _metrics;
+    // TCP send queue is used by streaming thread and RTSP replies from talker
+    SBL::Mutex  _queue_lock;
+    // removed from the streamer while the streaming thread may still be on it; talker may close
+    // the socket from now on, so nothing more is sent (guarded by _queue_lock)
+    bool        _detached;
+    // multicast group sockets belong to no talker, the group closes them when it goes
+    bool        _owns_sockets;
+    // send packet to this client, whatever frame it belongs to
+    void        deliver(const Packet& packet);
+    // stop using the socket, called by the streamer when the client is removed
+    void        detach();
+    // queue packet in _batch, flush it at the end of frame
+    SendStatus  batch_send(const uint8_t* header, int header_size, const Packet& packet);
+    // send everything queued in _batch
+    SendStatus  batch_flush();
+    // send thru TCP send queue
+    SendStatus  queue_send(const uint8_t* header, int header_size, const Packet& packet);
+    // send UDP packet right away, without blocking
+    SendStatus  udp_send(const uint8_t* header, int header_size, const Packet& packet);
+    // client is too slow, drop packets and wait for the next I-frame
+    void        overflow(int dropped);
+    // packet went out in part and the rest doesn't fit in send queue, drop it and disconnect
+    void        cut_off();
     // returns true if this frame should be skipped
     bool        skip_frame(unsigned int frame_index) {
         return frame_index & (3 >> (2 - _temporal_level));
@@ -90,10 +184,11 @@ private:
 //! Responsible for sending frames to remote clients.
 /*! Streamer supports both UDP and TCP (interleaved RTSP) transport mechanisms. For TCP, it prepends interleaved
     4-byte prefix to the frame, but otherwise doesn't distinguish between UDP and TCP.\n
+    Each frame is cut into packets once, by Packetizer; every client then sends the same packet descriptors,
+    with its own sequence number in its copy of the header. Frame itself is never written to.\n
     @b IMPORTANT:
     @li Each call to send_frame() should present a full frame, i.e. a NAL unit (Network Abstraction Layer)
         and frame parameter must point to NAL unit type octet.
-    @li frame must have 17 bytes *in front* of it free for the first RTP header
     @li sources must send sps/pps before each I-frame
 */
 class Streamer {
@@ -104,17 +199,21 @@ public:
     // @param   packet_size  by default, packet_size is 1434, which prevents IP fragmentation
     // @param   ssrc         initial ssrc, by default it is a random number
     // @param   seq_number   initial sequence number, by default it is a random number   
-    Streamer(int packet_size = -1, int ssrc = -1, int seq_number = -1);
+    // @param   stap_a       aggregate SPS, PPS and SEI NAL units with the following picture into STAP-A packets
+    Streamer(int packet_size = -1, int ssrc = -1, int seq_number = -1, bool stap_a = false);
+    //! Streamer destructor
+    ~Streamer();
     //! send a frame to all connected clients
-    // @param   frame       frame pointer (must have 17 bytes in front of it free
+    // @param   frame       frame pointer, frame is only read and may be shared with others
     // @param   frame_size  size of the frame, in bytes
     // @param   timestamp   Streamer doesn't process timestamps, just forwards them in packets
-    void send_frame(uint8_t* frame, int frame_size, uint32_t timestamp);
+    // @param   last_slice  H.264 only: no more slices of the picture follow (see Packetizer::h264())
+    void send_frame(const uint8_t* frame, int frame_size, uint32_t timestamp, bool last_slice = true);
 
     //! add a client with a given socket
     // @param   socket  socket to use for this client
-    // @details This method will wait on a mutex to avoid updating Streamer client list while 
-    // packets are being sent.
+    // @details Client list is copied and the copy replaces it, so packets being sent are not held up.
+    // Waits for the sending thread to finish the packet it is on before the old list is freed.
     Client* add_client(SBL::Socket socket, SBL::Socket rtcp_socket, Talker* talker = NULL);
     
     //! Remove a client from a client list
@@ -124,12 +223,27 @@ public:
     //! return a Source associated with this Client
     Source* source()  const { return _source; }
     
-    //! Set a source associated with this Client
-    void set_source(Source* source) { _source = source; }
+    //! Set a source associated with this Client, metrics of the stream go by its name
+    void set_source(Source* source);
     
     //! Return how many clients with Streamer has. 
-    //! This includes all client, active (play = true) or inactive (play = false)
-    int client_count() const { return _clients.size(); }
+    //! This includes all client, active (play = true) or inactive (play = false),
+    //! and counts every member of the multicast group
+    int client_count() const { return _client_count + (_group ? _group_size - 1 : 0); }
+
+    //! Add a member to the multicast group, creating the group client if this is the first one
+    // @param   socket, rtcp_socket sockets connected to the group, only used when the group is created
+    // @details Group client is deleted by delete_client() of its last member.
+    Client* join_group(SBL::Socket socket, SBL::Socket rtcp_socket, const Group& group);
+
+    //! Return multicast group client, or NULL if no client asked for multicast
+    Client* group() const { return _group; }
+
+    //! Return multicast destination, valid only while group() is not NULL
+    const Group& group_info() const { return _group_info; }
+
+    //! Return how many clients share the multicast group
+    int group_size() const { return _group_size; }
     
     //! Return the current timestamp.
     //! Streamer forwards this to source, because it may not be receiving any frames yet
@@ -143,66 +257,65 @@ public:
 
     //! Set new temporal level for all clients (for testing)
     void set_temporal_level(unsigned int level);
+
+    //! Return how many send syscalls were saved by batching UDP packets, since streamer creation
+    unsigned long long syscalls_saved() const { return _syscalls_saved; }
+
+    //! Print send queue statistics of all clients, one line per client
+    void print_client_stats(std::ostream& str);
+
+    //! Return streaming metrics of this stream
+    StreamMetrics* metrics() const { return _metrics; }
 private:
-    // RTP header
-    struct RTPHdr {
-        uint16_t    flags;
-        uint16_t    seq_number;
-        uint32_t    timestamp;
-        uint32_t    ssrc;
-    };
-    struct MJPEGHdr {
-        uint32_t    fragment_offset; // MJPEG type is fixed
-        uint8_t     type;
-        uint8_t     quality;
-        uint8_t     width;
-        uint8_t     height;
-    };
-    // Constants
-    enum    {
-             RTP_HEADER     = sizeof(struct RTPHdr), 
-             MJPEG_HEADER   = sizeof(struct MJPEGHdr),
-             MJPEG_TYPE     = 1,
-             RTP_SEQ_NUM    = 2,
-             NAL_SPS        = 7,
-             FU_INDICATOR   = 1,  // size of FU-A Indicator in bytes
-             FU_HEADER      = 1,     // size of FU-A Header in bytes
-             NAL_TYPE_FU_A  = 28,    // Fragmentation Unit A
-             NAL_TYPE_MASK  = 0x1F,  // Mask to get NAL Type from NAL Header (5 bits) 
-             NAL_START_BIT  = 1 << 7,    // Start and End bit in NAL Header
-             NAL_END_BIT    = 1 << 6,
-             RTP_VERSION_NUMBER = 2 // RTP version (is always 2)
-             };
-    typedef std::list<Client*> Clients;
-    Clients         _clients;           // clients for this streamer
+    enum {RTP_VERSION_NUMBER = 2}; // RTP version (is always 2)
+    // clients at one point in time, never changed once published, replaced as a whole
+    typedef std::vector<Client*> Clients;
+    Clients* volatile _clients;         // current snapshot of clients for this streamer
+    Clients* volatile _sending;         // snapshot sending thread is going thru, NULL between packets
+    volatile int    _client_count;      // size of _clients, readable without the lock
+    // snapshots the sending thread may still be on, with the client removed from each (or NULL); guarded by _lock
+    std::vector<std::pair<Clients*, Client*> > _retired;
+    volatile int    _retired_count;     // size of _retired, readable without the lock
+    Client*         _group;             // multicast group, also in _clients
+    int             _group_size;        // number of clients sharing _group
+    Group           _group_info;
     Source*         _source; 
     std::string     _name;
     int             _packet_size;       // Transport protocol (UDP/TCP) packet size;
     uint32_t        _ssrc;              // synchronization source identifier
     uint32_t        _timestamp;
     uint16_t        _seq_number;        // rtp packet sequence number
-    uint8_t         _fu_header;         // FU-A header
-    uint8_t         _fu_indicator;      // FU-A indicator
-    SBL::Mutex      _lock;              
+    Packetizer*     _packetizer;        // packets of the current frame
+    Pacer*          _pacer;             // pacing of the whole stream, settings for paced clients
+    Packetizer*     _replayer;          // packets of GOP cache frames, for clients catching up
+    SBL::Mutex      _lock;              // serializes changes to the client set, sending doesn't take it
     unsigned int    _frame_index;       // 0 for SPS/PPS/I-frame, increments thereafter
     char            _frame_type;
     bool            _mp4_starter_frame;    
+    unsigned long long _syscalls_saved; // packets sent minus syscalls used, for batched UDP clients
+    bool            _frame_start;       // true while sending first packet of a frame
+    StreamMetrics*  _metrics;           // counters of this stream, in the metrics registry
 
-    // Add RTP header 
-    void write_rtp_header(uint8_t* frame, bool last_packet);
-    // Add FU header and indicator bytes
-    inline void write_fu_header (uint8_t* frame, bool last_packet);
-    // create FU-A header and indicator
-    inline void create_fu_header(uint8_t* frame);
-    // send single RTP packet. 
-    void send_packet(uint8_t* frame, int tx_size, bool last_packet);
+    // send single RTP packet to all clients
+    void send_packet(const Packet& packet);
+    // return current client snapshot, which stays valid until unpin()
+    const Clients& pin();
+    // sending thread is done with the snapshot, it frees those retired meanwhile
+    void unpin();
+    // make a new client snapshot current, the old one goes with the client removed from it (if any);
+    // never waits for the sending thread, call with _lock held
+    void publish(Clients* clients, Client* removed = NULL);
+    // free retired snapshots and clients, called by the sending thread when it is off them
+    void reclaim();
+    // start or continue sending GOP cache to a client
+    void replay(Client* client, GopCache* cache);
+    // update pacing from server options and stream bitrate, return true if clients are paced separately
+    bool set_pacing();
+    // publish the number of clients, call after adding or removing one
+    void update_sessions() { _metrics->sessions = client_count(); }
     // current frame type
     char frame_type() const { return _frame_type; }
     bool is_mpeg4_starter_frame() {return _mp4_starter_frame;}
-    void h264_send_frame (uint8_t* frame, int frame_size);
-    void mjpeg_send_frame(uint8_t* frame, int frame_size);
-    void mpeg4_send_frame (uint8_t* frame, int frame_size);
-    void write_mjpeg_header(uint8_t* frame, uint32_t offset);
 };
 /* 
 RTP_PAYLOAD size calculations:
@@ -22,9 +22,10 @@
 void sdk_setup(const char* rom_file, int stream_count) {}
 #endif
 
-/* --------------------------------------------------------------------------------*/
-/*                  SDK callback for to send a frame                               */
-void rtsp_send_frame(unsigned int chan_num, unsigned int stream_num, uint8_t* frame, int size, uint32_t timestamp, RTSP::EncoderType encoder) {
+namespace {
+// Send a frame to the source of a given channel and stream, frame_ref is the pool buffer holding it, if any
+void send_frame(unsigned int chan_num, unsigned int stream_num, uint8_t* frame, int size, uint32_t timestamp,
+                RTSP::EncoderType encoder, const RTSP::FrameRef& frame_ref) {
     RTSP::Server* server = RTSP::application()->rtsp_server();
     if (!server)
         return;
@@ -36,9 +37,14 @@ void rtsp_send_frame(unsigned int chan_num, unsigned int stream_num, uint8_t* fr
         if (stream_id < 0) {
             SBL_ERROR("Incorrect channel number %d or stream number %d", chan_num, stream_num);
         } else {
-            RTSP::Source* source = server->get_source(stream_id);
-            // get_source() always returns a source (creating one if neccessary, so don't need to check for NULL
-            source->send_frame(frame, size, timestamp, encoder);
+            // lookup doesn't lock, so clients being set up don't hold up the frames
+            RTSP::Source* source = server->try_get_source(stream_id);
+            if (!source)
+                SBL_MSG(RTSP::MSG::SERVER, "Server busy, dropping frame of new stream %d", stream_id);
+            else if (frame_ref.is_valid())
+                source->send_shared_frame(frame_ref, timestamp, encoder);
+            else
+                source->send_frame(frame, size, timestamp, encoder);
         }
     } catch (RTSP::Errcode error_code) {
         SBL_ERROR("Callback caught error code %d", error_code);
@@ -46,6 +52,27 @@ void rtsp_send_frame(unsigned int chan_num, unsigned int stream_num, uint8_t* fr
         SBL_ERROR("Callack caught exception %s", ex.what());
     }
 }
+}
+
+/* --------------------------------------------------------------------------------*/
+/*                  SDK callback for to send a frame                               */
+void rtsp_send_frame(unsigned int chan_num, unsigned int stream_num, uint8_t* frame, int size, uint32_t timestamp, RTSP::EncoderType encoder) {
+    send_frame(chan_num, stream_num, frame, size, timestamp, encoder, RTSP::FrameRef());
+}
+
+RTSP::FrameRef rtsp_copy_frame(const uint8_t* frame, int size) {
+    RTSP::Server* server = RTSP::application()->rtsp_server();
+    if (!server)
+        return RTSP::FrameRef();
+    return server->frame_pool()->copy(frame, size);
+}
+
+void rtsp_send_frame(unsigned int chan_num, unsigned int stream_num, const RTSP::FrameRef& frame, uint32_t timestamp, RTSP::EncoderType encoder) {
+    if (!frame.is_valid())
+        return;
+    // Streamer only reads the frame, so it can be passed on to other consumers after this
+    send_frame(chan_num, stream_num, frame.data(), frame.size(), timestamp, encoder, frame);
+}
 
 namespace RTSP {
     int MSG::SERVER       =   4;
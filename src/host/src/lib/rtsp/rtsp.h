@@ -17,6 +17,7 @@
 \****************************************************************************/
 
 #include "rtsp_server.h"
+#include "frame_buffer.h"
 
 //! Supported encoder types
 namespace RTSP {
@@ -85,4 +86,12 @@ struct MSG {
 extern void rtsp_send_frame(unsigned int chan_num, unsigned int stream_id, 
                      uint8_t* frame, int size, uint32_t timestamp, RTSP::EncoderType encoder);
 
+//! called from a callback to copy a frame into server frame pool, so that SDK buffer can be released at once
+//! @return reference to the copy, or empty reference if server is not running yet
+extern RTSP::FrameRef rtsp_copy_frame(const uint8_t* frame, int size);
+
+//! called from a callback to send a frame from server frame pool (see rtsp_copy_frame)
+extern void rtsp_send_frame(unsigned int chan_num, unsigned int stream_id,
+                     const RTSP::FrameRef& frame, uint32_t timestamp, RTSP::EncoderType encoder);
+
 #endif
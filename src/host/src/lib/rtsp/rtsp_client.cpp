@@ -0,0 +1,384 @@
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <strings.h>
+#include <time.h>
+#include <poll.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sstream>
+#include <sbl/sbl_logger.h>
+#include <sbl/sbl_exception.h>
+#include "rtsp_impl.h"
+#include "rtsp_client.h"
+
+namespace RTSP {
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// value of the header if the line is one, NULL otherwise
+static const char* header_value(const std::string& line, const char* name) {
+    size_t length = strlen(name);
+    if (line.size() <= length || strncasecmp(line.c_str(), name, length) || line[length] != ':')
+        return NULL;
+    const char* value = line.c_str() + length + 1;
+    while (*value == ' ')
+        value++;
+    return value;
+}
+
+static void base64_decode(const char* text, size_t size, std::vector<uint8_t>& out) {
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    out.clear();
+    uint32_t bits = 0;
+    int count = 0;
+    for (size_t n = 0; n < size && text[n] != '='; n++) {
+        const char* digit = strchr(digits, text[n]);
+        if (!digit || !*digit)
+            continue;
+        bits = bits << 6 | (digit - digits);
+        count += 6;
+        if (count >= 8) {
+            count -= 8;
+            out.push_back(bits >> count);
+        }
+    }
+}
+
+RemoteClient::RemoteClient(const char* url, Depacketizer* depacketizer, const Options& options) :
+        _url(url), _port(RTSP_PORT), _depacketizer(depacketizer), _options(options),
+        _socket(SBL::Socket::NONE), _rtp(SBL::Socket::NONE), _rtcp(SBL::Socket::NONE),
+        _packet(MAX_PACKET), _cseq(0), _session_timeout(DEFAULT_SESSION_TIMEOUT), _last_data(0), _last_request(0) {
+    SBL_THROW_IF(strncmp(url, "rtsp://", 7), "Not an rtsp url: %s", url);
+    const char* host = url + 7;
+    const char* end  = host + strcspn(host, "/");
+    SBL_THROW_IF(memchr(host, '@', end - host), "Authentication is not supported: %s", url);
+    const char* colon = (const char*) memchr(host, ':', end - host);
+    if (colon) {
+        _port = atoi(colon + 1);
+        end   = colon;
+    }
+    _host.assign(host, end);
+    SBL_THROW_IF(_host.empty() || _port <= 0 || _port > 0xffff, "Bad url: %s", url);
+    _media.payload_type = 96;
+    _media.clock        = 90000;
+    _media.bitrate      = 0;
+}
+
+RemoteClient::~RemoteClient() {
+    close();
+}
+
+void RemoteClient::open() {
+    close();
+    connect();
+    Reply reply;
+    request("DESCRIBE", _url, "Accept: application/sdp\r\n", reply);
+    std::string base = reply.content_base.empty() ? _url : reply.content_base;
+    std::string control = parse_sdp(reply.body, base);
+
+    std::ostringstream transport;
+    if (_options.tcp)
+        transport << "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n";
+    else {
+        bind_udp();
+        int port = _rtp.local_address();
+        transport << "Transport: RTP/AVP;unicast;client_port=" << port << '-' << port + 1 << "\r\n";
+    }
+    request("SETUP", control, transport.str(), reply);
+    SBL_THROW_IF(reply.session.empty(), "SETUP %s: no session in the reply", control.c_str());
+    _session         = reply.session;
+    _session_timeout = reply.session_timeout;
+
+    // aggregate control, as the session description has it
+    if (base.size() > 7 && base[base.size() - 1] == '/')
+        base.erase(base.size() - 1);
+    request("PLAY", base, "Session: " + _session + "\r\nRange: npt=0.000-\r\n", reply);
+    _last_data = now();
+    SBL_INFO("Playing %s over %s, session %s", _url.c_str(), _options.tcp ? "TCP" : "UDP", _session.c_str());
+}
+
+void RemoteClient::connect() {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* address = NULL;
+    int status = getaddrinfo(_host.c_str(), NULL, &hints, &address);
+    SBL_THROW_IF(status != 0, "Unable to resolve %s: %s", _host.c_str(), gai_strerror(status));
+    char ip[SBL::Socket::IP_ADDR_BUFF_SIZE];
+    inet_ntop(AF_INET, &((struct sockaddr_in*) address->ai_addr)->sin_addr, ip, sizeof ip);
+    freeaddrinfo(address);
+
+    _socket.open(SBL::Socket::TCP);
+    // connect gives up after the send timeout
+    struct timeval timeout = { _options.timeout, 0 };
+    setsockopt(_socket.id(), SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+    _socket.set_option(SBL::Socket::NO_DELAY, 1);
+    SBL_MSG(MSG::SOURCE, "Connecting to %s (%s:%d)", _url.c_str(), ip, _port);
+    _socket.connect(ip, _port);
+}
+
+// RTP goes to an even port, RTCP to the next one
+void RemoteClient::bind_udp() {
+    for (int n = 0; n < 16; n++) {
+        _rtp.open(SBL::Socket::UDP);
+        _rtp.bind((short) 0);
+        int port = _rtp.local_address();
+        if (port % 2 == 0 && port < 0xffff) {
+            _rtcp.open(SBL::Socket::UDP);
+            try {
+                _rtcp.bind((short) (port + 1));
+                if (_options.recv_buff_size)
+                    _rtp.set_option(SBL::Socket::RECV_BUFF_SIZE, _options.recv_buff_size);
+                return;
+            } catch (SBL::Exception&) {
+                _rtcp.close();
+            }
+        }
+        _rtp.close();
+    }
+    SBL_THROW("Unable to bind a pair of UDP ports");
+}
+
+void RemoteClient::close() {
+    if (!_session.empty() && _socket.is_valid()) {
+        send_request("TEARDOWN", _url, "Session: " + _session + "\r\n");
+        SBL_MSG(MSG::SOURCE, "Tore down %s, session %s", _url.c_str(), _session.c_str());
+    }
+    _session.clear();
+    _socket.close();
+    _rtp.close();
+    _rtcp.close();
+    _in.clear();
+}
+
+void RemoteClient::send_request(const char* method, const std::string& url, const std::string& headers) {
+    std::ostringstream str;
+    str << method << ' ' << url << " RTSP/1.0\r\n"
+        << "CSeq: " << ++_cseq << "\r\n"
+        << "User-Agent: Stretch RTSP client\r\n"
+        << headers << "\r\n";
+    const std::string& text = str.str();
+    SBL_MSG(MSG::SOURCE, "Request to %s:\n%s", _host.c_str(), text.c_str());
+    _socket.send(text.data(), text.size(), method[0] != 'T');
+    _last_request = now();
+}
+
+void RemoteClient::request(const char* method, const std::string& url, const std::string& headers, Reply& reply) {
+    send_request(method, url, headers);
+    double deadline = now() + _options.timeout;
+    while (!parse(&reply) || reply.cseq != _cseq) {
+        int wait = (int) ((deadline - now()) * 1000);
+        SBL_THROW_IF(wait <= 0, "%s %s: no reply in %d s", method, url.c_str(), _options.timeout);
+        struct pollfd fd = { (int) _socket.id(), POLLIN, 0 };
+        SBL_PERROR(poll(&fd, 1, wait) < 0 && errno != EINTR);
+        SBL_THROW_IF(fd.revents && !read_socket(), "%s %s: connection closed", method, url.c_str());
+    }
+    SBL_THROW_IF(reply.status != 200, "%s %s: %d", method, url.c_str(), reply.status);
+}
+
+bool RemoteClient::read_socket() {
+    for (int n = 0; n < MAX_READS; n++) {
+        size_t size = _in.size();
+        _in.resize(size + MAX_REPLY);
+        int received = ::recv(_socket.id(), &_in[size], MAX_REPLY, MSG_DONTWAIT);
+        _in.resize(size + (received > 0 ? received : 0));
+        if (received < 0 && (errno == EAGAIN || errno == EINTR))
+            return true;
+        if (received < 0)
+            SBL_WARN("Connection to %s: %s", _host.c_str(), strerror(errno));
+        if (received <= 0)
+            return false;
+        if (received < MAX_REPLY)
+            return true;
+    }
+    return true;
+}
+
+bool RemoteClient::parse(Reply* reply) {
+    size_t begin = 0;
+    bool parsed = false;
+    while (!parsed && begin < _in.size()) {
+        const uint8_t* data = &_in[begin];
+        size_t left = _in.size() - begin;
+        if (data[0] == '$') {
+            if (left < 4 || left < 4u + (data[2] << 8 | data[3]))
+                break;
+            int size = data[2] << 8 | data[3];
+            if (data[1] == 0)
+                add_packet(data + 4, size);
+            begin += 4 + size;
+            continue;
+        }
+        const char* text = (const char*) data;
+        const char* end  = NULL;
+        for (size_t n = 3; n < left && !end; n++)
+            if (!memcmp(text + n - 3, "\r\n\r\n", 4))
+                end = text + n + 1;
+        if (!end) {
+            SBL_THROW_IF(left > MAX_REPLY, "Reply from %s is too long", _host.c_str());
+            break;
+        }
+        reply->status          = 0;
+        reply->cseq            = -1;
+        reply->session_timeout = DEFAULT_SESSION_TIMEOUT;
+        reply->session.clear();
+        reply->content_base.clear();
+        size_t content_length = 0;
+        std::istringstream lines(std::string(text, end));
+        std::string line;
+        std::getline(lines, line);
+        SBL_THROW_IF(sscanf(line.c_str(), "RTSP/%*d.%*d %d", &reply->status) != 1, "Bad reply from %s: %s", _host.c_str(), line.c_str());
+        while (std::getline(lines, line)) {
+            if (!line.empty() && line[line.size() - 1] == '\r')
+                line.erase(line.size() - 1);
+            const char* value;
+            if ((value = header_value(line, "CSeq")))
+                reply->cseq = atoi(value);
+            else if ((value = header_value(line, "Content-Length")))
+                content_length = atoi(value);
+            else if ((value = header_value(line, "Content-Base")))
+                reply->content_base = value;
+            else if ((value = header_value(line, "Session"))) {
+                reply->session.assign(value, strcspn(value, "; "));
+                const char* timeout = strstr(value, "timeout=");
+                if (timeout && atoi(timeout + 8) > 0)
+                    reply->session_timeout = atoi(timeout + 8);
+            }
+        }
+        if (left < (size_t) (end - text) + content_length)
+            break;
+        reply->body.assign(end, content_length);
+        SBL_MSG(MSG::SOURCE, "Reply from %s:\n%.*s", _host.c_str(), (int) (end - text + content_length), text);
+        begin += end - text + content_length;
+        parsed = true;
+    }
+    _in.erase(_in.begin(), _in.begin() + begin);
+    return parsed;
+}
+
+bool RemoteClient::receive(int ms) {
+    SBL_ASSERT(_socket.is_valid());
+    // session is kept alive with OPTIONS, often enough for servers that don't count RTCP
+    if (now() - _last_request > _session_timeout / 2)
+        send_request("OPTIONS", _url, "Session: " + _session + "\r\n");
+    bool udp = _rtp.is_valid() && !_options.detach_rtp;
+    struct pollfd fds[2] = { { (int) _socket.id(), POLLIN, 0 }, { (int) _rtp.id(), POLLIN, 0 } };
+    int count = poll(fds, udp ? 2 : 1, ms);
+    SBL_PERROR(count < 0 && errno != EINTR);
+    if (count > 0 && fds[0].revents) {
+        if (!read_socket()) {
+            SBL_WARN("Connection to %s closed", _host.c_str());
+            return false;
+        }
+        Reply reply;
+        while (parse(&reply))
+            if (reply.status != 200)
+                SBL_WARN("Reply %d from %s", reply.status, _host.c_str());
+    }
+    if (count > 0 && udp && fds[1].revents)
+        receive_udp();
+    // detached media is watched by whoever reads it
+    if ((udp || _options.tcp) && now() - _last_data > _options.timeout) {
+        SBL_WARN("No media from %s for %d s", _url.c_str(), _options.timeout);
+        return false;
+    }
+    return true;
+}
+
+void RemoteClient::receive_udp() {
+    for (;;) {
+        int size = ::recv(_rtp.id(), &_packet[0], _packet.size(), MSG_DONTWAIT);
+        if (size < 0) {
+            SBL_PERROR(errno != EAGAIN && errno != EINTR);
+            return;
+        }
+        add_packet(&_packet[0], size);
+    }
+}
+
+void RemoteClient::add_packet(const uint8_t* packet, int size) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    _last_data = ts.tv_sec + ts.tv_nsec * 1e-9;
+    uint64_t arrival = (uint64_t) ts.tv_sec * _media.clock + (uint64_t) ts.tv_nsec * _media.clock / 1000000000;
+    _depacketizer->add(packet, size, (uint32_t) arrival);
+}
+
+std::string RemoteClient::parse_sdp(const std::string& sdp, const std::string& base) {
+    std::istringstream lines(sdp);
+    std::string line, control;
+    int  session_bitrate = 0;
+    bool video = false, h264 = false, found = false;
+    while (std::getline(lines, line) && !found) {
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        int value;
+        if (!line.compare(0, 2, "m=")) {
+            // the first H.264 video is the one, so the previous one is done with if it was
+            found = video && h264;
+            if (found)
+                break;
+            video = !line.compare(0, 8, "m=video ") && sscanf(line.c_str(), "m=video %*d RTP/AVP %d", &_media.payload_type) == 1;
+            h264  = false;
+            control.clear();
+            _media.bitrate = session_bitrate;
+            _media.sps.clear();
+            _media.pps.clear();
+        } else if (sscanf(line.c_str(), "b=AS:%d", &value) == 1) {
+            if (video)
+                _media.bitrate = value;
+            else
+                session_bitrate = value;
+        } else if (!video)
+            continue;
+        else if (!line.compare(0, 10, "a=control:"))
+            control = line.substr(10);
+        else if (sscanf(line.c_str(), "a=rtpmap:%d", &value) == 1 && value == _media.payload_type) {
+            const char* encoding = line.c_str() + line.find(' ') + 1;
+            h264 = !strncasecmp(encoding, "H264/", 5);
+            if (h264)
+                _media.clock = atoi(encoding + 5);
+        } else if (!line.compare(0, 7, "a=fmtp:")) {
+            size_t sets = line.find("sprop-parameter-sets=");
+            if (sets != std::string::npos) {
+                const char* sps = line.c_str() + sets + 21;
+                size_t sps_size = strcspn(sps, ",; ");
+                base64_decode(sps, sps_size, _media.sps);
+                if (sps[sps_size] == ',') {
+                    const char* pps = sps + sps_size + 1;
+                    base64_decode(pps, strcspn(pps, ",; "), _media.pps);
+                }
+            }
+        }
+    }
+    SBL_THROW_IF(!video || !h264 || _media.clock <= 0, "No H.264 video at %s", _url.c_str());
+    if (control.empty() || control == "*")
+        return base;
+    if (!control.compare(0, 7, "rtsp://"))
+        return control;
+    return base[base.size() - 1] == '/' ? base + control : base + '/' + control;
+}
+
+}
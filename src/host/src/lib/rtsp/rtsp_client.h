@@ -0,0 +1,112 @@
+#pragma once
+#ifndef _RTSP_CLIENT_H
+#define _RTSP_CLIENT_H
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <sbl/sbl_socket.h>
+#include "depacketizer.h"
+
+namespace RTSP {
+
+//! Client side of an RTSP session, pulling the H.264 video of a remote stream.
+/*! open() sends DESCRIBE, SETUP and PLAY for the first H.264 video of the session description.
+    Media comes either over UDP, to a pair of local ports, or interleaved on the RTSP connection;
+    receive() hands RTP packets to the depacketizer and keeps the session alive with OPTIONS.
+    There is no authentication, and no RTCP receiver reports are sent.\n
+    Errors (no connection, error replies, no H.264 video) are thrown as SBL::Exception. */
+class RemoteClient {
+public:
+    //! Client options
+    struct Options {
+        bool    tcp;                //!< interleave media on the RTSP connection, rather than UDP
+        int     timeout;            //!< seconds to wait for a reply, or for media before giving up
+        int     recv_buff_size;     //!< UDP socket receive buffer size, 0 for system default
+        bool    detach_rtp;         //!< UDP media is read by the caller, from rtp_fd() (see RtpReceiver)
+        Options() : tcp(false), timeout(5), recv_buff_size(256 * 1024), detach_rtp(false) {}
+    };
+    //! What the session description says about the video
+    struct Media {
+        std::vector<uint8_t> sps;   //!< from sprop-parameter-sets, empty if not given
+        std::vector<uint8_t> pps;
+        int         payload_type;
+        int         clock;          //!< timestamp clock in Hz
+        int         bitrate;        //!< b=AS, kbps, 0 if not given
+    };
+    //! Create a client for rtsp://host[:port]/path, packets go to the depacketizer
+    RemoteClient(const char* url, Depacketizer* depacketizer, const Options& options);
+    ~RemoteClient();
+    //! Connect and start playing; a session left open before is closed first
+    void open();
+    //! Receive media for up to ms milliseconds; with detach_rtp and UDP, only serve the connection
+    //! @return false if the connection was closed, or nothing came for timeout seconds
+    bool receive(int ms);
+    //! UDP socket media comes to, -1 if media is interleaved or the session is not open
+    int  rtp_fd() const { return _rtp.is_valid() ? (int) _rtp.id() : -1; }
+    //! Send TEARDOWN, if playing, and close the connection
+    void close();
+    //! Video of the session, valid after open()
+    const Media& media() const { return _media; }
+    //! Url of the remote stream
+    const char* url() const { return _url.c_str(); }
+private:
+    enum { RTSP_PORT = 554, MAX_PACKET = 2048, MAX_REPLY = 16 * 1024, MAX_READS = 16, DEFAULT_SESSION_TIMEOUT = 60 };
+    struct Reply {
+        int         status;
+        int         cseq;
+        std::string session;
+        int         session_timeout;
+        std::string content_base;
+        std::string body;
+    };
+    std::string     _url;
+    std::string     _host;
+    int             _port;
+    Depacketizer*   _depacketizer;
+    Options         _options;
+    SBL::Socket     _socket;            // RTSP connection
+    SBL::Socket     _rtp;               // UDP only
+    SBL::Socket     _rtcp;
+    std::vector<uint8_t> _in;           // received on the RTSP connection, not parsed yet
+    std::vector<uint8_t> _packet;
+    int             _cseq;
+    std::string     _session;           // empty until SETUP
+    int             _session_timeout;
+    Media           _media;
+    double          _last_data;         // when media last came, seconds
+    double          _last_request;
+
+    void connect();
+    void bind_udp();
+    // send a request and wait for its reply, media that comes meanwhile is received
+    void request(const char* method, const std::string& url, const std::string& headers, Reply& reply);
+    void send_request(const char* method, const std::string& url, const std::string& headers);
+    // read what is there on the RTSP connection, up to MAX_READS times MAX_REPLY bytes, return false if it was closed
+    bool read_socket();
+    // parse media and replies in _in, a reply (if any) is returned in reply, return true if there was one
+    bool parse(Reply* reply);
+    void receive_udp();
+    void add_packet(const uint8_t* packet, int size);
+    // parse session description, return control url of the video
+    std::string parse_sdp(const std::string& sdp, const std::string& base);
+
+    RemoteClient(const RemoteClient&);              // not implemented
+    RemoteClient& operator=(const RemoteClient&);   // not implemented
+};
+
+}
+#endif
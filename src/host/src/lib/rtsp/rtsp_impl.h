@@ -31,7 +31,7 @@ class Server;
 extern void set_rtsp_server(Server* server);
 
 // Supported methods
-enum Method {OPTIONS, DESCRIBE, SETUP, PLAY, GET_PARAMETER, TEARDOWN};
+enum Method {OPTIONS, DESCRIBE, SETUP, PLAY, PAUSE, GET_PARAMETER, TEARDOWN};
 // Either RTP/C over UDP, or interleaved RTP in RTSP stream 
 enum Transport {UNKNOWN = 0, UDP, TCP};
 // Error codes
@@ -42,6 +42,7 @@ enum Errcode {  OK                              = 200,
                 REQUEST_URI_TOO_LARGE           = 414,
                 SESSION_NOT_FOUND               = 454,
                 METHOD_NOT_VALID_IN_THIS_STATE  = 455, 
+                INVALID_RANGE                   = 457,
                 UNSUPPORTED_TRANSPORT           = 461,
                 INTERNAL_SERVER_ERROR           = 500,
                 RTSP_VERSION_NOT_SUPPORTED      = 505,
@@ -58,7 +59,8 @@ enum Errcode {  OK                              = 200,
                 ERROR_MISSING_SPS               = 581,
                 SERVER_BUFFER_OVERFLOW          = 582,
                 SERVER_DATE_ERROR               = 583,
-                ERROR_UNSUPPORTED_ENCODER       = 584
+                ERROR_UNSUPPORTED_ENCODER       = 584,
+                ERROR_NO_MULTICAST_GROUP        = 585
                 };
 
 
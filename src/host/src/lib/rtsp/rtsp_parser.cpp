@@ -13,33 +13,35 @@
 *  destroy any copies you have made.                                         *
 \****************************************************************************/
 #include <cstdlib>
+#include <strings.h>
 #include <sbl/sbl_exception.h>
 #include "rtsp_parser.h"
 
 namespace RTSP {
 
-const Parser::Fields Parser::_fields = SBL::CreateMap<const char*, Field, SBL::StrCompare>
-    ("CSeq:",          CSeq)
-    ("Accept:",        Accept)
-    ("Transport:",     _Transport)
-    ("Session:",       Session)
-;
-const Parser::Methods Parser::_methods = SBL::CreateMap<const char*, Method, SBL::StrCompare>
-    ("OPTIONS",       OPTIONS)
-    ("DESCRIBE",      DESCRIBE)
-    ("SETUP",         SETUP)
-    ("PLAY",          PLAY)
-    ("GET_PARAMETER", GET_PARAMETER)
-    ("TEARDOWN",      TEARDOWN)
-    ("PAUSE",         TEARDOWN)  // ffmpeg rtsp client need the pause command. wired to teardown for now
-;
-const Parser::TranspArgs Parser::_transps = SBL::CreateMap<const char*, TranspArg, SBL::StrCompare>
-    ("RTP/AVP",       _UDP)
-    ("RTP/AVP/TCP",   _TCP)
-    ("client_port",   Client_port)
-    ("interleaved",   Interleaved)
-    ("unicast",       Unicast)
-;
+// Methods are listed in the order OPTIONS reply shows them
+const Parser::Keyword Parser::_keywords[] = {
+    {"DESCRIBE",      METHOD,     DESCRIBE},
+    {"GET_PARAMETER", METHOD,     GET_PARAMETER},
+    {"OPTIONS",       METHOD,     OPTIONS},
+    {"PAUSE",         METHOD,     PAUSE},
+    {"PLAY",          METHOD,     PLAY},
+    {"SETUP",         METHOD,     SETUP},
+    {"TEARDOWN",      METHOD,     TEARDOWN},
+    {"CSeq:",         FIELD,      CSeq},
+    {"Accept:",       FIELD,      Accept},
+    {"Transport:",    FIELD,      _Transport},
+    {"Session:",      FIELD,      Session},
+    {"Range:",        FIELD,      Range},
+    {"Scale:",        FIELD,      Scale},
+    {"RTP/AVP",       TRANSP_ARG, _UDP},
+    {"RTP/AVP/TCP",   TRANSP_ARG, _TCP},
+    {"client_port",   TRANSP_ARG, Client_port},
+    {"interleaved",   TRANSP_ARG, Interleaved},
+    {"unicast",       TRANSP_ARG, Unicast},
+    {"multicast",     TRANSP_ARG, Multicast},
+    {NULL,            METHOD,     0}
+};
 
 #define def_errcode(x) ( x, #x )
 const Parser::ErrorCodes Parser::_error_codes = SBL::CreateMap<Errcode, const char*>
@@ -50,6 +52,7 @@ const Parser::ErrorCodes Parser::_error_codes = SBL::CreateMap<Errcode, const ch
        def_errcode( REQUEST_URI_TOO_LARGE )
        def_errcode( SESSION_NOT_FOUND )
        def_errcode( METHOD_NOT_VALID_IN_THIS_STATE )
+       def_errcode( INVALID_RANGE )
        def_errcode( UNSUPPORTED_TRANSPORT )
        def_errcode( INTERNAL_SERVER_ERROR )
        def_errcode( RTSP_VERSION_NOT_SUPPORTED )
@@ -66,19 +69,55 @@ const Parser::ErrorCodes Parser::_error_codes = SBL::CreateMap<Errcode, const ch
        def_errcode( ERROR_MISSING_SPS )
        def_errcode( SERVER_BUFFER_OVERFLOW )
        def_errcode( SERVER_DATE_ERROR )
+       def_errcode( ERROR_UNSUPPORTED_ENCODER )
+       def_errcode( ERROR_NO_MULTICAST_GROUP )
 ;
 #undef def_errorcode
 
+// Keywords placed in slots by their hash, built once on first use
+const Parser::Keyword* const* Parser::keyword_table() {
+    struct Table {
+        const Keyword* slot[KEYWORD_SLOTS];
+        Table() {
+            memset(slot, 0, sizeof slot);
+            for (const Keyword* key = _keywords; key->name; key++) {
+                uint32_t hash = hash_init();
+                for (const char* c = key->name; *c; c++)
+                    hash = hash_next(hash, *c);
+                int n = hash_slot(hash);
+                SBL_THROW_IF(slot[n], "keywords %s and %s collide, change HASH_SEED", key->name, slot[n]->name);
+                slot[n] = key;
+            }
+        }
+    };
+    static const Table table;
+    return table.slot;
+}
+
+// word need not be terminated, only its first size characters are compared
+const Parser::Keyword* Parser::find_keyword(const char* word, int size, uint32_t hash, KeywordType type) {
+    const Keyword* key = keyword_table()[hash_slot(hash)];
+    return key && key->type == type && !strncmp(key->name, word, size) && key->name[size] == 0 ? key : NULL;
+}
+
+const Parser::Keyword* Parser::find_keyword(const char* word, KeywordType type) {
+    uint32_t hash = hash_init();
+    const char* c = word;
+    for (; *c; c++)
+        hash = hash_next(hash, *c);
+    return find_keyword(word, c - word, hash, type);
+}
+
 void Parser::get_method_names(std::vector<const char*>& names) {
-    for (Methods::const_iterator n = _methods.begin(); n != _methods.end(); ++n) {
-        names.push_back(n->first);
-    }
+    for (const Keyword* key = _keywords; key->name; key++)
+        if (key->type == METHOD)
+            names.push_back(key->name);
 }
 
 const char* Parser::method_name(Method method) {
-    for (Methods::const_iterator n = _methods.begin(); n != _methods.end(); ++n)
-        if (method == n->second)
-            return n->first;    
+    for (const Keyword* key = _keywords; key->name; key++)
+        if (key->type == METHOD && key->value == method)
+            return key->name;
     return NULL;
 }
 
@@ -91,15 +130,11 @@ const char* Parser::errcode_desc(Errcode errcode) {
 }
 
 
-Errcode Parser::parse_field(const Line& line) {
-    Fields::const_iterator field = _fields.find(_words[line.word]);
-    // we ignore fields we don't understand
-    if (field == _fields.end())
-        return OK;
+Errcode Parser::parse_field(Line& line) {
     // verify that Field does have argument
-    if (line.count == 0) return ERROR_MISSING_FIELD_ARG;
-    char* arg = _words[line.word + 1];
-    switch (field->second) {
+    if (line.count == 1) return ERROR_MISSING_FIELD_ARG;
+    char* arg = line.word[1];
+    switch (line.key->value) {
     case CSeq:          data.cseq = strtol(arg, 0, 0); 
                         break; 
     case Accept:        data.accept = arg;
@@ -108,23 +143,54 @@ Errcode Parser::parse_field(const Line& line) {
                         break;
     case Session:       data.session_id = arg;
                         break;
+    case Range:         return parse_range(arg);
+    case Scale:         data.scale = strtod(arg, &arg);
+                        if (*arg || data.scale == 0)
+                            return BAD_REQUEST;
+                        break;
     }
     return OK;
 }
 
+// Range: npt=12.5-  Range: npt=0:01:30-0:02:00  Range: npt=now-
+// Only the start is used, "now" and a missing start leave range_start negative (no seek)
+Errcode Parser::parse_range(char* arg) {
+    if (strncmp(arg, "npt=", 4))                    return INVALID_RANGE;
+    arg += 4;
+    if (!strncmp(arg, "now-", 4) || *arg == '-')    return OK;
+    double start = 0;
+    for (int n = 0; n < 3; n++) {
+        char* end;
+        double value = strtod(arg, &end);
+        if (end == arg || value < 0)                return INVALID_RANGE;
+        start = start * 60 + value;
+        arg = end;
+        if (*arg != ':')
+            break;
+        arg++;
+    }
+    if (*arg != '-')                                return INVALID_RANGE;
+    data.range_start = start;
+    return OK;
+}
+
 // Transport: RTP/AVP;unicast;client_port=1422-1423
 // Transport: RTP/AVP/TCP;unicast;interleaved=0-1
-Errcode Parser::parse_transport(const Line& line) {
+// Transport: RTP/AVP;multicast
+// For multicast, destination, port and ttl asked for by the client are ignored, server assigns them
+Errcode Parser::parse_transport(Line& line) {
     bool unicast = false;
-    for (int n = 1; n < line.count; n++) {
-        char* word = _words[line.word + n];
+    int  count = line.count < MAX_WORDS ? line.count : MAX_WORDS;
+    for (int n = 1; n < count; n++) {
+        // word hash stops at '='
+        char* word = line.word[n];
         char* arg = strchr(word, '=');
         if (arg)
             *arg++ = 0;
-        TranspArgs::const_iterator transp = _transps.find(word);
-        if (transp == _transps.end())
+        const Keyword* transp = find_keyword(word, strlen(word), line.hash[n], TRANSP_ARG);
+        if (!transp)
             continue;
-        switch (transp->second) {
+        switch (transp->value) {
         case _UDP: data.transport = UDP; break;
         case _TCP: data.transport = TCP; break;
         case Client_port: if (!arg)                     return ERROR_BAD_PORT_SPEC;
@@ -134,53 +200,146 @@ Errcode Parser::parse_transport(const Line& line) {
                           data.client_port1 = strtol(arg, &arg, 10);
                           if (!(arg && *arg == 0))      return ERROR_BAD_PORT_SPEC;
                           break;
-        case Interleaved: if (strcmp(arg, "0-1"))       return ERROR_BAD_INTERLEAVED_SPEC;
+        case Interleaved: if (!arg || strcmp(arg, "0-1")) return ERROR_BAD_INTERLEAVED_SPEC;
                           if (data.transport != TCP)    return ERROR_BAD_INTERLEAVED_SPEC;
                           break;
         case Unicast:     unicast = true;
                           break;
+        case Multicast:   data.multicast = true;
+                          break;
         }
     }
     if (data.transport == UNKNOWN)                      return UNSUPPORTED_TRANSPORT;
+    if (data.multicast)
+        return data.transport == UDP && !unicast ? OK : UNSUPPORTED_TRANSPORT;
     if (!unicast)                                       return ERROR_SUPPORT_UNICAST_ONLY;
     if (data.transport == TCP && (data.client_port0 || data.client_port1))  return ERROR_TCP_WITH_PORTS;
     if (data.transport == UDP && !(data.client_port0 && data.client_port1)) return ERROR_UDP_NO_PORTS;
     return OK;
 }
 
-// Parse message populating fields and return Method
-Method Parser::parse(char* buffer, int buffer_size) {
+// Parse message populating fields and return Method.
+// Lines are parsed as soon as they are tokenized, in a single pass over the message.
+Method Parser::parse(char* buffer, int buffer_size, int body_size) {
     data.clear();
-    tokenize(buffer, buffer_size);
-    Errcode errcode = parse_method(_lines[0]);
-    for (unsigned int line = 1; line < _lines.size(); ++line) {
-        Errcode ec = parse_field(_lines[line]);
+    Errcode errcode = OK;
+    bool    request_line = true;
+    char*   end = buffer + buffer_size - body_size;
+    if (body_size > 0) {
+        data.body      = end;
+        data.body_size = body_size;
+    }
+    Line    line;
+    for (char* next = buffer; next < end; ) {
+        next = tokenize(next, end, line, request_line);
+        // skip empty lines and fields we don't understand
+        if (line.count == 0)
+            continue;
+        Errcode ec = request_line ? parse_method(line) : parse_field(line);
         // We always throw the first error we find
         if (errcode == OK)
             errcode = ec;
+        request_line = false;
     }
+    if (request_line)                               // nothing but white space
+        errcode = METHOD_NOT_ALLOWED;
     switch (_state) {
-        case INIT:      if (data.method == SETUP)    _state = READY;     
-                   else if (data.method == PLAY)     throw METHOD_NOT_VALID_IN_THIS_STATE;
-                        break;
-        case READY:     if (data.method == PLAY)     _state = PLAYING;
-                   else if (data.method == TEARDOWN) _state = INIT;      break;
-        case PLAYING:   if (data.method == TEARDOWN) _state = INIT;      break;
+        case INIT:
+            if (data.method == SETUP) {
+                _state = READY;
+            } else if (data.method == PLAY || data.method == PAUSE) {
+                throw METHOD_NOT_VALID_IN_THIS_STATE;
+            }
+            break;
+        case READY:
+            if (data.method == PLAY) {
+                _state = PLAYING;
+            } else if (data.method == TEARDOWN) {
+                _state = INIT;
+            }
+            break;
+        case PLAYING:
+            if (data.method == PAUSE) {
+                _state = READY;
+            } else if (data.method == TEARDOWN) {
+                _state = INIT;
+            }
+            break;
     }
     if (errcode != OK)
         throw errcode;
     return data.method;
 }
 
+// Only the start of each line is looked at, the header ends with an empty line, so the value ends before the header does
+int Parser::content_length(const char* header, int header_size) {
+    static const char name[]    = "Content-Length:";
+    const int         name_size = sizeof name - 1;
+    const char*       end       = header + header_size;
+    for (const char* line = header; line && end - line > name_size; ) {
+        if (!strncasecmp(line, name, name_size))
+            return strtol(line + name_size, 0, 10);
+        line = (const char*) memchr(line, '\n', end - line);
+        if (line)
+            line++;
+    }
+    return 0;
+}
+
+// Split a line into words, terminating them in place, and return where the next line starts.
+// Only words looked up in the keyword table are hashed, as they are scanned: the first word of a line
+// and parameters of Transport field. Hash stops at '=', so that parameters hash without their value.
+// Field the parser doesn't know is skipped right after its name, and returned with no words.
+char* Parser::tokenize(char* p, char* end, Line& line, bool request_line) {
+    line.count = 0;
+    line.key   = NULL;
+    bool transport = false;
+    while (p < end) {
+        char c = *p;
+        if (is_delimiter(c)) {
+            *p++ = 0;
+            if (c == '\n')
+                break;
+            continue;
+        }
+        char* word = p;
+        if (line.count > 0 && !transport) {
+            while (++p < end && !is_delimiter(*p))
+                ;
+            if (line.count++ < MAX_WORDS)
+                line.word[line.count - 1] = word;
+            continue;
+        }
+        uint32_t hash = hash_init();
+        for (; p < end && !is_delimiter(*p) && *p != '='; p++)
+            hash = hash_next(hash, *p);
+        int size = p - word;
+        while (p < end && !is_delimiter(*p))
+            p++;
+        if (line.count < MAX_WORDS) {
+            line.word[line.count] = word;
+            line.hash[line.count] = hash;
+        }
+        if (line.count++ > 0)
+            continue;
+        line.key = find_keyword(word, size, hash, request_line ? METHOD : FIELD);
+        if (!line.key && !request_line) {
+            line.count = 0;
+            p = (char*) memchr(p, '\n', end - p);
+            return p ? p + 1 : end;
+        }
+        transport = !request_line && line.key->value == _Transport;
+    }
+    return p;
+}
 
 // parse first line of message
-Errcode Parser::parse_method(const Line& line) {
-    Methods::const_iterator method = _methods.find(_words[line.word]);
-    if (method == _methods.end())                   return METHOD_NOT_ALLOWED;
-    data.method = method->second;
+Errcode Parser::parse_method(Line& line) {
+    if (!line.key)                                  return METHOD_NOT_ALLOWED;
+    data.method = Method(line.key->value);
     if (line.count != 3)                            return BAD_REQUEST;
-    if (strcmp(_words[line.word + 2], "RTSP/1.0"))  return RTSP_VERSION_NOT_SUPPORTED;
-    data.url = _words[line.word + 1];
+    if (strcmp(line.word[2], "RTSP/1.0"))           return RTSP_VERSION_NOT_SUPPORTED;
+    data.url = line.word[1];
     int n = strlen(data.url);
     if (n && data.url[n - 1] == '/')
         data.url[n - 1] = '\0';
@@ -194,28 +353,6 @@ Errcode Parser::parse_method(const Line& line) {
     return OK;
 }
 
-void Parser::tokenize(char* buffer, int buffer_size) {
-    bool in_word = false;
-    bool line_start = true;
-    _words.clear();
-    _lines.clear();
-    for (int n = 0; n < buffer_size; ++n) {
-        char c = buffer[n];
-        if (c == ' ' || c == ';' || c == '\r' || c == '\n') {
-            buffer[n] = 0;
-            in_word = false;
-            line_start = (c == '\n');
-        } else if (!in_word) {
-            if (line_start)
-                _lines.push_back(Line(_words.size(), 0));
-            line_start = false;
-            in_word = true;
-            _words.push_back(&buffer[n]);
-            _lines[_lines.size() - 1].count++;
-        }
-    }
-}
-
 /*
     Header Field Definitions
     -------------------------
@@ -283,6 +420,9 @@ std::ostream& operator<<(std::ostream& s, const Parser& p) {
       << "client_port0: "  << p.data.client_port0 << eol
       << "client_port1: "  << p.data.client_port1 << eol
       << "transport:    "  << p.data.transport << eol
+      << "multicast:    "  << p.data.multicast << eol
+      << "range_start:  "  << p.data.range_start << eol
+      << "scale:        "  << p.data.scale << eol
       << "state:        "  << p._state  << eol
                            << "####" << std::endl;
     return s;
@@ -312,10 +452,10 @@ std::istream& operator>>(std::istream& s, Parser& p) {
         if (key == "method:") { 
             std::string value; 
             s >> value; 
-            Parser::Methods::const_iterator it = Parser::_methods.find(value.c_str());
-            if (it == Parser::_methods.end())
+            const Parser::Keyword* method = Parser::find_keyword(value.c_str(), Parser::METHOD);
+            if (!method)
                 SBL_THROW("Unrecognized method %s", value.c_str());
-            p.data.method = it->second; 
+            p.data.method = Method(method->value); 
         }
         else if (key == "cseq:")            s >> p.data.cseq;
         else if (key == "session_id:")      p.data.session_id = new_string(s);
@@ -325,6 +465,9 @@ std::istream& operator>>(std::istream& s, Parser& p) {
         else if (key == "client_port0:")    s >> p.data.client_port0;
         else if (key == "client_port1:")    s >> p.data.client_port1;
         else if (key == "transport:")       p.data.transport = new_t<Transport>(s);
+        else if (key == "multicast:")       s >> p.data.multicast;
+        else if (key == "range_start:")     s >> p.data.range_start;
+        else if (key == "scale:")           s >> p.data.scale;
         else if (key == "state:")           p._state = new_t<Parser::State>(s); 
         else SBL_THROW("Unrecognized data field %s", key.c_str());
     }
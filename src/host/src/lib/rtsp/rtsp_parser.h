@@ -19,26 +19,37 @@
 #include <map>
 #include <ostream>
 #include <istream>
-#include <sbl/sbl_map.h>
+#include <stdint.h>
 #include "rtsp_impl.h"
 
 namespace RTSP {
 
 //! Responsible for parsing client request and populating Parser::Data structure.
-/*! All errors result in the Parser throwing Errcode. */
+/*! Request is tokenized in place, in a single pass, and nothing is allocated while parsing it.
+    Methods, header names and transport parameters are all looked up in one keyword table,
+    thru a perfect hash computed while the word is being scanned.\n
+    All errors result in the Parser throwing Errcode. */
 class Parser {
 private:
     enum State     {INIT, READY, PLAYING};
-    enum Field     {CSeq, Accept, _Transport, Session};
-    enum TranspArg {_UDP, _TCP, Client_port, Unicast, Interleaved};
+    enum Field     {CSeq, Accept, _Transport, Session, Range, Scale};
+    enum TranspArg {_UDP, _TCP, Client_port, Unicast, Multicast, Interleaved};
+    enum KeywordType {METHOD, FIELD, TRANSP_ARG};
 public:
     //! Parser constructor
     Parser() : _state(INIT) {}
     //! parse incoming message and populate internal data structures. @b Overwrites buffer.
     /*! Parses messages received from a socket and populates Parser::Data. The content
-        of the buffer is @b overwritten. 
+        of the buffer is @b overwritten, Data points into it.
+        @param  buffer_size size of a single message; buffer may hold more (pipelined) messages after it
+        @param  body_size   size of the message body, which is the end of the message and is not parsed
     */
-    Method parse(char* buffer, int buffer_size);
+    Method parse(char* buffer, int buffer_size, int body_size = 0);
+
+    //! Return the value of Content-Length: field of a message header, 0 if there is none
+    /*! Talker needs it to know where the message ends, before the message is parsed.
+        @param  header_size size of the header, up to and including the empty line */
+    static int content_length(const char* header, int header_size);
 
     //! Return parser State
     State state() const { return _state; }
@@ -66,34 +77,56 @@ public:
         int         client_port0;   //!< client port 0, in SETUP
         int         client_port1;   //!< client port 1, in SETUP
         Transport   transport;      //!< UDP or TCP
+        bool        multicast;      //!< client asked for multicast (UDP only), server chooses the group
+        double      range_start;    //!< start of Range: npt=, in seconds; negative if there is none (or it is "now")
+        double      scale;          //!< Scale: of PLAY, 0 if there is none
+        char*       body;           //!< message body (not terminated), NULL if there is none
+        int         body_size;      //!< size of the body
         //! clear the whole Data structure
-        void clear() { memset(this, 0, sizeof(Data)); }
+        void clear() { memset(this, 0, sizeof(Data)); range_start = -1; }
     };
     Data            data;           //!< Parser output result
 private:
-    typedef std::map<const char*, Method, SBL::StrCompare>      Methods;
-    typedef std::map<const char*, Field, SBL::StrCompare>       Fields;
-    typedef std::map<const char*, TranspArg, SBL::StrCompare>   TranspArgs;
     typedef std::map<Errcode, const char*>                 ErrorCodes;
+    enum {KEYWORD_BITS = 7, KEYWORD_SLOTS = 1 << KEYWORD_BITS};   // keywords must hash to distinct slots
+    enum {MAX_WORDS = 32};          // words kept per line, words past this are only counted
+    enum {HASH_SEED = 357};         // picked so that keywords (and likely future ones) don't collide
+    struct Keyword {
+        const char*  name;
+        KeywordType  type;
+        int          value;
+    };
+    // a line of the request, words are terminated in place
     struct Line {
-        int word;
-        int count;
-        Line(int w = 0, int c = 0) : word(w), count(c) {}
+        char*           word[MAX_WORDS];
+        uint32_t        hash[MAX_WORDS];
+        int             count;
+        const Keyword*  key;            // method or field of the line, NULL if not known
     };
     State               _state;
-    std::vector<char*>  _words;
-    std::vector<Line>   _lines;
 
-    const static Methods     _methods;
-    const static Fields      _fields;
-    const static TranspArgs  _transps;
+    const static Keyword     _keywords[];
     const static ErrorCodes  _error_codes;
     const static char*       _none;
 
-    void    tokenize(char* buffer, int buffer_size);
-    Errcode parse_field(const Line&);
-    Errcode parse_transport(const Line&);
-    Errcode parse_method(const Line&);
+    // hash of a word, updated with each character as it is scanned
+    static uint32_t hash_init()                     { return HASH_SEED; }
+    static uint32_t hash_next(uint32_t h, char c)   { return (h * 33) ^ (uint8_t) c; }
+    static int      hash_slot(uint32_t h)           { return (h * 2654435761u) >> (32 - KEYWORD_BITS); }
+    // word delimiters are ' ', ';', '\r' and '\n', all below 64, so one shift tells
+    static bool     is_delimiter(char c) {
+        return (uint8_t) c < 64 && ((1ull << ' ' | 1ull << ';' | 1ull << '\r' | 1ull << '\n') >> c & 1);
+    }
+    // return keyword of given type, or NULL if word isn't one
+    static const Keyword* find_keyword(const char* word, int size, uint32_t hash, KeywordType type);
+    static const Keyword* find_keyword(const char* word, KeywordType type);
+    static const Keyword* const* keyword_table();
+
+    char*   tokenize(char* line_start, char* end, Line& line, bool request_line);
+    Errcode parse_field(Line&);
+    Errcode parse_transport(Line&);
+    Errcode parse_range(char* arg);
+    Errcode parse_method(Line&);
 
     friend std::ostream& operator<<(std::ostream& s, const Parser& p);
     friend std::istream& operator>>(std::istream& s, Parser& p);
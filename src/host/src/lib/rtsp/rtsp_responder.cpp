@@ -12,10 +12,31 @@
 *  and conditions, you may not use any of these items and must immediately   *
 *  destroy any copies you have made.                                         *
 \****************************************************************************/
+#include <cstdio>
+#include <cctype>
 #include <time.h>
 #include "rtsp_responder.h"
 #include "rtsp_talker.h"
 #include "live_source.h"
+#include "metrics.h"
+
+namespace {
+// GET_PARAMETER body lists parameter names, one per line
+bool has_parameter(const RTSP::Parser::Data& data, const char* name) {
+    const int   size = strlen(name);
+    const char* end  = data.body + data.body_size;
+    for (const char* line = data.body; line < end; ) {
+        const char* eol  = (const char*) memchr(line, '\n', end - line);
+        const char* next = eol ? eol + 1 : end;
+        while (next > line && isspace(next[-1]))
+            next--;
+        if (next - line == size && !memcmp(line, name, size))
+            return true;
+        line = eol ? eol + 1 : end;
+    }
+    return false;
+}
+}
 
 namespace RTSP {
 
@@ -24,17 +45,16 @@ const char* Responder::_eol = "\r\n";
 const char* Responder::_control = "track1";
 
 Responder::Responder(Talker* talker, char* buffer, int buffer_size) : 
-        _buffer(buffer), _buffer_size(buffer_size), _talker(talker) {
+        _talker(talker), _writer(buffer, buffer_size), _body(_body_buffer, BODY_SIZE) {
    memset(_date,      0, sizeof _date); 
    Parser::get_method_names(_method_name);
 }
 
 int Responder::reply(const Parser::Data& data, const Errcode errcode) {
-    _writer.clear();
-    _writer.seekp(0);
-    _writer.seekg(0);
+    _writer.reset();
+    _body.reset();
     get_date();
-    _writer << "RTSP/1.0 " << errcode << ' ' << Parser::errcode_desc(errcode) << _eol
+    _writer << "RTSP/1.0 " << int(errcode) << ' ' << Parser::errcode_desc(errcode) << _eol
             << "CSeq: " << data.cseq << _eol
             << "Date: " << _date << _eol;
     // This could be done through a table, but the syntax for pointers to
@@ -49,20 +69,14 @@ int Responder::reply(const Parser::Data& data, const Errcode errcode) {
         case DESCRIBE:      reply_describe(data);       break;
         case SETUP:         reply_setup(data);          break;
         case PLAY:          reply_play(data);           break;
+        case PAUSE:         reply_pause(data);          break;
         case GET_PARAMETER: reply_get_parameter(data);  break;
         case TEARDOWN:      reply_teardown(data);       break;
         default: RTSP_ASSERT(0, METHOD_NOT_ALLOWED);    break;
         }
-    _writer << _eol;
-    return copy_data();
-}
-
-int Responder::copy_data() {
-    std::streamsize size = _writer.tellp();
-    RTSP_ASSERT(_writer && size < _buffer_size - 1, SERVER_BUFFER_OVERFLOW);
-    _writer.read(_buffer, size);
-    _buffer[size] = '\0';
-    return size;
+    _writer << _eol << _body;
+    RTSP_ASSERT(_body.ok() && _writer.ok(), SERVER_BUFFER_OVERFLOW);
+    return _writer.size();
 }
 
 void Responder::get_date() {
@@ -82,26 +96,18 @@ void Responder::reply_options() {
     _writer << _eol;
 }
 
+// Media part of sdp comes from the source, which renders it only when the stream changes
 void Responder::reply_describe(const Parser::Data& data) {
-    _writer << "Content-Base: " << data.url << '/' << _eol
-            << "Content-Type: " << data.accept << _eol
-            << "Content-Length: ";
-    std::streampos len_ptr = _writer.tellp();
-    _writer << "    " << _eol << _eol;
-    std::streampos msg_start = _writer.tellp();
     RTSP_ASSERT(data.stream_name, BAD_REQUEST);
-    Source* source = _talker->get_source(data.stream_name);
-    // send play message to the application, but only if there
-    // no clients currently attached, i.e. if this is the first client
-    if (source->streamer()->client_count() == 0)
-        source->request_app_play();
-    source->get_stream_desc();
+    // talker has opened the source, asked the application to play and fetched the stream description,
+    // waiting for the file and SPS/PPS if needed
+    Source* source = _talker->source();
+    RTSP_ASSERT(source, INTERNAL_SERVER_ERROR);
     const char* encoder_name = source->encoder_name();
     if (strcmp(encoder_name, "MPEG4")==0){
         encoder_name = "MPEG-4";
     }
-    int payload_type = source->payload_type();
-    _writer << "v=0" << _eol
+    _body   << "v=0" << _eol
             << "o=- " << rand() << " 1 IN IP4 " << _talker->server_ip() << _eol
             << "s=" << encoder_name << " Video, streamed by the Stretch Media Server" << _eol    
             << "i=" << data.stream_name << _eol
@@ -109,25 +115,16 @@ void Responder::reply_describe(const Parser::Data& data) {
             << "a=tool:Stretch RTSP Server version " << _version << _eol
             << "a=type:broadcast" << _eol
             << "a=control:*" << _eol
-            << "a=range:npt=0-" << _eol
+            << "a=range:npt=0-";
+    write_duration(source, _body);
+    _body   << _eol
             << "a=x-qt-text-nam:" << encoder_name << " Video, streamed by the Stretch Media Server" << _eol
-            << "a=x-qt-text-inf:" << data.stream_name << _eol
-            << "m=video 0 RTP/AVP " << payload_type << _eol
-            << "c=IN IP4 0.0.0.0" << _eol
-            << "b=AS:" << source->get_bitrate() << _eol;
-    if (source->encoder_type() == H264) {
-        _writer << "a=rtpmap:" << payload_type << " H264/90000" << _eol;
-        source->write_param_set(_writer) << _eol;
-    }else if (source->encoder_type() == MPEG4){
-        _writer << "a=rtpmap:" << payload_type << " MP4V-ES/90000" << _eol;
-        //        source->write_param_set(_writer) << _eol;
-    }
-    _writer << "a=control:" << _control;    // Missing _eol, because reply() will add it
-    std::streampos pos = _writer.tellp();
-    std::streampos content_length = pos - msg_start + 2; // adding the length of _eol
-    _writer.seekp(len_ptr);
-    _writer << content_length;
-    _writer.seekp(pos);   
+            << "a=x-qt-text-inf:" << data.stream_name << _eol;
+    source->write_sdp_media(_body);
+    _body   << "a=control:" << _control << _eol;
+    _writer << "Content-Base: " << data.url << '/' << _eol
+            << "Content-Type: " << (data.accept ? data.accept : "application/sdp") << _eol
+            << "Content-Length: " << _body.size() << _eol;
 }
 
 void Responder::reply_setup(const Parser::Data& data) {
@@ -136,7 +133,17 @@ void Responder::reply_setup(const Parser::Data& data) {
     char* slash = data.stream_name + strlen(data.stream_name) - strlen(_control) - 1;
     RTSP_ASSERT(slash > data.stream_name && *slash == '/' && !strcmp(slash + 1, _control), NOT_FOUND);
     *slash = '\0';
-    if (data.transport == TCP) {
+    if (data.multicast) {
+        RTSP_ASSERT(data.transport == UDP, UNSUPPORTED_TRANSPORT);
+        SessionID session_id = _talker->setup_multicast(data.stream_name);
+        const Group& group = _talker->client()->streamer()->group_info();
+        _writer << "Transport: RTP/AVP;multicast"
+                << ";destination=" << group.address
+                << ";source=" << _talker->server_ip()
+                << ";port=" << group.port << '-' << (group.port + 1)
+                << ";ttl=" << group.ttl << _eol
+                << "Session: " << session_id << _eol;
+    } else if (data.transport == TCP) {
         SessionID session_id = _talker->setup_tcp(data.stream_name);
         _writer << "Transport: RTP/AVP/TCP;unicast"
                 << ";destination=" << _talker->client_ip()
@@ -159,18 +166,55 @@ void Responder::reply_play(const Parser::Data& data) {
     RTSP_ASSERT(session_id == _talker->session_id(), SESSION_NOT_FOUND);
     Client* client = _talker->client();
     RTSP_ASSERT(client, INTERNAL_SERVER_ERROR);
-    _writer << "Range: npt=0.000-" << _eol
-            << "Session: " << data.session_id << _eol
+    // file source stops to seek or change scale, talker has it play again once the reply is sent
+    Source* source = client->streamer()->source();
+    double scale = data.scale ? source->set_scale(data.scale) : 0;
+    if (data.range_start >= 0)
+        source->seek(data.range_start);
+    char npt[16];
+    snprintf(npt, sizeof npt, "%.3f", source->position());
+    _writer << "Range: npt=" << npt << '-';
+    write_duration(source, _writer);
+    _writer << _eol;
+    if (scale) {
+        snprintf(npt, sizeof npt, "%g", scale);
+        _writer << "Scale: " << npt << _eol;
+    }
+    _writer << "Session: " << data.session_id << _eol
             << "RTP-Info: url=" << data.url;
     _writer << '/' << _control
             << ";seq=" << client->seq_number()
             << ";rtptime=" << client->timestamp() << _eol;
 }
 
-void Responder::reply_get_parameter(const Parser::Data& data) {
+void Responder::reply_pause(const Parser::Data& data) {
+    SessionID session_id(data.session_id);
+    RTSP_ASSERT(session_id == _talker->session_id(), SESSION_NOT_FOUND);
+    _talker->pause();
     _writer << "Session: " << data.session_id << _eol;
 }
 
+// end of npt range, nothing for live sources
+void Responder::write_duration(Source* source, BufferWriter& writer) {
+    if (source->duration() > 0) {
+        char npt[16];
+        snprintf(npt, sizeof npt, "%.3f", source->duration());
+        writer << npt;
+    }
+}
+
+// Without a body, GET_PARAMETER is a keep-alive. Parameter "stats" asks for metrics of the stream and of this client.
+void Responder::reply_get_parameter(const Parser::Data& data) {
+    if (data.session_id)
+        _writer << "Session: " << data.session_id << _eol;
+    if (!data.body || !has_parameter(data, "stats"))
+        return;
+    const char* name = _talker->source() ? _talker->source()->name() : data.stream_name;
+    RTSP_ASSERT(name && Metrics::registry().print(_body, name, _talker->id()), NOT_FOUND);
+    _writer << "Content-Type: text/parameters" << _eol
+            << "Content-Length: " << _body.size() << _eol;
+}
+
 void Responder::reply_teardown(const Parser::Data& data) {
     SessionID session_id(data.session_id);
     RTSP_ASSERT(session_id == _talker->session_id(), SESSION_NOT_FOUND);
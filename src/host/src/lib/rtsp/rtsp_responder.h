@@ -15,9 +15,10 @@
 *  and conditions, you may not use any of these items and must immediately   *
 *  destroy any copies you have made.                                         *
 \****************************************************************************/
-#include <sstream>
+#include <vector>
 #include <sbl/sbl_socket.h>
 #include "rtsp_session_id.h"
+#include "buffer_writer.h"
 #include "rtsp_parser.h"
 #include "rtp_streamer.h"
 
@@ -26,6 +27,8 @@ namespace RTSP {
 class Talker;
 
 //! This class issues appropriate calls (thru Server) to handle a request and builds a reply to the client.
+/*! Reply is written straight into the talker buffer, message body (sdp) is put together in a buffer
+    of its own first, so that its length is known when headers are written. */
 class Responder {
 public:
     //! Constructor, ties up to Server and output stream
@@ -37,10 +40,11 @@ public:
     //! Create a reply for the given request, which was parsed by Parser.
     int reply(const Parser::Data& parser_data, const Errcode errcode = OK);
 private:
-    char*                    _buffer;
-    int                      _buffer_size;
+    enum {BODY_SIZE = 1024};
     Talker*                  _talker;
-    std::stringstream        _writer;
+    BufferWriter             _writer;
+    char                     _body_buffer[BODY_SIZE];
+    BufferWriter             _body;     // message body, goes after the headers
     char                     _date[32];
     std::vector<const char*> _method_name;
 
@@ -53,9 +57,10 @@ private:
     void reply_describe(const Parser::Data&);
     void reply_setup(const Parser::Data&);
     void reply_play(const Parser::Data&);
+    void reply_pause(const Parser::Data&);
     void reply_get_parameter(const Parser::Data&);
     void reply_teardown(const Parser::Data&);
-    int  copy_data();
+    void write_duration(Source* source, BufferWriter& writer);
 };
 }
 #endif
@@ -14,16 +14,34 @@
 \****************************************************************************/
 #include <string>
 #include <cctype>
+#include <arpa/inet.h>
 #include <sbl/sbl_exception.h>
 #include <sbl/sbl_logger.h>
 #include "rtsp_server.h"
 #include "rtsp_talker.h"
 #include "source_map.h"
 #include "live_source.h"
+#include "file_source.h"
+#include "file_opener.h"
+#include "relay_source.h"
+#include "reactor.h"
+#include "frame_buffer.h"
+#include "gop_cache.h"
+#include "recorder.h"
+#include "event_buffer.h"
+#include "hls_packager.h"
+#include "packetizer.h"
 
 namespace RTSP {
 
+// live stream name after it asks for the clip of its last event
+static const char EVENT_PREFIX[] = "event/";
+
 Server* Server::create(const short int port, const Options& options) {
+    // packet that went to the socket in part has to be queued whole, or TCP framing is broken
+    if (options.send_queue_size < options.min_send_queue_size())
+        SBL_THROW("Send queue of %d bytes is too small, it takes at least %d bytes for packets of %d bytes",
+                  options.send_queue_size, options.min_send_queue_size(), options.packet_size);
     Server* server = new Server(port, options);
     server->create_thread(Thread::Default, STACK_SIZE);
     application()->register_rtsp_server(server);
@@ -31,44 +49,204 @@ Server* Server::create(const short int port, const Options& options) {
     return server;
 }
 
+int Server::Options::min_send_queue_size() const {
+    int packet = Packet::PREFIX + Packet::MAX_HEADER + packet_size;
+    return packet > Talker::BUFFER_SIZE ? packet : Talker::BUFFER_SIZE;
+}
+
+// Accepts connections on behalf of Server in the first reactor
+class Server::Listener : public Reactor::Handler {
+public:
+    Listener(Server* server) : _server(server) {}
+    int  fd() const     { return _server->_socket.id(); }
+    bool on_readable()  { _server->accept(); return true; }
+private:
+    Server* _server;
+};
+
 Server::Server(const short int port, const Options& options) :
         _options(options), _socket(SBL::Socket::TCP), 
-         _source_map(new SourceMap) {
+         _source_map(new SourceMap), _frame_pool(new FramePool(options.frame_pool_size)), _recorder(NULL),
+         _file_opener(new FileOpener(&_options)), _talker_id(0),
+         _groups(options.multicast_groups > 0 ? options.multicast_groups : 0, false) {
     _socket.bind(port).listen(); 
-    memset(&_packet_tick, 0, sizeof(_packet_tick));
+    if (_options.record_dir) {
+        Recorder::Options record;
+        record.dir            = _options.record_dir;
+        record.segment_time   = _options.record_segment_time;
+        record.segment_size   = _options.record_segment_size;
+        record.retention_size = (int64_t) _options.record_retention * 1024 * 1024;
+        record.retention_time = _options.record_retention_time * 3600;
+        record.queue_size     = _options.record_queue_size;
+        _recorder = new Recorder(record, _frame_pool);
+    }
+    int reactors = _options.reactors < 1 ? 1 : _options.reactors;
+    for (int n = 0; n < reactors; n++)
+        _reactors.push_back(new Reactor(n));
+    _reactors[0]->add(new Listener(this));
+    // first reactor runs in Server thread
+    for (int n = 1; n < reactors; n++)
+        _reactors[n]->create_thread(Thread::Detached, STACK_SIZE);
 }
 
 void Server::set_temporal_level(unsigned int level) {
     SBL_MSG(MSG::SERVER, "Setting temporal level to %d", level);
     for (SourceMap::Iterator it = _source_map->begin(); it != _source_map->end(); ++it) {
         Source* source = it->second;
+        // live source may be listed under other names as well
+        if (strcmp(it->first, source->name()))
+            continue;
         source->streamer()->set_temporal_level(level);
     }
 }
 
 void Server::start_thread() {
-    int thread_id = 0;
-    do {
-        SBL::Socket client_socket(_socket.accept());
-        Talker* talker = new Talker(client_socket, ++thread_id, this);
-        // new thread starts in start_thread() method
-        talker->create_thread(Thread::Detached, STACK_SIZE);    
-    } while (1);
+    _reactors[0]->start_thread();
 }
 
-Source* Server::get_source(const int stream_id) {
-    lock();
+void Server::accept() {
+    SBL::Socket client_socket(_socket.accept());
+    Reactor* reactor = _reactors[0];
+    for (unsigned int n = 1; n < _reactors.size(); n++)
+        if (_reactors[n]->handler_count() < reactor->handler_count())
+            reactor = _reactors[n];
+    Talker* talker = new Talker(client_socket, ++_talker_id, this, reactor);
+    reactor->add(talker);
+    SBL_MSG(MSG::SERVER, "Talker %d for socket %d added to reactor %d", talker->id(), client_socket.id(), reactor->id());
+}
+
+Source* Server::create_source(const int stream_id) {
+    // somebody else may have created it while we were waiting for the lock
     Source* source = _source_map->find(stream_id);
     if (!source) {
-        source = new LiveSource(stream_id, new Streamer(_options.packet_size));
+        source = new LiveSource(stream_id, new Streamer(_options.packet_size, -1, -1, _options.stap_a));
+        source->set_gop_cache(_frame_pool, _options.gop_cache_size);
+        source->set_event_buffer(_options.event_buffer_size, _options.event_buffer_time);
+        source->set_hls_packager(_options.hls_segment_time, _options.hls_segments, _options.hls_part_time);
+        if (_recorder)
+            source->set_recorder(_recorder);
         _source_map->save(stream_id, source);
         SBL_MSG(MSG::SERVER, "Server created live source for stream %d", stream_id);
     }
+    return source;
+}
+
+Source* Server::add_relay(const char* name, const char* url, bool tcp) {
+    lock();
+    if (_source_map->find(name)) {
+        unlock();
+        SBL_THROW("Stream %s already exists", name);
+    }
+    Streamer* streamer = new Streamer(_options.packet_size, -1, -1, _options.stap_a);
+    RelaySource* source = NULL;
+    try {
+        source = new RelaySource(name, url, tcp, streamer);
+    } catch (...) {
+        delete streamer;
+        unlock();
+        throw;
+    }
+    source->set_gop_cache(_frame_pool, _options.gop_cache_size);
+    source->set_event_buffer(_options.event_buffer_size, _options.event_buffer_time);
+    source->set_hls_packager(_options.hls_segment_time, _options.hls_segments, _options.hls_part_time);
+    if (_recorder)
+        source->set_recorder(_recorder);
+    _source_map->save(name, source);
+    // frames come in once the thread runs, the source has to be complete by then
+    source->start();
+    unlock();
+    SBL_INFO("Relaying %s as stream %s", url, name);
+    return source;
+}
+
+Source* Server::get_source(const int stream_id) {
+    Source* source = _source_map->find(stream_id);
+    if (source)
+        return source;
+    lock();
+    source = create_source(stream_id);
+    unlock();
+    return source;
+}
+
+Source* Server::try_get_source(const int stream_id) {
+    Source* source = _source_map->find(stream_id);
+    if (source || !_lock.trylock())
+        return source;
+    source = create_source(stream_id);
+    unlock();
+    return source;
+}
+
+Source* Server::get_source(const char* stream_name) {
+    Source* source = find_source(stream_name);
+    return source ? source : FileOpener::create(stream_name, _options);
+}
+
+Source* Server::get_source(const char* stream_name, FileWaiter* waiter) {
+    Source* source = find_source(stream_name);
+    if (!source)
+        _file_opener->open(stream_name, waiter);
+    return source;
+}
+
+Source* Server::find_source(const char* stream_name) {
+    if (!strncmp(stream_name, EVENT_PREFIX, strlen(EVENT_PREFIX)))
+        return create_event_source(stream_name);
+    return get_live_source(stream_name);
+}
+
+Source* Server::get_live_source(const char* stream_name) {
+    lock();
+    Source* source = _source_map->find(stream_name);
+    unlock();
+    if (source)
+        return source;
+    int stream_id = application()->get_stream_id(stream_name);
+    SBL_MSG(MSG::SERVER, "Application returned id %d for stream %s", stream_id, stream_name);
+    if (stream_id < 0)
+        return NULL;
+    // live source may already be there, created when its first frame came in
+    source = get_source(stream_id);
+    lock();
+    if (!_source_map->find(stream_name))
+        _source_map->save(stream_name, source);
     unlock();
-    _packet_tick.tv_sec = 0; // first packet of a frame, synchronize packet tick
     return source;
 }
 
+// Clip is copied out of the live source, so that the event buffer can go on. Only live sources are
+// looked up: a file source created for the name would be left behind.
+Source* Server::create_event_source(const char* name) {
+    Source* live = get_live_source(name + strlen(EVENT_PREFIX));
+    RTSP_ASSERT(live && live->is_live(), NOT_FOUND);
+    EventBuffer* buffer = live->event_buffer();
+    std::vector<uint8_t> clip;
+    if (!buffer || !buffer->clip(clip)) {
+        SBL_WARN("Stream %s has no event clip", live->name());
+        throw NOT_FOUND;
+    }
+    Source* source = FileSource::create(name, clip, new Streamer(_options.packet_size, -1, -1, _options.stap_a),
+                                        _options.fps, _options.ts_clock);
+    SBL_MSG(MSG::SERVER, "Server created event source %p for stream %s", source, live->name());
+    return source;
+}
+
+int Server::trigger_event() {
+    int saved = 0;
+    lock();
+    for (SourceMap::Iterator it = _source_map->begin(); it != _source_map->end(); ++it) {
+        if (strcmp(it->first, it->second->name()) || !it->second->event_buffer())
+            continue;
+        if (it->second->event_buffer()->trigger())
+            saved++;
+    }
+    unlock();
+    if (saved)
+        SBL_INFO("Event clips saved for %d streams", saved);
+    return saved;
+}
+
 int Server::client_count(unsigned int stream_id) const {
     Source* source = _source_map->find(stream_id);
     if (source) 
@@ -76,32 +254,57 @@ int Server::client_count(unsigned int stream_id) const {
     return -1;
 }
 
-void Server::packet_wait() {
-    if (_options.packet_gap == 0)
-        return;
-    // first packet of frame, don't wait
-    if (_packet_tick.tv_sec == 0) {
-        SBL_MSG(MSG::STREAMER, "Busy-wait skipped, first packet of a frame");
-        if (::clock_gettime(CLOCK_MONOTONIC, &_packet_tick) != 0)
-            SBL_ERROR("clock_gettime failed");;
-        return;
-    }
-    _packet_tick.tv_nsec += _options.packet_gap;
-    const long ONE_SECOND = 1000 * 1000 * 1000;
-    if (_packet_tick.tv_nsec >= ONE_SECOND) {
-        _packet_tick.tv_nsec -= ONE_SECOND;
-        _packet_tick.tv_sec++;
-    }
-    struct timespec now;
-    if (::clock_gettime(CLOCK_MONOTONIC, &now) != 0)
-        SBL_ERROR("clock_gettime failed");;
-    int count = 0;
-    while (now.tv_sec < _packet_tick.tv_sec || now.tv_nsec < _packet_tick.tv_nsec) {
-        if (::clock_gettime(CLOCK_MONOTONIC, &now) != 0)
-            SBL_ERROR("clock_gettime failed");;
-        count++;
+void Server::set_gop_cache_size(int stream_id, int size) {
+    SBL_INFO("Setting GOP cache of stream %d to %d bytes", stream_id, size);
+    // cgi thread, frames may be coming in; lock keeps it from racing with source creation
+    lock();
+    create_source(stream_id)->set_gop_cache(_frame_pool, size);
+    unlock();
+}
+
+bool Server::alloc_group(Group& group) {
+    struct in_addr base;
+    if (!_options.multicast_address || !inet_aton(_options.multicast_address, &base))
+        return false;
+    unsigned int slot = 0;
+    while (slot < _groups.size() && _groups[slot])
+        slot++;
+    if (slot == _groups.size())
+        return false;
+    _groups[slot] = true;
+    // slot n gets n-th address after the base, and n-th port pair
+    struct in_addr address;
+    address.s_addr = htonl(ntohl(base.s_addr) + slot);
+    inet_ntop(AF_INET, &address, group.address, sizeof group.address);
+    group.slot = slot;
+    group.port = (_options.multicast_port & ~1) + 2 * slot;
+    group.ttl  = _options.multicast_ttl;
+    SBL_MSG(MSG::SERVER, "Allocated multicast group %d, %s:%d", slot, group.address, group.port);
+    return true;
+}
+
+void Server::free_group(const Group& group) {
+    SBL_MSG(MSG::SERVER, "Released multicast group %d, %s:%d", group.slot, group.address, group.port);
+    _groups.at(group.slot) = false;
+}
+
+void Server::print_client_stats(std::ostream& str) {
+    lock();
+    for (SourceMap::Iterator it = _source_map->begin(); it != _source_map->end(); ++it) {
+        if (strcmp(it->first, it->second->name()))
+            continue;
+        it->second->streamer()->print_client_stats(str);
+        it->second->print_stats(str);
+        if (it->second->gop_cache())
+            it->second->gop_cache()->print_stats(str, it->second->name());
+        if (it->second->event_buffer())
+            it->second->event_buffer()->print_stats(str, it->second->name());
+        if (it->second->hls_packager())
+            it->second->hls_packager()->print_stats(str, it->second->name());
     }
-    SBL_MSG(MSG::STREAMER, "Busy-wait for %d ns, %d loops, tick was %d.%09d", _options.packet_gap, count, _packet_tick.tv_sec, _packet_tick.tv_nsec);
+    unlock();
+    if (_recorder)
+        _recorder->print_stats(str);
 }
 
 void Server::print_verbosity_levels(std::ostream& str) {
@@ -15,14 +15,23 @@
 *  and conditions, you may not use any of these items and must immediately   *
 *  destroy any copies you have made.                                         *
 \****************************************************************************/
+#include <vector>
 #include <sbl/sbl_socket.h>
 #include <sbl/sbl_thread.h>
 
 namespace RTSP {
 class SourceMap;
 class Source;
+class Reactor;
+class FramePool;
+class Recorder;
+class FileOpener;
+class FileWaiter;
+struct Group;
 
-//! Main server class, listens on a port and starts Talker thread for each new client.
+//! Main server class, listens on a port and creates a Talker for each new client.
+/*! Server owns a fixed pool of Reactor event loops. Server thread runs the first one, which
+    also accepts connections; each new Talker goes to the reactor with the fewest handlers.*/
 class Server : public SBL::Thread {
 public:
     //! Server options
@@ -37,22 +46,87 @@ public:
         bool  temporal_levels;  //!< enable congestion control using temporal levels
         int   increase_time;    //!< rate increase timeout (seconds) for temporal level
         int   packet_gap;       //!< time gap in nanoseconds to add between packets
+        int   pacing_rate;      //!< pace packets to this percentage of stream bitrate, 0 for no rate pacing
+        int   pacing_burst;     //!< bytes that may be sent back to back when pacing to rate
+        bool  pace_clients;     //!< pace each client on its own, rather than the whole stream
+        bool  txtime;           //!< let the kernel pace UDP clients (SO_TXTIME), if pacing each client
+        bool  udp_batch;        //!< send all UDP packets of a frame with sendmmsg/GSO (ignored when pacing)
+        int   reactors;         //!< number of event loop threads serving RTSP connections and RTCP
+        int   send_queue_size;  //!< per client send queue (bytes) for TCP, slower clients skip to next I-frame
+        int   frame_pool_size;  //!< memory (bytes) preallocated for frames copied out of SDK buffers
+        bool  stap_a;           //!< aggregate H.264 SPS/PPS/SEI with the following NAL unit into STAP-A packets
+        int   gop_cache_size;   //!< per stream cache (bytes) of the current GOP for new clients, 0 to disable
+        int   gop_cache_speed;  //!< cached frames sent with each live frame while a client catches up, 0 for all at once
+        bool  gop_cache_rebase; //!< squeeze timestamps of cached frames, so that the player doesn't lag behind
+        const char* multicast_address; //!< first multicast group address, each stream takes the next one; NULL disables multicast
+        int   multicast_port;   //!< RTP port of the first multicast group, each stream takes the next pair
+        int   multicast_ttl;    //!< time to live of multicast packets
+        int   multicast_groups; //!< how many streams may be multicast at the same time
+        bool  file_index;       //!< save the index of each streamed file next to it (<file>.idx) and reuse it
+        const char* record_dir; //!< record live H.264 streams to segments in this directory, NULL to disable recording
+        int   record_segment_time;      //!< seconds per recorded segment
+        int   record_segment_size;      //!< bytes per recorded segment, at most
+        int   record_retention;         //!< MB of segments kept per stream, 0 for no limit
+        int   record_retention_time;    //!< hours segments are kept, 0 for no limit
+        int   record_queue_size;        //!< bytes of frames waiting to be written, slower disk makes streams skip to next I-frame
+        int   event_buffer_size;        //!< per stream buffer (bytes) of recent frames for event clips, 0 to disable
+        int   event_buffer_time;        //!< seconds of video kept before an event
+        int   hls_segment_time;         //!< seconds per HLS segment of each live H.264 stream, 0 to disable packaging
+        int   hls_segments;             //!< segments listed in the HLS playlist
+        int   hls_part_time;            //!< ms per low latency HLS partial segment, 0 for whole segments only
         Options() : packet_size(1456), fps(30), ts_clock(90000),
                     send_buff_size(0), recv_buff_size(0),
                     tcp_nodelay(true), tcp_cork(false),
-                    temporal_levels(false), increase_time(60) {}
+                    temporal_levels(false), increase_time(60),
+                    packet_gap(0), pacing_rate(0), pacing_burst(16 * 1024),
+                    pace_clients(false), txtime(false), udp_batch(true), reactors(2),
+                    send_queue_size(128 * 1024), frame_pool_size(4 * 1024 * 1024), stap_a(true),
+                    gop_cache_size(0), gop_cache_speed(4), gop_cache_rebase(true),
+                    multicast_address(NULL), multicast_port(20000), multicast_ttl(16), multicast_groups(64),
+                    file_index(false), record_dir(NULL), record_segment_time(60), record_segment_size(64 * 1024 * 1024),
+                    record_retention(0), record_retention_time(0), record_queue_size(4 * 1024 * 1024),
+                    event_buffer_size(0), event_buffer_time(10),
+                    hls_segment_time(0), hls_segments(6), hls_part_time(0) {}
+        //! Smallest send_queue_size that holds an interleaved packet of packet_size and an RTSP reply
+        int min_send_queue_size() const;
     };
     //! Create a new Server.
     /** This is the only way to create a new server. The object will be allocated on the heap.
         This object should never be deleted and the behavior is undefined when it is */
+    /** Options are checked first, it throws if they can't work */
     static Server* create(const short int port, const Options& options);
 
     //! Create a new Server with default options
     static Server* create(const short int port) { return create(port, Options()); }
 
-    //! Find the Source object associated with the stream.
+    //! Find the Source object associated with the stream, creating it if needed.
     Source* get_source(const int stream_id);
 
+    //! Find the Source object associated with the stream, on the frame path.
+    /*! Existing sources are found without locking. If the source has to be created while the server
+        is busy with a client, NULL is returned instead of waiting; such stream has no clients yet,
+        so its frame can be dropped. */
+    Source* try_get_source(const int stream_id);
+
+    //! Find the Source object of a live stream given its name, creating it if needed, or open the file.
+    /*! Every call for a file returns a new source, owned by the caller; it is opened and indexed in the
+        calling thread, without holding the server lock. So does event/<stream>, which plays the clip of the last
+        event of a live stream (see trigger_event()), or its buffered video if there was none. Throws Errcode if
+        there is no such stream. */
+    Source* get_source(const char* stream_name);
+
+    //! Same as get_source(stream_name), except that a file is opened by the file opener thread.
+    /*! NULL is returned for a file, and the waiter is told once it is open (see FileOpener::open()). */
+    Source* get_source(const char* stream_name, FileWaiter* waiter);
+
+    //! Add a live stream restreamed from a remote RTSP server (see RelaySource)
+    /*! The relay connects right away and stays connected; clients play it by name.
+        Throws SBL::Exception if the name is taken or the url is not an rtsp url. */
+    // @param   name    stream name
+    // @param   url     rtsp url of the remote stream
+    // @param   tcp     interleave media on the RTSP connection, rather than UDP
+    Source* add_relay(const char* name, const char* url, bool tcp);
+
     //! set temporal level for all clients (testing)
     void set_temporal_level(unsigned int level);
 
@@ -61,13 +135,28 @@ public:
 
     //! return options
     Options* options() { return &_options; }
+    //! return pool for frames shared between streamers and other consumers
+    FramePool* frame_pool() { return _frame_pool; }
+    //! return recorder of live streams, NULL if not recording
+    Recorder* recorder() { return _recorder; }
+    //! return opener of file sources, whose thread reads and indexes files for RTSP clients
+    FileOpener* file_opener() { return _file_opener; }
     //! return how many clients are currently attached to a given stream or
     //! -1 if the given stream_id is invalid
     int client_count(unsigned int stream_id) const;
     //! print verbosity levels
     static void print_verbosity_levels(std::ostream& str);
-    //! busy wait between packets
-    void packet_wait();
+    //! print send queue statistics for all clients of all streams
+    void print_client_stats(std::ostream& str);
+    //! set GOP cache limit (bytes) for one stream, 0 to disable caching
+    void set_gop_cache_size(int stream_id, int size);
+    //! freeze the event buffer of each live stream as its event clip, return how many were saved
+    int  trigger_event();
+    //! reserve multicast address and port pair for a stream, call with server locked
+    // @return  false if multicast is off, or all groups are taken
+    bool alloc_group(Group& group);
+    //! release a group reserved by alloc_group(), call with server locked
+    void free_group(const Group& group);
     //! update packet_gap
     void set_packet_gap(int packet_gap) { _options.packet_gap = packet_gap; }
     //! public lock procedure
@@ -81,15 +170,33 @@ private:
 
     Server(const short int port, const Options& options);
 
+    class Listener;
+    friend class Listener;
+
     Options         _options;
     SBL::Socket      _socket;
     // Receive and transmit buffers
     static const int STACK_SIZE = 64 * 1024; 
     SBL::Mutex      _lock;
     SourceMap*      _source_map;
-    struct timespec _packet_tick;
+    FramePool*      _frame_pool;
+    Recorder*       _recorder;
+    FileOpener*     _file_opener;
+    std::vector<Reactor*> _reactors;
+    int             _talker_id;         // id of the last Talker created
+    std::vector<bool> _groups;          // multicast groups in use, by slot
 
     void start_thread();
+    // Create a source for a live stream, call with server locked
+    Source* create_source(const int stream_id);
+    // Live source or event clip of a stream name, NULL if the name is a file
+    Source* find_source(const char* stream_name);
+    // Live (or relayed) source of a stream name, NULL if the application doesn't know it
+    Source* get_live_source(const char* stream_name);
+    // Create a file source playing the event clip of a live stream
+    Source* create_event_source(const char* stream_name);
+    // Create a Talker for a new connection and hand it to the least busy reactor
+    void accept();
     
 };
 
@@ -19,6 +19,7 @@
 #include <cstdio>
 #include <ostream>
 #include <iomanip>
+#include "buffer_writer.h"
 
 namespace RTSP {
 
@@ -48,6 +49,10 @@ public:
     bool operator==(const SessionID& id) const { return _session_id == id._session_id; }
     //! write SessionID in the server reply
     friend std::ostream& operator<<(std::ostream& str, const SessionID& session_id);
+    //! write SessionID in the server reply
+    friend BufferWriter& operator<<(BufferWriter& str, const SessionID& session_id) {
+        return str.hex(session_id._session_id, 8, true);
+    }
 private:
     SessionID(int id) : _session_id(id) {}
     int _session_id;
@@ -12,12 +12,17 @@
 *  and conditions, you may not use any of these items and must immediately   *
 *  destroy any copies you have made.                                         *
 \****************************************************************************/
+#include <algorithm>
 #include <cstring>
-#include <unistd.h>
+#include <ctime>
 #include <sbl/sbl_exception.h>
 #include "rtsp_source.h"
 #include "rtsp_impl.h"
 #include "rtp_streamer.h"
+#include "gop_cache.h"
+#include "recorder.h"
+#include "event_buffer.h"
+#include "hls_packager.h"
 
 namespace RTSP {
 
@@ -29,7 +34,8 @@ Source::Source(const char* name, Streamer* streamer) :
             _pps(NULL), _pps_size(0),
             _timestamp(0), _playing(false),
             // encoder_type needs to be set up to unknown when PSIA server is updated
-            _name(name), _streamer(streamer)  { 
+            _name(name), _streamer(streamer), _gop_cache(NULL), _event_buffer(NULL), _hls_packager(NULL), _recorder(NULL), _record_track(-1),
+            _params_version(0), _sdp_media_size(0), _sdp_params_version(0), _sdp_encoder(UNKNOWN_ENCODER), _sdp_bitrate(0)  { 
     streamer->set_source(this);
 }
 
@@ -38,14 +44,16 @@ Source::Source(const int id, Streamer* streamer, const char* stream_name)  :
             _pps(NULL), _pps_size(0),
             _timestamp(0), _playing(false),
             // encoder_type needs to be set up to unknown when PSIA server is updated
-             _streamer(streamer) {
-    streamer->set_source(this);
+             _streamer(streamer), _gop_cache(NULL), _event_buffer(NULL), _hls_packager(NULL), _recorder(NULL), _record_track(-1),
+            _params_version(0), _sdp_media_size(0), _sdp_params_version(0), _sdp_encoder(UNKNOWN_ENCODER), _sdp_bitrate(0) {
     char buffer[16];
     if (stream_name == NULL) {
         snprintf(buffer, sizeof buffer, "%d", id);
         _name = buffer;
     } else 
         _name = stream_name;
+    // streamer names its metrics after the source
+    streamer->set_source(this);
 }
 
 const char* Source::encoder_name() const {
@@ -81,20 +89,85 @@ Source::~Source() {
         _pps_size = 0;
     }
     _sps_lock.unlock();
+    delete _gop_cache;
+    delete _event_buffer;
+    delete _hls_packager;
     SBL_MSG(MSG::SOURCE, "Deleted source %s", _name.c_str());
 }
 
-void Source::save_sps(uint8_t* frame, int frame_size) {
+void Source::send_shared_frame(const FrameRef& frame, uint32_t timestamp, EncoderType encoder) {
+    _frame_ref = frame;
+    try {
+        send_frame(frame.data(), frame.size(), timestamp, encoder);
+    } catch (...) {
+        _frame_ref.reset();
+        throw;
+    }
+    _frame_ref.reset();
+}
+
+void Source::cache_frame(const uint8_t* frame, int frame_size, uint32_t timestamp) {
+    if (_event_buffer && encoder_type() == H264)
+        _event_buffer->add(frame, frame_size, timestamp, frame_type(frame[0]) == 's');
+    if (_hls_packager && encoder_type() == H264)
+        _hls_packager->add(frame, frame_size, timestamp);
+    // GOP starts with SPS for H.264, with visual object sequence for MPEG4, MJPEG has no use for the cache
+    if (!_gop_cache || (encoder_type() != H264 && encoder_type() != MPEG4))
+        return;
+    bool key = encoder_type() == H264 ? frame_type(frame[0]) == 's' : frame_size > 3 && frame[3] == 0xb0;
+    _gop_cache->add(frame, frame_size, timestamp, key, _frame_ref);
+}
+
+void Source::record_frame(const uint8_t* frame, int frame_size, uint32_t timestamp) {
+    if (_recorder && encoder_type() == H264)
+        _recorder->record(_record_track, frame, frame_size, timestamp, _frame_ref);
+}
+
+void Source::set_recorder(Recorder* recorder) {
+    _record_track = recorder->add_track(_name.c_str());
+    _recorder     = _record_track < 0 ? NULL : recorder;
+}
+
+void Source::set_event_buffer(int max_bytes, int seconds) {
+    if (!_event_buffer && max_bytes > 0 && seconds > 0)
+        _event_buffer = new EventBuffer(max_bytes, seconds);
+}
+
+// Sequence numbers start at the current time, so that segment names of a restarted server don't
+// collide with the ones HTTP caches still have
+void Source::set_hls_packager(int segment_time, int segments, int part_time) {
+    if (_hls_packager || segment_time <= 0 || segments <= 0)
+        return;
+    HlsPackager::Options options;
+    options.segment_time   = segment_time;
+    options.segments       = segments;
+    options.part_time      = part_time;
+    options.first_sequence = time(NULL);
+    _hls_packager = new HlsPackager(options);
+}
+
+// Frame thread picks the cache up on its own, so it is complete before it is published
+void Source::set_gop_cache(FramePool* pool, int max_bytes) {
+    if (_gop_cache) {
+        _gop_cache->set_max_bytes(max_bytes);
+    } else if (max_bytes > 0) {
+        GopCache* cache = new GopCache(pool, max_bytes);
+        __sync_synchronize();
+        _gop_cache = cache;
+    }
+}
+
+void Source::save_sps(const uint8_t* frame, int frame_size) {
     SBL_MSG(MSG::SOURCE, "Saving SPS for source %s", _name.c_str());
     save_params(frame, frame_size, _sps, _sps_size);
 }
 //! save PPS frame
-void Source::save_pps(uint8_t* frame, int frame_size) {
+void Source::save_pps(const uint8_t* frame, int frame_size) {
     SBL_MSG(MSG::SOURCE, "Saving PPS for source %s", _name.c_str());
     save_params(frame, frame_size, _pps, _pps_size);
 }
 
-bool Source::save_if_sps_pps(uint8_t* frame, int size) {
+bool Source::save_if_sps_pps(const uint8_t* frame, int size) {
     switch (frame_type(frame[0])) {
         case 's':   save_sps(frame, size);  return true;
         case 'p':   save_pps(frame, size);  return true;
@@ -106,20 +179,42 @@ int Source::seq_number() {
     return _streamer->seq_number();
 }
 
-void Source::save_params(uint8_t* frame, int frame_size, uint8_t*& buffer, int& buffer_size) {
+// Live sources send the same sps/pps with every I-frame, so they are copied (and sdp invalidated) only when they change
+void Source::save_params(const uint8_t* frame, int frame_size, uint8_t*& buffer, int& buffer_size) {
     _sps_lock.lock();
-    if (frame_size > buffer_size) {
-        if (buffer)
-            delete[] buffer;
-        buffer = new uint8_t[frame_size];
+    if (frame_size != buffer_size || memcmp(buffer, frame, frame_size)) {
+        if (frame_size > buffer_size) {
+            if (buffer)
+                delete[] buffer;
+            buffer = new uint8_t[frame_size];
+        }
+        memcpy(buffer, frame, frame_size);
+        buffer_size = frame_size;
+        _params_version++;
     }
-    memcpy(buffer, frame, frame_size);
-    buffer_size = frame_size;
+    // anybody waiting for the parameter set is woken up
+    if (_sps && _pps) {
+        _sps_lock.broadcast();
+        for (unsigned int n = 0; n < _param_waiters.size(); n++)
+            _param_waiters[n]->param_set_saved();
+        _param_waiters.clear();
+    }
+    _sps_lock.unlock();
+}
+
+bool Source::param_set_ready(ParamSetWaiter* waiter) {
+    _sps_lock.lock();
+    bool ready = _sps && _pps;
+    if (!ready)
+        _param_waiters.push_back(waiter);
     _sps_lock.unlock();
+    return ready;
 }
 
-bool Source::is_nal_header(uint8_t* frame) {
-    return frame[0] == 0 && frame[1] == 0 && frame[2] == 0 && frame[3] == 1;
+void Source::cancel_param_wait(ParamSetWaiter* waiter) {
+    _sps_lock.lock();
+    _param_waiters.erase(std::remove(_param_waiters.begin(), _param_waiters.end(), waiter), _param_waiters.end());
+    _sps_lock.unlock();
 }
 
 int Source::profile_level(uint8_t* sps) {
@@ -129,47 +224,85 @@ int Source::profile_level(uint8_t* sps) {
          |  (sps[3] & 0x0ff); // profile_idc|constraint_setN_flag|level_idc
 }
 
-std::ostream& Source::write_param_set(std::ostream& str) {
+bool Source::wait_param_set() {
     // when used with PSIA server, we may be asked for param set before sps & pps were cached,
     // so we wait for about 2 GOPs before giving up
-    for (int n = 0; n < 60 && ! ((volatile uint8_t*) _sps && (volatile uint8_t*) _pps); ++n) {
-        SBL_MSG(MSG::SOURCE, "Waiting for sps/pps");
-        usleep(30000);
+    if (_sps && _pps)
+        return true;
+    SBL_MSG(MSG::SOURCE, "Waiting for sps/pps");
+    timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (!(_sps && _pps)) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int left = PARAM_SET_TIMEOUT - (now.tv_sec - start.tv_sec) * 1000 - (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (left <= 0)
+            return false;
+        _sps_lock.wait(left % 1000 * 1000, left / 1000);
     }
-    RTSP_ASSERT(_sps && _pps, ERROR_MISSING_SPS);
-    // Can't see a scenario where client would be deleted between _sps is checked
-    // (above) and used (below). The profile_level() will assert in that case.
-    _sps_lock.lock();
-    std::ios_base::fmtflags flags = str.flags();
+    return true;
+}
+
+void Source::write_param_set(BufferWriter& str) {
+    // non-interleaved mode (1) allows both FU-A and STAP-A, whether Streamer aggregates or not
     str << "a=fmtp:" << payload_type()
-        << " packetization-mode=1;profile-level-id=" << std::hex << profile_level(_sps)
+        << " packetization-mode=1;profile-level-id=";
+    str.hex(profile_level(_sps), 6)
         << ";sprop-parameter-sets=";
-    str.flags(flags);
-    encode64(str, _sps, _sps_size) << ',' ;
-    encode64(str, _pps, _pps_size);
+    str.base64(_sps, _sps_size) << ',';
+    str.base64(_pps, _pps_size);
+}
+
+std::ostream& Source::write_param_set(std::ostream& str) {
+    char buffer[SDP_MEDIA_SIZE];
+    BufferWriter line(buffer, sizeof buffer);
+    _sps_lock.lock();
+    bool ready = wait_param_set();
+    if (ready)
+        write_param_set(line);
     _sps_lock.unlock();
-    return str;
-}
-
-
-std::ostream& Source::encode64(std::ostream& str, uint8_t* data, int size) {
-    static const char encode_table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-    SBL_THROW_IF(!data, "attempt to encode void data"); 
-    SBL_THROW_IF(!size, "attempt to encode empty data");
-
-    int triplets = 3 * ((size - 1) / 3 + 1);
-    // Map each full group of 3 input bytes into 4 output base-64 characters:
-    for (int i = 0; i < triplets; i += 3) {
-        str << encode_table[(data[i] >> 2) & 0x3F]
-            << (i + 1 < size ? encode_table[(((data[i] & 0x3) << 4) | (data[i + 1] >> 4)) & 0x3F] :
-                               encode_table[((data[i] & 0x3) << 4) & 0x3F])
-            << (i + 2 < size ? encode_table[((data[i + 1] << 2) | (data[i + 2] >>6)) & 0x3F] :
-                i + 1 < size ? encode_table[(data[i + 1] << 2) &0x3F] :
-                               '=')
-            << (i + 2 < size ? encode_table[data[i + 2] & 0x3F] :
-                               '=');
+    RTSP_ASSERT(ready, ERROR_MISSING_SPS);
+    return str << line.data();
+}
+
+void Source::render_sdp_media() {
+    const char* eol = "\r\n";
+    int payload = payload_type();
+    BufferWriter str(_sdp_media, sizeof _sdp_media);
+    str << "m=video 0 RTP/AVP " << payload << eol
+        << "c=IN IP4 0.0.0.0" << eol
+        << "b=AS:" << get_bitrate() << eol;
+    if (encoder_type() == H264) {
+        str << "a=rtpmap:" << payload << " H264/90000" << eol;
+        write_param_set(str);
+        str << eol;
+    } else if (encoder_type() == MPEG4) {
+        str << "a=rtpmap:" << payload << " MP4V-ES/90000" << eol;
     }
-    return str;
+    _sdp_media_size     = str.ok() ? str.size() : 0;
+    _sdp_params_version = _params_version;
+    _sdp_encoder        = encoder_type();
+    _sdp_bitrate        = _stream_desc.bitrate;
+    SBL_MSG(MSG::SOURCE, "Source %s, rendered sdp media, %d bytes", _name.c_str(), _sdp_media_size);
+}
+
+void Source::write_sdp_media(BufferWriter& str) {
+    Errcode errcode = OK;
+    _sps_lock.lock();
+    if (_sdp_media_size == 0 || _sdp_params_version != _params_version ||
+        _sdp_encoder != encoder_type() || _sdp_bitrate != _stream_desc.bitrate) {
+        if (encoder_type() != H264 && encoder_type() != MJPEG && encoder_type() != MPEG4)
+            errcode = ERROR_UNSUPPORTED_ENCODER;
+        else if (encoder_type() == H264 && !(_sps && _pps))
+            errcode = ERROR_MISSING_SPS;
+        else
+            render_sdp_media();
+        if (errcode == OK && _sdp_media_size == 0)
+            errcode = SERVER_BUFFER_OVERFLOW;
+    }
+    if (errcode == OK)
+        str.write(_sdp_media, _sdp_media_size);
+    _sps_lock.unlock();
+    RTSP_ASSERT(errcode == OK, errcode);
 }
 
 int Source::get_bitrate() const { 
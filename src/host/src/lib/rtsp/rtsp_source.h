@@ -16,17 +16,34 @@
 *  destroy any copies you have made.                                         *
 \****************************************************************************/
 #include <ostream>
+#include <utility>
+#include <vector>
 #include "rtsp.h"
 #include "rtsp_session_id.h"
+#include "buffer_writer.h"
 #include <sbl/sbl_socket.h>
 #include <sbl/sbl_thread.h>
 #include <sbl/sbl_logger.h>
 
 namespace RTSP {
 class Streamer;
+class GopCache;
+class Recorder;
+class EventBuffer;
+class HlsPackager;
+
+//! Waits for SPS and PPS of a source, see Source::param_set_ready()
+class ParamSetWaiter {
+public:
+    //! Called once they are saved, from the thread that saved them, with the source locked
+    virtual void param_set_saved() = 0;
+protected:
+    virtual ~ParamSetWaiter() {}
+};
 
 //! An abstract base clase for LiveSource and FileSource classes.
-/*! It implements sps/pps caching and writing sdp to a Responder stream. */
+/*! It implements sps/pps caching and writing sdp to a Responder stream.
+    Media part of the sdp is rendered once and kept, DESCRIBE only copies it. */
 class Source  {
 public:
     //! Constructor requires stream name and pointer to the streamer.
@@ -38,8 +55,22 @@ public:
     //! This is called from the callback, when a frame is ready for this source.
     //! FileSource doesn't use this method, because it calls streamer->send_frame directly.
     virtual void send_frame(uint8_t* frame, int size, uint32_t timestamp, EncoderType encoder) = 0;
+    //! Send a frame from the frame pool, so that it can be kept (see gop_cache()) without copying.
+    void send_shared_frame(const FrameRef& frame, uint32_t timestamp, EncoderType encoder);
+    //! Frame being sent, if it came from the frame pool, empty reference otherwise
+    const FrameRef& frame_ref() const { return _frame_ref; }
     //! This is called when TEARDOWN method is received.
     virtual void teardown() = 0;
+    //! This is called when PAUSE method is received. Live sources keep going, only the client stops.
+    virtual void pause() {}
+    //! Move playback to npt seconds (Range: of PLAY), return where it will start. Live sources can't seek.
+    virtual double seek(double npt) { return 0; }
+    //! Change playback speed (Scale: of PLAY), return the scale that will be used. Live sources play at 1.
+    virtual double set_scale(double scale) { return 1; }
+    //! Where playback (re)starts, in seconds
+    virtual double position() const { return 0; }
+    //! Length of the stream in seconds, 0 if it has none (live)
+    virtual double duration() const { return 0; }
     //! Need to distinguish between Live and FileSources.
     virtual bool is_live() const = 0;
     //! Ask application to play (only live source use this)
@@ -52,9 +83,22 @@ public:
     //! Sequence number is maintained by Streamer, this is a convienience method that
     //! forwards the request there.
     virtual int seq_number();
-    //! Write out parameter set line of the .sdp file to the Responder output stream.
+    //! Write out parameter set line of the .sdp file to the output stream.
+    //! Waits up to PARAM_SET_TIMEOUT for SPS/PPS, so it is not to be called from a reactor.
     //! @param str  output stream to write data to
     std::ostream& write_param_set(std::ostream& str);
+    //! Write media description of the .sdp file (from m= line on, without control) for DESCRIBE reply.
+    //! It is rendered again only when SPS/PPS or stream description have changed since the last time.
+    //! It doesn't wait for SPS/PPS, DESCRIBE fails if an H.264 source doesn't have them yet.
+    //! @param str  writer to copy it to
+    void write_sdp_media(BufferWriter& str);
+    //! ms to wait for sps/pps, about 2 GOPs
+    enum {PARAM_SET_TIMEOUT = 1800};
+    //! Return true if SPS and PPS are saved. Otherwise the waiter is told once they are,
+    //! unless cancel_param_wait() is called first.
+    bool param_set_ready(ParamSetWaiter* waiter);
+    //! Stop waiting for SPS/PPS on behalf of the waiter
+    void cancel_param_wait(ParamSetWaiter* waiter);
     //! Return this source name
     const char* name() const { return _name.c_str(); }
     //! Return the Streamer associated with this Source.
@@ -75,6 +119,29 @@ public:
     int payload_type() const;
     //! Return this source encoder name
     const char* encoder_name() const;
+    //! Cache of the current GOP for clients joining mid-GOP, NULL if not enabled
+    GopCache* gop_cache() const { return _gop_cache; }
+    //! Enable GOP caching, or change the limit. Call under Server lock, frames may be coming in.
+    // @param   pool        pool to copy frames into
+    // @param   max_bytes   limit on cached frame data, 0 to stop caching
+    void set_gop_cache(FramePool* pool, int max_bytes);
+    //! Recent frames kept for event clips, NULL if not enabled
+    EventBuffer* event_buffer() const { return _event_buffer; }
+    //! Enable the event buffer (H.264 only); it is set up once, later calls are ignored
+    // @param   max_bytes   size of the buffer, 0 not to buffer
+    // @param   seconds     video kept before an event
+    void set_event_buffer(int max_bytes, int seconds);
+    //! Packager of this stream for HTTP (HLS) viewers, NULL if not enabled
+    HlsPackager* hls_packager() const { return _hls_packager; }
+    //! Enable HLS packaging (H.264 only); it is set up once, later calls are ignored
+    // @param   segment_time    seconds per segment, 0 not to package
+    // @param   segments        segments listed in the playlist
+    // @param   part_time       ms per partial segment, 0 for none
+    void set_hls_packager(int segment_time, int segments, int part_time);
+    //! Print counters of the source itself, if it keeps any, on one line
+    virtual void print_stats(std::ostream& str) {}
+    //! Record this stream (H.264 only), from its next key frame on
+    void set_recorder(Recorder* recorder);
     //! Abstract base classes must have virtual destructor by definition.
     virtual ~Source();
     //! return frame type ('s', 'p', 'I', 'P')
@@ -94,25 +161,46 @@ protected:
     Application::StreamDesc   _stream_desc;   //!< description of stream associated with this source
 
     //! save SPS frame
-    void save_sps(uint8_t* frame, int frame_size);
+    void save_sps(const uint8_t* frame, int frame_size);
     
     //! save PPS frame
-    void save_pps(uint8_t* frame, int frame_size);
+    void save_pps(const uint8_t* frame, int frame_size);
 
-    //! true if frame points to a valid NAL header (0001)
-    static bool is_nal_header(uint8_t* frame);
     //! save SPS or PPS, return true if either
-    bool save_if_sps_pps(uint8_t* frame, int frame_size);
+    bool save_if_sps_pps(const uint8_t* frame, int frame_size);
+    //! add frame to GOP cache, event buffer and HLS packager, if there are any, whether this source is playing or not
+    void cache_frame(const uint8_t* frame, int frame_size, uint32_t timestamp);
+    //! queue frame for recording, if the stream is recorded
+    void record_frame(const uint8_t* frame, int frame_size, uint32_t timestamp);
 private:
+    enum {SDP_MEDIA_SIZE = 512};
     std::string _name;
     Streamer*   _streamer;
-    SBL::Mutex  _sps_lock;
+    SBL::Mutex  _sps_lock;          // guards sps/pps and sdp, also signals when sps/pps are saved
+    GopCache*   _gop_cache;
+    EventBuffer* _event_buffer;
+    HlsPackager* _hls_packager;
+    Recorder*   _recorder;
+    int         _record_track;
+    FrameRef    _frame_ref;
+    unsigned int _params_version;   // incremented whenever sps or pps change
+    std::vector<ParamSetWaiter*> _param_waiters;    // woken up once sps and pps are saved
+    char        _sdp_media[SDP_MEDIA_SIZE];
+    int         _sdp_media_size;    // 0 until sdp is rendered
+    unsigned int _sdp_params_version;
+    EncoderType _sdp_encoder;       // stream description sdp was rendered with
+    int         _sdp_bitrate;
 
     static const char* _frame_type;
 
-    std::ostream& encode64(std::ostream& str, uint8_t* data, int data_size);
     int profile_level(uint8_t*);
-    void save_params(uint8_t* frame, int frame_size, uint8_t*& buffer, int& buffer_size);
+    void save_params(const uint8_t* frame, int frame_size, uint8_t*& buffer, int& buffer_size);
+    // wait for both sps and pps to be saved, return false on timeout; call with _sps_lock held
+    bool wait_param_set();
+    // write parameter set line, without end of line; call with _sps_lock held
+    void write_param_set(BufferWriter& str);
+    // render media part of sdp into _sdp_media; call with _sps_lock held
+    void render_sdp_media();
 };
 
 }
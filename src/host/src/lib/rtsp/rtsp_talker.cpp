@@ -14,6 +14,9 @@
 \****************************************************************************/
 #include <string>
 #include <cctype>
+#include <cerrno>
+#include <sys/socket.h>
+#include <netinet/in.h>
 #include <sbl/sbl_exception.h>
 #include <sbl/sbl_logger.h>
 
@@ -21,158 +24,289 @@
 #include "rtsp_server.h"
 #include "rtsp_parser.h"
 #include "rtsp_responder.h"
-#include "file_source.h"
-#include "live_source.h"
 #include "source_map.h"
 #include "rtcp.h"
 
 namespace RTSP {
 
-Talker::Talker(const SBL::Socket socket, int id, Server* master) :
+Talker::Talker(const SBL::Socket socket, int id, Server* master, Reactor* reactor) :
         _id(id),  _socket(socket), 
-        _rx_bytes(0), _msg_size(0), _master(master), _rtcp_parser(NULL),
-        _client(NULL), _source(NULL), _session_id("") {
+        _rx_bytes(0), _rx_start(0), _msg_size(0), _body_size(0), _scan(0), _master(master), _reactor(reactor),
+        _responder(this, _tx_buffer, BUFFER_SIZE), _rtcp_parser(NULL),
+        _client(NULL), _source(NULL), _open_error(OK), _session_id(""), _writable(false),
+        _waiting(WAIT_NONE), _resumed(WAIT_NONE) {
     _server_port = _socket.local_address(_server_ip);
     _client_port = _socket.remote_address(_client_ip);
     SBL_MSG(MSG::SERVER, "Created RTSP talker id %d", id);
 }
 
-void Talker::start_thread() {
-    SBL_INFO("RTSP talker thread %d listening to %s:%d", id(), _client_ip, _client_port);
-    Parser      parser;
-    Responder   responder(this, _tx_buffer, BUFFER_SIZE);
-    Method      method = OPTIONS;
+Talker::~Talker() {
+    try {
+        teardown();
+    } catch (SBL::Exception& ex) {
+        SBL_WARN("RTSP talker %d, teardown failed: %s", id(), ex.what());
+    }
+    _socket.close();
+    SBL_INFO("RTSP talker %d terminating", id());
+}
+
+bool Talker::on_readable() {
+    // parked talker doesn't wait for data, it is called only when the connection failed or was closed
+    if (parked()) {
+        SBL_MSG(MSG::SERVER, "RTSP talker %d, connection to %s:%d lost while parked", id(), _client_ip, _client_port);
+        teardown();
+        return false;
+    }
+    // Always leave space to append \0 for logging.
+    int size = ::recv(_socket.id(), _rx_buffer + _rx_bytes, BUFFER_SIZE - _rx_bytes - 1, MSG_DONTWAIT);
+    if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return true;
+    if (size <= 0) {
+        SBL_MSG(MSG::SERVER, "RTSP talker %d, connection closed by %s:%d", id(), _client_ip, _client_port);
+        teardown();
+        return false;
+    }
+    _rx_bytes += size; 
+    SBL_MSG(MSG::SERVER, "Received %d bytes, have total %d bytes", size, _rx_bytes);
+    return process_messages();
+}
+
+bool Talker::process_messages() {
+    Method method = OPTIONS;
     do {
         try {
-            MsgType msg_type = receive_msg();
-            if (msg_type == MSG_RTSP) {
-                SBL_MSG(MSG::SERVER, "RTSP Server thread %d received message length %d:\n%s", 
-                         id(), _msg_size, _rx_buffer);
-                method = parser.parse(_rx_buffer, _msg_size);
-                int reply_size = responder.reply(parser.data);
-                SBL_MSG(MSG::SERVER, "RTSP Server thread %d reply:\n%s", id(), _tx_buffer);
-                if (!_socket.send(_tx_buffer, reply_size, false)) {
-                    SBL_MSG(MSG::SERVER, "RTSP Server thread %d, socket error, exiting thread ...\n", id());
-                    break;
-                }
-                if (method == PLAY) {
-                    RTSP_ASSERT(client(), BAD_REQUEST);
-                    client()->play();
-                }
-            } else if (msg_type == MSG_RTCP) {
-                SBL_MSG(MSG::SERVER, "RTSP Server thread %d received RTCP message length %d", 
-                         id(), _msg_size);
-                if (_rtcp_parser) {
-                    RTSP_ASSERT(_msg_size >= 4, BAD_REQUEST);
-                    _rtcp_parser->parse(_rx_buffer + 4, _msg_size - 4);
-                }
-                else
-                    SBL_WARN("Thread %d, received RTCP message, but RTCP parser is not yet ready", id());
-            } else
-                method = TEARDOWN;
-            _rx_bytes -= _msg_size;
-            if (_rx_bytes > 0)
-                memmove(_rx_buffer, _rx_buffer + _msg_size, _rx_bytes);
+            MsgType msg_type = next_msg();
+            if (msg_type == MSG_NONE) {
+                RTSP_ASSERT(_rx_bytes - _rx_start < BUFFER_SIZE - 1, SERVER_BUFFER_OVERFLOW);
+                break;
+            }
+            method = process(msg_type);
+            // parked message stays in the buffer, it is processed again when the talker resumes
+            if (parked())
+                break;
+            consume();
         } catch (Errcode errcode) {
             // If we catch Errcode, it may be possible to continue, so reply with error code
             SBL_MSG(MSG::SERVER, "RTSP talker %d caught error code %d", id(), errcode);
-            int reply_size = responder.reply(parser.data, errcode);
-            SBL_MSG(MSG::SERVER, "RTSP talker thread %d reply:\n%s\n", id(), _tx_buffer);
-            if (!_socket.send(_tx_buffer, reply_size, false)) {
-                SBL_MSG(MSG::SERVER, "Talker %d unable to send reply, exiting...", id());
+            if (!reply_error(errcode))
                 method = TEARDOWN;
-            }
             // We throw out any data already received if we had error
-            _rx_bytes = _msg_size = 0;
+            _rx_bytes = _rx_start = _msg_size = _body_size = _scan = 0;
+            _resumed = WAIT_NONE;
         } catch (SBL::Exception& ex) {
             // if we catch Exception, it is coming from Socket, so can't send anything back    
-            // log the error in the log file and terminate the thread;
+            // log the error in the log file and close the connection;
             SBL_MSG(MSG::SERVER, "RTSP talker %d exiting, caught exception %s", id(), ex.what());
             method = TEARDOWN;
         }
-    } while (method != TEARDOWN);
+    } while (method != TEARDOWN && !parked() && _rx_start < _rx_bytes);
+    // parser data of the parked message points into the buffer, so it stays where it is
+    if (method != TEARDOWN) {
+        if (!parked())
+            compact();
+        return true;
+    }
     teardown();
-    SBL_INFO("RTSP talker %d terminating", id());
-    delete this;
+    return false;
+}
+
+bool Talker::on_writable() {
+    if (_client && _client->is_interleaved() && !_client->drain()) {
+        SBL_MSG(MSG::SERVER, "RTSP talker %d, socket error, closing connection ...", id());
+        teardown();
+        return false;
+    }
+    watch_writable();
+    return true;
 }
 
+bool Talker::on_wakeup() {
+    return parked() ? resume() : true;
+}
 
-Talker::MsgType Talker::receive_msg() {
-    if (!receive()) 
-        return MSG_RESET;
-    if (_rx_buffer[0] == '$')
-        return receive_rtcp();
-    return receive_rtsp();
+bool Talker::on_timer() {
+    if (_waiting != WAIT_PARAM_SET)
+        return true;
+    SBL_WARN("RTSP talker %d, no sps/pps from %s in %d ms", id(), _source->name(), (int) Source::PARAM_SET_TIMEOUT);
+    return resume();
 }
 
-Talker::MsgType Talker::receive_rtcp() {
-    while (_rx_bytes < 4) {
-        if (!receive())
-            return MSG_RESET;
+void Talker::watch_writable() {
+    bool writable = _client && _client->is_backlogged();
+    if (writable != _writable) {
+        _reactor->watch(this, !parked(), writable);
+        _writable = writable;
     }
-    RTSP_ASSERT(_rx_buffer[1] == 1, BAD_REQUEST);
-    _msg_size = (((_rx_buffer[2] & 0x00ff) << 8) | (_rx_buffer[3] & 0x00ff)) + 4;
-    while (_rx_bytes < _msg_size) {
-        if (!receive())
-            return MSG_RESET;
+}
+
+// A file is opened by the file opener first. Application is asked to play a live stream for its first viewer,
+// and the stream is described. Each step is done once, a resumed DESCRIBE goes on from the step it waited in.
+bool Talker::park_describe() {
+    if (_resumed == WAIT_PARAM_SET)
+        return false;
+    if (_resumed == WAIT_FILE) {
+        RTSP_ASSERT(_source, _open_error);
+    } else if (!_source) {
+        RTSP_ASSERT(_parser.data.stream_name, BAD_REQUEST);
+        // opener thread sets _source, so it is not written here when the file is queued
+        Source* source = _master->get_source(_parser.data.stream_name, this);
+        if (!source) {
+            SBL_MSG(MSG::SERVER, "RTSP talker %d waits for file %s to open", id(), _parser.data.stream_name);
+            park(WAIT_FILE);
+            return true;
+        }
+        _source = source;
     }
-    return MSG_RTCP;
+    SBL_MSG(MSG::SERVER, "Server %d, source %p for stream %s", id(), _source, _parser.data.stream_name);
+    if (_source->streamer()->client_count() == 0)
+        _source->request_app_play();
+    _source->get_stream_desc();
+    if (_source->encoder_type() != H264 || _source->param_set_ready(this))
+        return false;
+    SBL_MSG(MSG::SERVER, "RTSP talker %d waits for sps/pps of %s", id(), _source->name());
+    park(WAIT_PARAM_SET);
+    _reactor->set_timer(this, Source::PARAM_SET_TIMEOUT);
+    return true;
 }
 
-Talker::MsgType Talker::receive_rtsp() {
-    const char eom[] = "\r\n\r\n";
-    const int sizeof_eom = sizeof(eom) - 1;
-    int ptr = 0;
-    do {
-        for (; ptr <= _rx_bytes - sizeof_eom; ptr++)
-            if (!memcmp(_rx_buffer + ptr, eom, sizeof_eom)) {
-                _msg_size = ptr + sizeof_eom;
-                _rx_buffer[_msg_size] = '\0';
-                return MSG_RTSP;
-            }
-        if (!receive())
-            return MSG_RESET;
-    } while (1);
+void Talker::park(Wait wait) {
+    _waiting = wait;
+    _reactor->watch(this, false, _writable);
 }
 
-int Talker::receive() {
-    // Always leave space to append \0 for logging.
-    RTSP_ASSERT(_rx_bytes < BUFFER_SIZE - 1, SERVER_BUFFER_OVERFLOW);
-    int size = _socket.recv(_rx_buffer + _rx_bytes, BUFFER_SIZE  - _rx_bytes - 1);
-    _rx_bytes += size; 
-    SBL_MSG(MSG::SERVER, "Received %d bytes, have total %d bytes", size, _rx_bytes);
-    return size;
+bool Talker::resume() {
+    _resumed = _waiting;
+    stop_waiting();
+    _reactor->watch(this, true, _writable);
+    return process_messages();
 }
 
-Source* Talker::get_source(const char* stream_name) {
-    if (_source)
-        return _source;
-    _master->lock();
-    _source = _master->source_map()->find(stream_name);
-    _master->unlock();
-    Errcode errcode = OK;
-    if (!_source) {
-        int stream_id = application()->get_stream_id(stream_name);
-        SBL_MSG(MSG::SERVER, "Server %d, application return id %d for stream %s", id(), stream_id, stream_name);
-        _master->lock();
-        try {
-            if (stream_id < 0) {
-                _source = FileSource::create(stream_name, new Streamer(_master->options()->packet_size), _master->options()->fps, _master->options()->ts_clock);
-                _master->source_map()->save(stream_name, _source);
-                SBL_MSG(MSG::SERVER, "Server %d created file source %p for stream %s", id(), _source, stream_name);
-            } else {
-                _source = new LiveSource(stream_id, new Streamer(_master->options()->packet_size));
-                _master->source_map()->save(stream_id, _source, stream_name);
-                SBL_MSG(MSG::SERVER, "Server %d created live source %p for stream %s", id(), _source, stream_name);
-            }
-        } catch (Errcode err) {
-            errcode = err;
+void Talker::stop_waiting() {
+    if (_waiting == WAIT_PARAM_SET) {
+        _source->cancel_param_wait(this);
+        _reactor->cancel_timer(this);
+    } else if (_waiting == WAIT_FILE)
+        _master->file_opener()->cancel(this);
+    _waiting = WAIT_NONE;
+}
+
+Method Talker::process(MsgType msg_type) {
+    Method method = OPTIONS;
+    char* msg = _rx_buffer + _rx_start;
+    if (msg_type == MSG_RTSP) {
+        // parser cuts the message up as it goes, so a parked message isn't parsed again
+        if (_resumed != WAIT_NONE) {
+            method = _parser.data.method;
+        } else {
+            // terminate the message for the log, next message (if any) may start right after it
+            char next = msg[_msg_size];
+            msg[_msg_size] = '\0';
+            SBL_MSG(MSG::SERVER, "RTSP talker %d received message length %d:\n%s", 
+                     id(), _msg_size, msg);
+            method = _parser.parse(msg, _msg_size, _body_size);
+            msg[_msg_size] = next;
         }
-        _master->unlock();
+        if (method == DESCRIBE && park_describe())
+            return method;
+        int reply_size = _responder.reply(_parser.data);
+        SBL_MSG(MSG::SERVER, "RTSP talker %d reply:\n%s", id(), _tx_buffer);
+        if (!send_reply(reply_size)) {
+            SBL_MSG(MSG::SERVER, "RTSP talker %d, socket error, closing connection ...\n", id());
+            return TEARDOWN;
+        }
+        if (method == PLAY) {
+            RTSP_ASSERT(client(), BAD_REQUEST);
+            client()->play();
+        }
+    } else {
+        SBL_MSG(MSG::SERVER, "RTSP talker %d received RTCP message length %d", 
+                 id(), _msg_size);
+        if (_rtcp_parser) {
+            RTSP_ASSERT(_msg_size >= 4, BAD_REQUEST);
+            _rtcp_parser->parse(msg + 4, _msg_size - 4);
+        }
+        else
+            SBL_WARN("Talker %d, received RTCP message, but RTCP parser is not yet ready", id());
     }
-    if (errcode != OK)
-        throw errcode;
-    return _source;
+    return method;
+}
+
+bool Talker::reply_error(Errcode errcode) {
+    int reply_size = _responder.reply(_parser.data, errcode);
+    SBL_MSG(MSG::SERVER, "RTSP talker %d reply:\n%s\n", id(), _tx_buffer);
+    if (!send_reply(reply_size)) {
+        SBL_MSG(MSG::SERVER, "Talker %d unable to send reply, exiting...", id());
+        return false;
+    }
+    return true;
+}
+
+bool Talker::send_reply(int reply_size) {
+    // Interleaved RTP and RTSP replies share the socket, so replies must go thru client send queue
+    if (_client && _client->is_interleaved()) {
+        if (!_client->send_control(_tx_buffer, reply_size))
+            return false;
+        watch_writable();
+        return true;
+    }
+    return _socket.send(_tx_buffer, reply_size, false);
+}
+
+void Talker::consume() {
+    _rx_start += _msg_size;
+    _msg_size = _body_size = _scan = 0;
+    _resumed = WAIT_NONE;
+}
+
+void Talker::compact() {
+    if (_rx_start == 0)
+        return;
+    _rx_bytes -= _rx_start;
+    if (_rx_bytes > 0)
+        memmove(_rx_buffer, _rx_buffer + _rx_start, _rx_bytes);
+    _rx_start = 0;
+}
+
+Talker::MsgType Talker::next_msg() {
+    if (_rx_start == _rx_bytes) 
+        return MSG_NONE;
+    if (_rx_buffer[_rx_start] == '$')
+        return next_rtcp();
+    return next_rtsp();
+}
+
+Talker::MsgType Talker::next_rtcp() {
+    const char* msg = _rx_buffer + _rx_start;
+    if (_rx_bytes - _rx_start < 4)
+        return MSG_NONE;
+    RTSP_ASSERT(msg[1] == 1, BAD_REQUEST);
+    _msg_size = (((msg[2] & 0x00ff) << 8) | (msg[3] & 0x00ff)) + 4;
+    return _rx_bytes - _rx_start < _msg_size ? MSG_NONE : MSG_RTCP;
+}
+
+// Header ends with an empty line; only '\n' can end it, so memchr skips to those and checks what precedes them.
+// Body (GET_PARAMETER may have one) follows, as long as Content-Length says.
+Talker::MsgType Talker::next_rtsp() {
+    const char* msg  = _rx_buffer + _rx_start;
+    const int   size = _rx_bytes - _rx_start;
+    if (_msg_size)
+        return size < _msg_size ? MSG_NONE : MSG_RTSP;
+    while (_scan < size) {
+        const char* eol = (const char*) memchr(msg + _scan, '\n', size - _scan);
+        if (!eol) {
+            _scan = size;
+            break;
+        }
+        _scan = eol - msg + 1;
+        if (_scan >= 4 && !memcmp(eol - 3, "\r\n\r", 3)) {
+            _body_size = Parser::content_length(msg, _scan);
+            RTSP_ASSERT(_body_size >= 0, BAD_REQUEST);
+            _msg_size = _scan + _body_size;
+            RTSP_ASSERT(_msg_size < BUFFER_SIZE, SERVER_BUFFER_OVERFLOW);
+            return size < _msg_size ? MSG_NONE : MSG_RTSP;
+        }
+    }
+    return MSG_NONE;
 }
 
 SessionID Talker::setup_tcp(const char* stream_name) {
@@ -209,37 +343,97 @@ SessionID Talker::setup_udp(const char* stream_name, int client_port0, int clien
     SBL::Socket rtcp_in(SBL::Socket::UDP);
     rtcp_in.bind(_server_port + 1);
     _rtcp_parser = new RTCP::Parser(this, rtcp_in);
-    _rtcp_parser->create_thread(Thread::Default, 64 * 1024);
+    _reactor->add(_rtcp_parser);
     SBL_INFO("Server %d, %s stream (UDP) on socket %d/%d for client %s:%d/%d", id(), _source->encoder_name(), rtp_socket.id(), 
              rtcp_out.id(), _client_ip, _client_port, rtcp_port);
     return _session_id;
 }
 
+// Multicast packets go out on the group sockets, RTCP receiver reports are not listened to
+SessionID Talker::setup_multicast(const char* stream_name) {
+    RTSP_ASSERT(_source, INTERNAL_SERVER_ERROR);
+    RTSP_ASSERT(_master->options()->multicast_address, ERROR_SUPPORT_UNICAST_ONLY);
+    Errcode errcode = OK;
+    _master->lock();
+    Streamer* streamer = _source->streamer();
+    Group group;
+    bool created = false;
+    try {
+        if (!streamer->group()) {
+            RTSP_ASSERT(_master->alloc_group(group), ERROR_NO_MULTICAST_GROUP);
+            created = true;
+            SBL::Socket rtp_socket(SBL::Socket::UDP);
+            SBL::Socket rtcp_socket(SBL::Socket::UDP);
+            unsigned char ttl = group.ttl;
+            SBL_PERROR(::setsockopt(rtp_socket.id(),  IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof ttl) != 0);
+            SBL_PERROR(::setsockopt(rtcp_socket.id(), IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof ttl) != 0);
+            rtp_socket.connect(group.address, group.port);
+            rtcp_socket.connect(group.address, group.port + 1);
+            _client = streamer->join_group(rtp_socket, rtcp_socket, group);
+        } else
+            _client = streamer->join_group(SBL::Socket(SBL::Socket::NONE), SBL::Socket(SBL::Socket::NONE), group);
+    } catch (Errcode err) {
+        errcode = err;
+    } catch (SBL::Exception& ex) {
+        SBL_WARN("Server %d, unable to create multicast group: %s", id(), ex.what());
+        errcode = INTERNAL_SERVER_ERROR;
+    }
+    if (errcode != OK && created)
+        _master->free_group(group);
+    _master->unlock();
+    if (errcode != OK)
+        throw errcode;
+    _session_id = SessionID::generate();
+    const Group& info = streamer->group_info();
+    SBL_INFO("Server %d, %s stream (multicast) to %s:%d for client %s:%d, %d clients in group", id(), _source->encoder_name(),
+             info.address, info.port, _client_ip, _client_port, streamer->group_size());
+    return _session_id;
+}
+
+// Source stops first, so that the client isn't stopped in the middle of a frame.
+// Multicast group members share the stream, one of them can't stop it for the others.
+void Talker::pause() {
+    RTSP_ASSERT(_source && _client, INTERNAL_SERVER_ERROR);
+    if (_client->is_group())
+        return;
+    _source->pause();
+    _client->stop();
+    SBL_MSG(MSG::SERVER, "Server %d, %s paused", id(), _source->name());
+}
+
+// File source belongs to this talker, it goes away with the session; live source stays.
+// Waiting stops first, so that the file opener doesn't set the source any more.
 void Talker::teardown() {
+    stop_waiting();
     if (_rtcp_parser) {
-        _rtcp_parser->kill();
-        delete _rtcp_parser;
+        // UDP parser is registered with the reactor, which will delete it
+        if (_rtcp_parser->is_udp())
+            _reactor->remove(_rtcp_parser);
+        else
+            delete _rtcp_parser;
         _rtcp_parser = NULL;
     }
     if (_source && _client) {
         _master->lock();
         Streamer* streamer = _client->streamer();
         SBL_MSG(MSG::SERVER, "Deleting client for source %s in server %d", _source->name(), id());
+        // last member of the multicast group takes it down
+        if (_client->is_group() && streamer->group_size() == 1)
+            _master->free_group(streamer->group_info());
         streamer->delete_client(_client);
         _client = NULL;
-        if (streamer->client_count() == 0) {
+        if (streamer->client_count() == 0)
             _source->teardown();
-            if (!_source->is_live()) {
-                _master->source_map()->erase(_source->name());
-                delete _source;
-                _source = NULL;
-                delete streamer;
-                SBL_MSG(MSG::SERVER, "Deleted source and streamer for server %d", id());
-            }
-        }
         _master->unlock();
     }
-    _socket.close();
+    if (_source && !_source->is_live()) {
+        Streamer* streamer = _source->streamer();
+        _source->teardown();
+        delete _source;
+        _source = NULL;
+        delete streamer;
+        SBL_MSG(MSG::SERVER, "Deleted source and streamer for server %d", id());
+    }
 }
 
 }
@@ -17,9 +17,12 @@
 \****************************************************************************/
 
 #include <sbl/sbl_socket.h>
-#include <sbl/sbl_thread.h>
 #include "rtsp_session_id.h"
 #include "rtsp_server.h"
+#include "rtsp_parser.h"
+#include "rtsp_responder.h"
+#include "reactor.h"
+#include "file_opener.h"
 
 namespace RTSP {
 class Source;
@@ -30,20 +33,64 @@ namespace RTCP {
 }
 
 //! Manages all RTSP communication with RTSP client
-class Talker: public SBL::Thread {
+/*! Talker doesn't have its own thread. It is owned by a Reactor, which calls on_readable()
+    whenever there is data on the RTSP socket. Talker reads whatever is available without
+    blocking, and processes every complete message it has; partial messages wait in
+    the receive buffer for the next call.\n
+    Replies on an interleaved (TCP) session go thru the client send queue. When the socket
+    doesn't take a reply at once, talker waits for the socket to become writable, and
+    on_writable() sends the rest; it never waits in the reactor thread.\n
+    DESCRIBE of a file waits for the file opener to open it, and DESCRIBE of an H.264 stream
+    needs its SPS/PPS. Until it has them, talker is parked: it stops reading, and the message is
+    processed again once the opener (file_opened()) or the source (param_set_saved()) wakes it
+    up, then on_wakeup(), or PARAM_SET_TIMEOUT passes (on_timer()).
+*/
+class Talker: public Reactor::Handler, public ParamSetWaiter, public FileWaiter {
 public:
+    //! Largest RTSP message that is received or sent
+    static const int BUFFER_SIZE = 1024;
+
     //! Create a talker object
     //! @param  socket  socket to talk to RTSP client to
     //! @param  id      id of this talker
     //! @param  master  pointer to the master server
-    Talker(const SBL::Socket socket, int thread_id, Server* master);
+    //! @param  reactor reactor this talker is added to, it also gets the RTCP socket
+    Talker(const SBL::Socket socket, int id, Server* master, Reactor* reactor);
+
+    //! Tears down the session and closes the socket
+    ~Talker();
+
+    //! RTSP socket, for the reactor
+    int  fd() const { return _socket.id(); }
+
+    //! Read and process everything available on RTSP socket. Return false when connection is closed.
+    bool on_readable();
+
+    //! Send what the client send queue holds, called while a reply is waiting for the socket
+    bool on_writable();
+
+    //! Source the parked DESCRIBE waits for is open, or saved SPS/PPS; process it
+    bool on_wakeup();
 
-    //! Find the Source object associated with the stream.
-    Source* get_source(const char* stream_name);
+    //! File is open, called from the file opener thread; wakes the talker up in its reactor
+    void file_opened(Source* source, Errcode errcode) {
+        _source     = source;
+        _open_error = errcode;
+        _reactor->wake(this);
+    }
+
+    //! Source saved SPS/PPS, called from the thread that saved them; wakes the talker up in its reactor
+    void param_set_saved() { _reactor->wake(this); }
+
+    //! Source didn't get SPS/PPS in time, process the parked DESCRIBE, which fails
+    bool on_timer();
 
     //! Return Client attached to this server
     Client* client() const { return _client; }
 
+    //! Return Source of the stream, NULL until DESCRIBE asks for one
+    Source* source() const { return _source; }
+
     //! Setup a TCP connection to the client for this stream (TCP over RTSP)
     SessionID setup_tcp(const char* stream_name);
 
@@ -51,6 +98,12 @@ public:
     SessionID setup_udp(const char* stream_name, int client_port0,
                                                  int client_port1);
 
+    //! Join the multicast group of the stream, creating it for the first client (RTP over UDP multicast)
+    SessionID setup_multicast(const char* stream_name);
+
+    //! Pause the session, PLAY resumes it
+    void pause();
+
     //! Teardown a session for this stream
     void teardown();
 
@@ -76,35 +129,66 @@ public:
     const Server::Options* options() const { return _master->options(); }
 
 private:
-    static const int BUFFER_SIZE = 1024; 
+    // what a parked message waits for
+    enum Wait { WAIT_NONE, WAIT_FILE, WAIT_PARAM_SET };
+
     int             _id;
     SBL::Socket     _socket;
     char            _rx_buffer[BUFFER_SIZE];
     char            _tx_buffer[BUFFER_SIZE];
     int             _rx_bytes;    // how many bytes there are in rx_buffer
-    int             _msg_size;    // size of the message in rx_buffer
+    int             _rx_start;    // start of the next message in rx_buffer, messages before it are processed
+    int             _msg_size;    // size of the message at _rx_start, set once its header is complete
+    int             _body_size;   // size of its body, as Content-Length gives it
+    int             _scan;        // end of message search resumes here (from _rx_start)
     Server*         _master;      // NULL for master server
+    Reactor*        _reactor;
+    Parser          _parser;
+    Responder       _responder;
     RTCP::Parser*   _rtcp_parser;
     Client*         _client;
-    Source*         _source;
+    Source*         _source;      // set by the file opener thread while parked for it
+    Errcode         _open_error;  // why the file opener returned no source
     SessionID       _session_id;
+    bool            _writable;    // waiting for the socket to become writable
+    Wait            _waiting;     // not reading while parked, message at _rx_start waits for this
+    Wait            _resumed;     // what message at _rx_start was parked for, WAIT_NONE if it wasn't
 
     char            _server_ip[SBL::Socket::IP_ADDR_BUFF_SIZE];  // server (local) IP address
     char            _client_ip[SBL::Socket::IP_ADDR_BUFF_SIZE];  // client (remote) IP address
     unsigned int    _server_port;                           // server (local) port
     unsigned int    _client_port;                           // client (remote) port
 
-    enum    MsgType { MSG_RESET, MSG_RTSP, MSG_RTCP};
-    // Receive one full message and place it in _rx_buffer
-    MsgType receive_msg();
-    // Receive RTSP message and place it in _rx_buffer
-    MsgType receive_rtsp();
-    // Receive RTCP message and place it in _rx_buffer
-    MsgType receive_rtcp();
-    // Get next chunk of data in _rx_buffer, return how many got from last recv()
-    int     receive();
-    // Thread start procedure
-    void    start_thread();
+    enum    MsgType { MSG_NONE, MSG_RTSP, MSG_RTCP};
+    // Return type of the full message at _rx_start, MSG_NONE if it is not complete yet
+    MsgType next_msg();
+    // Check for full RTSP message at _rx_start
+    MsgType next_rtsp();
+    // Check for full RTCP message at _rx_start
+    MsgType next_rtcp();
+    // Process every complete message received, return false when connection is closed
+    bool    process_messages();
+    // Process one message, return the method (TEARDOWN closes the connection)
+    Method  process(MsgType msg_type);
+    // Ask for the stream DESCRIBE is for, park if it has to wait for its file or SPS/PPS; return true if parked
+    bool    park_describe();
+    // Stop reading until the message at _rx_start has what it waits for
+    void    park(Wait wait);
+    bool    parked() const { return _waiting != WAIT_NONE; }
+    // Read and process messages again, once the parked DESCRIBE can go on
+    bool    resume();
+    // Stop waiting for the file or SPS/PPS, without touching the socket
+    void    stop_waiting();
+    // Send reply to an error, return false if it can't be sent
+    bool    reply_error(Errcode errcode);
+    // Send reply from _tx_buffer, return false if it can't be sent
+    bool    send_reply(int reply_size);
+    // Wait for the socket to become writable while client send queue is backed up, stop waiting once it is empty
+    void    watch_writable();
+    // Skip processed message
+    void    consume();
+    // Move unprocessed bytes to the start of _rx_buffer, once all messages of a read are processed
+    void    compact();
     // currently unused, prints message with readable \r\n
     void log(const char* buffer, int buffer_size);
 };
@@ -0,0 +1,149 @@
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "rtsp_impl.h"
+#include "send_queue.h"
+
+namespace RTSP {
+
+SendQueue::SendQueue(int max_bytes) : _buffer(max_bytes), _start(0), _end(0), _stall_ms(0) {
+    memset(&_stall_start, 0, sizeof _stall_start);
+}
+
+SendQueue::Status SendQueue::send(SBL::Socket socket, const uint8_t* header, int header_size,
+                                                      const uint8_t* payload, int payload_size, bool reply) {
+    if (!drain(socket))
+        return ERROR;
+    int size = header_size + payload_size;
+    if (empty()) {
+        struct iovec iov[2];
+        iov[0].iov_base = const_cast<uint8_t*>(header);
+        iov[0].iov_len  = header_size;
+        iov[1].iov_base = const_cast<uint8_t*>(payload);
+        iov[1].iov_len  = payload_size;
+        struct msghdr msg;
+        memset(&msg, 0, sizeof msg);
+        msg.msg_iov    = iov;
+        msg.msg_iovlen = payload_size ? 2 : 1;
+        int sent = ::sendmsg(socket.id(), &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        _stats.syscalls++;
+        if (sent == size)
+            return SENT;
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return ERROR;
+            _stats.would_block++;
+            sent = 0;
+        }
+        // partially sent packet must be queued no matter what, otherwise TCP stream is broken
+        if (sent > 0) {
+            _stats.partial_writes++;
+            int header_sent = sent < header_size ? sent : header_size;
+            return push(header + header_sent, header_size - header_sent,
+                        payload + sent - header_sent, payload_size - (sent - header_sent), reply) ? QUEUED : BROKEN;
+        }
+    }
+    return push(header, header_size, payload, payload_size, reply) ? QUEUED : FULL;
+}
+
+bool SendQueue::drain(SBL::Socket socket) {
+    while (!empty()) {
+        int sent = ::send(socket.id(), &_buffer[_start], bytes(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        _stats.syscalls++;
+        if (sent < 0) {
+            bool blocked = errno == EAGAIN || errno == EWOULDBLOCK;
+            _stats.would_block += blocked;
+            return blocked;
+        }
+        if (sent < bytes())
+            _stats.partial_writes++;
+        consumed(sent);
+    }
+    return true;
+}
+
+// Replies that are kept are moved down over the dropped packets
+int SendQueue::drop() {
+    if (_entries.size() < 2)
+        return 0;
+    // first packet may be partially sent already, it has to go out
+    int end  = _start + _entries.front().size;
+    int next = end;
+    unsigned int kept = 1;
+    for (unsigned int n = 1; n < _entries.size(); n++) {
+        const Entry& entry = _entries[n];
+        if (entry.reply) {
+            memmove(&_buffer[end], &_buffer[next], entry.size);
+            end += entry.size;
+            _entries[kept++] = entry;
+        }
+        next += entry.size;
+    }
+    int dropped = _entries.size() - kept;
+    _end = end;
+    _entries.resize(kept);
+    return dropped;
+}
+
+bool SendQueue::push(const uint8_t* header, int header_size, const uint8_t* payload, int payload_size, bool reply) {
+    int size = header_size + payload_size;
+    if (bytes() + size > int(_buffer.size()))
+        return false;
+    if (_end + size > int(_buffer.size())) {
+        memmove(&_buffer[0], &_buffer[_start], bytes());
+        _end  -= _start;
+        _start = 0;
+    }
+    if (empty())
+        SBL_PERROR(::clock_gettime(CLOCK_MONOTONIC, &_stall_start) != 0);
+    memcpy(&_buffer[_end], header, header_size);
+    if (payload_size)
+        memcpy(&_buffer[_end + header_size], payload, payload_size);
+    _end += size;
+    Entry entry = {size, reply};
+    _entries.push_back(entry);
+    return true;
+}
+
+void SendQueue::consumed(int size) {
+    _start += size;
+    while (size > 0) {
+        if (size < _entries.front().size) {
+            _entries.front().size -= size;
+            break;
+        }
+        size -= _entries.front().size;
+        _entries.pop_front();
+    }
+    if (empty()) {
+        _start = _end = 0;
+        _stall_ms += elapsed_ms(_stall_start);
+    }
+}
+
+unsigned int SendQueue::stall_ms() const {
+    return empty() ? _stall_ms : _stall_ms + elapsed_ms(_stall_start);
+}
+
+unsigned int SendQueue::elapsed_ms(const struct timespec& since) {
+    struct timespec now;
+    SBL_PERROR(::clock_gettime(CLOCK_MONOTONIC, &now) != 0);
+    return (now.tv_sec - since.tv_sec) * 1000 + (now.tv_nsec - since.tv_nsec) / 1000000;
+}
+
+}
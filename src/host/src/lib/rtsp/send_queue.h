@@ -0,0 +1,91 @@
+#pragma once
+#ifndef _RTSP_SEND_QUEUE_H
+#define _RTSP_SEND_QUEUE_H
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <stdint.h>
+#include <ctime>
+#include <deque>
+#include <vector>
+#include <sbl/sbl_socket.h>
+#include "metrics.h"
+
+namespace RTSP {
+
+//! Bounded, non-blocking egress queue for one TCP (interleaved) client.
+/*! Data is sent with MSG_DONTWAIT. Whatever the socket doesn't take right away is
+    queued and sent on the next call, so a slow client never blocks the Streamer.
+    Queue remembers packet boundaries, so that when it overflows, packets that were
+    not started yet can be dropped without breaking the interleaved TCP framing.
+    RTSP replies are never dropped.\n
+    Class is not thread safe. Client calls it under its own queue lock, from the streaming
+    thread for packets and from the talker's reactor thread for replies and draining.
+*/
+class SendQueue {
+public:
+    //! Result of send()
+    enum Status {SENT   /*!< all data went to the socket */,
+                 QUEUED /*!< some or all data was queued */,
+                 FULL   /*!< queue is full, nothing was sent nor queued */,
+                 BROKEN /*!< packet was sent in part and the rest doesn't fit, TCP framing is lost */,
+                 ERROR  /*!< socket error */
+                };
+    //! Create a queue
+    // @param   max_bytes   queue capacity in bytes, the largest packet has to fit, or it may come back BROKEN
+    SendQueue(int max_bytes);
+    //! Send queued data first, then the packet. Queue whatever doesn't fit in the socket.
+    //! @param  reply   packet is an RTSP reply, which drop() leaves in the queue
+    Status send(SBL::Socket socket, const uint8_t* packet, int size, bool reply = false) {
+        return send(socket, packet, size, NULL, 0, reply);
+    }
+    //! Same as above, for a packet made of header and payload, which are sent with one syscall
+    Status send(SBL::Socket socket, const uint8_t* header, int header_size, const uint8_t* payload, int payload_size,
+                bool reply = false);
+    //! Send as much queued data as the socket will take. Return false on socket error.
+    bool   drain(SBL::Socket socket);
+    //! Drop all packets that were not started yet, except RTSP replies, return how many were dropped.
+    int    drop();
+    //! Bytes currently in the queue
+    int    bytes()   const { return _end - _start; }
+    //! Packets currently in the queue (including partially sent one)
+    int    packets() const { return _entries.size(); }
+    //! Return true if there is nothing to send
+    bool   empty()   const { return _entries.empty(); }
+    //! Total time (in ms) the queue was not empty, since its creation
+    unsigned int stall_ms() const;
+    //! Send calls made, and how many of them would block or took only a part, since clear_stats()
+    const SendStats& stats() const { return _stats; }
+    //! Start counting send calls over
+    void clear_stats() { _stats.clear(); }
+private:
+    struct Entry {
+        int     size;                   // unsent bytes of the packet
+        bool    reply;                  // RTSP reply, never dropped
+    };
+    std::vector<uint8_t> _buffer;
+    int                  _start;        // first byte to send
+    int                  _end;          // one past the last queued byte
+    std::deque<Entry>    _entries;      // queued packets
+    struct timespec      _stall_start;  // when queue became non-empty
+    unsigned int         _stall_ms;     // accumulated time with non-empty queue
+    SendStats            _stats;        // only the syscall counters are used
+
+    bool push(const uint8_t* header, int header_size, const uint8_t* payload, int payload_size, bool reply);
+    void consumed(int size);
+    static unsigned int elapsed_ms(const struct timespec& since);
+};
+
+}
+#endif
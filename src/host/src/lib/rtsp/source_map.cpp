@@ -12,11 +12,22 @@
 *  and conditions, you may not use any of these items and must immediately   *
 *  destroy any copies you have made.                                         *
 \****************************************************************************/
+#include <cstdlib>
 #include "rtsp_impl.h"
 #include "source_map.h"
 
 namespace RTSP {
 
+SourceMap::SourceMap() : _table(new Vector(MIN_TABLE, NULL)) {}
+
+SourceMap::~SourceMap() {
+    delete _table;
+    for (unsigned int n = 0; n < _retired.size(); n++)
+        delete _retired[n];
+    for (Map::iterator it = _map.begin(); it != _map.end(); ++it)
+        free(const_cast<char*>(it->first));
+}
+
 Source* SourceMap::find(const char* name) {
     Map::iterator it = _map.find(name);
     Source* source = it == _map.end() ? NULL : it->second;
@@ -34,22 +45,36 @@ void SourceMap::erase(const char* name) {
     if (it == _map.end()) 
         SBL_WARN("Attempting to erase non-existing source %s", name);
     else {
-        _map.erase(name);
-        delete[] it->first;
+        const char* key = it->first;
+        _map.erase(it);
+        free(const_cast<char*>(key));
         SBL_MSG(MSG::SOURCE_MAP, "Source map %p, erasing name '%s'", this, name);
     }
 }
 
 Source* SourceMap::find(const unsigned int id) {
-    Source* source = id >= _vector.size() ? NULL : _vector[id];
+    // table is read thru a single pointer, which always points to a complete table
+    const Vector* table = _table;
+    Source* source = id >= table->size() ? NULL : (*table)[id];
     SBL_MSG(MSG::SOURCE_MAP, "Source map %p, found source %p for id %d", this, source, id);
     return source;
 }
 
 void SourceMap::save(const unsigned int id, Source* source, const char* stream_name) {
-    if (id >= _vector.size())
-        _vector.resize(id + 1, NULL);
-    _vector[id] = source;
+    Vector* table = _table;
+    if (id < table->size()) {
+        // source must be complete before a frame thread can see it
+        __sync_synchronize();
+        (*table)[id] = source;
+    } else {
+        Vector* grown = new Vector(*table);
+        grown->resize(id + 1 > 2 * table->size() ? id + 1 : 2 * table->size(), NULL);
+        (*grown)[id] = source;
+        __sync_synchronize();
+        _table = grown;
+        _retired.push_back(table);
+        SBL_MSG(MSG::SOURCE_MAP, "Source map %p, table grown to %d sources", this, grown->size());
+    }
     char source_number[4];
     if (stream_name == NULL) {
         snprintf(source_number, sizeof source_number, "%d", id);
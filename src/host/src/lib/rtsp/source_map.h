@@ -24,18 +24,27 @@ namespace RTSP {
 class Source;
 
 /// Manages sources for a server.
-/** This class maps source names and ids to sources. It is instantiated only in master server
+/** This class maps source names and ids to sources. It is instantiated only in master server.\n
+    Lookup by id is on the path of every frame, so it doesn't need a lock: sources are kept in a table
+    that is replaced as a whole when it has to grow, and a slot is only written after its source is
+    complete. Replaced tables are kept until the map is destroyed, since frame threads may still be
+    reading them; this costs little, as each table is at least twice the size of the previous one.
+    All other methods must be called with the server locked.
 */
 class SourceMap {
 private:
     typedef std::map<const char*, Source*, SBL::StrCompare>  Map;
     typedef std::vector<Source*> Vector;
 public:
+    /// SourceMap constructor
+    SourceMap();
+    /// SourceMap destructor, doesn't delete sources
+    ~SourceMap();
     /// SourceMap iterator
     typedef Map::iterator Iterator;
     /// Find a source given its name, return NULL if not found
     Source* find(const char* name);
-    /// Find a source given its name, return NULL if not found
+    /// Find a source given its id, return NULL if not found. Doesn't need the server lock.
     Source* find(const unsigned int id);
     /// Save a name for the source
     void save(const char* name, Source* source);
@@ -48,8 +57,13 @@ public:
     /// STL iterator to source map end
     Iterator end()   { return _map.end();   }
 private:
-    Map     _map;
-    Vector  _vector;
+    enum {MIN_TABLE = 16};
+    Map                 _map;
+    Vector* volatile    _table;     // sources by id, never written to once it is replaced
+    std::vector<Vector*> _retired;  // replaced tables, frame threads may still be reading them
+
+    SourceMap(const SourceMap&);                // not implemented
+    SourceMap& operator=(const SourceMap&);     // not implemented
 };
 
 }
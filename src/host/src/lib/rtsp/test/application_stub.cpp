@@ -0,0 +1,18 @@
+#include "rtsp.h"
+
+// Application for the tests that are not one themselves, it knows no streams
+using namespace RTSP;
+
+class StubApplication : public Application {
+public:
+    int get_stream_id(unsigned int channel_num, unsigned int stream_num) { return -1; }
+    int get_stream_id(const char* stream_name) { return -1; }
+    void play(int stream_id) {}
+    void teardown(int stream_id) {}
+    int describe(int stream_id, StreamDesc& stream_desc) { return -1; }
+    int pe_id() const { return 0; }
+} stub_application;
+
+namespace RTSP {
+Application* application() { return &stub_application; }
+}
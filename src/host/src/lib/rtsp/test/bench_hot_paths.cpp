@@ -0,0 +1,378 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <sbl/sbl_param_set.h>
+#include "rtsp.h"
+#include "rtp_streamer.h"
+#include "live_source.h"
+#include "rtsp_parser.h"
+#include "rtcp.h"
+#include "buffer_writer.h"
+#include "nal_scanner.h"
+#include "count_allocations.h"      // server threads are idle, but their allocations count too
+
+using namespace std;
+using namespace RTSP;
+
+// Microbenchmarks of the per frame and per request paths. Each benchmark is run in samples of
+// about the same length, and prints one line of key=value pairs: median, min and max ns per
+// operation over the samples, their median absolute deviation (percent of the median), and
+// allocations and bytes allocated per operation, counted over all samples.
+//
+// Streamer sends to UDP sockets nobody reads: the kernel drops what doesn't fit, so sending
+// costs the syscalls and loopback, not a receiver.
+
+const char* usage = "\n"
+    "bench_hot_paths -s <samples> -t <ms> -p <port> [<name> ...]\n"
+    "Runs the benchmarks whose name contains one of the names, all if none is given.\n"
+    "Options:\n"
+    "   -s <int>    : samples per benchmark, default 9\n"
+    "   -t <int>    : ms per sample, default 20\n"
+    "   -p <int>    : port of the server the streamers need for options, default 18590\n"
+    "\n";
+
+double now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//! One benchmark, run() does one operation
+class Bench {
+public:
+    Bench(const char* name) : name(name) {}
+    virtual ~Bench() {}
+    virtual void run() = 0;
+    const char* name;
+};
+
+// Warm up and calibrate: double the operations until they take sample_ms, then time samples
+void measure(Bench& bench, int samples, int sample_ms) {
+    unsigned long ops = 1;
+    for (;;) {
+        double start = now();
+        for (unsigned long n = 0; n < ops; n++)
+            bench.run();
+        if ((now() - start) * 1000 >= sample_ms || ops >= (1ul << 30))
+            break;
+        ops *= 2;
+    }
+
+    vector<double> ns(samples);
+    unsigned long allocations_before = allocations, allocated_before = allocated;
+    for (int s = 0; s < samples; s++) {
+        double start = now();
+        for (unsigned long n = 0; n < ops; n++)
+            bench.run();
+        ns[s] = (now() - start) * 1e9 / ops;
+    }
+    double total_ops = (double) ops * samples;
+    double allocs    = (allocations - allocations_before) / total_ops;
+    double bytes     = (allocated - allocated_before) / total_ops;
+
+    sort(ns.begin(), ns.end());
+    double median = ns[samples / 2];
+    vector<double> deviations(samples);
+    for (int s = 0; s < samples; s++)
+        deviations[s] = fabs(ns[s] - median);
+    sort(deviations.begin(), deviations.end());
+    cout << fixed << setprecision(1)
+         << "bench=" << bench.name << " ns_op=" << median << " ns_op_min=" << ns[0] << " ns_op_max=" << ns[samples - 1]
+         << " mad_pct=" << setprecision(2) << (median > 0 ? deviations[samples / 2] * 100 / median : 0)
+         << " allocs_op=" << setprecision(3) << allocs << " bytes_op=" << setprecision(1) << bytes
+         << " ops=" << ops << " samples=" << samples << endl;
+}
+
+// Stream 0 is H.264, stream 1 MJPEG
+class App : public Application {
+public:
+    int get_stream_id(unsigned int channel_num, unsigned int stream_num) { return channel_num < 2 && !stream_num ? channel_num : -1; }
+    int get_stream_id(const char* stream_name) { return -1; }
+    void play(int stream_id) {}
+    void teardown(int stream_id) {}
+    int describe(int stream_id, StreamDesc& stream_desc) {
+        stream_desc.encoder_type = stream_id ? MJPEG : H264;
+        stream_desc.bitrate      = 4000;
+        stream_desc.quality      = 75;
+        stream_desc.width        = 1280;
+        stream_desc.height       = 720;
+        return 0;
+    }
+    int pe_id() const { return 0; }
+} app;
+
+namespace RTSP {
+Application* application() { return &app; }
+}
+
+// UDP socket connected to a port nobody reads
+SBL::Socket null_socket() {
+    static int sink = -1;
+    static sockaddr_in address;
+    if (sink < 0) {
+        sink = socket(AF_INET, SOCK_DGRAM, 0);
+        assert(sink >= 0);
+        int size = 4096;
+        setsockopt(sink, SOL_SOCKET, SO_RCVBUF, &size, sizeof size);
+        memset(&address, 0, sizeof address);
+        address.sin_family      = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof address;
+        assert(bind(sink, (sockaddr*) &address, sizeof address) == 0);
+        assert(getsockname(sink, (sockaddr*) &address, &length) == 0);
+    }
+    SBL::Socket socket(SBL::Socket::UDP);
+    socket.connect("127.0.0.1", ntohs(address.sin_port));
+    return socket;
+}
+
+// Streamer::send_frame() of one frame, again and again, to clients playing it
+class StreamerBench : public Bench {
+public:
+    StreamerBench(const char* name, int stream_id, uint8_t header, int frame_size, int clients) : Bench(name),
+        _streamer(1456, 0x12345678, 0, true), _source(stream_id, &_streamer), _timestamp(0) {
+        _source.get_stream_desc();
+        const uint8_t sps[] = { 0x67, 0x42, 0x00, 0x1f, 0xe9, 0x01, 0x40, 0x7b, 0x20 };
+        _frame.assign(frame_size, 0x55);
+        _frame[0] = header;
+        for (int n = 0; n < clients; n++) {
+            SBL::Socket socket = null_socket();
+            _streamer.add_client(socket, socket)->play();
+        }
+        // clients start playing at an I-frame
+        if (_source.encoder_type() == H264)
+            _streamer.send_frame(sps, sizeof sps, _timestamp);
+    }
+    void run() {
+        _streamer.send_frame(&_frame[0], _frame.size(), _timestamp += 3000);
+    }
+private:
+    Streamer            _streamer;
+    LiveSource          _source;
+    vector<uint8_t>     _frame;
+    uint32_t            _timestamp;
+};
+
+// requests (not replies) from a capture, with \r\n turned back into line ends
+void read_requests(vector<string>& requests, const char* filename) {
+    ifstream file(filename);
+    assert(!file.fail());
+    string line;
+    bool   start = true;
+    bool   request = false;
+    while (getline(file, line)) {
+        if (line.empty()) {
+            start = true;
+            continue;
+        }
+        if (start) {
+            start = false;
+            if ((request = line.compare(0, 8, "RTSP/1.0") != 0))
+                requests.push_back(string());
+        }
+        if (!request)
+            continue;
+        if (line.size() >= 4 && line.compare(line.size() - 4, 4, "\\r\\n") == 0)
+            line.replace(line.size() - 4, 4, "\r\n");
+        requests.back() += line;
+    }
+}
+
+// Parser::parse() of each request of the live555 captures in turn, copied into the buffer first
+class ParserBench : public Bench {
+public:
+    ParserBench() : Bench("rtsp_parser_parse"), _next(0) {
+        read_requests(_requests, "live555-1.0.3-file-qcif-tcp-rtsp.txt");
+        read_requests(_requests, "live555-1.0.3-file-qcif-udp-rtsp.txt");
+        assert(_requests.size() == 12);
+    }
+    void run() {
+        const string& request = _requests[_next++ % _requests.size()];
+        memcpy(_buffer, request.data(), request.size());
+        _parser.parse(_buffer, request.size());
+    }
+private:
+    Parser          _parser;
+    vector<string>  _requests;
+    unsigned int    _next;
+    char            _buffer[1024];
+};
+
+// SPS and PPS in base64, as sprop-parameter-sets of DESCRIBE
+class Base64Bench : public Bench {
+public:
+    Base64Bench() : Bench("base64_sps_pps"), _writer(_buffer, sizeof _buffer) {}
+    void run() {
+        const uint8_t sps[] = { 0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40, 0x78, 0x02, 0x27, 0xe5, 0x84 };
+        const uint8_t pps[] = { 0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0 };
+        _writer.reset();
+        _writer.base64(sps, sizeof sps) << ',';
+        _writer.base64(pps, sizeof pps);
+    }
+private:
+    char            _buffer[128];
+    BufferWriter    _writer;
+};
+
+// RTCP::Parser::parse() of a receiver report with SDES, as players send them
+class RtcpBench : public Bench {
+public:
+    RtcpBench() : Bench("rtcp_parser_parse"), _parser(NULL, SBL::Socket(SBL::Socket::NONE)) {
+        RTCP::Receiver report;
+        memset(&report, 0, sizeof report);
+        report.rr.flags           = htons(0x8100 | RTCP::RR_PACKET_TYPE);
+        report.rr.length          = htons(7);
+        report.rr.ssrc            = htonl(0x1234);
+        report.rr.cumulative_lost = htonl(3);
+        report.rr.highest_seq     = htonl(70000);
+        report.sdes.flags         = htons(0x8100 | RTCP::SDES_PACKET_TYPE);
+        report.sdes.length        = htons(4);
+        report.sdes.type          = 1;
+        report.sdes.item_length   = 8;
+        memcpy(report.sdes.name, "player01", 8);
+        _size = sizeof report - sizeof report.sdes.name + 8;
+        memcpy(_packet, &report, _size);
+        assert(_parser.parse(_buffer, copy()));
+    }
+    void run() {
+        _parser.parse(_buffer, copy());
+    }
+private:
+    RTCP::Parser    _parser;
+    char            _packet[sizeof(RTCP::Receiver)];
+    char            _buffer[sizeof(RTCP::Receiver)];
+    unsigned int    _size;
+
+    // parse() works on the receive buffer, as the packet comes
+    unsigned int copy() {
+        memcpy(_buffer, _packet, _size);
+        return _size;
+    }
+};
+
+struct Stream : public SBL::ParamSet {
+    SBL::Param<int>         width;
+    SBL::Param<int>         height;
+    SBL::Param<int>         bitrate;
+    SBL::Param<std::string> encoder;
+    Stream() : ParamSet("stream"),
+               width(this, "width", 1280, SBL::VerifyRange(0, 4096)),
+               height(this, "height", 720, SBL::VerifyRange(0, 4096)),
+               bitrate(this, "bitrate", 4000, SBL::VerifyRange(16, 20000)),
+               encoder(this, "encoder", "h264", SBL::VerifyEnum("h264", "mjpeg"))
+               {}
+};
+
+// ParamSet::set() of one member by name, or of several from the arguments of a cgi request
+class ParamSetBench : public Bench {
+public:
+    ParamSetBench(const char* name, bool args) : Bench(name), _args(args), _next(0) {
+        _arg_map["width"]   = "1920";
+        _arg_map["height"]  = "1080";
+        _arg_map["encoder"] = "h264";
+    }
+    void run() {
+        if (_args)
+            _stream.set(_arg_map);
+        else
+            _stream.set("bitrate", (int) (1000 + (_next++ & 1023)));
+    }
+private:
+    Stream                  _stream;
+    bool                    _args;
+    SBL::ParamSet::ArgMap   _arg_map;
+    unsigned int            _next;
+};
+
+// Start codes of a 64 KB frame of 8 slices, slice data random with emulation prevention bytes
+class ScanBench : public Bench {
+public:
+    ScanBench() : Bench("nal_scanner_scan_64k") {
+        const uint8_t code[] = { 0, 0, 0, 1 };
+        srand(1);
+        for (int slice = 0; slice < 8; slice++) {
+            _frame.insert(_frame.end(), code, code + 4);
+            _frame.push_back(0x41);
+            int zeros = 0;
+            for (int n = 0; n < 8 * 1024; n++) {
+                uint8_t byte = rand() % 8 ? rand() : 0;
+                if (zeros == 2 && byte <= 3) {
+                    _frame.push_back(3);
+                    zeros = 0;
+                }
+                _frame.push_back(byte);
+                zeros = byte ? 0 : zeros + 1;
+            }
+        }
+        _units.reserve(16);
+        run();
+        assert(_units.size() == 8);
+    }
+    void run() {
+        _units.clear();
+        NalScanner::scan(&_frame[0], _frame.size(), _units);
+    }
+private:
+    vector<uint8_t> _frame;
+    vector<NalUnit> _units;
+};
+
+bool selected(const char* name, const vector<const char*>& names) {
+    if (names.empty())
+        return true;
+    for (unsigned int n = 0; n < names.size(); n++)
+        if (strstr(name, names[n]))
+            return true;
+    return false;
+}
+
+int main(int argc, char* argv[]) {
+    int samples = 9, sample_ms = 20, port = 18590;
+    int c;
+    while ((c = getopt(argc, argv, "s:t:p:h")) != -1)
+        switch (c) {
+            case 's': samples   = strtol(optarg, 0, 0); break;
+            case 't': sample_ms = strtol(optarg, 0, 0); break;
+            case 'p': port      = strtol(optarg, 0, 0); break;
+            case 'h':
+            default : cout << usage << endl;
+                      return 1;
+        }
+    if (samples <= 0 || sample_ms <= 0) {
+        cout << usage << endl;
+        return 1;
+    }
+    vector<const char*> names(argv + optind, argv + argc);
+
+    // streamers take their options from the server
+    Server::create(port);
+    vector<Bench*> benches;
+    benches.push_back(new StreamerBench("streamer_h264_p_16k_0_clients",   0, 0x41, 16 * 1024, 0));
+    benches.push_back(new StreamerBench("streamer_h264_p_16k_1_client",    0, 0x41, 16 * 1024, 1));
+    benches.push_back(new StreamerBench("streamer_h264_p_16k_8_clients",   0, 0x41, 16 * 1024, 8));
+    benches.push_back(new StreamerBench("streamer_h264_i_128k_1_client",   0, 0x65, 128 * 1024, 1));
+    benches.push_back(new StreamerBench("streamer_mjpeg_64k_0_clients",    1, 0xff, 64 * 1024, 0));
+    benches.push_back(new StreamerBench("streamer_mjpeg_64k_1_client",     1, 0xff, 64 * 1024, 1));
+    benches.push_back(new ParserBench);
+    benches.push_back(new Base64Bench);
+    benches.push_back(new RtcpBench);
+    benches.push_back(new ParamSetBench("param_set_set_int", false));
+    benches.push_back(new ParamSetBench("param_set_set_args", true));
+    benches.push_back(new ScanBench);
+    for (unsigned int n = 0; n < benches.size(); n++)
+        if (selected(benches[n]->name, names))
+            measure(*benches[n], samples, sample_ms);
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include <cassert>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <vector>
+#include "nal_scanner.h"
+
+using namespace std;
+using namespace RTSP;
+
+// 1080p IDR access unit: SPS, PPS, SEI and 8 slices of random data with emulation prevention bytes
+void make_idr(vector<uint8_t>& frame, int size) {
+    const uint8_t sps[] = { 0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40, 0x78, 0x02, 0x27, 0xe5, 0x84 };
+    const uint8_t pps[] = { 0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0 };
+    const uint8_t sei[] = { 0x06, 0x05, 0x10, 0xb9, 0xed, 0xb9, 0x30, 0x5d, 0x21, 0x4b, 0x71, 0x80 };
+    const uint8_t code[] = { 0, 0, 0, 1 };
+    frame.insert(frame.end(), code, code + 4); frame.insert(frame.end(), sps, sps + sizeof sps);
+    frame.insert(frame.end(), code, code + 4); frame.insert(frame.end(), pps, pps + sizeof pps);
+    frame.insert(frame.end(), code, code + 4); frame.insert(frame.end(), sei, sei + sizeof sei);
+    srand(1);
+    for (int slice = 0; slice < 8; slice++) {
+        frame.insert(frame.end(), code, code + 4);
+        frame.push_back(0x65);
+        int zeros = 0;
+        for (int n = 0; n < size / 8; n++) {
+            // CABAC data is mostly random, with more zeros than that
+            uint8_t byte = rand() % 8 ? rand() : 0;
+            if (zeros == 2 && byte <= 3) {
+                frame.push_back(3);
+                zeros = 0;
+            }
+            frame.push_back(byte);
+            zeros = byte ? 0 : zeros + 1;
+        }
+        frame.push_back(0x80);
+    }
+}
+
+double now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// the way file source used to find the end of a NAL unit, looking for 00 00 00 01 at every byte
+int old_frame_size(const uint8_t* frame, int size) {
+    for (int count = 0; count < size; ++count)
+        if (frame[count] == 0 && frame[count + 1] == 0 && frame[count + 2] == 0 && frame[count + 3] == 1)
+            return count;
+    return size;
+}
+
+int old_scan(const uint8_t* data, int size) {
+    int count = 0;
+    for (int offset = 4; offset < size; count++)
+        offset += old_frame_size(data + offset, size - offset) + 4;
+    return count;
+}
+
+// byte by byte search for 00 00 01
+int byte_scan(const uint8_t* data, int size) {
+    int count = 0;
+    for (int n = 0; n + 3 <= size; n++)
+        if (data[n + 2] == 1 && data[n + 1] == 0 && data[n] == 0) {
+            count++;
+            n += 2;
+        }
+    return count;
+}
+
+int main(int argc, char* argv[]) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 2000;
+    vector<uint8_t> frame;
+    make_idr(frame, 300000);
+    int size = frame.size();
+    // the old loop reads up to 3 bytes past the end, as it did in its 1 MB buffer
+    frame.insert(frame.end(), 4, 0xff);
+    const uint8_t* data = &frame[0];
+
+    vector<NalUnit> units;
+    units.reserve(16);
+    NalScanner::scan(data, size, units);
+    assert(units.size() == 11 && old_scan(data, size) == 11 && byte_scan(data, size) == 11);
+    cout << "1080p IDR frame, " << size << " bytes, " << units.size() << " NAL units, " << rounds << " rounds" << endl;
+
+    volatile int sink = 0;
+    double start = now();
+    for (int r = 0; r < rounds; r++)
+        sink += old_scan(data, size);
+    double old_time = (now() - start) / rounds;
+
+    start = now();
+    for (int r = 0; r < rounds; r++)
+        sink += byte_scan(data, size);
+    double byte_time = (now() - start) / rounds;
+
+    start = now();
+    for (int r = 0; r < rounds; r++) {
+        units.clear();
+        NalScanner::scan(data, size, units);
+        sink += units.size();
+    }
+    double scan_time = (now() - start) / rounds;
+
+    cout << "00 00 00 01 at every byte: " << old_time * 1e6  << " us per frame, " << size / old_time / 1e6  << " MB/s" << endl;
+    cout << "00 00 01 byte by byte:     " << byte_time * 1e6 << " us per frame, " << size / byte_time / 1e6 << " MB/s" << endl;
+    cout << "NalScanner (" << NalScanner::implementation() << "):        "
+         << scan_time * 1e6 << " us per frame, " << size / scan_time / 1e6 << " MB/s" << endl;
+    return 0;
+}
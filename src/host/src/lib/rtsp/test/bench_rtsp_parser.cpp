@@ -0,0 +1,105 @@
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "rtsp_parser.h"
+#include "count_allocations.h"     // parser must not allocate
+
+using namespace std;
+
+// requests (not replies) from a capture, with \r\n turned back into line ends
+void read_requests(vector<string>& requests, const char* filename) {
+    ifstream file(filename);
+    assert(!file.fail());
+    string line;
+    bool   start = true;
+    bool   request = false;
+    while (getline(file, line)) {
+        if (line.empty()) {
+            start = true;
+            continue;
+        }
+        if (start) {
+            start = false;
+            if ((request = line.compare(0, 8, "RTSP/1.0") != 0))
+                requests.push_back(string());
+        }
+        if (!request)
+            continue;
+        if (line.size() >= 4 && line.compare(line.size() - 4, 4, "\\r\\n") == 0)
+            line.replace(line.size() - 4, 4, "\r\n");
+        requests.back() += line;
+    }
+}
+
+double now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Parse all requests, each copied into the receive buffer first; returns seconds per request
+double run(RTSP::Parser& parser, const vector<string>& requests, int rounds, bool parse) {
+    char buffer[1024];
+    double start = now();
+    for (int r = 0; r < rounds; r++)
+        for (unsigned int n = 0; n < requests.size(); n++) {
+            memcpy(buffer, requests[n].data(), requests[n].size());
+            if (parse)
+                parser.parse(buffer, requests[n].size());
+        }
+    return (now() - start) / rounds / requests.size();
+}
+
+// All requests arrive in one read, each is found and parsed in place
+double run_pipelined(RTSP::Parser& parser, const string& stream, int rounds, unsigned int& count) {
+    char buffer[1024];
+    assert(stream.size() < sizeof buffer);
+    double start = now();
+    for (int r = 0; r < rounds; r++) {
+        memcpy(buffer, stream.data(), stream.size());
+        char* msg = buffer;
+        char* end = buffer + stream.size();
+        count = 0;
+        while (msg < end) {
+            char* eom = (char*) memmem(msg, end - msg, "\r\n\r\n", 4);
+            assert(eom);
+            eom += 4;
+            parser.parse(msg, eom - msg);
+            msg = eom;
+            count++;
+        }
+    }
+    return (now() - start) / rounds / count;
+}
+
+int main(int argc, char* argv[]) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 200000;
+    vector<string> requests;
+    read_requests(requests, "live555-1.0.3-file-qcif-tcp-rtsp.txt");
+    read_requests(requests, "live555-1.0.3-file-qcif-udp-rtsp.txt");
+    assert(requests.size() == 12);
+
+    RTSP::Parser parser;
+    unsigned long before = allocations;
+    double copy = run(parser, requests, rounds, false);
+    double each = run(parser, requests, rounds, true);
+    assert(allocations == before);
+    cout << "parse:      " << (each - copy) * 1e9 << " ns per request (" << requests.size() * rounds << " requests)" << endl;
+
+    // one client's requests pipelined in a single read
+    string stream;
+    for (unsigned int n = 0; n < 6; n++)
+        stream += requests[n];
+    unsigned int count = 0;
+    before = allocations;
+    double pipelined = run_pipelined(parser, stream, rounds, count);
+    assert(allocations == before && count == 6);
+    cout << "pipelined:  " << pipelined * 1e9 << " ns per request" << endl;
+    cout << "no allocations while parsing" << endl;
+    return 0;
+}
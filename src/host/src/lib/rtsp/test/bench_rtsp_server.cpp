@@ -0,0 +1,452 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <sbl/sbl_logger.h>
+#include <sbl/sbl_exception.h>
+#include <sbl/sbl_thread.h>
+#include "rtsp.h"
+#include "rtsp_client.h"
+#include "rtp_receiver.h"
+
+using namespace std;
+using namespace RTSP;
+
+// Streaming load benchmark: RTSP::Server with synthetic H.264 sources, viewed over loopback by
+// a growing number of UDP and TCP interleaved sessions. Each step of the ramp prints one line of
+// key=value pairs, for scripts to compare run over run.
+//
+// Frames carry the time they were sent as RTP timestamp (90 kHz), so the latency of a frame is
+// the time from the source handing it to the server until its last packet is read by the viewer.
+// Loss is what the viewers' depacketizers saw: packet_loss_pct of the packets sent (received and
+// lost), frame_loss_pct of the frames decoded that missed a packet.
+// Server CPU is that of the process less the viewer thread; threads, RSS and file descriptors
+// are of the whole process, viewers included.
+
+const char* usage = "\n"
+    "bench_rtsp_server -n <sessions>[,<sessions>...] -s <streams> -d <seconds> -u -t -b <kbps> -f <fps>\n"
+    "                  -g <gop> -p <port> -r <ms> -v <verbosity>\n"
+    "Options:\n"
+    "   -n <list>   : sessions at each step of the ramp, default 4,16\n"
+    "   -s <int>    : live streams, sessions are spread over them, default 2\n"
+    "   -d <int>    : seconds measured at each step, default 3\n"
+    "   -u          : UDP sessions only (default half UDP, half TCP)\n"
+    "   -t          : TCP sessions only\n"
+    "   -b <int>    : stream bitrate in kbps, default 2000\n"
+    "   -f <int>    : frames per second, default 30\n"
+    "   -g <int>    : GOP size, default 30\n"
+    "   -p <int>    : server port, default 18560\n"
+    "   -r <int>    : ms between session starts, default 20\n"
+    "   -v <int>    : message verbosity (default 1, errors only)\n"
+    "\n";
+
+enum { CLOCK = 90000 };
+
+double now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double cpu_time(clockid_t clock) {
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// RTP timestamp of a time, differences wrap as RTP timestamps do
+uint32_t rtp_time(double time) {
+    return (uint32_t) (uint64_t) (time * CLOCK);
+}
+
+// entries of a /proc directory
+int count_entries(const char* path) {
+    DIR* dir = opendir(path);
+    if (!dir)
+        return -1;
+    int count = 0;
+    while (dirent* entry = readdir(dir))
+        if (entry->d_name[0] != '.')
+            count++;
+    closedir(dir);
+    return count;
+}
+
+long rss_kb() {
+    long size = 0, resident = 0;
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (!file)
+        return -1;
+    if (fscanf(file, "%ld %ld", &size, &resident) != 2)
+        resident = 0;
+    fclose(file);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Streams are named by their number, all H.264
+class Bench : public Application {
+public:
+    Bench(int streams, int bitrate) : _streams(streams), _bitrate(bitrate) {}
+    int get_stream_id(unsigned int channel_num, unsigned int stream_num) {
+        return stream_num == 0 && (int) channel_num < _streams ? (int) channel_num : -1;
+    }
+    int get_stream_id(const char* stream_name) {
+        char* end;
+        long id = strtol(stream_name, &end, 10);
+        return end == stream_name || *end || id < 0 || id >= _streams ? -1 : (int) id;
+    }
+    void play(int stream_id) {}
+    void teardown(int stream_id) {}
+    int describe(int stream_id, StreamDesc& stream_desc) {
+        if (stream_id < 0 || stream_id >= _streams)
+            return -1;
+        stream_desc.encoder_type = H264;
+        stream_desc.bitrate      = _bitrate;
+        return 0;
+    }
+    int pe_id() const { return 0; }
+private:
+    int _streams;
+    int _bitrate;
+};
+
+Bench* bench;
+
+namespace RTSP {
+Application* application() { return bench; }
+}
+
+// Plays the SDK callback: each frame of each stream is copied to the frame pool and sent, as
+// rtsp_server does. A GOP is SPS, PPS, an IDR four times the size of a P frame, then P frames,
+// sized to the bitrate. Slices are filler.
+class Camera : public SBL::Thread {
+public:
+    Camera(int streams, int bitrate, int fps, int gop) : _streams(streams), _fps(fps), _gop(gop), _stopped(false) {
+        int gop_bytes = bitrate * 1000 / 8 * gop / fps;
+        _p.assign(max(gop_bytes / (gop - 1 + IDR_WEIGHT), 64), 0x55);
+        _idr.assign(_p.size() * IDR_WEIGHT, 0xaa);
+        const uint8_t header[] = { 0, 0, 0, 1, 0x41 };
+        memcpy(&_p[0], header, sizeof header);
+        memcpy(&_idr[0], header, sizeof header);
+        _idr[4] = 0x65;
+    }
+    void start_thread() {
+        const uint8_t sps[] = { 0, 0, 0, 1, 0x67, 0x42, 0x00, 0x1f, 0xe9, 0x01, 0x40, 0x7b, 0x20 };
+        const uint8_t pps[] = { 0, 0, 0, 1, 0x68, 0xce, 0x38, 0x80 };
+        double next = now();
+        for (unsigned int frame = 0; !_stopped; frame++) {
+            double time = now();
+            if (next > time)
+                usleep((useconds_t) ((next - time) * 1e6));
+            else if (time - next > 1)
+                next = time;            // too far behind, don't catch up with a burst
+            next += 1.0 / _fps;
+            uint32_t timestamp = rtp_time(now());
+            for (int stream = 0; stream < _streams; stream++) {
+                if (frame % _gop == 0) {
+                    send(stream, sps, sizeof sps, timestamp);
+                    send(stream, pps, sizeof pps, timestamp);
+                    send(stream, &_idr[0], _idr.size(), timestamp);
+                } else
+                    send(stream, &_p[0], _p.size(), timestamp);
+            }
+        }
+    }
+    void stop() {
+        _stopped = true;
+        join_thread();
+    }
+private:
+    enum { IDR_WEIGHT = 4 };
+    int                 _streams;
+    int                 _fps;
+    int                 _gop;
+    volatile bool       _stopped;
+    vector<uint8_t>     _idr;
+    vector<uint8_t>     _p;
+
+    void send(int stream, const uint8_t* frame, int size, uint32_t timestamp) {
+        FrameRef copy = rtsp_copy_frame(frame, size);
+        rtsp_send_frame(stream, 0, copy, timestamp, H264);
+    }
+};
+
+// One session, with latency of each complete frame it gets
+class Viewer : public Depacketizer::Sink {
+public:
+    Viewer(const char* url, const RemoteClient::Options& options, vector<double>* latencies) :
+        depacketizer(this), client(url, &depacketizer, options), tcp(options.tcp), playing(false), retry(0),
+        failures(0), last_packets(0), last_progress(0), step_bytes(0), _latencies(latencies) {}
+    void nal_unit(const uint8_t* data, int size, uint32_t timestamp) {}
+    void access_unit(uint32_t timestamp, bool complete) {
+        if (complete)
+            _latencies->push_back((int32_t) (rtp_time(now()) - timestamp) * 1000.0 / CLOCK);
+    }
+
+    Depacketizer    depacketizer;
+    RemoteClient    client;
+    bool            tcp;
+    bool            playing;
+    double          retry;              // when to open the session again
+    unsigned int    failures;
+    uint64_t        last_packets;       // packets when they last went up
+    double          last_progress;
+    uint64_t        step_bytes;         // bytes when the step started
+private:
+    vector<double>* _latencies;
+};
+
+// Viewers, all served from this thread: UDP media thru one RtpReceiver, TCP media and
+// keepalives thru each client
+class Viewers {
+public:
+    Viewers(int port, int streams, bool udp, bool tcp) : _port(port), _streams(streams), _udp(udp), _tcp(tcp),
+        _next_service(0) {}
+    ~Viewers() {
+        for (unsigned int n = 0; n < _viewers.size(); n++) {
+            stop(_viewers[n]);
+            delete _viewers[n];
+        }
+    }
+    //! Open one more session, on the next stream, alternating UDP and TCP if both are used
+    void add() {
+        char url[64];
+        int n = _viewers.size();
+        snprintf(url, sizeof url, "rtsp://127.0.0.1:%d/%d", _port, n % _streams);
+        RemoteClient::Options options;
+        options.tcp        = _tcp && (!_udp || n % 2);
+        options.detach_rtp = true;
+        Viewer* viewer = new Viewer(url, options, &latencies);
+        _viewers.push_back(viewer);
+        start(viewer);
+    }
+    //! Receive for up to ms milliseconds
+    void serve(int ms) {
+        _receiver.poll(ms);
+        double time = now();
+        // UDP sessions only need keepalives
+        bool keepalive = time >= _next_service;
+        if (keepalive)
+            _next_service = time + 0.5;
+        for (unsigned int n = 0; n < _viewers.size(); n++) {
+            Viewer* viewer = _viewers[n];
+            if (!viewer->playing) {
+                if (time >= viewer->retry)
+                    start(viewer);
+                continue;
+            }
+            if (!viewer->tcp && !keepalive)
+                continue;
+            bool ok = false;
+            try {
+                ok = viewer->client.receive(0);
+            } catch (SBL::Exception& ex) {
+                SBL_ERROR("%s: %s", viewer->client.url(), ex.what());
+            }
+            uint64_t packets = viewer->depacketizer.stats().packets;
+            if (packets != viewer->last_packets) {
+                viewer->last_packets  = packets;
+                viewer->last_progress = time;
+            } else if (ok && time - viewer->last_progress > 5) {
+                SBL_ERROR("%s: no media for 5 s", viewer->client.url());
+                ok = false;
+            }
+            if (!ok) {
+                viewer->failures++;
+                stop(viewer);
+            }
+        }
+    }
+    int  size() const { return _viewers.size(); }
+    const vector<Viewer*>& viewers() const { return _viewers; }
+    const RtpReceiver& receiver() const { return _receiver; }
+
+    vector<double>  latencies;      // ms, of the frames of all sessions
+private:
+    int             _port;
+    int             _streams;
+    bool            _udp;
+    bool            _tcp;
+    double          _next_service;
+    RtpReceiver     _receiver;
+    vector<Viewer*> _viewers;
+
+    void start(Viewer* viewer) {
+        try {
+            viewer->client.open();
+            if (viewer->client.rtp_fd() >= 0)
+                _receiver.add(viewer->client.rtp_fd(), &viewer->depacketizer, viewer->client.media().clock);
+            viewer->playing       = true;
+            viewer->last_progress = now();
+        } catch (SBL::Exception& ex) {
+            SBL_ERROR("%s: %s", viewer->client.url(), ex.what());
+            viewer->failures++;
+            stop(viewer);
+        }
+    }
+    void stop(Viewer* viewer) {
+        if (viewer->client.rtp_fd() >= 0)
+            _receiver.remove(viewer->client.rtp_fd());
+        try {
+            viewer->client.close();
+        } catch (SBL::Exception& ex) {
+            SBL_WARN("%s: %s", viewer->client.url(), ex.what());
+        }
+        viewer->depacketizer.reset();
+        viewer->playing = false;
+        viewer->retry   = now() + 1;
+    }
+};
+
+// Sum of the counters of all viewers
+struct Totals {
+    int             playing;
+    unsigned int    failures;
+    uint64_t        packets;
+    uint64_t        bytes;
+    uint64_t        lost;
+    uint64_t        late;
+    uint64_t        frames;
+    uint64_t        broken;
+    Totals(const vector<Viewer*>& viewers) : playing(0), failures(0), packets(0), bytes(0), lost(0), late(0),
+        frames(0), broken(0) {
+        for (unsigned int n = 0; n < viewers.size(); n++) {
+            const Depacketizer::Stats& stats = viewers[n]->depacketizer.stats();
+            playing  += viewers[n]->playing;
+            failures += viewers[n]->failures;
+            packets  += stats.packets;
+            bytes    += stats.bytes;
+            lost     += stats.lost;
+            late     += stats.late;
+            frames   += stats.access_units;
+            broken   += stats.broken;
+        }
+    }
+};
+
+double percentile(vector<double>& samples, double fraction) {
+    if (samples.empty())
+        return 0;
+    vector<double>::iterator nth = samples.begin() + (size_t) (fraction * (samples.size() - 1));
+    nth_element(samples.begin(), nth, samples.end());
+    return *nth;
+}
+
+int main(int argc, char* argv[]) {
+    vector<int> steps;
+    int streams = 2, duration = 3, bitrate = 2000, fps = 30, gop = 30, port = 18560, ramp = 20;
+    bool udp = true, tcp = true;
+    const char* list = "4,16";
+    int c;
+    while ((c = getopt(argc, argv, "n:s:d:utb:f:g:p:r:v:h")) != -1)
+        switch (c) {
+            case 'n': list     = optarg;                    break;
+            case 's': streams  = strtol(optarg, 0, 0);      break;
+            case 'd': duration = strtol(optarg, 0, 0);      break;
+            case 'u': tcp      = false;                     break;
+            case 't': udp      = false;                     break;
+            case 'b': bitrate  = strtol(optarg, 0, 0);      break;
+            case 'f': fps      = strtol(optarg, 0, 0);      break;
+            case 'g': gop      = strtol(optarg, 0, 0);      break;
+            case 'p': port     = strtol(optarg, 0, 0);      break;
+            case 'r': ramp     = strtol(optarg, 0, 0);      break;
+            case 'v': SBL::Log::set_verbosity(strtol(optarg, 0, 0)); break;
+            case 'h':
+            default : cout << usage << endl;
+                      return 1;
+        }
+    for (char* end; *list; list = *end ? end + 1 : end) {
+        steps.push_back(strtol(list, &end, 10));
+        if (end == list || steps.back() <= 0 || (steps.size() > 1 && steps.back() < steps[steps.size() - 2]))
+            break;
+    }
+    if (steps.empty() || steps.back() <= 0 || streams <= 0 || duration <= 0 || bitrate <= 0 || fps <= 0 || gop <= 1 ||
+        (!udp && !tcp) || (steps.size() > 1 && steps.back() < steps[steps.size() - 2])) {
+        cout << usage << endl;
+        return 1;
+    }
+
+    bench = new Bench(streams, bitrate);
+    Server::create(port);
+    Camera camera(streams, bitrate, fps, gop);
+    camera.create_thread();
+    Viewers viewers(port, streams, udp, tcp);
+    bool received = false;
+
+    for (unsigned int step = 0; step < steps.size(); step++) {
+        // sessions start one at a time, then a second for them to settle before measuring;
+        // sessions that fail to start count against the step
+        unsigned int failures = Totals(viewers.viewers()).failures;
+        double next_start = now();
+        while (viewers.size() < steps[step]) {
+            if (now() >= next_start) {
+                viewers.add();
+                next_start = now() + ramp / 1000.0;
+            }
+            viewers.serve(2);
+        }
+        for (double end = now() + 1; now() < end; )
+            viewers.serve(2);
+
+        const vector<Viewer*>& all = viewers.viewers();
+        for (unsigned int n = 0; n < all.size(); n++)
+            all[n]->step_bytes = all[n]->depacketizer.stats().bytes;
+        Totals first(all);
+        viewers.latencies.clear();
+        double start = now(), process_start = cpu_time(CLOCK_PROCESS_CPUTIME_ID), viewer_start = cpu_time(CLOCK_THREAD_CPUTIME_ID);
+        while (now() < start + duration)
+            viewers.serve(2);
+        double elapsed = now() - start;
+        double viewer_cpu = cpu_time(CLOCK_THREAD_CPUTIME_ID) - viewer_start;
+        double server_cpu = cpu_time(CLOCK_PROCESS_CPUTIME_ID) - process_start - viewer_cpu;
+
+        Totals last(all);
+        double client_min = 0, client_max = 0;
+        for (unsigned int n = 0; n < all.size(); n++) {
+            double mbps = (all[n]->depacketizer.stats().bytes - all[n]->step_bytes) * 8 / elapsed / 1e6;
+            client_min = n ? min(client_min, mbps) : mbps;
+            client_max = n ? max(client_max, mbps) : mbps;
+        }
+        double mbps     = (last.bytes - first.bytes) * 8 / elapsed / 1e6;
+        uint64_t packets = last.packets - first.packets;
+        uint64_t lost    = last.lost - first.lost;
+        uint64_t frames  = last.frames - first.frames;
+        uint64_t broken  = last.broken - first.broken;
+        int tcp_count   = 0;
+        for (unsigned int n = 0; n < all.size(); n++)
+            tcp_count += all[n]->tcp;
+        received |= frames > 0;
+
+        cout << fixed << setprecision(2)
+             << "step=" << step + 1 << " sessions=" << last.playing << " target=" << all.size()
+             << " udp=" << all.size() - tcp_count << " tcp=" << tcp_count << " streams=" << streams
+             << " kbps=" << bitrate << " fps=" << fps << " seconds=" << elapsed
+             << " failures=" << last.failures - failures
+             << " mbps=" << mbps << " client_mbps_min=" << client_min
+             << " client_mbps_avg=" << (all.empty() ? 0 : mbps / all.size()) << " client_mbps_max=" << client_max
+             << " packets=" << packets << " lost=" << lost
+             << " late=" << last.late - first.late << " frames=" << frames << " broken=" << broken
+             << " packet_loss_pct=" << (packets + lost ? lost * 100.0 / (packets + lost) : 0)
+             << " frame_loss_pct=" << (frames ? broken * 100.0 / frames : 0)
+             << " latency_ms_p50=" << percentile(viewers.latencies, 0.5)
+             << " latency_ms_p90=" << percentile(viewers.latencies, 0.9)
+             << " latency_ms_p99=" << percentile(viewers.latencies, 0.99)
+             << " latency_ms_max=" << percentile(viewers.latencies, 1)
+             << " server_cpu_pct=" << server_cpu * 100 / elapsed
+             << " server_cpu_pct_per_session=" << (last.playing ? server_cpu * 100 / elapsed / last.playing : 0)
+             << " viewer_cpu_pct=" << viewer_cpu * 100 / elapsed;
+        if (viewers.receiver().stats().syscalls)
+            cout << " packets_per_read=" << (double) viewers.receiver().stats().packets / viewers.receiver().stats().syscalls;
+        cout << " threads=" << count_entries("/proc/self/task") << " rss_kb=" << rss_kb()
+             << " fds=" << count_entries("/proc/self/fd") - 1 << endl;
+    }
+    camera.stop();
+    return received ? 0 : 1;
+}
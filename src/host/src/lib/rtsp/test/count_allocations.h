@@ -0,0 +1,33 @@
+#ifndef _COUNT_ALLOCATIONS_H
+#define _COUNT_ALLOCATIONS_H
+#include <cstdlib>
+#include <new>
+
+// Replaces operator new and delete to count every allocation of the program, so a benchmark
+// can check what its hot paths allocate. Include it from one source file of the program only.
+
+// dynamic exception specifications are an error since C++17, and only allowed before C++11
+#if __cplusplus >= 201103L
+#define NEW_THROWS
+#define DELETE_THROWS noexcept
+#else
+#define NEW_THROWS    throw(std::bad_alloc)
+#define DELETE_THROWS throw()
+#endif
+
+static volatile unsigned long allocations = 0;
+static volatile unsigned long allocated   = 0;
+
+void* operator new(size_t size) NEW_THROWS {
+    __sync_fetch_and_add(&allocations, 1);
+    __sync_fetch_and_add(&allocated, size);
+    void* p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+void* operator new[](size_t size) NEW_THROWS { return operator new(size); }
+void  operator delete(void* p) DELETE_THROWS   { free(p); }
+void  operator delete[](void* p) DELETE_THROWS { free(p); }
+
+#endif
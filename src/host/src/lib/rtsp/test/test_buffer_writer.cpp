@@ -0,0 +1,53 @@
+#include <cassert>
+#include <cstring>
+#include <sbl/sbl_logger.h>
+#include "buffer_writer.h"
+#include "rtsp_session_id.h"
+
+using namespace RTSP;
+
+int main(int argc, char* argv[]) {
+    char buffer[64];
+    BufferWriter str(buffer, sizeof buffer);
+    assert(str.size() == 0 && str.ok() && buffer[0] == 0);
+
+    str << "CSeq: " << 0 << ' ' << -17 << ' ' << 4000000000u << "\r\n";
+    assert(!strcmp(str.data(), "CSeq: 0 -17 4000000000\r\n"));
+    str.reset();
+    str.hex(0x42001f, 6) << ' ';
+    str.hex(0x1f, 6) << ' ';
+    str.hex(0xabc, 0, true) << ' ' << SessionID("00C0FFEE");
+    assert(!strcmp(str.data(), "42001f 00001f ABC 00C0FFEE"));
+
+    // RFC 4648 test vectors, and an SPS/PPS pair
+    const char* plain[]  = {"", "f", "fo", "foo", "foob", "fooba", "foobar"};
+    const char* base64[] = {"", "Zg==", "Zm8=", "Zm9v", "Zm9vYg==", "Zm9vYmE=", "Zm9vYmFy"};
+    for (int n = 0; n < 7; n++) {
+        str.reset();
+        str.base64((const uint8_t*) plain[n], strlen(plain[n]));
+        assert(!strcmp(str.data(), base64[n]));
+    }
+    const uint8_t sps[] = {0x67, 0x42, 0x00, 0x1f, 0xe9, 0x01, 0x40, 0x7b, 0x20};
+    const uint8_t pps[] = {0x68, 0xce, 0x38, 0x80};
+    str.reset();
+    str.base64(sps, sizeof sps) << ',';
+    str.base64(pps, sizeof pps);
+    assert(!strcmp(str.data(), "Z0IAH+kBQHsg,aM44gA=="));
+
+    // what doesn't fit is cut off, buffer stays terminated
+    str.reset();
+    for (int n = 0; n < 10; n++)
+        str << "0123456789";
+    assert(!str.ok() && str.size() == sizeof buffer - 1 && strlen(buffer) == sizeof buffer - 1);
+    str.reset();
+    assert(str.ok() && str.size() == 0);
+
+    // one writer appended to another
+    char body_buffer[16];
+    BufferWriter body(body_buffer, sizeof body_buffer);
+    body << "v=0\r\n";
+    str << "Content-Length: " << body.size() << "\r\n\r\n" << body;
+    assert(!strcmp(str.data(), "Content-Length: 5\r\n\r\nv=0\r\n"));
+    SBL_INFO("Done!");
+    return 0;
+}
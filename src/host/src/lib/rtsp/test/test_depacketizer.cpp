@@ -0,0 +1,180 @@
+#include <cassert>
+#include <cstring>
+#include <vector>
+#include <sbl/sbl_logger.h>
+#include "packetizer.h"
+#include "depacketizer.h"
+
+using namespace RTSP;
+
+typedef std::vector<uint8_t> Bytes;
+
+const int      PACKET_SIZE = 1000;
+const uint32_t TICKS       = 3000;
+
+struct Collector : public Depacketizer::Sink {
+    std::vector<Bytes>    units;
+    std::vector<uint32_t> timestamps;
+    int                   access_units;
+    int                   complete;
+    Collector() : access_units(0), complete(0) {}
+    void nal_unit(const uint8_t* data, int size, uint32_t timestamp) {
+        units.push_back(Bytes(data, data + size));
+        timestamps.push_back(timestamp);
+    }
+    void access_unit(uint32_t timestamp, bool whole) {
+        access_units++;
+        complete += whole;
+    }
+};
+
+// NAL units of a GOP: SPS, PPS, a fragmented IDR and small P frames
+void make_gop(std::vector<Bytes>& units) {
+    static const uint8_t SPS[] = { 0x67, 0x42, 0x00, 0x1f, 0xe9, 0x01, 0x40, 0x7b, 0x20 };
+    static const uint8_t PPS[] = { 0x68, 0xce, 0x38, 0x80 };
+    units.clear();
+    units.push_back(Bytes(SPS, SPS + sizeof SPS));
+    units.push_back(Bytes(PPS, PPS + sizeof PPS));
+    Bytes idr(4500);
+    for (unsigned int n = 0; n < idr.size(); n++)
+        idr[n] = n * 7;
+    idr[0] = 0x65;
+    units.push_back(idr);
+    for (int n = 0; n < 5; n++)
+        units.push_back(Bytes(300 + n, 0x41));
+}
+
+// RTP packets of the NAL units, SPS and PPS go with the IDR in a STAP-A; units after the third one are one frame each
+void packetize(const std::vector<Bytes>& units, std::vector<Bytes>& packets, uint16_t seq, uint32_t ssrc = 0x1234) {
+    Packetizer packetizer(PACKET_SIZE, ssrc, true);
+    packets.clear();
+    uint32_t timestamp = 0;
+    for (unsigned int n = 0; n < units.size(); n++) {
+        if (n > 2)
+            timestamp += TICKS;
+        packetizer.begin(96, timestamp, seq);
+        packetizer.h264(&units[n][0], units[n].size());
+        const Packets& out = packetizer.packets();
+        for (unsigned int p = 0; p < out.size(); p++) {
+            Bytes packet(out[p].header + Packet::PREFIX, out[p].header + Packet::PREFIX + out[p].header_size);
+            packet.insert(packet.end(), out[p].payload, out[p].payload + out[p].payload_size);
+            packets.push_back(packet);
+        }
+        seq += out.size();
+    }
+}
+
+void add(Depacketizer& depacketizer, const Bytes& packet) {
+    uint32_t timestamp = packet[4] << 24 | packet[5] << 16 | packet[6] << 8 | packet[7];
+    depacketizer.add(&packet[0], packet.size(), timestamp + 1000);   // constant transit, no jitter
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<Bytes> units, packets;
+    make_gop(units);
+    packetize(units, packets, 0xfff0);      // sequence numbers wrap around
+    // SPS and PPS ride the first IDR fragment's STAP-A, so there are fewer packets than NAL units + fragments
+    assert(packets.size() == 1 + 5 + 5);
+    assert((packets[0][12] & 0x1f) == 24 && (packets[1][12] & 0x1f) == 28);
+
+    // in order, every NAL unit comes out as it went in
+    {
+        Collector sink;
+        Depacketizer depacketizer(&sink);
+        for (unsigned int n = 0; n < packets.size(); n++)
+            add(depacketizer, packets[n]);
+        assert(sink.units == units);
+        assert(sink.timestamps[0] == 0 && sink.timestamps[2] == 0 && sink.timestamps[3] == TICKS);
+        const Depacketizer::Stats& stats = depacketizer.stats();
+        assert(stats.packets == packets.size() && stats.lost == 0 && stats.late == 0 && stats.nal_units == units.size());
+        assert(stats.access_units == 6 && stats.broken == 0 && depacketizer.jitter() == 0);
+        assert(sink.access_units == 6 && sink.complete == 6);
+    }
+
+    // reordered and duplicated packets come out in order, once
+    {
+        Collector sink;
+        Depacketizer depacketizer(&sink);
+        add(depacketizer, packets[0]);
+        add(depacketizer, packets[3]);
+        add(depacketizer, packets[2]);
+        add(depacketizer, packets[1]);
+        add(depacketizer, packets[1]);
+        for (unsigned int n = 4; n < packets.size(); n++)
+            add(depacketizer, packets[n]);
+        assert(sink.units == units);
+        const Depacketizer::Stats& stats = depacketizer.stats();
+        assert(stats.reordered == 1 && stats.late == 1 && stats.lost == 0);
+    }
+
+    // a lost fragment takes its NAL unit down, the rest goes on
+    {
+        Collector sink;
+        Depacketizer depacketizer(&sink);
+        for (unsigned int n = 0; n < packets.size(); n++)
+            if (n != 3)
+                add(depacketizer, packets[n]);
+        // the gap is only given up on when the window runs out, or at flush
+        assert(sink.units.size() == 2);
+        depacketizer.flush();
+        assert(sink.units.size() == units.size() - 1);
+        assert(sink.units[1] == units[1] && sink.units[2] == units[3]);
+        const Depacketizer::Stats& stats = depacketizer.stats();
+        assert(stats.lost == 1 && stats.dropped == 1);
+        // the IDR access unit is broken, it ends when the next one starts
+        assert(sink.access_units == 6 && sink.complete == 5 && stats.broken == 1);
+    }
+
+    // window overflow gives up on missing packets without a flush
+    {
+        std::vector<Bytes> many;
+        for (int n = 0; n < 3 * Depacketizer::WINDOW; n++)
+            many.push_back(Bytes(100, 0x41));
+        packetize(many, packets, 10);
+        Collector sink;
+        Depacketizer depacketizer(&sink);
+        add(depacketizer, packets[0]);
+        for (int n = 2; n <= Depacketizer::WINDOW; n++)
+            add(depacketizer, packets[n]);
+        assert(sink.units.size() == 1 && depacketizer.stats().lost == 0);
+        // the next one has no room, all held ones go
+        add(depacketizer, packets[Depacketizer::WINDOW + 1]);
+        assert(int(sink.units.size()) == Depacketizer::WINDOW + 1 && depacketizer.stats().lost == 1);
+        for (unsigned int n = Depacketizer::WINDOW + 2; n < packets.size(); n++)
+            add(depacketizer, packets[n]);
+        assert(sink.units.size() == packets.size() - 1);
+
+        // new SSRC starts over, no loss for the sequence number jump
+        std::vector<Bytes> restarted;
+        packetize(many, restarted, 5000, 0x5678);
+        for (unsigned int n = 0; n < restarted.size(); n++)
+            add(depacketizer, restarted[n]);
+        assert(depacketizer.stats().restarts == 1 && depacketizer.stats().lost == 1);
+        assert(sink.units.size() == 2 * packets.size() - 1);
+    }
+
+    // jitter follows RFC 3550, each packet moves it 1/16 of the way to the transit time difference
+    {
+        make_gop(units);
+        packetize(units, packets, 0);
+        Collector sink;
+        Depacketizer depacketizer(&sink);
+        for (unsigned int n = 0; n < packets.size(); n++) {
+            uint32_t timestamp = packets[n][4] << 24 | packets[n][5] << 16 | packets[n][6] << 8 | packets[n][7];
+            depacketizer.add(&packets[n][0], packets[n].size(), timestamp + (n % 2 ? 1000 : 1320));
+        }
+        // J converges toward 320 from below: 20, 38.75, ...
+        assert(depacketizer.jitter() > 100 && depacketizer.jitter() < 320);
+    }
+
+    // garbage is counted, not decoded
+    {
+        Collector sink;
+        Depacketizer depacketizer(&sink);
+        uint8_t junk[20] = { 0 };
+        depacketizer.add(junk, sizeof junk, 0);
+        depacketizer.add(junk, 5, 0);
+        assert(depacketizer.stats().invalid == 2 && sink.units.empty());
+    }
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sbl/sbl_logger.h>
+#include "rtsp.h"
+#include "event_buffer.h"
+#include "metrics.h"
+#include "file_index.h"
+#include "nal_scanner.h"
+
+using namespace RTSP;
+
+static const int FRAME_SIZE = 1000;
+static const uint32_t TICKS = 3000;         // 30 fps at 90 kHz
+static const int server_port = 18594;
+static const char* CLIP_NAME = "test_event_buffer.264";
+
+// GOP of SPS, PPS, IDR and P frames, 30 frames a second; slices start at macroblock 0, the byte after numbers the frame
+void add_gop(EventBuffer& buffer, uint32_t& timestamp, int& number, int frames = 30, int size = FRAME_SIZE) {
+    std::vector<uint8_t> frame(size, 0xaa);
+    buffer.add((const uint8_t*) "\x67\x42\x00\x1e", 4, timestamp, true);
+    buffer.add((const uint8_t*) "\x68\xce\x3c\x80", 4, timestamp, false);
+    for (int n = 0; n < frames; n++) {
+        frame[0] = n ? 0x41 : 0x65;
+        frame[1] = 0x88;
+        frame[2] = number++;
+        buffer.add(&frame[0], size, timestamp, false);
+        timestamp += TICKS;
+    }
+}
+
+// streams in the metrics registry, each streamer has one
+int stream_count() {
+    std::ostringstream text;
+    Metrics::registry().print(text, NULL);
+    int count = 0;
+    for (size_t at = 0; (at = text.str().find("metrics stream=", at)) != std::string::npos; at++)
+        count++;
+    return count;
+}
+
+// NAL units of a clip: it starts with a GOP, pictures are in order and intact
+int check_clip(const std::vector<uint8_t>& clip, int& first, int& last) {
+    std::vector<NalUnit> units;
+    NalScanner::scan(&clip[0], clip.size(), units);
+    assert(units.size() >= 3 && units[0].type() == 7 && units[1].type() == 8 && units[2].type() == 5);
+    int pictures = 0;
+    for (unsigned int n = 0; n < units.size(); n++) {
+        if (units[n].type() != 5 && units[n].type() != 1)
+            continue;
+        const uint8_t* data = &clip[units[n].offset];
+        assert(units[n].size == FRAME_SIZE && data[FRAME_SIZE - 1] == 0xaa);
+        if (pictures++)
+            assert(data[2] == uint8_t(last + 1));
+        else
+            first = data[2];
+        last = data[2];
+    }
+    return pictures;
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t timestamp = 0xffff0000;   // wraps around
+    int number = 0;
+    std::vector<uint8_t> clip;
+    int first, last;
+
+    // ring keeps the GOP starting at or before 2 seconds back, and the rest
+    {
+        EventBuffer buffer(1024 * 1024, 2);
+        buffer.add((const uint8_t*) "\x41\x9a", 2, timestamp, false);   // waits for the first key frame
+        assert(buffer.clip(clip) == 0 && buffer.length() == 0);
+        for (int n = 0; n < 5; n++)
+            add_gop(buffer, timestamp, number);
+        assert(buffer.length() > 2.9 && buffer.length() < 3);
+        assert(buffer.clip(clip) > 0);
+        assert(check_clip(clip, first, last) == 90 && first == 60 && last == 149);
+    }
+
+    // ring smaller than the time limit drops the oldest GOPs, and wraps around without breaking frames
+    {
+        EventBuffer buffer(10 * 1000, 10);
+        number = 0;
+        for (int n = 0; n < 20; n++)
+            add_gop(buffer, timestamp, number, 3);
+        assert(buffer.clip(clip) > 0 && clip.size() <= 10 * 1000 + 100);
+        int pictures = check_clip(clip, first, last);
+        assert(pictures >= 6 && first % 3 == 0 && last == 59 && pictures == 60 - first);
+        // GOP larger than the ring is not buffered, the next one that fits is
+        add_gop(buffer, timestamp, number, 11);
+        assert(buffer.clip(clip) == 0);
+        add_gop(buffer, timestamp, number, 2);
+        assert(buffer.clip(clip) > 0 && check_clip(clip, first, last) == 2 && first == 71);
+        std::ostringstream stats;
+        buffer.print_stats(stats, "0");
+        assert(stats.str().find("event_buffer stream=0 frames=4 ") == 0);
+        assert(stats.str().find(" overflows=1 ") != std::string::npos);
+    }
+
+    // event freezes the clip, the ring goes on; events within the time limit are ignored
+    {
+        EventBuffer buffer(1024 * 1024, 1);
+        number = 0;
+        assert(!buffer.trigger() && buffer.event_time() == 0);
+        add_gop(buffer, timestamp, number);
+        assert(buffer.trigger() && buffer.event_time() != 0);
+        add_gop(buffer, timestamp, number);
+        assert(!buffer.trigger());
+        assert(buffer.clip(clip) > 0 && check_clip(clip, first, last) == 30 && first == 0);
+        assert(buffer.clip(clip, true) > 0 && check_clip(clip, first, last) == 60 && last == 59);
+
+        // clip plays like a file
+        FileIndex index;
+        assert(index.open(&clip[0], clip.size(), "event/0") == OK);
+        assert(index.count() == 64 && index.key_frame_count() == 2 && index.access_unit_count() == 60);
+        assert(index.data(index[2]) == &clip[20] && index.data(index[2])[2] == 0);
+        index.close();
+        assert(clip.size() == 2 * (8 + 8 + 30 * (FRAME_SIZE + 4)));
+        std::ofstream(CLIP_NAME, std::ios::binary).write((const char*) &clip[0], clip.size());
+    }
+
+    // event clip of a file is not found, and no file source is left behind looking for it
+    Server* server = Server::create(server_port);
+    int streams = stream_count();
+    std::string name = std::string("event/") + CLIP_NAME;
+    bool found = true;
+    try {
+        server->get_source(name.c_str());
+    } catch (Errcode errcode) {
+        found = errcode != NOT_FOUND;
+    }
+    assert(!found && stream_count() == streams);
+    remove(CLIP_NAME);
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sbl/sbl_logger.h>
+#include "file_index.h"
+
+using namespace RTSP;
+
+static const char* FILENAME = "test_file_index.264";
+
+// start code (3 or 4 bytes) followed by a NAL unit
+std::string nal(const char* data, int size, bool long_start_code = true) {
+    std::string s(long_start_code ? "\0\0\0\1" : "\0\0\1", long_start_code ? 4 : 3);
+    return s.append(data, size);
+}
+
+void write_file(const std::string& data) {
+    FILE* file = fopen(FILENAME, "wb");
+    assert(file);
+    assert(fwrite(data.data(), 1, data.size(), file) == data.size());
+    fclose(file);
+}
+
+bool same(const FileIndex& a, const FileIndex& b) {
+    if (a.count() != b.count() || a.key_frame_count() != b.key_frame_count())
+        return false;
+    for (int n = 0; n < a.count(); n++)
+        if (a[n].offset != b[n].offset || a[n].size != b[n].size || a[n].flags != b[n].flags)
+            return false;
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    // GOP: SPS, PPS, SEI, IDR in two slices, P with a 3 byte start code and trailing zeros, P; then next GOP
+    std::string gop = nal("\x67\x42\x00\x1e", 4) + nal("\x68\xce\x3c\x80", 4) + nal("\x06\x05\x01", 3)
+                    + nal("\x65\x88\x84\x00\x01\x02", 6) + nal("\x65\x40\x11", 3)
+                    + nal("\x41\x9a\x22\x00\x00", 5, false) + nal("\x41\x9a\x33", 3);
+    write_file(gop + gop);
+    unlink((std::string(FILENAME) + ".idx").c_str());
+
+    FileIndex index;
+    assert(index.open(FILENAME) == OK);
+    assert(index.count() == 14 && index.key_frame_count() == 2);
+    assert(index.key_frame(0) == 0 && index.key_frame(1) == 7);
+    const int flags[] = { FileIndex::ACCESS_UNIT | FileIndex::KEY_FRAME, 0, 0, 0, 0, FileIndex::ACCESS_UNIT, FileIndex::ACCESS_UNIT };
+    for (int n = 0; n < index.count(); n++)
+        assert(index[n].flags == flags[n % 7]);
+    // NAL units point into the mapping, start code and trailing zeros excluded
+    assert(index[0].offset == 4 && index[0].size == 4 && memcmp(index.data(index[0]), "\x67\x42\x00\x1e", 4) == 0);
+    assert(index[3].size == 6 && memcmp(index.data(index[3]), "\x65\x88\x84\x00\x01\x02", 6) == 0);
+    assert(index[5].size == 3 && memcmp(index.data(index[5]), "\x41\x9a\x22", 3) == 0);
+    assert(index[13].offset + index[13].size == index.file_size());
+
+    // access units, and the key frame at or before each of them
+    assert(index.access_unit_count() == 6 && index.access_unit(1) == 5 && index.access_unit(3) == 7);
+    assert(index.key_frame_unit(0) == 0 && index.key_frame_unit(1) == 3);
+    const int key_frames[] = { 0, 0, 0, 1, 1, 1 };
+    for (int unit = 0; unit < index.access_unit_count(); unit++)
+        assert(index.find_key_frame(unit) == key_frames[unit]);
+    assert(index.find_key_frame(-1) == 0 && index.find_key_frame(1000) == 1);
+
+    // index is saved next to the file and loaded the next time
+    FileIndex saved;
+    assert(saved.open(FILENAME, true) == OK && same(index, saved));
+    struct stat st;
+    assert(stat("test_file_index.264.idx", &st) == 0);
+    FileIndex loaded;
+    assert(loaded.open(FILENAME, true) == OK && same(index, loaded));
+    assert(loaded[7].flags == (FileIndex::ACCESS_UNIT | FileIndex::KEY_FRAME));
+
+    // saved index of a changed file is not used
+    write_file(gop);
+    struct utimbuf times = { 1, 1 };
+    assert(utime(FILENAME, &times) == 0);
+    assert(loaded.open(FILENAME, true) == OK && loaded.count() == 7 && loaded.key_frame_count() == 1);
+    assert(loaded.access_unit_count() == 3 && loaded.find_key_frame(2) == 0);
+
+    // errors
+    assert(index.open("no_such_file.264") == NOT_FOUND);
+    write_file("not a video file");
+    assert(index.open(FILENAME) == BAD_REQUEST && index.count() == 0);
+    assert(index.access_unit_count() == 0 && index.find_key_frame(0) == -1);
+
+    unlink(FILENAME);
+    unlink("test_file_index.264.idx");
+    SBL_INFO("Done!");
+    return 0;
+}
@@ -12,23 +12,23 @@ void callback(uint32_t stream_id, uint8_t* frame, uint32_t size, uint32_t timest
 
 int main(int argc, char* argv[]) {
     int fps = 2;
-    int buffsize = 333;
+    bool save_index = false;
     const char* filename = "stream_test.txt";
     int clock = 90000;
     bool threads = true;
-    const char* usage = "Usage: test_file_source [-F fps] [-f filename] [-c clock] [-b buffsize] [-T]";
+    const char* usage = "Usage: test_file_source [-F fps] [-f filename] [-c clock] [-i] [-T]";
     int c;
-    while ( (c = getopt(argc, argv, "F:f:b:c:Th")) != -1)
+    while ( (c = getopt(argc, argv, "F:f:ic:Th")) != -1)
         switch (c) {
             case 'F': fps      = strtol(optarg, 0, 0); break;
-            case 'b': buffsize = strtol(optarg, 0, 0); break;
+            case 'i': save_index = true;               break;
             case 'c': clock    = strtol(optarg, 0, 0); break;
             case 'f': filename = optarg;               break;
             case 'T': threads  = false;                break;
             case 'h':
             default:  printf("%s\n", usage); exit(1);
         }
-    RTSP::FileSource* file_source = RTSP::FileSource::create(filename, 0, fps, clock, buffsize);
+    RTSP::FileSource* file_source = RTSP::FileSource::create(filename, 0, fps, clock, save_index);
     if (!threads)
         file_source->start_thread(); // this won't return
     file_source->play();
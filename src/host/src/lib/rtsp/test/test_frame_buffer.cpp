@@ -0,0 +1,59 @@
+#include <cassert>
+#include <cstring>
+#include <sbl/sbl_logger.h>
+#include "frame_buffer.h"
+
+using namespace RTSP;
+
+int main(int argc, char* argv[]) {
+    // 5 classes of 64K each: 16 x 4K, 4 x 16K, 1 x 64K, 1 x 256K, 1 x 1M
+    FramePool pool(5 * 64 * 1024);
+
+    // copy keeps data
+    uint8_t frame[3000];
+    for (unsigned n = 0; n < sizeof frame; n++)
+        frame[n] = n;
+    FrameRef ref = pool.copy(frame, sizeof frame);
+    assert(ref.is_valid() && ref->is_pooled());
+    assert(ref.size() == sizeof frame);
+    assert(memcmp(ref.data(), frame, sizeof frame) == 0);
+    assert(pool.in_use() == 1);
+
+    // copies share the buffer, it goes back to the pool with the last reference
+    {
+        FrameRef copy1 = ref;
+        FrameRef copy2;
+        copy2 = copy1;
+        assert(copy2.data() == ref.data());
+        ref.reset();
+        assert(pool.in_use() == 1);
+        assert(copy1.data()[100] == 100);
+    }
+    assert(pool.in_use() == 0);
+
+    // released slot is reused
+    uint8_t* data = pool.alloc(1000).data();
+    assert(pool.alloc(1000).data() == data);
+
+    // exhausted class spills into the larger one, then to heap
+    FrameRef big1 = pool.alloc(200 * 1024);
+    FrameRef big2 = pool.alloc(200 * 1024);
+    assert(big1->is_pooled() && big1->capacity() >= 200 * 1024);
+    assert(big2->is_pooled() && big2->capacity() >= 1000 * 1024);
+    FrameRef big3 = pool.alloc(200 * 1024);
+    assert(!big3->is_pooled() && pool.heap_allocs() == 1);
+    assert(pool.in_use() == 2);
+    big3.reset();
+
+    // frame larger than any slot
+    FrameRef huge = pool.alloc(2 * 1024 * 1024);
+    assert(!huge->is_pooled() && pool.heap_allocs() == 2);
+    huge->set_size(2 * 1024 * 1024);
+    huge.reset();
+
+    big1.reset();
+    big2.reset();
+    assert(pool.in_use() == 0);
+    SBL_INFO("Done!");
+    return 0;
+}
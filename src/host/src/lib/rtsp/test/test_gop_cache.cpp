@@ -0,0 +1,54 @@
+#include <cassert>
+#include <cstring>
+#include <sbl/sbl_logger.h>
+#include "gop_cache.h"
+
+using namespace RTSP;
+
+int main(int argc, char* argv[]) {
+    FramePool pool(5 * 64 * 1024);
+    GopCache cache(&pool, 10000);
+    uint8_t frame[4000];
+    memset(frame, 0x55, sizeof frame);
+
+    // nothing is cached before the first key frame
+    cache.add(frame, 100, 0, false, FrameRef());
+    assert(!cache.is_usable() && cache.count() == 0);
+
+    // key frame starts the GOP, frames not from the pool are copied
+    cache.add(frame, 100, 3000, true, FrameRef());
+    cache.add(frame, 1000, 6000, false, FrameRef());
+    assert(cache.is_usable() && cache.count() == 2);
+    assert(cache.entry(0).data != frame && cache.entry(0).timestamp == 3000);
+    assert(cache.entry(1).size == 1000 && memcmp(cache.entry(1).data, frame, 1000) == 0);
+    assert(pool.in_use() == 2);
+
+    // frames from the pool are shared, data may point past the start code
+    FrameRef ref = pool.copy(frame, 2000);
+    cache.add(ref.data() + 4, 1996, 9000, false, ref);
+    assert(cache.entry(2).data == ref.data() + 4 && cache.entry(2).frame.get() == ref.get());
+    assert(pool.in_use() == 3);
+
+    // next key frame drops the old GOP
+    unsigned int gop = cache.gop();
+    cache.add(frame, 100, 12000, true, FrameRef());
+    assert(cache.count() == 1 && cache.gop() != gop);
+    ref.reset();
+    assert(pool.in_use() == 1);
+
+    // GOP over the limit empties the cache until the next key frame
+    for (int n = 0; n < 3; n++)
+        cache.add(frame, 4000, 15000, false, FrameRef());
+    assert(!cache.is_usable() && pool.in_use() == 0);
+    cache.add(frame, 100, 18000, false, FrameRef());
+    assert(!cache.is_usable());
+    cache.add(frame, 100, 21000, true, FrameRef());
+    assert(cache.is_usable() && cache.count() == 1);
+
+    // disabled cache keeps nothing
+    cache.set_max_bytes(0);
+    cache.add(frame, 100, 24000, true, FrameRef());
+    assert(!cache.is_usable());
+    SBL_INFO("Done!");
+    return 0;
+}
@@ -0,0 +1,176 @@
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <sbl/sbl_logger.h>
+#include "hls_packager.h"
+
+using namespace RTSP;
+
+static const uint8_t SPS[] = { 0x67, 0x42, 0x00, 0x1f, 0xe9, 0x01, 0x40, 0x7b, 0x20 };
+static const uint8_t PPS[] = { 0x68, 0xce, 0x38, 0x80 };
+static const int FRAME_SIZE = 1000;
+static const uint32_t TICKS = 3000;         // 30 fps at 90 kHz
+
+// GOP of SPS, PPS, IDR and P frames, one second long
+void add_gop(HlsPackager& packager, uint32_t& timestamp, const uint8_t* sps = SPS, int sps_size = sizeof SPS) {
+    std::vector<uint8_t> frame(FRAME_SIZE, 0xaa);
+    packager.add(sps, sps_size, timestamp);
+    packager.add(PPS, sizeof PPS, timestamp);
+    for (int n = 0; n < 30; n++) {
+        frame[0] = n ? 0x41 : 0x65;
+        packager.add(&frame[0], FRAME_SIZE, timestamp);
+        timestamp += TICKS;
+    }
+}
+
+uint32_t get32(const uint8_t* data) {
+    return data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+}
+
+// offset of the first box of the type among the boxes in [begin, end), end if there is none
+size_t find_box(const std::vector<uint8_t>& data, const char* type, size_t begin, size_t end) {
+    while (begin + 8 <= end) {
+        uint32_t size = get32(&data[begin]);
+        assert(size >= 8 && begin + size <= end);
+        if (!memcmp(&data[begin + 4], type, 4))
+            return begin;
+        begin += size;
+    }
+    return end;
+}
+
+// box at the path, like "moof/traf/trun", boxes are checked to nest properly on the way
+size_t find_path(const std::vector<uint8_t>& data, const char* path, size_t begin = 0) {
+    size_t end = data.size();
+    for (;;) {
+        size_t box = find_box(data, path, begin, end);
+        assert(box != end);
+        if (!path[4])
+            return box;
+        end   = box + get32(&data[box]);
+        begin = box + 8;
+        path += 5;
+    }
+}
+
+bool contains(const std::string& text, const std::string& what) {
+    return text.find(what) != std::string::npos;
+}
+
+int main(int argc, char* argv[]) {
+    HlsPackager::SpsInfo info;
+    assert(HlsPackager::parse_sps(SPS, sizeof SPS, info));
+    assert(info.profile == 66 && info.width == 640 && info.height == 480);
+    // high profile 1080p, with scaling lists skipped, cropping and an emulation prevention byte
+    static const uint8_t HIGH_SPS[] = { 0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40, 0x78, 0x02, 0x27, 0xe5, 0xc0, 0x44, 0x00, 0x00, 0x03,
+                                        0x00, 0x04, 0x00, 0x00, 0x03, 0x00, 0xf0, 0x3c, 0x60, 0xc6, 0x58 };
+    assert(HlsPackager::parse_sps(HIGH_SPS, sizeof HIGH_SPS, info));
+    assert(info.profile == 100 && info.chroma_format == 1 && info.width == 1920 && info.height == 1080);
+    assert(!HlsPackager::parse_sps(PPS, sizeof PPS, info) && !HlsPackager::parse_sps(SPS, 5, info));
+
+    std::string playlist;
+    std::vector<uint8_t> file;
+
+    // segments are cut at key frames, the ring keeps the last ones
+    {
+        HlsPackager::Options options;
+        options.segment_time = 1;
+        options.segments     = 3;
+        HlsPackager packager(options);
+        uint32_t timestamp = 0xffff0000;    // wraps around
+        assert(!packager.playlist(playlist, "p/"));
+        std::vector<uint8_t> frame(FRAME_SIZE, 0xaa);
+        frame[0] = 0x41;
+        packager.add(&frame[0], FRAME_SIZE, timestamp - TICKS);   // waits for the first key frame
+        for (int n = 0; n < 5; n++)
+            add_gop(packager, timestamp);
+        assert(packager.playlist(playlist, "p/"));
+        assert(playlist.find("#EXTM3U\n") == 0);
+        assert(contains(playlist, "#EXT-X-TARGETDURATION:1\n#EXT-X-MEDIA-SEQUENCE:1\n#EXT-X-MAP:URI=\"p/init1.mp4\"\n"));
+        assert(contains(playlist, "#EXTINF:1.000,\np/seg1.m4s\n#EXTINF:1.000,\np/seg2.m4s\n#EXTINF:1.000,\np/seg3.m4s\n"));
+        assert(!contains(playlist, "seg4") && !contains(playlist, "PART"));
+
+        assert(packager.file("seg0.m4s", file) == 0 && packager.file("seg4.m4s", file) == 0);
+        assert(packager.file("seg1.m4sx", file) == 0 && packager.file("seg1.0.m4s", file) > 0);
+        assert(packager.file("init2.mp4", file) == 0);
+        // init segment has the track and parameter sets
+        assert(packager.file("init1.mp4", file) > 0);
+        assert(find_path(file, "ftyp") == 0);
+        size_t tkhd = find_path(file, "moov/trak/tkhd");
+        assert(get32(&file[tkhd + 84]) == 640u << 16 && get32(&file[tkhd + 88]) == 480u << 16);
+        size_t mdhd = find_path(file, "moov/trak/mdia/mdhd");
+        assert(get32(&file[mdhd + 20]) == 90000);
+        size_t avcc = find_path(file, "moov/trak/mdia/minf/stbl/stsd") + 16 + 86;
+        assert(!memcmp(&file[avcc + 4], "avcC", 4) && file[avcc + 13] == 0xe1);
+        assert(!memcmp(&file[avcc + 16], SPS, sizeof SPS));
+        find_path(file, "moov/mvex/trex");
+
+        // a segment is one fragment: samples with durations, sizes and the key frame flagged
+        assert(packager.file("seg2.m4s", file) > 0);
+        size_t tfdt = find_path(file, "moof/traf/tfdt");
+        assert(file[tfdt + 8] == 1 && get32(&file[tfdt + 16]) == 2 * 30 * TICKS);
+        size_t trun = find_path(file, "moof/traf/trun");
+        assert(get32(&file[trun + 12]) == 30);
+        size_t mdat = find_path(file, "mdat");
+        assert(get32(&file[trun + 16]) == mdat + 8);
+        assert(get32(&file[trun + 20]) == TICKS && get32(&file[trun + 24]) == FRAME_SIZE + 4 && get32(&file[trun + 28]) == 0x02000000);
+        assert(get32(&file[trun + 40]) == 0x01010000);
+        assert(get32(&file[mdat]) == 8 + 30 * (FRAME_SIZE + 4) && mdat + get32(&file[mdat]) == file.size());
+        assert(get32(&file[mdat + 8]) == FRAME_SIZE && file[mdat + 12] == 0x65);
+
+        // new parameter sets start the playlist over
+        add_gop(packager, timestamp, HIGH_SPS, sizeof HIGH_SPS);
+        add_gop(packager, timestamp, HIGH_SPS, sizeof HIGH_SPS);
+        assert(packager.playlist(playlist, "p/"));
+        assert(contains(playlist, "#EXT-X-MEDIA-SEQUENCE:5\n#EXT-X-DISCONTINUITY-SEQUENCE:1\n#EXT-X-MAP:URI=\"p/init2.mp4\"\n"));
+        assert(contains(playlist, "p/seg5.m4s\n") && !contains(playlist, "seg4"));
+        assert(packager.file("init1.mp4", file) == 0 && packager.file("seg4.m4s", file) == 0);
+        assert(packager.file("init2.mp4", file) > 0);
+
+        std::ostringstream stats;
+        packager.print_stats(stats, "0");
+        assert(stats.str().find("hls stream=0 sequence=6 segments=1 ") == 0);
+        assert(contains(stats.str(), " skipped=1 resets=1 "));
+    }
+
+    // partial segments are listed for the last segments and the one being built
+    {
+        HlsPackager::Options options;
+        options.segment_time   = 1;
+        options.segments       = 6;
+        options.part_time      = 500;
+        options.first_sequence = 100;
+        HlsPackager packager(options);
+        uint32_t timestamp = 0;
+        add_gop(packager, timestamp);
+        // first part is listed before the first segment is complete
+        assert(packager.playlist(playlist, ""));
+        assert(contains(playlist, "#EXT-X-PART-INF:PART-TARGET=0.500\n#EXT-X-SERVER-CONTROL:PART-HOLD-BACK=1.500\n"));
+        assert(contains(playlist, "#EXT-X-PART:DURATION=0.500,URI=\"seg100.0.m4s\",INDEPENDENT=YES\n"));
+        assert(!contains(playlist, "seg100.1") && !contains(playlist, "EXTINF"));
+        for (int n = 0; n < 5; n++)
+            add_gop(packager, timestamp);
+        assert(packager.playlist(playlist, ""));
+        assert(contains(playlist, "#EXT-X-MEDIA-SEQUENCE:100\n"));
+        assert(contains(playlist, "#EXT-X-PART:DURATION=0.500,URI=\"seg104.1.m4s\"\n#EXTINF:1.000,\nseg104.m4s\n"));
+        assert(contains(playlist, "seg102.0.m4s") && !contains(playlist, "seg101.0.m4s") && contains(playlist, "seg101.m4s"));
+        assert(contains(playlist, "seg105.0.m4s") && !contains(playlist, "seg105.m4s"));
+        // parts together are the segment
+        std::vector<uint8_t> parts;
+        for (int n = 0; n < 2; n++) {
+            std::ostringstream name;
+            name << "seg103." << n << ".m4s";
+            assert(packager.file(name.str().c_str(), file) > 0);
+            parts.insert(parts.end(), file.begin(), file.end());
+        }
+        assert(packager.file("seg103.2.m4s", file) == 0);
+        assert(packager.file("seg103.m4s", file) > 0 && file == parts);
+        size_t trun = find_path(parts, "moof/traf/trun");
+        assert(get32(&parts[trun + 12]) == 15);
+        size_t tfdt = find_path(parts, "moof/traf/tfdt", find_path(parts, "mdat"));
+        assert(get32(&parts[tfdt + 16]) == 3 * 30 * TICKS + 15 * TICKS);
+    }
+    return 0;
+}
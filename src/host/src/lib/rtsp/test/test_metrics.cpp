@@ -0,0 +1,176 @@
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sbl/sbl_logger.h>
+#include <sbl/sbl_socket.h>
+#include "rtsp.h"
+#include "rtp_streamer.h"
+#include "live_source.h"
+#include "rtsp_parser.h"
+#include "buffer_writer.h"
+#include "metrics.h"
+
+using namespace RTSP;
+
+const int server_port   = 18592;
+const int loopback_port = 61238;
+
+class App : public Application {
+public:
+    int get_stream_id(unsigned int channel_num, unsigned int stream_num) { return -1; }
+    int get_stream_id(const char* stream_name) { return -1; }
+    void play(int stream_id) {}
+    void teardown(int stream_id) {}
+    int describe(int stream_id, StreamDesc& stream_desc) {
+        stream_desc.encoder_type = H264;
+        stream_desc.bitrate      = 4000;
+        return 0;
+    }
+    int pe_id() const { return 0; }
+} app;
+
+namespace RTSP {
+Application* application() { return &app; }
+}
+
+// value of key in the line of metrics output that starts with prefix
+long long value(const std::string& text, const char* prefix, const char* key) {
+    size_t line = text.find(prefix);
+    assert(line != std::string::npos);
+    std::string pair = std::string(" ") + key + "=";
+    size_t at = text.find(pair, line);
+    assert(at != std::string::npos && at < text.find('\n', line));
+    return atoll(text.c_str() + at + pair.size());
+}
+
+void test_histogram() {
+    Histogram histogram;
+    assert(histogram.percentile(50) == 0);
+    // 90 values in the first bucket, 9 in the fourth, one past the last bound
+    for (int n = 0; n < 90; n++)
+        histogram.add(10);
+    for (int n = 0; n < 9; n++)
+        histogram.add(500);
+    histogram.add(100000000);
+    assert(histogram.count() == 100);
+    assert(histogram.count(0) == 90 && histogram.count(3) == 9 && histogram.count(Histogram::BUCKETS - 1) == 1);
+    assert(histogram.percentile(50) == 64);
+    assert(histogram.percentile(90) == 64);
+    assert(histogram.percentile(99) == 512);
+    assert(histogram.percentile(100) == Histogram::bound(Histogram::BUCKETS - 1));
+    assert(histogram.sum() == 90 * 10 + 9 * 500 + 100000000);
+}
+
+void test_parser_body() {
+    char message[] = "GET_PARAMETER rtsp://127.0.0.1/0 RTSP/1.0\r\nCSeq: 5\r\ncontent-length: 7\r\n\r\nstats\r\n";
+    int size        = strlen(message);
+    int header_size = strstr(message, "\r\n\r\n") + 4 - message;
+    assert(Parser::content_length(message, header_size) == 7);
+    assert(Parser::content_length(message, 44) == 0);
+    Parser parser;
+    assert(parser.parse(message, size, size - header_size) == GET_PARAMETER);
+    assert(parser.data.cseq == 5 && !strcmp(parser.data.stream_name, "0"));
+    assert(parser.data.body == message + header_size && parser.data.body_size == 7);
+}
+
+// Frames to a UDP client are counted on the stream and the client, and the client goes with its counters
+void test_streamer() {
+    Streamer   streamer(1456, 0x1234, 0);
+    LiveSource source(0, &streamer);
+    source.get_stream_desc();
+    SBL::Socket rx(SBL::Socket::UDP);
+    rx.bind(loopback_port);
+    SBL::Socket tx(SBL::Socket::UDP);
+    tx.connect("127.0.0.1", loopback_port);
+    Client* client = streamer.add_client(tx, tx);
+    client->play();
+
+    const uint8_t sps[] = { 0x67, 0x42, 0x00, 0x1f, 0xe9 };
+    std::vector<uint8_t> frame(4000, 0x55);
+    frame[0] = 0x41;
+    streamer.send_frame(sps, sizeof sps, 0);
+    for (int n = 1; n <= 3; n++)
+        streamer.send_frame(&frame[0], frame.size(), n * 3000);
+    uint8_t packet[1500];
+    int received = 0;
+    while (::recv(rx.id(), packet, sizeof packet, MSG_DONTWAIT) > 0)
+        received++;
+
+    std::ostringstream text;
+    assert(Metrics::registry().print(text, "0"));
+    assert(!Metrics::registry().print(text, "no such stream"));
+    const std::string& stats = text.str();
+    assert(value(stats, "metrics stream=0", "sessions") == 1);
+    assert(value(stats, "metrics stream=0", "frames_in") == 4);
+    assert(value(stats, "metrics stream=0", "frames_out") == 4);
+    assert(value(stats, "metrics stream=0", "packets") == received);
+    assert(value(stats, "metrics client=-1", "packets") == received);
+    assert(value(stats, "metrics client=-1", "frames") == 4);
+    assert(value(stats, "metrics client=-1", "syscalls") >= 4);
+    assert(value(stats, "metrics client=-1", "dropped_frames") == 0);
+    assert(streamer.metrics()->send_latency.count() == 4);
+    SBL_INFO("%s", stats.c_str());
+
+    // receiver reports show on the client, the worst jitter on the stream
+    client->metrics()->rtcp_report(64, 12, 900);
+    char buffer[1024];
+    BufferWriter writer(buffer, sizeof buffer);
+    assert(Metrics::registry().print(writer, "0", -1) && writer.ok());
+    assert(value(writer.data(), "metrics client=-1", "rtcp_loss_pct") == 25);
+    assert(value(writer.data(), "metrics client=-1", "rtcp_lost") == 12);
+    assert(value(writer.data(), "metrics stream=0", "rtcp_jitter_ms") == 10);
+
+    streamer.delete_client(client);
+    text.str("");
+    Metrics::registry().print(text, "0");
+    assert(value(text.str(), "metrics stream=0", "sessions") == 0);
+    assert(text.str().find("metrics client=") == std::string::npos);
+}
+
+// GET_PARAMETER with "stats" in the body, the header and the body coming separately
+void test_get_parameter() {
+    Streamer   streamer;
+    LiveSource source(1, &streamer, "metrics");
+    SBL::Socket socket(SBL::Socket::TCP);
+    socket.connect("127.0.0.1", server_port);
+    const char* header = "GET_PARAMETER rtsp://127.0.0.1/metrics RTSP/1.0\r\nCSeq: 2\r\nContent-Length: 7\r\n\r\n";
+    socket.send(header, strlen(header));
+    usleep(50000);
+    socket.send("stats\r\n", 7);
+    char reply[1024] = "";
+    int size = 0;
+    while (!strstr(reply, "metrics stream=metrics") || reply[size - 1] != '\n') {
+        int received = socket.recv(reply + size, sizeof reply - size - 1);
+        assert(received > 0);
+        size += received;
+        reply[size] = '\0';
+    }
+    assert(!strncmp(reply, "RTSP/1.0 200", 12));
+    assert(strstr(reply, "Content-Type: text/parameters\r\n"));
+    const char* body = strstr(reply, "\r\n\r\n") + 4;
+    assert(atoi(strstr(reply, "Content-Length: ") + 16) == int(strlen(body)));
+
+    // keep-alive has no body in its reply
+    const char* keep_alive = "GET_PARAMETER rtsp://127.0.0.1/metrics RTSP/1.0\r\nCSeq: 3\r\n\r\n";
+    socket.send(keep_alive, strlen(keep_alive));
+    size = socket.recv(reply, sizeof reply - 1);
+    assert(size > 0);
+    reply[size] = '\0';
+    assert(strstr(reply, "CSeq: 3\r\n") && !strstr(reply, "Content-Length"));
+    socket.close();
+}
+
+int main(int argc, char* argv[]) {
+    test_histogram();
+    test_parser_body();
+    Server::create(server_port);
+    test_streamer();
+    test_get_parameter();
+    printf("test_metrics passed\n");
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <sbl/sbl_logger.h>
+#include "nal_scanner.h"
+
+using namespace RTSP;
+
+// byte by byte reference, returns where the first start code is
+size_t reference(const uint8_t* data, size_t size, std::vector<NalUnit>& units) {
+    std::vector<size_t> codes;
+    for (size_t n = 0; n + 3 <= size; n++)
+        if (data[n] == 0 && data[n + 1] == 0 && data[n + 2] == 1)
+            codes.push_back(n);
+    codes.push_back(size);
+    for (unsigned int n = 0; n + 1 < codes.size(); n++) {
+        size_t nal  = codes[n] + 3;
+        size_t stop = codes[n + 1];
+        while (stop > nal && data[stop - 1] == 0)
+            stop--;
+        if (stop > nal) {
+            NalUnit unit = { nal, uint32_t(stop - nal), data[nal] };
+            units.push_back(unit);
+        }
+    }
+    return codes[0];
+}
+
+bool same(const std::vector<NalUnit>& a, const std::vector<NalUnit>& b) {
+    if (a.size() != b.size())
+        return false;
+    for (unsigned int n = 0; n < a.size(); n++)
+        if (a[n].offset != b[n].offset || a[n].size != b[n].size || a[n].header != b[n].header)
+            return false;
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    SBL_INFO("NAL scanner uses %s", NalScanner::implementation());
+    // 3 and 4 byte start codes, trailing zeros, empty NAL unit, junk before the first start code
+    const uint8_t stream[] = { 0x12, 0x00, 0x00, 0x00, 0x01, 0x67, 0x42, 0x00, 0x00, 0x00, 0x01, 0x68, 0xce,
+                               0x00, 0x00, 0x01, 0x00, 0x00, 0x01, 0x65, 0x88, 0x00, 0x00, 0x03, 0x01, 0x00 };
+    std::vector<NalUnit> units;
+    NalScanner::scan(stream, sizeof stream, units);
+    assert(units.size() == 3);
+    assert(units[0].offset == 5  && units[0].size == 2 && units[0].type() == 7);
+    assert(units[1].offset == 11 && units[1].size == 2 && units[1].type() == 8);
+    assert(units[2].offset == 19 && units[2].size == 6 && units[2].type() == 5);
+
+    // no start code at all, or a start code and nothing after it
+    units.clear();
+    NalScanner::scan(stream + 5, 6, units);
+    assert(units.empty());
+    NalScanner::scan(stream + 1, 4, units);
+    assert(units.empty());
+
+    assert(NalScanner::start_code_size(stream + 1, 4) == 4);
+    assert(NalScanner::start_code_size(stream + 2, 3) == 3);
+    assert(NalScanner::start_code_size(stream + 2, 2) == 0);
+    assert(NalScanner::start_code_size(stream, 5) == 0);
+
+    // start codes at every position relative to the vector blocks, in random data with many zeros
+    srand(1);
+    std::vector<uint8_t> data(1000);
+    for (int round = 0; round < 2000; round++) {
+        for (unsigned int n = 0; n < data.size(); n++)
+            data[n] = rand() % 4 ? rand() % 4 : 0xaa;
+        size_t size = 1 + rand() % data.size();
+        std::vector<NalUnit> expected, found;
+        size_t first = reference(&data[0], size, expected);
+        NalScanner::scan(&data[0], size, found);
+        assert(same(expected, found));
+        assert(NalScanner::find_start_code(&data[0], &data[0] + size) == &data[0] + first);
+    }
+    SBL_INFO("Done!");
+    return 0;
+}
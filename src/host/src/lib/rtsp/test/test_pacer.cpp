@@ -0,0 +1,39 @@
+#include <cassert>
+#include <sbl/sbl_logger.h>
+#include "pacer.h"
+
+using namespace RTSP;
+
+const uint64_t MS = 1000 * 1000;
+
+int main(int argc, char* argv[]) {
+    Pacer pacer;
+    assert(!pacer.is_enabled() && pacer.schedule(1000) == 0);
+
+    // fixed gap, 10 packets take at least 9 gaps
+    pacer.set(1 * MS, 0, 0);
+    uint64_t start = Pacer::now();
+    for (int n = 0; n < 10; n++)
+        pacer.wait(1000);
+    uint64_t elapsed = Pacer::now() - start;
+    assert(elapsed >= 9 * MS && elapsed < 100 * MS);
+
+    // rate with burst: 1 MB/s, 10K go out at once, the rest is 1 ms per 1000 bytes
+    Pacer rate;
+    rate.set(0, 1000 * 1000, 10 * 1000);
+    start = Pacer::now();
+    for (int n = 0; n < 10; n++)
+        assert(rate.schedule(1000) == 0);
+    uint64_t due = rate.schedule(1000);
+    assert(due >= start + 1 * MS - MS / 10 && due <= start + 2 * MS);
+    due = rate.schedule(1000);
+    assert(due >= start + 2 * MS - MS / 10 && due <= start + 3 * MS);
+
+    // idle time is not saved up beyond the burst
+    Pacer::sleep_until(Pacer::now() + 30 * MS);
+    for (int n = 0; n < 10; n++)
+        assert(rate.schedule(1000) == 0);
+    assert(rate.schedule(1000) != 0);
+    SBL_INFO("Done!");
+    return 0;
+}
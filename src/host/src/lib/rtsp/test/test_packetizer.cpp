@@ -0,0 +1,147 @@
+#include <cassert>
+#include <cstring>
+#include <vector>
+#include <sbl/sbl_logger.h>
+#include "packetizer.h"
+
+using namespace RTSP;
+
+const int PACKET_SIZE = 1000;
+const int PT          = 96;
+
+uint16_t seq_number(const Packet& packet) {
+    return packet.header[Packet::PREFIX + 2] << 8 | packet.header[Packet::PREFIX + 3];
+}
+
+bool marker(const Packet& packet) {
+    return packet.header[Packet::PREFIX + 1] & 0x80;
+}
+
+// Reassemble FU-A fragments and compare with the original NAL unit
+void check_fu_a(const Packets& packets, const uint8_t* nal, int size) {
+    std::vector<uint8_t> nal_unit;
+    for (unsigned int n = 0; n < packets.size(); n++) {
+        const Packet& packet = packets[n];
+        const uint8_t* fu = packet.header + Packet::PREFIX + Packet::RTP_HEADER;
+        assert(packet.header_size == Packet::RTP_HEADER + 2);
+        assert((fu[0] & 0x1F) == 28);
+        assert(bool(fu[1] & 0x80) == (n == 0));                    // Start
+        assert(bool(fu[1] & 0x40) == (n == packets.size() - 1));   // End
+        assert(packet.last == (n == packets.size() - 1));
+        assert(packet.payload_size <= PACKET_SIZE);
+        int size = packet.size();
+        assert(packet.header[0] == '$' && packet.header[2] == (size >> 8 & 0xFF) && packet.header[3] == (size & 0xFF));
+        if (n == 0)
+            nal_unit.push_back((fu[0] & 0xE0) | (fu[1] & 0x1F));
+        nal_unit.insert(nal_unit.end(), packet.payload, packet.payload + packet.payload_size);
+    }
+    assert(int(nal_unit.size()) == size && memcmp(&nal_unit[0], nal, size) == 0);
+}
+
+int main(int argc, char* argv[]) {
+    Packetizer packetizer(PACKET_SIZE, 0x12345678);
+    static uint8_t frame[20000];
+    for (unsigned int n = 0; n < sizeof frame; n++)
+        frame[n] = n * 7;
+
+    // SPS fits in one packet, no marker, payload points into the frame
+    frame[0] = 0x67;
+    packetizer.begin(PT, 9000, 100);
+    packetizer.h264(frame, 20);
+    const Packets& packets = packetizer.packets();
+    assert(packets.size() == 1 && packets[0].payload == frame && packets[0].payload_size == 20);
+    assert(!marker(packets[0]) && packets[0].last && seq_number(packets[0]) == 100);
+    assert((packets[0].header[Packet::PREFIX + 1] & 0x7F) == PT);
+
+    // IDR is fragmented, marker on the last fragment only
+    frame[0] = 0x65;
+    packetizer.begin(PT, 9000, 101);
+    packetizer.h264(frame, sizeof frame);
+    check_fu_a(packets, frame, sizeof frame);
+    for (unsigned int n = 0; n < packets.size(); n++) {
+        assert(seq_number(packets[n]) == 101 + n);
+        assert(marker(packets[n]) == (n == packets.size() - 1));
+    }
+
+    // SEI + IDR frame: only the picture ends the access unit, so SEI and AUD don't get the marker
+    static uint8_t aud[] = {0x09, 0xf0}, sei_nal[] = {0x06, 5, 6};
+    packetizer.begin(PT, 12000, 200);
+    packetizer.h264(aud, sizeof aud);
+    assert(packets.size() == 1 && !marker(packets[0]));
+    packetizer.begin(PT, 12000, 201);
+    packetizer.h264(sei_nal, sizeof sei_nal);
+    assert(packets.size() == 1 && !marker(packets[0]));
+    packetizer.begin(PT, 12000, 202);
+    packetizer.h264(frame, sizeof frame);
+    assert(marker(packets.back()));
+
+    // picture in two slices: the first doesn't end it
+    packetizer.begin(PT, 15000, 0);
+    packetizer.h264(frame, 500, false);
+    assert(packets.size() == 1 && !marker(packets[0]));
+    packetizer.begin(PT, 15000, 1);
+    packetizer.h264(frame, 500);
+    assert(packets.size() == 1 && marker(packets[0]));
+
+    // one byte over the packet size: single fragment would have both Start and End bits
+    packetizer.begin(PT, 9000, 0);
+    packetizer.h264(frame, PACKET_SIZE + 1);
+    assert(packets.size() == 2);
+    check_fu_a(packets, frame, PACKET_SIZE + 1);
+
+    // JPEG fragment offsets
+    packetizer.begin(26, 9000, 0);
+    packetizer.mjpeg(frame, 2500, 50, 640, 480);
+    assert(packets.size() == 3);
+    for (unsigned int n = 0; n < packets.size(); n++) {
+        const uint8_t* jpeg = packets[n].header + Packet::PREFIX + Packet::RTP_HEADER;
+        assert((jpeg[1] << 16 | jpeg[2] << 8 | jpeg[3]) == int(n * PACKET_SIZE));
+        assert(jpeg[6] == 640 / 8 && jpeg[7] == 480 / 8);
+        assert(packets[n].payload == frame + n * PACKET_SIZE);
+    }
+    assert(packets[2].payload_size == 500 && marker(packets[2]));
+
+    // STAP-A: SPS, PPS and SEI are held, then go out with the small picture that follows
+    Packetizer stap_a(PACKET_SIZE, 0x12345678, true);
+    const Packets& aggregated = stap_a.packets();
+    static uint8_t sps[] = {0x67, 1, 2, 3}, pps[] = {0x68, 4}, sei[] = {0x06, 5, 6}, slice[] = {0x41, 7, 8, 9, 10};
+    stap_a.begin(PT, 3000, 10);
+    stap_a.h264(sps, sizeof sps);
+    stap_a.h264(pps, sizeof pps);
+    stap_a.h264(sei, sizeof sei);
+    assert(aggregated.empty() && stap_a.has_held());
+    stap_a.h264(slice, sizeof slice);
+    assert(aggregated.size() == 1 && !stap_a.has_held() && (stap_a.first_nal() & 0x1F) == 7);
+    const Packet& packet = aggregated[0];
+    assert(packet.header_size == Packet::RTP_HEADER + 1 && marker(packet) && packet.last && seq_number(packet) == 10);
+    assert(packet.header[Packet::PREFIX + Packet::RTP_HEADER] == (0x60 | 24));    // highest NRI
+    static const uint8_t payload[] = {0, 4, 0x67, 1, 2, 3, 0, 2, 0x68, 4, 0, 3, 0x06, 5, 6, 0, 5, 0x41, 7, 8, 9, 10};
+    assert(packet.payload_size == sizeof payload && memcmp(packet.payload, payload, sizeof payload) == 0);
+
+    // large IDR follows held SPS/PPS in its own packets, single held NAL unit is not aggregated
+    frame[0] = 0x65;
+    stap_a.begin(PT, 6000, 11);
+    stap_a.h264(sps, sizeof sps);
+    stap_a.h264(pps, sizeof pps);
+    stap_a.h264(frame, 3000);
+    assert(aggregated.size() == 4 && aggregated[0].payload[0] == 0 && aggregated[0].payload[2] == 0x67);
+    assert(!marker(aggregated[0]) && !aggregated[0].last);
+    check_fu_a(Packets(aggregated.begin() + 1, aggregated.end()), frame, 3000);
+    stap_a.begin(PT, 9000, 16);
+    stap_a.h264(sei, sizeof sei);
+    stap_a.h264(frame, 3000);
+    assert(aggregated[0].header_size == Packet::RTP_HEADER && aggregated[0].payload_size == sizeof sei);
+    assert(memcmp(aggregated[0].payload, sei, sizeof sei) == 0 && !marker(aggregated[0]));
+    assert(marker(aggregated.back()));
+
+    // held NAL units don't wait for an access unit with another timestamp
+    stap_a.begin(PT, 12000, 20);
+    stap_a.h264(sei, sizeof sei);
+    stap_a.begin(PT, 15000, 20);
+    assert(aggregated.size() == 1 && aggregated[0].header[Packet::PREFIX + 7] == (12000 & 0xFF));
+    stap_a.h264(slice, sizeof slice);
+    assert(aggregated.size() == 2 && aggregated[1].payload == slice && aggregated[1].header[Packet::PREFIX + 7] == (15000 & 0xFF));
+    assert(seq_number(aggregated[1]) == 21);
+    SBL_INFO("Done!");
+    return 0;
+}
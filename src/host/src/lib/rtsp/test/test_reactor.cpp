@@ -0,0 +1,266 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sbl/sbl_exception.h>
+#include <sbl/sbl_socket.h>
+#include <sbl/sbl_thread.h>
+#include "rtsp.h"
+
+using namespace RTSP;
+
+// Whatever one connection waits for, the others on the same reactor must still be answered at once
+
+const int server_port = 18593;
+const int MAX_REPLY_MS = 500;
+// opening a fifo blocks until the test opens it for writing, then it fails: it is not a regular file
+static const char* FIFO_NAME  = "test_reactor.fifo";
+static const char* FILE_NAME  = "test_reactor.264";
+
+class App : public Application {
+public:
+    // "late" gets its SPS/PPS only when the test sends them, "mute" never does
+    int get_stream_id(unsigned int channel_num, unsigned int stream_num) { return channel_num == 0 && stream_num < 3 ? stream_num : -1; }
+    int get_stream_id(const char* stream_name) {
+        return !strcmp(stream_name, "live") ? 0 : !strcmp(stream_name, "late") ? 1 : !strcmp(stream_name, "mute") ? 2 : -1;
+    }
+    void play(int stream_id) {}
+    void teardown(int stream_id) {}
+    int describe(int stream_id, StreamDesc& stream_desc) {
+        stream_desc.encoder_type = H264;
+        stream_desc.bitrate      = 100000;
+        return 0;
+    }
+    int pe_id() const { return 0; }
+} app;
+
+namespace RTSP {
+Application* application() { return &app; }
+}
+
+double now_ms() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+// Stream 0 gets an I-frame of 200 KB every 10 ms, much more than a viewer that doesn't read can take
+class Camera : public SBL::Thread {
+public:
+    Camera() : _stopped(false), _idr(200 * 1024, 0xaa) {
+        const uint8_t header[] = { 0, 0, 0, 1, 0x65 };
+        memcpy(&_idr[0], header, sizeof header);
+    }
+    void start_thread() {
+        uint8_t sps[] = { 0, 0, 0, 1, 0x67, 0x42, 0x00, 0x1f, 0xe9, 0x01, 0x40, 0x7b, 0x20 };
+        uint8_t pps[] = { 0, 0, 0, 1, 0x68, 0xce, 0x38, 0x80 };
+        for (uint32_t timestamp = 0; !_stopped; timestamp += 900) {
+            rtsp_send_frame(0, 0, sps, sizeof sps, timestamp, H264);
+            rtsp_send_frame(0, 0, pps, sizeof pps, timestamp, H264);
+            rtsp_send_frame(0, 0, &_idr[0], _idr.size(), timestamp, H264);
+            usleep(10000);
+        }
+    }
+    void stop() {
+        _stopped = true;
+        join_thread();
+    }
+private:
+    volatile bool        _stopped;
+    std::vector<uint8_t> _idr;
+};
+
+// RTSP connection, media interleaved in it is skipped
+class Connection {
+public:
+    Connection(int rcvbuf = 0) : _socket(SBL::Socket::TCP) {
+        if (rcvbuf)
+            assert(::setsockopt(_socket.id(), SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf) == 0);
+        _socket.connect("127.0.0.1", server_port);
+    }
+    ~Connection() { _socket.close(); }
+    void send(const char* method, const char* path, int cseq, const char* headers = "") {
+        char request[512];
+        int size = snprintf(request, sizeof request, "%s rtsp://127.0.0.1/%s RTSP/1.0\r\nCSeq: %d\r\n%s\r\n",
+                            method, path, cseq, headers);
+        _socket.send(request, size);
+    }
+    //! Read until reply with the given CSeq is complete, return its status line and header
+    std::string reply(int cseq) {
+        char tag[32];
+        snprintf(tag, sizeof tag, "CSeq: %d\r\n", cseq);
+        size_t at, end;
+        while ((at = _received.find(tag)) == std::string::npos || (end = _received.find("\r\n\r\n", at)) == std::string::npos) {
+            // what comes before the reply is media, only its tail is kept, in case tag is split between reads
+            if (at == std::string::npos && _received.size() > 1024 * 1024)
+                _received.erase(0, _received.size() - sizeof tag);
+            receive();
+        }
+        at = _received.rfind("RTSP/1.0 ", at);
+        std::string header = _received.substr(at, end + 4 - at);
+        size_t length = header.find("Content-Length: ");
+        size_t size = end + 4 + (length == std::string::npos ? 0 : atoi(header.c_str() + length + 16));
+        while (_received.size() < size)
+            receive();
+        _received.erase(0, size);
+        return header;
+    }
+private:
+    SBL::Socket _socket;
+    std::string _received;
+
+    void receive() {
+        char buffer[64 * 1024];
+        int size = ::recv(_socket.id(), buffer, sizeof buffer, 0);
+        assert(size > 0);
+        _received.append(buffer, size);
+    }
+};
+
+// OPTIONS on a new connection, return ms until its reply
+double options_ms() {
+    Connection connection;
+    double start = now_ms();
+    connection.send("OPTIONS", "live", 1);
+    connection.reply(1);
+    return now_ms() - start;
+}
+
+// Interleaved viewer that stops reading: the reply to its keep-alive waits behind the video
+// for the socket, while other connections are served
+void test_slow_viewer() {
+    Connection slow(4096);
+    slow.send("DESCRIBE", "live", 1, "Accept: application/sdp\r\n");
+    slow.reply(1);
+    slow.send("SETUP", "live/track1", 2, "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n");
+    std::string reply = slow.reply(2);
+    size_t at = reply.find("Session: ");
+    assert(at != std::string::npos);
+    std::string session = reply.substr(at, reply.find_first_of(";\r", at) - at) + "\r\n";
+    slow.send("PLAY", "live", 3, session.c_str());
+    slow.reply(3);
+    usleep(500000);
+    slow.send("GET_PARAMETER", "live", 4, session.c_str());
+    usleep(50000);
+    double ms = options_ms();
+    printf("OPTIONS answered in %.1f ms while a viewer is backed up\n", ms);
+    assert(ms < MAX_REPLY_MS);
+    // reply goes out once the viewer reads again
+    slow.reply(4);
+}
+
+// DESCRIBE waits for SPS/PPS of the stream, other connections are served meanwhile
+void test_late_param_set() {
+    Connection viewer;
+    viewer.send("DESCRIBE", "late", 1, "Accept: application/sdp\r\n");
+    usleep(50000);
+    double ms = options_ms();
+    printf("OPTIONS answered in %.1f ms while DESCRIBE waits for SPS/PPS\n", ms);
+    assert(ms < MAX_REPLY_MS);
+    uint8_t sps[] = { 0, 0, 0, 1, 0x67, 0x42, 0x00, 0x1f, 0xe9, 0x01, 0x40, 0x7b, 0x20 };
+    uint8_t pps[] = { 0, 0, 0, 1, 0x68, 0xce, 0x38, 0x80 };
+    double start = now_ms();
+    rtsp_send_frame(0, 1, sps, sizeof sps, 0, H264);
+    rtsp_send_frame(0, 1, pps, sizeof pps, 0, H264);
+    std::string reply = viewer.reply(1);
+    printf("DESCRIBE answered %.1f ms after SPS/PPS came\n", now_ms() - start);
+    assert(reply.find("RTSP/1.0 200") == 0);
+    assert(now_ms() - start < MAX_REPLY_MS);
+}
+
+// Without SPS/PPS, DESCRIBE fails after a while, other connections are served meanwhile
+void test_missing_param_set() {
+    Connection viewer;
+    double start = now_ms();
+    viewer.send("DESCRIBE", "mute", 1, "Accept: application/sdp\r\n");
+    usleep(50000);
+    assert(options_ms() < MAX_REPLY_MS);
+    std::string reply = viewer.reply(1);
+    double ms = now_ms() - start;
+    printf("DESCRIBE without SPS/PPS failed after %.1f ms\n", ms);
+    assert(reply.find("RTSP/1.0 200") != 0);
+    assert(ms > 1000 && ms < 5000);
+    // connection is still good
+    viewer.send("OPTIONS", "mute", 2);
+    assert(viewer.reply(2).find("RTSP/1.0 200") == 0);
+}
+
+// Let the file opener's open() of the fifo return
+void release_fifo() {
+    int fd = ::open(FIFO_NAME, O_WRONLY);
+    assert(fd >= 0);
+    ::close(fd);
+}
+
+// DESCRIBE waits while its file is opened, other connections are served meanwhile
+void test_slow_file() {
+    unlink(FIFO_NAME);
+    assert(mkfifo(FIFO_NAME, 0600) == 0);
+    const uint8_t gop[] = { 0, 0, 0, 1, 0x67, 0x42, 0x00, 0x1f, 0xe9, 0x01, 0x40, 0x7b, 0x20,
+                            0, 0, 0, 1, 0x68, 0xce, 0x38, 0x80,
+                            0, 0, 0, 1, 0x65, 0x88, 0x84, 0x00, 0x01, 0x02 };
+    FILE* file = fopen(FILE_NAME, "wb");
+    assert(file && fwrite(gop, 1, sizeof gop, file) == sizeof gop);
+    fclose(file);
+
+    Connection viewer;
+    viewer.send("DESCRIBE", FIFO_NAME, 1, "Accept: application/sdp\r\n");
+    usleep(50000);
+    double ms = options_ms();
+    printf("OPTIONS answered in %.1f ms while DESCRIBE waits for its file\n", ms);
+    assert(ms < MAX_REPLY_MS);
+    release_fifo();
+    assert(viewer.reply(1).find("RTSP/1.0 200") != 0);
+    viewer.send("DESCRIBE", FILE_NAME, 2, "Accept: application/sdp\r\n");
+    assert(viewer.reply(2).find("RTSP/1.0 200") == 0);
+
+    // connection closed while its file is being opened, the source is closed once it is open
+    Connection* gone = new Connection;
+    gone->send("DESCRIBE", FIFO_NAME, 1, "Accept: application/sdp\r\n");
+    usleep(50000);
+    delete gone;
+    usleep(50000);
+    release_fifo();
+    Connection next;
+    next.send("DESCRIBE", FILE_NAME, 1, "Accept: application/sdp\r\n");
+    assert(next.reply(1).find("RTSP/1.0 200") == 0);
+    unlink(FIFO_NAME);
+    unlink(FILE_NAME);
+}
+
+// Send queue has to hold the rest of a packet that went out in part, server doesn't start with less
+void test_small_queue() {
+    Server::Options options;
+    options.send_queue_size = options.packet_size;
+    bool rejected = false;
+    try {
+        Server::create(server_port, options);
+    } catch (SBL::Exception& ex) {
+        rejected = true;
+    }
+    assert(rejected);
+}
+
+int main(int argc, char* argv[]) {
+    test_small_queue();
+    Server::Options options;
+    options.reactors = 1;
+    Server::create(server_port, options);
+    Camera camera;
+    camera.create_thread();
+    usleep(100000);
+    test_slow_viewer();
+    test_late_param_set();
+    test_missing_param_set();
+    test_slow_file();
+    camera.stop();
+    printf("test_reactor passed\n");
+    return 0;
+}
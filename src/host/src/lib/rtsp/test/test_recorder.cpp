@@ -0,0 +1,143 @@
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include <fstream>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sbl/sbl_logger.h>
+#include "recorder.h"
+#include "file_index.h"
+
+using namespace RTSP;
+
+static const char* DIR_NAME = "test_recorder.d";
+
+// segments (or other files with the suffix) in the directory, sorted
+std::vector<std::string> list(const char* suffix) {
+    std::vector<std::string> names;
+    DIR* dir = opendir(DIR_NAME);
+    assert(dir);
+    while (struct dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.size() > strlen(suffix) && name.compare(name.size() - strlen(suffix), strlen(suffix), suffix) == 0)
+            names.push_back(std::string(DIR_NAME) + "/" + name);
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+void clean() {
+    mkdir(DIR_NAME, 0755);
+    std::vector<std::string> names = list("");
+    for (unsigned int n = 0; n < names.size(); n++)
+        unlink(names[n].c_str());
+}
+
+// GOP of SPS, PPS, IDR and 4 P frames, GOP_SIZE bytes with start codes
+static const int P_SIZE = 500, IDR_SIZE = 1000;
+static const int GOP_SIZE = 7 * 4 + 4 + 4 + IDR_SIZE + 4 * P_SIZE;
+
+void record_gop(Recorder& recorder, int track, uint32_t timestamp) {
+    static uint8_t frame[IDR_SIZE];
+    memset(frame, 0xaa, sizeof frame);
+    recorder.record(track, (const uint8_t*) "\x67\x42\x00\x1e", 4, timestamp, FrameRef());
+    recorder.record(track, (const uint8_t*) "\x68\xce\x3c\x80", 4, timestamp, FrameRef());
+    frame[0] = 0x65;
+    recorder.record(track, frame, IDR_SIZE, timestamp, FrameRef());
+    frame[0] = 0x41;
+    for (int n = 1; n <= 4; n++)
+        recorder.record(track, frame, P_SIZE, timestamp + n * 3000, FrameRef());
+}
+
+std::string stats(Recorder& recorder) {
+    std::ostringstream str;
+    recorder.print_stats(str);
+    return str.str();
+}
+
+int main(int argc, char* argv[]) {
+    FramePool pool(1024 * 1024);
+    clean();
+
+    // segments rotate at the first key frame past the size limit, each one has a key frame index
+    Recorder::Options options;
+    options.dir          = DIR_NAME;
+    options.segment_size = GOP_SIZE + 1;
+    {
+        Recorder recorder(options, &pool);
+        int track = recorder.add_track("cam/0");
+        assert(track == 0 && recorder.add_track("1") == 1);
+        // P frame before the first key frame is not recorded
+        recorder.record(track, (const uint8_t*) "\x41\x9a", 2, 0, FrameRef());
+        for (int n = 0; n < 5; n++)
+            record_gop(recorder, track, n * 15000);
+        recorder.flush();
+        assert(stats(recorder).find("recorder stream=cam_0 frames=35 dropped=0") != std::string::npos);
+    }
+    std::vector<std::string> segments = list(".264");
+    assert(segments.size() == 3 && list(".key").size() == 3);
+    assert(segments[0].find(std::string(DIR_NAME) + "/cam_0-") == 0);
+    const int sizes[] = { 2, 2, 1 };
+    for (int n = 0; n < 3; n++) {
+        struct stat st;
+        assert(stat(segments[n].c_str(), &st) == 0 && st.st_size == sizes[n] * GOP_SIZE);
+        std::ifstream file((segments[n] + ".key").c_str(), std::ios::binary);
+        Recorder::KeyHeader header;
+        assert(file.read((char*) &header, sizeof header));
+        assert(memcmp(header.magic, "KEYS", 4) == 0 && header.version == Recorder::KEY_VERSION);
+        assert((int) header.count == sizes[n]);
+        for (int key = 0; key < sizes[n]; key++) {
+            Recorder::KeyFrame entry;
+            assert(file.read((char*) &entry, sizeof entry));
+            assert(entry.offset == (uint64_t) key * GOP_SIZE && entry.timestamp == (uint32_t) (n * 2 + key) * 15000);
+        }
+    }
+    // segment streams like any other file
+    FileIndex index;
+    assert(index.open(segments[0].c_str()) == OK);
+    assert(index.count() == 14 && index.key_frame_count() == 2 && index.access_unit_count() == 10);
+    assert(index[2].size == IDR_SIZE && index.data(index[2])[0] == 0x65);
+
+    // segments of an earlier run are taken over, the oldest deleted when over the limit;
+    // those of another stream with the same prefix, and other files, are left alone
+    const std::string other = std::string(DIR_NAME) + "/cam_0-hd-20000101-000000-000.264";
+    const std::string notes = std::string(DIR_NAME) + "/cam_0-notes.264";
+    std::ofstream(other.c_str()) << "other stream";
+    std::ofstream(notes.c_str()) << "not a segment";
+    options.retention_size = 2 * GOP_SIZE;
+    {
+        Recorder recorder(options, &pool);
+        recorder.add_track("cam/0");
+        std::vector<std::string> kept = list(".264");
+        assert(kept.size() == 3 && kept[0] == segments[2] && kept[1] == other && kept[2] == notes);
+        assert(list(".key").size() == 1);
+    }
+
+    // frames that don't fit into the queue are dropped, the stream resumes at its next key frame
+    clean();
+    options.retention_size = 0;
+    options.queue_size     = IDR_SIZE - 1;
+    {
+        Recorder recorder(options, &pool);
+        int track = recorder.add_track("2");
+        for (int n = 0; n < 3; n++) {
+            record_gop(recorder, track, n * 15000);
+            recorder.flush();
+        }
+        assert(stats(recorder).find("recorder stream=2 frames=6 dropped=3") != std::string::npos);
+    }
+    segments = list(".264");
+    assert(segments.size() == 1);
+    struct stat st;
+    assert(stat(segments[0].c_str(), &st) == 0 && st.st_size == 3 * 16);
+
+    clean();
+    rmdir(DIR_NAME);
+    return 0;
+}
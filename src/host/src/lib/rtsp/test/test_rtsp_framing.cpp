@@ -0,0 +1,134 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sbl/sbl_socket.h>
+#include "rtsp.h"
+
+using namespace RTSP;
+
+// Talker takes whatever one recv() returns and answers every complete message in it: pipelined requests,
+// requests split over several reads and interleaved RTCP in between. Connections don't cost threads.
+
+const int server_port = 18597;
+const int CONNECTIONS = 32;
+
+int thread_count() {
+    DIR* dir = opendir("/proc/self/task");
+    assert(dir);
+    int count = 0;
+    while (dirent* entry = readdir(dir))
+        if (entry->d_name[0] != '.')
+            count++;
+    closedir(dir);
+    return count;
+}
+
+std::string options(int cseq) {
+    char request[128];
+    snprintf(request, sizeof request, "OPTIONS rtsp://127.0.0.1/stream RTSP/1.0\r\nCSeq: %d\r\n\r\n", cseq);
+    return request;
+}
+
+// receiver report as it comes interleaved on channel 1, header and an empty report
+std::string rtcp() {
+    static const char packet[] = { '$', 1, 0, 8, (char) 0x80, (char) 201, 0, 1, 0x12, 0x34, 0x56, 0x78 };
+    return std::string(packet, sizeof packet);
+}
+
+class Connection {
+public:
+    Connection() : _socket(SBL::Socket::TCP) { _socket.connect("127.0.0.1", server_port); }
+    ~Connection() { _socket.close(); }
+    void send(const std::string& data) { _socket.send(data.data(), data.size()); }
+    // send a byte at a time, each in its own segment
+    void trickle(const std::string& data) {
+        for (unsigned int n = 0; n < data.size(); n++) {
+            _socket.send(&data[n], 1);
+            usleep(1000);
+        }
+    }
+    // Read replies, which have no body, and check they are OK and come in CSeq order
+    void replies(int first, int count) {
+        for (int cseq = first; cseq < first + count; cseq++) {
+            size_t end;
+            while ((end = _received.find("\r\n\r\n")) == std::string::npos)
+                receive();
+            std::string reply = _received.substr(0, end + 4);
+            _received.erase(0, end + 4);
+            char tag[32];
+            snprintf(tag, sizeof tag, "CSeq: %d\r\n", cseq);
+            assert(reply.find("RTSP/1.0 200") == 0 && reply.find(tag) != std::string::npos);
+        }
+    }
+private:
+    SBL::Socket _socket;
+    std::string _received;
+
+    void receive() {
+        char buffer[4096];
+        int size = ::recv(_socket.id(), buffer, sizeof buffer, 0);
+        assert(size > 0);
+        _received.append(buffer, size);
+    }
+};
+
+void test_pipelined() {
+    Connection connection;
+    std::string requests;
+    for (int cseq = 1; cseq <= 5; cseq++)
+        requests += options(cseq);
+    connection.send(requests);
+    connection.replies(1, 5);
+}
+
+void test_split() {
+    Connection connection;
+    connection.trickle(options(1));
+    connection.replies(1, 1);
+    // second request starts in the segment that ends the first
+    std::string requests = options(2) + options(3);
+    connection.send(requests.substr(0, options(2).size() + 10));
+    connection.send(requests.substr(options(2).size() + 10));
+    connection.replies(2, 2);
+}
+
+void test_interleaved_rtcp() {
+    Connection connection;
+    connection.send(rtcp() + options(1) + rtcp());
+    connection.replies(1, 1);
+    connection.trickle(rtcp());
+    connection.send(options(2));
+    connection.replies(2, 1);
+}
+
+void test_threads() {
+    int threads = thread_count();
+    std::vector<Connection*> connections;
+    for (int n = 0; n < CONNECTIONS; n++) {
+        connections.push_back(new Connection);
+        connections.back()->send(options(1));
+    }
+    for (int n = 0; n < CONNECTIONS; n++)
+        connections[n]->replies(1, 1);
+    printf("%d threads with %d connections, %d without\n", thread_count(), CONNECTIONS, threads);
+    assert(thread_count() == threads);
+    for (int n = 0; n < CONNECTIONS; n++)
+        delete connections[n];
+}
+
+int main(int argc, char* argv[]) {
+    Server::create(server_port);
+    usleep(100000);
+    test_pipelined();
+    test_split();
+    test_interleaved_rtcp();
+    test_threads();
+    printf("test_rtsp_framing passed\n");
+    return 0;
+}
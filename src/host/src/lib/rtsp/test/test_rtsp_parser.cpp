@@ -2,9 +2,9 @@
 #include <fstream>
 #include <string>
 #include <vector>
-#include <stdlib.h>
-#include <iostream>
-#include "st_exception.h"
+#include <cstdlib>
+#include <cstring>
+#include <sbl/sbl_exception.h>
 #include "rtsp_parser.h"
 
 using namespace std;
@@ -17,7 +17,7 @@ struct Message {
 void read_messages(vector<Message>& messages, const char* filename) {
     ifstream file(filename);
     if (file.fail())
-        _throw_("Cannot open file %s", filename);
+        SBL_THROW("Cannot open file %s", filename);
     bool request = true;
     bool empty_line = true;
     char buffer[200];
@@ -47,16 +47,19 @@ void read_messages(vector<Message>& messages, const char* filename) {
 
 void compare(const RTSP::Parser& udt, const RTSP::Parser& ref) {
     const char* empty = "----";
-    _assert_(udt.data.method == ref.data.method);
-    _assert_(udt.data.cseq   == ref.data.cseq);
-    _assert_(!strcmp(udt.data.session_id  ? udt.data.session_id  : empty , ref.data.session_id ));
-    _assert_(!strcmp(udt.data.url         ? udt.data.url         : empty , ref.data.url        ));
-    _assert_(!strcmp(udt.data.stream_name ? udt.data.stream_name : empty , ref.data.stream_name));
-    _assert_(!strcmp(udt.data.accept      ? udt.data.accept      : empty , ref.data.accept));
-    _assert_(udt.data.client_port0   == ref.data.client_port0);
-    _assert_(udt.data.client_port1   == ref.data.client_port1);
-    _assert_(udt.data.transport      == ref.data.transport   );
-    _assert_(udt.state()             == ref.state()  );
+    SBL_ASSERT(udt.data.method == ref.data.method);
+    SBL_ASSERT(udt.data.cseq   == ref.data.cseq);
+    SBL_ASSERT(!strcmp(udt.data.session_id  ? udt.data.session_id  : empty , ref.data.session_id ));
+    SBL_ASSERT(!strcmp(udt.data.url         ? udt.data.url         : empty , ref.data.url        ));
+    SBL_ASSERT(!strcmp(udt.data.stream_name ? udt.data.stream_name : empty , ref.data.stream_name));
+    SBL_ASSERT(!strcmp(udt.data.accept      ? udt.data.accept      : empty , ref.data.accept));
+    SBL_ASSERT(udt.data.client_port0   == ref.data.client_port0);
+    SBL_ASSERT(udt.data.client_port1   == ref.data.client_port1);
+    SBL_ASSERT(udt.data.transport      == ref.data.transport   );
+    SBL_ASSERT(udt.data.multicast      == ref.data.multicast   );
+    SBL_ASSERT(udt.data.range_start    == ref.data.range_start );
+    SBL_ASSERT(udt.data.scale          == ref.data.scale       );
+    SBL_ASSERT(udt.state()             == ref.state()  );
 }
 
 int main(int argc, char* argv[]) {
@@ -84,6 +87,10 @@ int main(int argc, char* argv[]) {
             cerr << "Request" << endl << "-------" << endl << messages[n].request << endl << endl;
             cerr << "Reply"   << endl << "-------" << endl << messages[n].reply   << endl << endl;
             return 1;
+        } catch (SBL::Exception& ex) {
+            cerr << "Message " << n << " parsed wrong: " << ex.what() << endl;
+            cerr << "Request" << endl << "-------" << endl << messages[n].request << endl << endl;
+            return 1;
         }
     }
     cout << "Compared " << messages.size() << " messages, no errors found" << endl;
@@ -0,0 +1,58 @@
+#include <cassert>
+#include <sbl/sbl_logger.h>
+#include <sbl/sbl_thread.h>
+#include "source_map.h"
+
+using namespace RTSP;
+
+const unsigned int STREAMS = 1000;
+
+// sources are never dereferenced by the map, so made up pointers will do
+Source* source(unsigned int id) {
+    return reinterpret_cast<Source*>((id + 1) * 16);
+}
+
+// Looks up sources by id while they are being added, like frame threads do
+class Reader : public SBL::Thread {
+public:
+    Reader(SourceMap& map) : _map(map), _done(false), _lookups(0) {}
+    void start_thread() {
+        while (!_done)
+            for (unsigned int id = 0; id < STREAMS; id++, _lookups++) {
+                Source* found = _map.find(id);
+                assert(found == NULL || found == source(id));
+            }
+    }
+    void stop() { _done = true; join_thread(); }
+    unsigned int lookups() const { return _lookups; }
+private:
+    SourceMap&      _map;
+    volatile bool   _done;
+    unsigned int    _lookups;
+};
+
+int main(int argc, char* argv[]) {
+    SourceMap map;
+    assert(map.find(0u) == NULL && map.find(12345u) == NULL);
+
+    // table grows while it is being read
+    Reader reader(map);
+    reader.create_thread();
+    for (unsigned int id = 0; id < STREAMS; id += 3)
+        map.save(id, source(id));
+    reader.stop();
+    for (unsigned int id = 0; id < STREAMS; id++)
+        assert(map.find(id) == (id % 3 ? NULL : source(id)));
+    assert(reader.lookups() > 0);
+
+    // id also saves a name, and a source may have more names
+    assert(map.find("3") == source(3));
+    map.save(7, source(7), "camera");
+    assert(map.find("camera") == source(7) && map.find("7") == NULL);
+    map.save("lobby", source(7));
+    assert(map.find("lobby") == source(7));
+    map.erase("lobby");
+    assert(map.find("lobby") == NULL && map.find("camera") == source(7));
+    SBL_INFO("Done!");
+    return 0;
+}
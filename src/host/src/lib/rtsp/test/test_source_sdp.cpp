@@ -0,0 +1,122 @@
+#include <cassert>
+#include <cstring>
+#include <unistd.h>
+#include <sbl/sbl_logger.h>
+#include <sbl/sbl_thread.h>
+#include "rtsp_source.h"
+#include "rtp_streamer.h"
+#include "rtsp_impl.h"
+#include "reactor.h"
+
+using namespace RTSP;
+
+uint8_t sps[]  = {0x67, 0x42, 0x00, 0x1f, 0xe9, 0x01, 0x40, 0x7b, 0x20};
+uint8_t sps2[] = {0x67, 0x64, 0x00, 0x28, 0xac, 0xd2};
+uint8_t pps[]  = {0x68, 0xce, 0x38, 0x80};
+
+struct TestSource : public Source {
+    TestSource() : Source("test", new Streamer) {
+        _stream_desc.encoder_type = H264;
+        _stream_desc.bitrate      = 2000;
+    }
+    ~TestSource() { delete streamer(); }
+    void play() {}
+    void send_frame(uint8_t* frame, int size, uint32_t timestamp, EncoderType encoder) { save_if_sps_pps(frame, size); }
+    void teardown() {}
+    bool is_live() const { return true; }
+    void get_stream_desc() {}
+    void set_bitrate(int bitrate) { _stream_desc.bitrate = bitrate; }
+};
+
+// Sends SPS and PPS a bit later, like the encoder would after DESCRIBE asked it to start
+class Encoder : public SBL::Thread {
+public:
+    Encoder(TestSource& source) : _source(source) {}
+    void start_thread() {
+        usleep(100000);
+        _source.send_frame(sps, sizeof sps, 0, H264);
+        _source.send_frame(pps, sizeof pps, 0, H264);
+    }
+private:
+    TestSource& _source;
+};
+
+// Stands for the talker of a DESCRIBE that waits for parameter sets
+class Waiter : public Reactor::Handler, public ParamSetWaiter {
+public:
+    Waiter(Reactor* reactor) : woken(false), _reactor(reactor) {}
+    int  fd() const         { return -1; }
+    bool on_readable()      { return true; }
+    bool on_wakeup()        { woken = true; return true; }
+    void param_set_saved()  { _reactor->wake(this); }
+    volatile bool woken;
+private:
+    Reactor* _reactor;
+};
+
+double now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char* argv[]) {
+    char buffer[512];
+    BufferWriter sdp(buffer, sizeof buffer);
+
+    // DESCRIBE doesn't wait for parameter sets, its talker is woken up as soon as they come
+    Reactor* reactor = new Reactor(0);
+    reactor->create_thread(SBL::Thread::Detached);
+    TestSource source;
+    Waiter waiter(reactor);
+    assert(!source.param_set_ready(&waiter));
+    try {
+        source.write_sdp_media(sdp);
+        assert(false);
+    } catch (Errcode errcode) {
+        assert(errcode == ERROR_MISSING_SPS);
+    }
+    Encoder encoder(source);
+    encoder.create_thread();
+    double start = now();
+    while (!waiter.woken && now() - start < 1)
+        usleep(1000);
+    double waited = now() - start;
+    encoder.join_thread();
+    assert(waiter.woken && waited > 0.05 && waited < 1);
+    assert(source.param_set_ready(&waiter));
+    source.write_sdp_media(sdp);
+    assert(!strcmp(sdp.data(), "m=video 0 RTP/AVP 96\r\n"
+                               "c=IN IP4 0.0.0.0\r\n"
+                               "b=AS:2000\r\n"
+                               "a=rtpmap:96 H264/90000\r\n"
+                               "a=fmtp:96 packetization-mode=1;profile-level-id=42001f;sprop-parameter-sets=Z0IAH+kBQHsg,aM44gA==\r\n"));
+
+    // same parameter sets again, same sdp
+    source.send_frame(sps, sizeof sps, 0, H264);
+    sdp.reset();
+    source.write_sdp_media(sdp);
+    assert(strstr(sdp.data(), "profile-level-id=42001f;"));
+
+    // new SPS or bitrate show up in the next DESCRIBE
+    source.send_frame(sps2, sizeof sps2, 0, H264);
+    sdp.reset();
+    source.write_sdp_media(sdp);
+    assert(strstr(sdp.data(), "profile-level-id=640028;sprop-parameter-sets=Z2QAKKzS,aM44gA==\r\n"));
+    source.set_bitrate(500);
+    sdp.reset();
+    source.write_sdp_media(sdp);
+    assert(strstr(sdp.data(), "b=AS:500\r\n"));
+
+    // talker that stopped waiting isn't woken up
+    TestSource silent;
+    Waiter gone(reactor);
+    assert(!silent.param_set_ready(&gone));
+    silent.cancel_param_wait(&gone);
+    silent.send_frame(sps, sizeof sps, 0, H264);
+    silent.send_frame(pps, sizeof pps, 0, H264);
+    usleep(50000);
+    assert(!gone.woken);
+    SBL_INFO("Done!");
+    return 0;
+}
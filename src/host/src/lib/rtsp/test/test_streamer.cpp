@@ -1,36 +1,117 @@
-#include "streamer.h"
-#include <iostream>
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <time.h>
+#include <unistd.h>
+#include <sbl/sbl_socket.h>
+#include <sbl/sbl_thread.h>
+#include "rtsp.h"
+#include "rtp_streamer.h"
+#include "live_source.h"
+#include "metrics.h"
 
-namespace RTP {
-class H264Streamer : public Streamer {
+using namespace RTSP;
+
+// Clients come and go while the sending thread sleeps for a paced client, without waiting for it
+
+const int server_port   = 18596;
+const int loopback_port = 61240;
+const int PACKET_GAP_MS = 100;
+const int MAX_CHANGE_MS = 20;
+
+class App : public Application {
 public:
-    H264Streamer() : Streamer(0x15, 0x27272727) , _counter(0) {}
-    virtual uint32_t fetch_timestamp(uint8_t* frame) {
-        return ++_counter;
+    int get_stream_id(unsigned int channel_num, unsigned int stream_num) { return -1; }
+    int get_stream_id(const char* stream_name) { return -1; }
+    void play(int stream_id) {}
+    void teardown(int stream_id) {}
+    int describe(int stream_id, StreamDesc& stream_desc) {
+        stream_desc.encoder_type = H264;
+        stream_desc.bitrate      = 4000;
+        return 0;
+    }
+    int pe_id() const { return 0; }
+} app;
+
+namespace RTSP {
+Application* application() { return &app; }
+}
+
+double now_ms() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+// SPS and P frames of 3 packets, as fast as the paced client lets them go
+class Sender : public SBL::Thread {
+public:
+    Sender(Streamer& streamer) : _streamer(streamer), _stopped(false), _frame(4000, 0x55) { _frame[0] = 0x41; }
+    void start_thread() {
+        const uint8_t sps[] = { 0x67, 0x42, 0x00, 0x1f, 0xe9 };
+        for (uint32_t timestamp = 0; !_stopped; timestamp += 3000) {
+            _streamer.send_frame(sps, sizeof sps, timestamp);
+            _streamer.send_frame(&_frame[0], _frame.size(), timestamp);
+        }
+    }
+    void stop() {
+        _stopped = true;
+        join_thread();
     }
 private:
-    uint32_t    _counter;
+    Streamer&            _streamer;
+    volatile bool        _stopped;
+    std::vector<uint8_t> _frame;
 };
 
+int clients_in_metrics() {
+    std::ostringstream text;
+    Metrics::registry().print(text, "paced");
+    int count = 0;
+    for (size_t at = 0; (at = text.str().find("metrics client=", at)) != std::string::npos; at++)
+        count++;
+    return count;
 }
 
+int main(int argc, char* argv[]) {
+    Server::Options options;
+    options.pace_clients = true;
+    options.packet_gap   = PACKET_GAP_MS * 1000000;
+    Server::create(server_port, options);
 
-int main() {
-    std::cout << sizeof(uint8_t) << "\n";
-    const int frame_size = 5000;
-    char frame[frame_size];
-    for (int i = 0; i < frame_size; i++) {
-        frame[i] = i & 0x00ff;
-    }
-    RTP::H264Streamer streamer;
-    uint8_t* ptr = (uint8_t*) &frame[24];
-    streamer.add_client("192.168.1.99", 5678);
-    // send small frame
-    streamer.send_frame(ptr, 1000);
-    for (int i = 0; i < frame_size; i++) {
-        frame[i] = i & 0x00ff;
+    Streamer   streamer(1456, 0x1234, 0);
+    LiveSource source(0, &streamer, "paced");
+    source.get_stream_desc();
+    SBL::Socket rx(SBL::Socket::UDP);
+    rx.bind(loopback_port);
+    SBL::Socket tx(SBL::Socket::UDP);
+    tx.connect("127.0.0.1", loopback_port);
+    streamer.add_client(tx, tx)->play();
+    Sender sender(streamer);
+    sender.create_thread();
+    usleep(3 * PACKET_GAP_MS * 1000);
+
+    // clients removed while the sending thread may be on them are freed once it is off them
+    double slowest = 0;
+    for (int n = 0; n < 10; n++) {
+        double start = now_ms();
+        Client* client = streamer.add_client(tx, tx);
+        client->play();
+        double added = now_ms();
+        usleep(PACKET_GAP_MS * 1000 / 3);
+        double removing = now_ms();
+        streamer.delete_client(client);
+        double ms = std::max(added - start, now_ms() - removing);
+        slowest = std::max(slowest, ms);
     }
-    // send large frame
-    streamer.send_frame(ptr, frame_size - 100);
+    printf("Slowest client change took %.1f ms, packets are %d ms apart\n", slowest, PACKET_GAP_MS);
+    assert(slowest < MAX_CHANGE_MS);
+    sender.stop();
+    assert(streamer.client_count() == 1 && clients_in_metrics() == 1);
+    printf("test_streamer passed\n");
     return 0;
 }
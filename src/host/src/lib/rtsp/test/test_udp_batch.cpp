@@ -0,0 +1,79 @@
+#include <cassert>
+#include <cstring>
+#include <cstdlib>
+#include <sbl/sbl_logger.h>
+#include <sbl/sbl_socket.h>
+#include "udp_batch.h"
+
+using namespace SBL;
+
+const char* loopback_addr = "127.0.0.1";
+const int   loopback_port = 61236;
+
+// Queue packets of given sizes, flush them and check that receiver gets them intact and in order
+int send_and_check(Socket& tx, Socket& rx, const int* sizes, int count) {
+    RTSP::UdpBatch batch(1500);
+    uint8_t packet[1500];
+    static uint8_t payloads[64][1500];
+    for (int n = 0; n < count; n++) {
+        memset(payloads[n], n, sizeof payloads[n]);
+        memset(packet, n, sizes[n]);
+        assert(batch.fits(sizes[n]));
+        // header is copied, payload stays where it is until flush
+        int header_size = sizes[n] < 12 ? sizes[n] : 12;
+        batch.add(packet, header_size, payloads[n], sizes[n] - header_size);
+    }
+    assert(batch.count() == count);
+    int dropped = -1;
+    int syscalls = batch.flush(tx, dropped);
+    assert(syscalls > 0 && syscalls <= count);
+    assert(dropped == 0);
+    assert(batch.empty());
+    for (int n = 0; n < count; n++) {
+        int received = rx.recv(packet, sizeof packet);
+        assert(received == sizes[n]);
+        assert(packet[0] == n);
+        assert(packet[received - 1] == n);
+    }
+    return syscalls;
+}
+
+int main(int argc, char* argv[]) {
+    Socket rx(Socket::UDP);
+    rx.bind(loopback_port);
+    Socket tx(Socket::UDP);
+    tx.connect(loopback_addr, loopback_port);
+
+    // FU-A shape: equal sizes, shorter last packet (GSO candidate)
+    const int fu_sizes[] = {1470, 1470, 1470, 1470, 300};
+    int syscalls = send_and_check(tx, rx, fu_sizes, 5);
+    SBL_INFO("FU-A batch: 5 packets in %d syscalls", syscalls);
+
+    // mixed sizes, cannot use GSO
+    const int mixed_sizes[] = {20, 12, 1470, 800, 1470};
+    syscalls = send_and_check(tx, rx, mixed_sizes, 5);
+    SBL_INFO("mixed batch: 5 packets in %d syscalls", syscalls);
+
+    // single packet
+    const int single_size[] = {100};
+    assert(send_and_check(tx, rx, single_size, 1) == 1);
+
+    // batch must refuse packets beyond its capacity
+    RTSP::UdpBatch batch(1500);
+    uint8_t packet[1500];
+    int added = 0;
+    while (batch.fits(sizeof packet)) {
+        batch.add(packet, 12, packet + 12, sizeof packet - 12);
+        added++;
+    }
+    assert(added > 1);
+    batch.clear();
+    assert(batch.empty());
+    int dropped = -1;
+    assert(batch.flush(tx, dropped) == 0 && dropped == 0);
+
+    tx.close();
+    rx.close();
+    SBL_INFO("Done!");
+    return 0;
+}
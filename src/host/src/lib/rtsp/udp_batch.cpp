@@ -0,0 +1,196 @@
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "rtsp_impl.h"
+#include "udp_batch.h"
+
+// Toolchain headers predate both of these, so we carry our own definitions.
+// Kernel will simply reject them if it is too old, and we fall back.
+#ifndef SOL_UDP
+#define SOL_UDP     17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+namespace {
+// Same layout as struct mmsghdr, which old glibc doesn't have
+struct MMsgHdr {
+    struct msghdr   msg_hdr;
+    unsigned int    msg_len;
+};
+
+bool unsupported(int error) {
+    return error == ENOSYS || error == EINVAL || error == ENOPROTOOPT || error == EOPNOTSUPP || error == EIO;
+}
+
+bool would_block(int error) {
+    return error == EAGAIN || error == EWOULDBLOCK;
+}
+}
+
+namespace RTSP {
+
+bool UdpBatch::_gso_enabled  = true;
+#ifdef __NR_sendmmsg
+bool UdpBatch::_mmsg_enabled = true;
+#else
+bool UdpBatch::_mmsg_enabled = false;
+#endif
+
+UdpBatch::UdpBatch(int max_packet_size) : _bytes(0) {
+    _max_bytes = max_packet_size > MAX_BYTES ? max_packet_size : MAX_BYTES;
+    _headers.resize(MAX_PACKETS * MAX_HEADER);
+    _iov.reserve(2 * MAX_PACKETS);
+    _sizes.reserve(MAX_PACKETS);
+}
+
+bool UdpBatch::fits(int size) const {
+    return _sizes.size() < MAX_PACKETS && _bytes + size <= _max_bytes;
+}
+
+void UdpBatch::add(const uint8_t* header, int header_size, const uint8_t* payload, int payload_size) {
+    int size = header_size + payload_size;
+    SBL_ASSERT(fits(size) && header_size <= MAX_HEADER);
+    uint8_t* copy = &_headers[_sizes.size() * MAX_HEADER];
+    memcpy(copy, header, header_size);
+    struct iovec iov;
+    iov.iov_base = copy;
+    iov.iov_len  = header_size;
+    _iov.push_back(iov);
+    iov.iov_base = const_cast<uint8_t*>(payload);
+    iov.iov_len  = payload_size;
+    _iov.push_back(iov);
+    _bytes += size;
+    _sizes.push_back(size);
+}
+
+int UdpBatch::flush(SBL::Socket socket, int& dropped) {
+    int syscalls = 0;
+    dropped = 0;
+    if (_sizes.empty())
+        return 0;
+    if (_sizes.size() == 1)
+        syscalls = send_each(socket, dropped);
+    else if (_gso_enabled && is_gso_shape())
+        syscalls = send_gso(socket, dropped);
+    else if (_mmsg_enabled)
+        syscalls = send_mmsg(socket, dropped);
+    else
+        syscalls = send_each(socket, dropped);
+    clear();
+    return syscalls;
+}
+
+// GSO cuts the buffer into gso_size pieces, so only the last one can be shorter
+bool UdpBatch::is_gso_shape() const {
+    for (unsigned int n = 1; n < _sizes.size() - 1; n++)
+        if (_sizes[n] != _sizes[0])
+            return false;
+    return _sizes.back() <= _sizes[0];
+}
+
+int UdpBatch::send_gso(SBL::Socket socket, int& dropped) {
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    memset(control, 0, sizeof control);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov        = &_iov[0];
+    msg.msg_iovlen     = _iov.size();
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof control;
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type  = UDP_SEGMENT;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(uint16_t));
+    uint16_t gso_size = _sizes[0];
+    memcpy(CMSG_DATA(cmsg), &gso_size, sizeof gso_size);
+    if (::sendmsg(socket.id(), &msg, MSG_DONTWAIT | MSG_NOSIGNAL) == _bytes)
+        return 1;
+    if (would_block(errno)) {
+        dropped = _sizes.size();
+        return 1;
+    }
+    if (!unsupported(errno)) {
+        SBL_WARN("Socket %d, GSO send error: %s", socket.id(), strerror(errno));
+        return -1;
+    }
+    SBL_INFO("UDP segmentation offload not available (%s), disabling it", strerror(errno));
+    _gso_enabled = false;
+    int syscalls = _mmsg_enabled ? send_mmsg(socket, dropped) : send_each(socket, dropped);
+    return syscalls < 0 ? -1 : syscalls + 1;
+}
+
+int UdpBatch::send_mmsg(SBL::Socket socket, int& dropped) {
+#ifdef __NR_sendmmsg
+    MMsgHdr msgs[MAX_PACKETS];
+    memset(msgs, 0, sizeof msgs);
+    int count = _sizes.size();
+    for (int n = 0; n < count; n++) {
+        msgs[n].msg_hdr.msg_iov    = &_iov[2 * n];
+        msgs[n].msg_hdr.msg_iovlen = 2;
+    }
+    int syscalls = 0;
+    int sent = 0;
+    while (sent < count) {
+        int n = ::syscall(__NR_sendmmsg, socket.id(), msgs + sent, count - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        syscalls++;
+        if (n > 0) {
+            sent += n;
+            continue;
+        }
+        if (n < 0 && would_block(errno)) {
+            dropped = count - sent;
+            break;
+        }
+        if (n < 0 && errno == ENOSYS && sent == 0) {
+            SBL_INFO("sendmmsg not available, disabling it");
+            _mmsg_enabled = false;
+            int each = send_each(socket, dropped);
+            return each < 0 ? -1 : each + syscalls;
+        }
+        SBL_WARN("Socket %d, sendmmsg error: %s", socket.id(), strerror(errno));
+        return -1;
+    }
+    return syscalls;
+#else
+    return send_each(socket, dropped);
+#endif
+}
+
+int UdpBatch::send_each(SBL::Socket socket, int& dropped) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iovlen = 2;
+    for (unsigned int n = 0; n < _sizes.size(); n++) {
+        msg.msg_iov = &_iov[2 * n];
+        if (::sendmsg(socket.id(), &msg, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+            if (!would_block(errno)) {
+                SBL_WARN("Socket %d, send error: %s", socket.id(), strerror(errno));
+                return -1;
+            }
+            dropped = _sizes.size() - n;
+            return n + 1;
+        }
+    }
+    return _sizes.size();
+}
+
+}
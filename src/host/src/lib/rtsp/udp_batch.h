@@ -0,0 +1,75 @@
+#pragma once
+#ifndef _RTSP_UDP_BATCH_H
+#define _RTSP_UDP_BATCH_H
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <stdint.h>
+#include <vector>
+#include <sys/uio.h>
+#include <sbl/sbl_socket.h>
+
+namespace RTSP {
+
+//! Collects RTP packets of a frame for one UDP client and sends them with as few syscalls as possible.
+/*! Only packet headers are copied in; payloads are referenced where they are, in the frame,
+    so the frame must stay untouched until flush(). flush() tries, in order:
+    @li a single sendmsg() with UDP_SEGMENT (GSO), when all packets but the last have the same size
+    @li sendmmsg(), one syscall for the whole batch
+    @li plain send() per packet
+    The first two are probed at runtime; when kernel says it doesn't support them, they are
+    switched off for the whole process and never tried again.\n
+    Sends never block: packets that don't fit in the socket buffer are dropped and reported.
+*/
+class UdpBatch {
+public:
+    //! Batch constructor
+    // @param   max_packet_size     largest packet that will be added, RTP header included
+    UdpBatch(int max_packet_size);
+    //! Return true if packet of a given size still fits into the batch
+    bool fits(int size) const;
+    //! Add packet to the batch, header is copied, payload is not. Caller must check fits() first.
+    void add(const uint8_t* header, int header_size, const uint8_t* payload, int payload_size);
+    //! Discard all queued packets
+    void clear() { _sizes.clear(); _iov.clear(); _bytes = 0; }
+    //! Send all queued packets to a connected UDP socket and empty the batch.
+    //! Return number of syscalls used, or -1 on socket error.
+    //! @param  dropped     set to number of packets socket didn't take (its buffer was full)
+    int  flush(SBL::Socket socket, int& dropped);
+    //! Number of packets currently queued
+    int  count() const { return _sizes.size(); }
+    //! Return true if batch is empty
+    bool empty() const { return _sizes.empty(); }
+private:
+    enum {MAX_PACKETS   = 64,           // UDP_SEGMENT limit on number of segments
+          MAX_BYTES     = 64000,        // UDP_SEGMENT limit on total size (less IP/UDP headers)
+          MAX_HEADER    = 32            // largest header that can be added
+         };
+    std::vector<uint8_t> _headers;      // MAX_HEADER bytes for each packet
+    std::vector<struct iovec> _iov;     // header and payload of each packet
+    std::vector<int>     _sizes;        // size of each packet
+    int                  _bytes;        // bytes in all packets
+    int                  _max_bytes;
+
+    int  send_gso(SBL::Socket socket, int& dropped);
+    int  send_mmsg(SBL::Socket socket, int& dropped);
+    int  send_each(SBL::Socket socket, int& dropped);
+    bool is_gso_shape() const;
+
+    static bool _gso_enabled;
+    static bool _mmsg_enabled;
+};
+
+}
+#endif
@@ -217,6 +217,13 @@ public:
         _wait = false;
         SBL_ASSERT(pthread_cond_signal(&_cond) == 0);
     }
+    /// Signal the condition variable to all waiting threads
+    /** Same as signal(), but wakes everybody waiting on the mutex, not just one. */
+    void broadcast() {
+        _SBL_MSG_("Broadcasting from mutex %p", this);
+        _wait = false;
+        SBL_ASSERT(pthread_cond_broadcast(&_cond) == 0);
+    }
 private:
     pthread_mutex_t _mutex;
     pthread_cond_t  _cond;
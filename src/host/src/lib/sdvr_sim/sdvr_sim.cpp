@@ -0,0 +1,375 @@
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+//! @file sdvr_sim.cpp
+//! The part of the SDK API the applications use, on the simulated board (see SIM::Board).
+//! Functions the board has nothing to do for succeed and do nothing.
+#include <cstdio>
+#include <cstring>
+#include <sbl/sbl_logger.h>
+#include "sim_board.h"
+
+using SIM::Board;
+
+static sdvr_signals_callback  _signals_callback = NULL;
+static sdvr_sdk_params_t      _sdk_params = { 0, 0, 0, 0, 10, 0, NULL };
+static sx_uint8               _macaddr[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+sdvr_err_e sdvr_sdk_init() {
+    return Board::instance().init();
+}
+
+sdvr_signals_callback sdvr_set_signals_callback(sdvr_signals_callback signals_callback) {
+    sdvr_signals_callback previous = _signals_callback;
+    _signals_callback = signals_callback;
+    return previous;
+}
+
+sdvr_stream_callback sdvr_set_stream_callback(sdvr_stream_callback stream_callback) {
+    return Board::instance().set_stream_callback(stream_callback);
+}
+
+sdvr_err_e sdvr_get_sdk_params(sdvr_sdk_params_t* sdk_params) {
+    if (!sdk_params)
+        return SDVR_ERR_INVALID_ARG;
+    *sdk_params = _sdk_params;
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_set_sdk_params(sdvr_sdk_params_t* sdk_params) {
+    if (!sdk_params)
+        return SDVR_ERR_INVALID_ARG;
+    _sdk_params = *sdk_params;
+    return SDVR_ERR_NONE;
+}
+
+sx_uint32 sdvr_get_board_count() {
+    return 1;
+}
+
+sdvr_err_e sdvr_upgrade_firmware(sx_uint32 board_index, char* firmware_file_name) {
+    if (board_index)
+        return SDVR_ERR_INVALID_BOARD;
+    SBL_INFO("Simulated board, firmware %s is not loaded", firmware_file_name ? firmware_file_name : "");
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_get_firmware_version(sx_uint32 board_index, sdvr_firmware_ver_t* version_info) {
+    if (board_index)
+        return SDVR_ERR_INVALID_BOARD;
+    if (!version_info)
+        return SDVR_ERR_INVALID_ARG;
+    memset(version_info, 0, sizeof *version_info);
+    version_info->fw_major      = 7;
+    version_info->fw_minor      = 2;
+    version_info->fw_build_year = 2013;
+    version_info->fw_build_month = 1;
+    version_info->fw_build_day  = 1;
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_get_pci_attrib(sx_uint32 board_index, sdvr_pci_attrib_t* pci_attrib) {
+    if (board_index)
+        return SDVR_ERR_INVALID_BOARD;
+    if (!pci_attrib)
+        return SDVR_ERR_INVALID_ARG;
+    memset(pci_attrib, 0, sizeof *pci_attrib);
+    pci_attrib->board_type       = 0x18a2;
+    pci_attrib->vendor_id        = 0x18a2;
+    pci_attrib->subsystem_vendor = 0x18a2;
+    strcpy((char*) pci_attrib->serial_number, "SIMULATED");
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_get_board_config(sx_uint32 board_index, sdvr_board_config_t* board_config) {
+    if (board_index)
+        return SDVR_ERR_INVALID_BOARD;
+    if (!board_config)
+        return SDVR_ERR_INVALID_ARG;
+    Board::instance().config(*board_config);
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_get_board_attributes(sx_uint32 board_index, sdvr_board_attrib_t* board_attrib) {
+    if (board_index)
+        return SDVR_ERR_INVALID_BOARD;
+    if (!board_attrib)
+        return SDVR_ERR_INVALID_ARG;
+    Board::instance().attributes(*board_attrib);
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_board_connect_ex(sx_uint32 board_index, sdvr_board_settings_t* board_settings) {
+    if (board_index)
+        return SDVR_ERR_INVALID_BOARD;
+    if (!board_settings)
+        return SDVR_ERR_INVALID_ARG;
+    return Board::instance().connect(*board_settings);
+}
+
+sdvr_err_e sdvr_create_chan_ex(sdvr_chan_def_t* chan_def, sdvr_chan_buf_def_t* buf_def, sdvr_chan_handle_t* handle_ptr) {
+    if (!chan_def || !buf_def)
+        return SDVR_ERR_INVALID_ARG;
+    return Board::instance().create_channel(*chan_def, *buf_def, handle_ptr);
+}
+
+sx_uint8 sdvr_get_chan_num(sdvr_chan_handle_t handle) {
+    return handle & 0xff;
+}
+
+sdvr_err_e sdvr_get_chan_vstd(sdvr_chan_handle_t handle, sdvr_video_std_e* video_std_type) {
+    if (!video_std_type)
+        return SDVR_ERR_INVALID_ARG;
+    return Board::instance().video_std(handle, *video_std_type);
+}
+
+sdvr_err_e sdvr_set_chan_video_codec(sdvr_chan_handle_t handle, sx_uint32 stream_id, sdvr_venc_e video_codec) {
+    return Board::instance().set_codec(handle, stream_id, video_codec);
+}
+
+sdvr_err_e sdvr_set_video_encoder_channel_params(sdvr_chan_handle_t handle, sx_uint32 enc_stream_id,
+                                                 sdvr_video_enc_chan_params_t* video_enc_params) {
+    if (!video_enc_params)
+        return SDVR_ERR_INVALID_ARG;
+    return Board::instance().set_encoder(handle, enc_stream_id, *video_enc_params);
+}
+
+sdvr_err_e sdvr_get_video_encoder_channel_params(sdvr_chan_handle_t handle, sx_int32 enc_stream_id,
+                                                 sdvr_video_enc_chan_params_t* video_enc_params) {
+    if (!video_enc_params || enc_stream_id < 0)
+        return SDVR_ERR_INVALID_ARG;
+    return Board::instance().get_encoder(handle, enc_stream_id, *video_enc_params);
+}
+
+sdvr_err_e sdvr_enable_encoder(sdvr_chan_handle_t handle, sx_uint32 enc_stream_id, sx_bool enable) {
+    return Board::instance().enable_encoder(handle, enc_stream_id, enable);
+}
+
+sx_uint8 sdvr_set_frame_rate(sdvr_frame_rate_skip_method_e skip_method, sx_uint8 count) {
+    return skip_method == SDVR_FRS_METHOD_NONE ? count : (skip_method << 6) | (count & 0x3f);
+}
+
+sdvr_err_e sdvr_get_stream_buffer(sdvr_chan_handle_t handle, sdvr_frame_type_e frame_type, sx_uint32 stream_id,
+                                  sdvr_av_buffer_t** frame_buffer) {
+    return Board::instance().get_buffer(handle, frame_type, stream_id, frame_buffer);
+}
+
+sdvr_err_e sdvr_release_av_buffer(sdvr_av_buffer_t* frame_buffer) {
+    return Board::instance().release_buffer(frame_buffer);
+}
+
+sdvr_err_e sdvr_get_buffer_timestamp(void* frame_buffer, sx_uint64* timestamp64) {
+    const sdvr_av_buffer_t* buffer = (const sdvr_av_buffer_t*) frame_buffer;
+    if (!buffer || !timestamp64)
+        return SDVR_ERR_INVALID_ARG;
+    *timestamp64 = (sx_uint64) buffer->timestamp_high << 32 | buffer->timestamp;
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_av_buf_sequence(void* frame_buffer, sx_uint32* seq_number, sx_uint32* frame_number,
+                                sx_uint32* frame_drop_count) {
+    const sdvr_av_buffer_t* buffer = (const sdvr_av_buffer_t*) frame_buffer;
+    if (!buffer || !seq_number || !frame_number || !frame_drop_count)
+        return SDVR_ERR_INVALID_ARG;
+    *seq_number       = buffer->seq_number;
+    *frame_number     = buffer->frame_number;
+    *frame_drop_count = buffer->frame_drop_count;
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_av_buf_payload(sdvr_av_buffer_t* frame_buffer, sx_uint8** payload, sx_uint32* payload_size) {
+    if (!frame_buffer || !payload || !payload_size)
+        return SDVR_ERR_INVALID_ARG;
+    *payload      = frame_buffer->payload;
+    *payload_size = frame_buffer->payload_size;
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_set_test_frames(sx_bool enable) {
+    Board::instance().set_test_frames(enable);
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_get_buffer_test_frame(void* frame_buffer, sx_bool* test_frame) {
+    if (!frame_buffer || !test_frame)
+        return SDVR_ERR_INVALID_ARG;
+    *test_frame = ((const sdvr_av_buffer_t*) frame_buffer)->is_test_frame;
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_get_buffer_test_pattern(void* frame_buffer, sx_uint8* test_pattern) {
+    if (!frame_buffer || !test_pattern)
+        return SDVR_ERR_INVALID_ARG;
+    *test_pattern = ((const sdvr_av_buffer_t*) frame_buffer)->test_pattern;
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_snapshot(sdvr_chan_handle_t handle, sdvr_video_res_decimation_e resolution) {
+    return Board::instance().snapshot(handle, resolution);
+}
+
+// The command is only logged; no response buffer follows
+sdvr_err_e sdvr_raw_command_channel(sdvr_chan_handle_t handle, sdvr_raw_command_t* cmd_buf) {
+    if (!cmd_buf)
+        return SDVR_ERR_INVALID_ARG;
+    int size = cmd_buf->cmd_data && cmd_buf->cmd_data_size ? cmd_buf->cmd_data_size : 0;
+    SBL_MSG(SBL_MSG_SIM, "Raw command to subsystem %d: %.*s", cmd_buf->sub_system, size, (const char*) cmd_buf->cmd_data);
+    memset(cmd_buf->response, 0, sizeof cmd_buf->response);
+    strncpy((char*) cmd_buf->response, "OK", sizeof cmd_buf->response);
+    cmd_buf->response_size = 0;
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_get_img_properties(sdvr_chan_handle_t handle, sdvr_img_t* img) {
+    return Board::instance().property(handle, Board::IMAGE, img, sizeof *img, false);
+}
+
+sdvr_err_e sdvr_set_img_properties(sdvr_chan_handle_t handle, sdvr_img_t* img) {
+    return Board::instance().property(handle, Board::IMAGE, img, sizeof *img, true);
+}
+
+sdvr_err_e sdvr_get_flip_properties(sdvr_chan_handle_t handle, sdvr_flip_t* flip) {
+    return Board::instance().property(handle, Board::FLIP, flip, sizeof *flip, false);
+}
+
+sdvr_err_e sdvr_set_flip_properties(sdvr_chan_handle_t handle, sdvr_flip_t* flip) {
+    return Board::instance().property(handle, Board::FLIP, flip, sizeof *flip, true);
+}
+
+sdvr_err_e sdvr_get_exposure_properties(sdvr_chan_handle_t handle, sdvr_exposure_t* exposure) {
+    return Board::instance().property(handle, Board::EXPOSURE, exposure, sizeof *exposure, false);
+}
+
+sdvr_err_e sdvr_set_exposure_properties(sdvr_chan_handle_t handle, sdvr_exposure_t* exposure) {
+    return Board::instance().property(handle, Board::EXPOSURE, exposure, sizeof *exposure, true);
+}
+
+// Motion maps are not made, the setting is only kept
+sdvr_err_e sdvr_enable_motion_map(sdvr_chan_handle_t handle, sx_bool enable) {
+    return Board::instance().property(handle, Board::MOTION_MAP, &enable, sizeof enable, true);
+}
+
+sdvr_err_e sdvr_osd_text_config_ex(sdvr_chan_handle_t handle, sx_uint8 osd_id, sdvr_osd_config_ex_t* osd_text_config) {
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_osd_text_show(sdvr_chan_handle_t handle, sx_uint8 osd_id, sx_bool show) {
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_fosd_get_cap(const sdvr_chan_handle_t handle, sdvr_fosd_msg_cap_t* fosd_cap) {
+    if (!fosd_cap)
+        return SDVR_ERR_INVALID_ARG;
+    memset(fosd_cap, 0, sizeof *fosd_cap);
+    fosd_cap->num_enc        = SIM::Channel::MAX_ENCODERS + 1;     // and the snapshot
+    fosd_cap->num_enc_osd    = 1;
+    fosd_cap->max_width_cap  = 600;
+    fosd_cap->max_height_cap = 36;
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_fosd_spec(const sdvr_chan_handle_t handle, const sdvr_fosd_msg_cap_t* fosd_spec) {
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_fosd_config(const sdvr_chan_handle_t handle, const sx_uint16 osd_id, const sdvr_fosd_config_t* fosd_config) {
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_fosd_show(const sdvr_chan_handle_t handle, const sx_uint16 osd_id, const sx_bool show) {
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_smo_set_disable_mode(sx_uint32 board_index, sx_uint8 port_num, sdvr_smo_disable_mode_e mode) {
+    return SDVR_ERR_NONE;
+}
+
+// There is no spot monitor
+sdvr_err_e sdvr_get_smo_attributes(sx_uint32 board_index, sx_uint8 port_num, sdvr_smo_attribute_t* smo_attrib) {
+    return SDVR_ERR_COMMAND_NOT_SUPPORTED;
+}
+
+sdvr_err_e sdvr_set_smo_grid_ex(sdvr_chan_handle_t handle, sx_uint8 port_num, sdvr_smo_grid_t* smo_grid) {
+    return SDVR_ERR_COMMAND_NOT_SUPPORTED;
+}
+
+sdvr_err_e sdvr_get_macaddr(sx_uint8 board_index, sx_uint8* macaddr) {
+    if (!macaddr)
+        return SDVR_ERR_INVALID_ARG;
+    memcpy(macaddr, _macaddr, sizeof _macaddr);
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_set_macaddr(sx_uint8 board_index, sx_uint8* macaddr) {
+    if (!macaddr)
+        return SDVR_ERR_INVALID_ARG;
+    memcpy(_macaddr, macaddr, sizeof _macaddr);
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_set_date_time(sx_uint32 board_index, time_t unix_time) {
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_measure_temperature(sx_uint8 board_index, float* temp) {
+    if (!temp)
+        return SDVR_ERR_INVALID_ARG;
+    *temp = 45;
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_set_watchdog_state_ex(sx_uint32 board_index, sdvr_watchdog_control_e enable, sx_uint32 msec) {
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e sdvr_enable_auth_key(sx_bool enable) {
+    return SDVR_ERR_NONE;
+}
+
+char* sdvr_get_error_text(sdvr_err_e error_no) {
+    switch (error_no) {
+        case SDVR_ERR_NONE:                 return (char*) "No error";
+        case SDVR_ERR_INVALID_ARG:          return (char*) "Invalid argument";
+        case SDVR_ERR_INVALID_BOARD:        return (char*) "Invalid board index";
+        case SDVR_ERR_BOARD_NOT_CONNECTED:  return (char*) "Board is not connected";
+        case SDVR_ERR_INVALID_CHANNEL:      return (char*) "Invalid channel number";
+        case SDVR_ERR_INVALID_CHAN_HANDLE:  return (char*) "Invalid channel handle";
+        case SDVR_ERR_WRONG_CHANNEL_TYPE:   return (char*) "Wrong channel type";
+        case SDVR_ERR_WRONG_CODEC:          return (char*) "Codec is not supported";
+        case SDVR_ERR_NOBUF:                return (char*) "No buffer available";
+        case SDVR_ERR_FILE_NOT_FOUND:       return (char*) "File not found";
+        case SDVR_ERR_COMMAND_NOT_SUPPORTED: return (char*) "Command not supported";
+        default:                            break;
+    }
+    static char text[32];
+    snprintf(text, sizeof text, "Error %d", error_no);
+    return text;
+}
+
+int sutil_vres_width(sdvr_video_std_e vs, sdvr_video_res_decimation_e res) {
+    int width, height;
+    SIM::picture_size(vs, res, width, height);
+    return width;
+}
+
+//! Padded to whole macroblocks unless bTrueSize
+int sutil_vres_height(sdvr_video_std_e vs, sdvr_video_res_decimation_e res, sx_bool bTrueSize) {
+    int width, height;
+    SIM::picture_size(vs, res, width, height);
+    return bTrueSize ? height : (height + 15) / 16 * 16;
+}
+
+sx_uint32 sutil_vstd_frame_rate(sdvr_video_std_e video_std) {
+    return video_std == SDVR_VIDEO_STD_NONE ? 0 : SIM::frame_rate(video_std);
+}
@@ -0,0 +1,548 @@
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+#include <time.h>
+#include <sbl/sbl_logger.h>
+#include <sbl/sbl_exception.h>
+#include "sim_board.h"
+
+namespace {
+const uint64_t SECOND   = 1000000000ULL;
+const uint64_t MAX_WAIT = SECOND / 10;      // the thread looks at the clock at least this often
+const uint64_t MAX_LATE = SECOND;           // frames later than this are dropped, not caught up on
+const uint8_t  START_CODE[] = { 0, 0, 0, 1 };
+const uint32_t HANDLE_SIGNATURE = 0xBEEF0000;     // as the SDK makes them, channel number in the low byte
+
+uint64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * SECOND + ts.tv_nsec;
+}
+
+int env(const char* name, int value) {
+    const char* text = getenv(name);
+    return text && *text ? strtol(text, 0, 0) : value;
+}
+}
+
+namespace SIM {
+
+int frame_rate(sdvr_video_std_e video_std) {
+    if (video_std & (SDVR_VIDEO_STD_720P60 | SDVR_VIDEO_STD_1080P60 | SDVR_VIDEO_STD_1080I60))
+        return 60;
+    if (video_std & (SDVR_VIDEO_STD_720P50 | SDVR_VIDEO_STD_1080P50 | SDVR_VIDEO_STD_1080I50))
+        return 50;
+    return video_std & SDVR_VIDEO_STD_PAL_MASK ? 25 : 30;
+}
+
+void picture_size(sdvr_video_std_e video_std, int decimation, int& width, int& height) {
+    bool pal = video_std & SDVR_VIDEO_STD_PAL_MASK;
+    switch (video_std) {
+        case SDVR_VIDEO_STD_D1_PAL:
+        case SDVR_VIDEO_STD_D1_NTSC:    width = 720;  height = pal ? 576 : 480;  break;
+        case SDVR_VIDEO_STD_CIF_PAL:
+        case SDVR_VIDEO_STD_CIF_NTSC:   width = 352;  height = pal ? 288 : 240;  break;
+        case SDVR_VIDEO_STD_2CIF_PAL:
+        case SDVR_VIDEO_STD_2CIF_NTSC:  width = 704;  height = pal ? 288 : 240;  break;
+        case SDVR_VIDEO_STD_4CIF_PAL:
+        case SDVR_VIDEO_STD_4CIF_NTSC:  width = 704;  height = pal ? 576 : 480;  break;
+        case SDVR_VIDEO_STD_720P60:
+        case SDVR_VIDEO_STD_720P50:
+        case SDVR_VIDEO_STD_720P30:
+        case SDVR_VIDEO_STD_720P25:     width = 1280; height = 720;              break;
+        case SDVR_VIDEO_STD_NONE:       width = 0;    height = 0;                return;
+        default:                        width = 1920; height = 1080;             break;
+    }
+    switch (decimation) {
+        case SDVR_VIDEO_RES_DECIMATION_EQUAL:                                   break;
+        case SDVR_VIDEO_RES_DECIMATION_FOURTH:      width /= 2; height /= 2;    break;
+        case SDVR_VIDEO_RES_DECIMATION_SIXTEENTH:   width /= 4; height /= 4;    break;
+        case SDVR_VIDEO_RES_DECIMATION_HALF:
+        case SDVR_VIDEO_RES_DECIMATION_DCIF:        width /= 2;                 break;
+        case SDVR_VIDEO_RES_DECIMATION_CLASSIC_CIF: width = 352; height = pal ? 288 : 240; break;
+        case SDVR_VIDEO_RES_DECIMATION_CLASSIC_2CIF:
+        case SDVR_VIDEO_RES_2CIF:                   width = 704; height = pal ? 288 : 240; break;
+        case SDVR_VIDEO_RES_DECIMATION_CLASSIC_4CIF:
+        case SDVR_VIDEO_RES_4CIF:                   width = 704; height = pal ? 576 : 480; break;
+        case SDVR_VIDEO_RES_D1:                     width = 720; height = pal ? 576 : 480; break;
+        case SDVR_VIDEO_RES_720P:                   width = 1280; height = 720;  break;
+        case SDVR_VIDEO_RES_1080I:
+        case SDVR_VIDEO_RES_1080P:                  width = 1920; height = 1080; break;
+        default:                                    width = 0;    height = 0;    break;
+    }
+}
+
+Queue::~Queue() {
+    for (unsigned int n = 0; n < ready.size(); n++)
+        free(ready[n]);
+    for (unsigned int n = 0; n < unused.size(); n++)
+        free(unused[n]);
+}
+
+Buffer* Queue::acquire(uint32_t size) {
+    Buffer* buffer = NULL;
+    if (!unused.empty()) {
+        buffer = unused.back();
+        unused.pop_back();
+    } else if (held + (int) ready.size() >= limit) {
+        if (ready.empty())
+            return NULL;
+        buffer = ready.front();             // the application is behind, the oldest frame goes
+        ready.pop_front();
+        drops++;
+    }
+    if (!buffer || buffer->capacity < size) {
+        uint32_t capacity = buffer && buffer->capacity * 2 > size ? buffer->capacity * 2 : size;
+        free(buffer);
+        buffer = (Buffer*) malloc(sizeof(Buffer) + capacity);
+        SBL_THROW_IF(!buffer, "Out of memory for a %d byte frame", size);
+        buffer->capacity = capacity;
+    }
+    buffer->queue = this;
+    return buffer;
+}
+
+// never deleted, the thread keeps running until the process exits
+Board& Board::instance() {
+    static Board* board = new Board;
+    return *board;
+}
+
+Board::Board() : _initialized(false), _connected(false), _test_frames(false), _channel_count(1),
+    _frame_size(0), _video_std(SDVR_VIDEO_STD_NONE), _stream_callback(NULL), _start(0) {
+    memset(&_settings, 0, sizeof _settings);
+}
+
+sdvr_err_e Board::init() {
+    _mutex.lock();
+    if (!_initialized) {
+        _channel_count = env("SDVR_SIM_CHANNELS", 1);
+        if (_channel_count < 1 || _channel_count > 16)
+            _channel_count = 1;
+        _frame_size = env("SDVR_SIM_FRAME_SIZE", 0);
+        const char* files = getenv("SDVR_SIM_FILES");
+        if (files && *files) {
+            const char* p = files;
+            for (const char* comma; (comma = strchr(p, ',')); p = comma + 1)
+                _file_names.push_back(std::string(p, comma - p));
+            _file_names.push_back(p);
+        }
+        sdvr_err_e err = SDVR_ERR_NONE;
+        for (unsigned int n = 0; n < _file_names.size(); n++) {
+            const std::string& name = _file_names[n];
+            if (name.empty() || _files.count(name))
+                continue;
+            try {
+                _files[name] = new StreamFile(name.c_str());
+            } catch (SBL::Exception& ex) {
+                SBL_ERROR("%s", ex.what());
+                err = SDVR_ERR_FILE_NOT_FOUND;
+            }
+        }
+        if (err != SDVR_ERR_NONE) {
+            _file_names.clear();
+            _mutex.unlock();
+            return err;
+        }
+        SBL_INFO("Simulated board with %d channels, %d stream files", _channel_count, (int) _files.size());
+        _initialized = true;
+    }
+    _mutex.unlock();
+    return SDVR_ERR_NONE;
+}
+
+sdvr_err_e Board::connect(const sdvr_board_settings_t& settings) {
+    if (!_initialized)
+        return SDVR_ERR_INVALID_BOARD;
+    _mutex.lock();
+    if (_connected) {
+        _mutex.unlock();
+        return SDVR_ERR_NONE;
+    }
+    _settings  = settings;
+    _video_std = settings.hd_video_std != SDVR_VIDEO_STD_NONE ? settings.hd_video_std : settings.video_std;
+    if (_video_std == SDVR_VIDEO_STD_NONE)
+        _video_std = SDVR_VIDEO_STD_D1_NTSC;
+    _channels.assign(_channel_count, (Channel*) NULL);
+    _start     = now();
+    _connected = true;
+    _mutex.unlock();
+    create_thread(Detached);
+    return SDVR_ERR_NONE;
+}
+
+void Board::config(sdvr_board_config_t& config) const {
+    memset(&config, 0, sizeof config);
+    config.num_cameras_supported         = _channel_count;
+    config.num_encoders_supported        = _channel_count;
+    config.camera_type                   = _video_std;
+    config.num_video_encoders_per_camera = Channel::MAX_ENCODERS;
+    config.num_raw_video_stream_per_camera = 1;
+}
+
+void Board::attributes(sdvr_board_attrib_t& attrib) const {
+    memset(&attrib, 0, sizeof attrib);
+    attrib.board_type           = 0x18a2;
+    attrib.supported_video_stds = SDVR_VIDEO_STD_NTSC_MASK | SDVR_VIDEO_STD_PAL_MASK;
+    attrib.board_revision       = 1;
+    attrib.board_sub_rev        = 'A';
+    attrib.max_recv_buf_count   = 32;
+}
+
+sdvr_err_e Board::create_channel(const sdvr_chan_def_t& def, const sdvr_chan_buf_def_t& buf_def,
+                                 sdvr_chan_handle_t* handle) {
+    if (!handle)
+        return SDVR_ERR_INVALID_ARG;
+    if (def.chan_type != SDVR_CHAN_TYPE_ENCODER)
+        return SDVR_ERR_WRONG_CHANNEL_TYPE;
+    _mutex.lock();
+    sdvr_err_e err = SDVR_ERR_NONE;
+    if (!_connected)
+        err = SDVR_ERR_BOARD_NOT_CONNECTED;
+    else if (def.chan_num >= _channels.size())
+        err = SDVR_ERR_INVALID_CHANNEL;
+    else if (_channels[def.chan_num])
+        err = SDVR_ERR_INVALID_CHANNEL;
+    if (err != SDVR_ERR_NONE) {
+        _mutex.unlock();
+        return err;
+    }
+    Channel* channel = new Channel;
+    channel->handle   = (sdvr_chan_handle_t) (HANDLE_SIGNATURE | def.chan_num);
+    channel->number   = def.chan_num;
+    channel->encoder_count = def.set_video_encoders_count ? def.video_encoders_count : 2;
+    if (channel->encoder_count < 1 || channel->encoder_count > Channel::MAX_ENCODERS)
+        channel->encoder_count = Channel::MAX_ENCODERS;
+    channel->snapshot = 0;
+    int buffers = buf_def.u1.encoder.video_buf_count ? buf_def.u1.encoder.video_buf_count : DEFAULT_BUFFERS;
+    for (int n = 0; n < Channel::MAX_ENCODERS; n++) {
+        Encoder& encoder = channel->encoders[n];
+        memset(&encoder.params, 0, sizeof encoder.params);
+        encoder.params.frame_rate     = frame_rate(_video_std);
+        encoder.params.res_decimation = SDVR_VIDEO_RES_DECIMATION_EQUAL;
+        encoder.queue.limit = buffers;
+    }
+    channel->encoders[0].codec = (sdvr_venc_e) def.video_format_primary;
+    channel->encoders[1].codec = (sdvr_venc_e) def.video_format_secondary;
+    channel->snapshots.limit   = SNAPSHOT_BUFFERS;
+    if (!_file_names.empty())
+        channel->file = _file_names[def.chan_num % _file_names.size()];
+    _channels[def.chan_num] = channel;
+    *handle = channel->handle;
+    _mutex.unlock();
+    SBL_MSG(SBL_MSG_SIM, "Created channel %d, %d buffers a stream, %s", def.chan_num, buffers,
+            channel->file.empty() ? "synthetic frames" : channel->file.c_str());
+    return SDVR_ERR_NONE;
+}
+
+Channel* Board::channel(sdvr_chan_handle_t handle) {
+    if (((uint32_t) handle & 0xffff0000) != HANDLE_SIGNATURE)
+        return NULL;
+    unsigned int number = handle & 0xff;
+    return number < _channels.size() ? _channels[number] : NULL;
+}
+
+Encoder* Board::encoder(sdvr_chan_handle_t handle, unsigned int stream_id) {
+    Channel* chan = channel(handle);
+    return chan && (int) stream_id < chan->encoder_count ? &chan->encoders[stream_id] : NULL;
+}
+
+sdvr_err_e Board::video_std(sdvr_chan_handle_t handle, sdvr_video_std_e& video_std) {
+    _mutex.lock();
+    bool valid = channel(handle);
+    _mutex.unlock();
+    video_std = _video_std;
+    return valid ? SDVR_ERR_NONE : SDVR_ERR_INVALID_CHAN_HANDLE;
+}
+
+// Frame rate of the encoder settings is either frames per second, or with a skip method (see
+// sdvr_set_frame_rate()) one frame in n, every n seconds or every n minutes.
+void Board::start_encoder(Channel* channel, Encoder& encoder) {
+    int fps  = frame_rate(_video_std);
+    int rate = encoder.params.frame_rate;
+    int count = rate & 0x3f;
+    switch (rate >> 6) {
+        case SDVR_FRS_METHOD_NONE:      encoder.interval = SECOND / (rate > 0 && rate <= fps ? rate : fps);  break;
+        case SDVR_FRS_METHOD_FRAMES:    encoder.interval = SECOND / fps * (count ? count : 1);  break;
+        case SDVR_FRS_METHOD_SECONDS:   encoder.interval = SECOND * (count ? count : 1);        break;
+        default:                        encoder.interval = SECOND * 60 * (count ? count : 1);   break;
+    }
+    int width, height;
+    if (encoder.params.res_decimation == SDVR_VIDEO_RES_CUSTOM) {
+        width  = encoder.params.custom_res.scaled_width;
+        height = encoder.params.custom_res.scaled_height;
+    } else {
+        picture_size(_video_std, encoder.params.res_decimation, width, height);
+    }
+    if (width <= 0 || height <= 0)
+        picture_size(_video_std, SDVR_VIDEO_RES_DECIMATION_EQUAL, width, height);
+
+    delete encoder.frames;
+    encoder.frames = NULL;
+    int frames_per_second = SECOND / encoder.interval ? SECOND / encoder.interval : 1;
+    if (encoder.codec == SDVR_VIDEO_ENC_JPEG) {
+        encoder.frames = new SyntheticJpeg(width, height, encoder.params.encoder.jpeg.quality);
+    } else if (!channel->file.empty()) {
+        encoder.frames = new FileH264(_files[channel->file]);
+    } else {
+        encoder.frames = new SyntheticH264(width, height, encoder.params.encoder.h264.gop, frames_per_second,
+                                           encoder.params.encoder.h264.avg_bitrate, _frame_size);
+    }
+    encoder.next = now();
+    SBL_MSG(SBL_MSG_SIM, "Channel %d encoder %d: %dx%d, a frame every %d ms", channel->number,
+            (int) (&encoder - channel->encoders), width, height, (int) (encoder.interval / 1000000));
+}
+
+sdvr_err_e Board::set_codec(sdvr_chan_handle_t handle, unsigned int stream_id, sdvr_venc_e codec) {
+    if (codec != SDVR_VIDEO_ENC_H264 && codec != SDVR_VIDEO_ENC_JPEG && codec != SDVR_VIDEO_ENC_NONE)
+        return SDVR_ERR_WRONG_CODEC;
+    _mutex.lock();
+    Encoder* enc = encoder(handle, stream_id);
+    if (enc && enc->codec != codec) {
+        enc->codec = codec;
+        if (enc->enabled && codec != SDVR_VIDEO_ENC_NONE)
+            start_encoder(channel(handle), *enc);
+        else
+            enc->enabled = false;
+    }
+    _mutex.unlock();
+    return enc ? SDVR_ERR_NONE : SDVR_ERR_INVALID_CHAN_HANDLE;
+}
+
+sdvr_err_e Board::set_encoder(sdvr_chan_handle_t handle, unsigned int stream_id, const sdvr_video_enc_chan_params_t& params) {
+    _mutex.lock();
+    Encoder* enc = encoder(handle, stream_id);
+    if (enc) {
+        enc->params = params;
+        if (enc->enabled)
+            start_encoder(channel(handle), *enc);
+    }
+    _mutex.unlock();
+    return enc ? SDVR_ERR_NONE : SDVR_ERR_INVALID_CHAN_HANDLE;
+}
+
+sdvr_err_e Board::get_encoder(sdvr_chan_handle_t handle, unsigned int stream_id, sdvr_video_enc_chan_params_t& params) {
+    _mutex.lock();
+    Encoder* enc = encoder(handle, stream_id);
+    if (enc)
+        params = enc->params;
+    _mutex.unlock();
+    return enc ? SDVR_ERR_NONE : SDVR_ERR_INVALID_CHAN_HANDLE;
+}
+
+sdvr_err_e Board::enable_encoder(sdvr_chan_handle_t handle, unsigned int stream_id, bool enable) {
+    _mutex.lock();
+    sdvr_err_e err = SDVR_ERR_NONE;
+    Encoder* enc = encoder(handle, stream_id);
+    if (!enc)
+        err = SDVR_ERR_INVALID_CHAN_HANDLE;
+    else if (enable && enc->codec == SDVR_VIDEO_ENC_NONE)
+        err = SDVR_ERR_WRONG_CODEC;
+    else if (enable != enc->enabled) {
+        enc->enabled = enable;
+        if (enable)
+            start_encoder(channel(handle), *enc);
+        _mutex.signal();
+    }
+    _mutex.unlock();
+    return err;
+}
+
+sdvr_err_e Board::snapshot(sdvr_chan_handle_t handle, int decimation) {
+    _mutex.lock();
+    Channel* chan = channel(handle);
+    if (chan) {
+        chan->snapshot = decimation ? decimation : SDVR_VIDEO_RES_DECIMATION_EQUAL;
+        _mutex.signal();
+    }
+    _mutex.unlock();
+    return chan ? SDVR_ERR_NONE : SDVR_ERR_INVALID_CHAN_HANDLE;
+}
+
+sdvr_err_e Board::property(sdvr_chan_handle_t handle, Property property, void* data, int size, bool set) {
+    if (!data)
+        return SDVR_ERR_INVALID_ARG;
+    _mutex.lock();
+    Channel* chan = channel(handle);
+    if (chan) {
+        std::vector<uint8_t>& value = chan->properties[property];
+        value.resize(size);
+        if (set)
+            memcpy(&value[0], data, size);
+        else
+            memcpy(data, &value[0], size);
+    }
+    _mutex.unlock();
+    return chan ? SDVR_ERR_NONE : SDVR_ERR_INVALID_CHAN_HANDLE;
+}
+
+sdvr_err_e Board::get_buffer(sdvr_chan_handle_t handle, sdvr_frame_type_e frame_type, unsigned int stream_id,
+                             sdvr_av_buffer_t** buffer) {
+    if (!buffer)
+        return SDVR_ERR_INVALID_ARG;
+    *buffer = NULL;
+    _mutex.lock();
+    Channel* chan  = channel(handle);
+    Queue*   queue = NULL;
+    if (chan && (frame_type == SDVR_FRAME_JPEG_SNAPSHOT || frame_type == SDVR_FRAME_CMD_RESPONSE))
+        queue = &chan->snapshots;
+    else if (chan && (int) stream_id < chan->encoder_count)
+        queue = &chan->encoders[stream_id].queue;
+    if (queue && !queue->ready.empty()) {
+        Buffer* ready = queue->ready.front();
+        queue->ready.pop_front();
+        queue->held++;
+        *buffer = &ready->av;
+    }
+    _mutex.unlock();
+    if (!queue)
+        return SDVR_ERR_INVALID_CHAN_HANDLE;
+    return *buffer ? SDVR_ERR_NONE : SDVR_ERR_NOBUF;
+}
+
+sdvr_err_e Board::release_buffer(sdvr_av_buffer_t* buffer) {
+    if (!buffer)
+        return SDVR_ERR_INVALID_ARG;
+    Buffer* owner = (Buffer*) ((uint8_t*) buffer - offsetof(Buffer, av));
+    _mutex.lock();
+    owner->queue->held--;
+    owner->queue->unused.push_back(owner);
+    _mutex.unlock();
+    return SDVR_ERR_NONE;
+}
+
+sdvr_stream_callback Board::set_stream_callback(sdvr_stream_callback callback) {
+    _mutex.lock();
+    sdvr_stream_callback previous = _stream_callback;
+    _stream_callback = callback;
+    _mutex.unlock();
+    return previous;
+}
+
+// A ready buffer taken back for the new frame may not have been called back yet; then the
+// callback goes to the new frame only, there is nothing left for the older one to get
+void Board::fill(Queue& queue, const Unit& unit, bool start_code, uint64_t time, uint32_t frame_number,
+                 unsigned int stream_id, Channel* channel, std::vector<Event>& events) {
+    uint32_t size = unit.size + (start_code ? sizeof START_CODE : 0);
+    uint32_t drops = queue.drops;
+    Buffer* buffer = queue.acquire(size);
+    if (!buffer) {
+        queue.drops++;
+        return;
+    }
+    if (queue.drops != drops) {
+        unsigned int pending = 0, first = events.size();
+        for (unsigned int n = 0; n < events.size(); n++)
+            if (events[n].queue == &queue && !pending++)
+                first = n;
+        if (pending > queue.ready.size())
+            events.erase(events.begin() + first);
+    }
+    sdvr_av_buffer_t& av = buffer->av;
+    memset(&av, 0, offsetof(sdvr_av_buffer_t, payload));
+    av.channel_type     = SDVR_CHAN_TYPE_ENCODER;
+    av.channel_id       = channel->number;
+    av.frame_type       = unit.type;
+    av.stream_id        = stream_id;
+    av.payload_size     = size;
+    av.timestamp        = (uint32_t) time;
+    av.timestamp_high   = (uint32_t) (time >> 32);
+    av.seq_number       = queue.seq_number++;
+    av.frame_number     = frame_number;
+    av.frame_drop_count = queue.drops;
+    if (_test_frames) {
+        av.is_test_frame = 1;
+        av.test_pattern  = frame_number & 0xff;
+        memset(av.payload, av.test_pattern, size);
+    } else {
+        if (start_code)
+            memcpy(av.payload, START_CODE, sizeof START_CODE);
+        memcpy(av.payload + size - unit.size, unit.data, unit.size);
+    }
+    queue.ready.push_back(buffer);
+    Event event = { &queue, channel->handle, unit.type, stream_id };
+    events.push_back(event);
+}
+
+void Board::encode(Channel* channel, unsigned int stream_id, std::vector<Event>& events) {
+    Encoder& encoder = channel->encoders[stream_id];
+    encoder.frames->next(_units);
+    uint64_t time = (encoder.next - _start) / (SECOND / CLOCK);
+    encoder.frame_number++;
+    for (unsigned int n = 0; n < _units.size(); n++)
+        fill(encoder.queue, _units[n], encoder.codec == SDVR_VIDEO_ENC_H264, time, encoder.frame_number,
+             stream_id, channel, events);
+}
+
+void Board::take_snapshot(Channel* channel, uint64_t now, std::vector<Event>& events) {
+    int width, height;
+    picture_size(_video_std, channel->snapshot, width, height);
+    if (width <= 0 || height <= 0)
+        picture_size(_video_std, SDVR_VIDEO_RES_DECIMATION_EQUAL, width, height);
+    channel->snapshot = 0;
+    SyntheticJpeg jpeg(width, height, 75, SDVR_FRAME_JPEG_SNAPSHOT);
+    jpeg.next(_units);
+    fill(channel->snapshots, _units[0], false, (now - _start) / (SECOND / CLOCK), 0, 0, channel, events);
+}
+
+// The firmware: encode what is due, then with the lock released, tell the application about
+// the buffers, as the SDK does from its own thread
+void Board::start_thread() {
+    std::vector<Event> events;
+    _mutex.lock();
+    for (;;) {
+        uint64_t time = now();
+        uint64_t due  = time + MAX_WAIT;
+        for (unsigned int c = 0; c < _channels.size(); c++) {
+            Channel* channel = _channels[c];
+            if (!channel)
+                continue;
+            for (int n = 0; n < channel->encoder_count; n++) {
+                Encoder& encoder = channel->encoders[n];
+                if (!encoder.enabled || !encoder.frames)
+                    continue;
+                if (encoder.next + MAX_LATE < time) {
+                    uint32_t missed = (time - encoder.next) / encoder.interval;
+                    SBL_WARN("Channel %d encoder %d: %d frames late, dropped", c, n, missed);
+                    encoder.queue.drops += missed;
+                    encoder.next        += (uint64_t) missed * encoder.interval;
+                }
+                while (encoder.next <= time) {
+                    encode(channel, n, events);
+                    encoder.next += encoder.interval;
+                }
+                if (encoder.next < due)
+                    due = encoder.next;
+            }
+            if (channel->snapshot)
+                take_snapshot(channel, time, events);
+        }
+        if (!events.empty()) {
+            sdvr_stream_callback callback = _stream_callback;
+            _mutex.unlock();
+            for (unsigned int n = 0; callback && n < events.size(); n++)
+                callback(events[n].handle, events[n].frame_type, events[n].stream_id);
+            events.clear();
+            _mutex.lock();
+            continue;
+        }
+        int wait = (due - time) / 1000;
+        _mutex.wait(wait > 0 ? wait : 1);
+    }
+}
+
+}
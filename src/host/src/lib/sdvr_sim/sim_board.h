@@ -0,0 +1,171 @@
+#pragma once
+#ifndef _SIM_BOARD_H
+#define _SIM_BOARD_H
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include <sbl/sbl_thread.h>
+#include <sdk/sdvr_sdk.h>
+#include "sim_frames.h"
+
+namespace SIM {
+
+//! Width and height of a picture of the video standard at the decimation, 0 if there is no such size
+void picture_size(sdvr_video_std_e video_std, int decimation, int& width, int& height);
+//! Frames per second of the video standard
+int  frame_rate(sdvr_video_std_e video_std);
+
+struct Queue;
+
+//! SDK buffer of a frame, the payload runs past the end of it
+struct Buffer {
+    Queue*              queue;          // where it goes back to
+    uint32_t            capacity;       // payload bytes
+    sdvr_av_buffer_t    av;             // must be last
+};
+
+//! Buffers of one stream of a channel. At most limit of them are given to the application
+//! or waiting to be taken, when all are the oldest waiting one is dropped for the new frame.
+struct Queue {
+    std::deque<Buffer*>     ready;      // waiting for sdvr_get_stream_buffer()
+    std::vector<Buffer*>    unused;     // released, to be filled again
+    int                     held;       // taken and not released yet
+    int                     limit;
+    uint32_t                seq_number;
+    uint32_t                drops;
+    Queue() : held(0), limit(0), seq_number(0), drops(0) {}
+    ~Queue();
+    //! Buffer for size bytes of payload, NULL if all are held by the application
+    Buffer* acquire(uint32_t size);
+};
+
+//! Encoder stream of a channel
+struct Encoder {
+    sdvr_venc_e                     codec;
+    sdvr_video_enc_chan_params_t    params;
+    bool                            enabled;
+    Frames*                         frames;     // made when enabled, again when settings change
+    uint64_t                        next;       // when the next frame is due, ns on the monotonic clock
+    uint64_t                        interval;   // ns between frames
+    uint32_t                        frame_number;
+    Queue                           queue;
+    Encoder() : codec(SDVR_VIDEO_ENC_NONE), enabled(false), frames(NULL), next(0), interval(0), frame_number(0) {}
+    ~Encoder() { delete frames; }
+};
+
+//! Encoder channel (camera) of the board
+struct Channel {
+    enum { MAX_ENCODERS = 4 };
+    sdvr_chan_handle_t  handle;
+    int                 number;
+    int                 encoder_count;
+    Encoder             encoders[MAX_ENCODERS];
+    Queue               snapshots;
+    int                 snapshot;               // decimation of the snapshot asked for, 0 if none
+    std::string         file;                   // stream file the encoders replay, empty to make up frames
+    std::map<int, std::vector<uint8_t> > properties;  // settings the board only keeps, by Property
+};
+
+//! A board that is not there: what sdvr_* functions of the SDK do, on the host.
+/*! The board has SDVR_SIM_CHANNELS encoder channels (1 if not set), each with up to four encoder
+    streams. One thread plays the part of the firmware: when a frame of an enabled encoder is due,
+    on the monotonic clock at the encoder frame rate, it puts the frame into buffers of the stream
+    and calls the stream callback for each buffer, as the SDK does. The application then takes
+    the buffer with sdvr_get_stream_buffer() and gives it back with sdvr_release_av_buffer();
+    buffers it keeps count against the channel buffer count, and frames with no buffer are dropped.\n
+    H.264 frames are made up to match the GOP and bitrate of the encoder (SDVR_SIM_FRAME_SIZE
+    bytes a frame on average if set), or replayed from the elementary stream files in
+    SDVR_SIM_FILES, a comma separated list; channel n plays the file n modulo the number of files,
+    an empty name makes up frames. JPEG frames and snapshots are filler of a plausible size.
+    Other settings (image, OSD, watchdog...) are only kept, to be read back. */
+class Board : private SBL::Thread {
+public:
+    //! Settings that are only kept
+    enum Property { IMAGE, FLIP, EXPOSURE, MOTION_MAP };
+
+    //! The one board
+    static Board& instance();
+
+    sdvr_err_e init();
+    sdvr_err_e connect(const sdvr_board_settings_t& settings);
+    void config(sdvr_board_config_t& config) const;
+    void attributes(sdvr_board_attrib_t& attrib) const;
+    sdvr_err_e create_channel(const sdvr_chan_def_t& def, const sdvr_chan_buf_def_t& buf_def, sdvr_chan_handle_t* handle);
+    sdvr_err_e video_std(sdvr_chan_handle_t handle, sdvr_video_std_e& video_std);
+
+    sdvr_err_e set_codec(sdvr_chan_handle_t handle, unsigned int stream_id, sdvr_venc_e codec);
+    sdvr_err_e set_encoder(sdvr_chan_handle_t handle, unsigned int stream_id, const sdvr_video_enc_chan_params_t& params);
+    sdvr_err_e get_encoder(sdvr_chan_handle_t handle, unsigned int stream_id, sdvr_video_enc_chan_params_t& params);
+    sdvr_err_e enable_encoder(sdvr_chan_handle_t handle, unsigned int stream_id, bool enable);
+    sdvr_err_e snapshot(sdvr_chan_handle_t handle, int decimation);
+    //! Keep or read back a setting of a channel, read back as zeros if never set
+    sdvr_err_e property(sdvr_chan_handle_t handle, Property property, void* data, int size, bool set);
+
+    sdvr_err_e get_buffer(sdvr_chan_handle_t handle, sdvr_frame_type_e frame_type, unsigned int stream_id,
+                          sdvr_av_buffer_t** buffer);
+    sdvr_err_e release_buffer(sdvr_av_buffer_t* buffer);
+
+    sdvr_stream_callback set_stream_callback(sdvr_stream_callback callback);
+    //! Send test frames, payload filled with a pattern, rather than video
+    void set_test_frames(bool enable) { _test_frames = enable; }
+    bool connected() const { return _connected; }
+private:
+    // a buffer the callback is called for
+    struct Event {
+        Queue*              queue;
+        sdvr_chan_handle_t  handle;
+        sdvr_frame_type_e   frame_type;
+        unsigned int        stream_id;
+    };
+    enum { DEFAULT_BUFFERS = 10, SNAPSHOT_BUFFERS = 2, CLOCK = 100000 /* timestamp clock, Hz */ };
+
+    SBL::Mutex                          _mutex;
+    bool                                _initialized;
+    bool                                _connected;
+    volatile bool                       _test_frames;
+    int                                 _channel_count;
+    int                                 _frame_size;
+    std::vector<std::string>            _file_names;
+    std::map<std::string, StreamFile*>  _files;
+    sdvr_board_settings_t               _settings;
+    sdvr_video_std_e                    _video_std;
+    std::vector<Channel*>               _channels;
+    sdvr_stream_callback                _stream_callback;
+    uint64_t                            _start;             // ns, timestamps count from here
+    Units                               _units;
+
+    Board();
+    // channel of a handle; call with _mutex held
+    Channel* channel(sdvr_chan_handle_t handle);
+    Encoder* encoder(sdvr_chan_handle_t handle, unsigned int stream_id);
+    // make the frames of the encoder from its settings and start it now; call with _mutex held
+    void start_encoder(Channel* channel, Encoder& encoder);
+    // put the next frame of the encoder into buffers; call with _mutex held
+    void encode(Channel* channel, unsigned int stream_id, std::vector<Event>& events);
+    void take_snapshot(Channel* channel, uint64_t now, std::vector<Event>& events);
+    void fill(Queue& queue, const Unit& unit, bool start_code, uint64_t time, uint32_t frame_number,
+              unsigned int stream_id, Channel* channel, std::vector<Event>& events);
+    void start_thread();
+
+    Board(const Board&);                // not implemented
+    Board& operator=(const Board&);     // not implemented
+};
+
+}
+#endif
@@ -0,0 +1,243 @@
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <sbl/sbl_logger.h>
+#include <sbl/sbl_exception.h>
+#include "sim_frames.h"
+
+namespace {
+// Writes the bits of an RBSP, most significant first
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<uint8_t>& out) : _out(out), _bits(0), _count(0) {}
+    void put(uint32_t value, int bits) {
+        while (bits-- > 0) {
+            _bits = _bits << 1 | ((value >> bits) & 1);
+            if (++_count == 8) {
+                _out.push_back(_bits);
+                _bits  = 0;
+                _count = 0;
+            }
+        }
+    }
+    // unsigned Exp-Golomb code
+    void ue(uint32_t value) {
+        uint32_t code = value + 1;
+        int bits = 0;
+        while (code >> bits)
+            bits++;
+        put(0, bits - 1);
+        put(code, bits);
+    }
+    // rbsp_stop_one_bit and alignment
+    void trailing() {
+        put(1, 1);
+        if (_count)
+            put(0, 8 - _count);
+    }
+private:
+    std::vector<uint8_t>&   _out;
+    uint8_t                 _bits;
+    int                     _count;
+};
+
+// First bytes of slices, after the NAL header: first_mb_in_slice 0 and slice_type 7 (all I) or 5 (all P)
+const uint8_t IDR_FILL = 0x88;
+const uint8_t P_FILL   = 0x9a;
+const uint8_t PPS[]    = { 0x68, 0xce, 0x38, 0x80 };
+
+// first_mb_in_slice of a slice NAL unit, -1 if it does not fit in the first 4 bytes after the header
+int first_mb(const uint8_t* nal, uint32_t size) {
+    uint32_t bits = 0;
+    for (uint32_t n = 1; n < 5; n++)
+        bits = bits << 8 | (n < size ? nal[n] : 0);
+    int zeros = 0;
+    while (zeros < 16 && !(bits & 0x80000000u >> zeros))
+        zeros++;
+    if (zeros == 16 || 2 * zeros + 1 > (int) (size - 1) * 8)
+        return -1;
+    return (bits >> (31 - 2 * zeros)) - 1;
+}
+}
+
+namespace SIM {
+
+void SyntheticH264::make_sps(int width, int height, std::vector<uint8_t>& sps) {
+    int mb_width  = (width  + 15) / 16;
+    int mb_height = (height + 15) / 16;
+    int crop_right  = mb_width  * 16 - width;
+    int crop_bottom = mb_height * 16 - height;
+    std::vector<uint8_t> rbsp;
+    BitWriter bits(rbsp);
+    bits.put(66, 8);                                // baseline
+    bits.put(0xc0, 8);                              // constraint_set0 and 1
+    bits.put(mb_width * mb_height > 3600 ? 40 : 31, 8);
+    bits.ue(0);                                     // seq_parameter_set_id
+    bits.ue(0);                                     // log2_max_frame_num_minus4
+    bits.ue(0);                                     // pic_order_cnt_type
+    bits.ue(0);                                     // log2_max_pic_order_cnt_lsb_minus4
+    bits.ue(1);                                     // max_num_ref_frames
+    bits.put(0, 1);                                 // gaps_in_frame_num_value_allowed_flag
+    bits.ue(mb_width - 1);
+    bits.ue(mb_height - 1);
+    bits.put(1, 1);                                 // frame_mbs_only_flag
+    bits.put(1, 1);                                 // direct_8x8_inference_flag
+    bits.put(crop_right || crop_bottom, 1);
+    if (crop_right || crop_bottom) {                // in units of 2 pixels for 4:2:0
+        bits.ue(0);
+        bits.ue(crop_right / 2);
+        bits.ue(0);
+        bits.ue(crop_bottom / 2);
+    }
+    bits.put(0, 1);                                 // vui_parameters_present_flag
+    bits.trailing();
+
+    sps.assign(1, 0x67);
+    int zeros = 0;
+    for (unsigned int n = 0; n < rbsp.size(); n++) {
+        if (zeros == 2 && rbsp[n] <= 3) {
+            sps.push_back(3);                       // emulation_prevention_three_byte
+            zeros = 0;
+        }
+        sps.push_back(rbsp[n]);
+        zeros = rbsp[n] ? 0 : zeros + 1;
+    }
+}
+
+SyntheticH264::SyntheticH264(int width, int height, int gop, int fps, int bitrate, int frame_size) :
+    _pps(PPS, PPS + sizeof PPS), _gop(gop > 0 ? gop : 1), _frame(0) {
+    make_sps(width, height, _sps);
+    if (frame_size <= 0)
+        frame_size = (int64_t) bitrate * 1000 / 8 / (fps > 0 ? fps : 30);
+    // the GOP averages frame_size a frame, most of it in the IDR
+    int p_size   = (int64_t) frame_size * _gop / (_gop - 1 + IDR_WEIGHT);
+    int idr_size = _gop > 1 ? p_size * IDR_WEIGHT : frame_size;
+    _idr.assign(idr_size > 16 ? idr_size : 16, IDR_FILL);
+    _p.assign(p_size > 16 ? p_size : 16, P_FILL);
+    _idr[0] = 0x65;
+    _p[0]   = 0x41;
+    SBL_MSG(SBL_MSG_SIM, "Synthetic H.264 %dx%d, GOP %d, IDR %d bytes, P %d bytes", width, height, _gop,
+            (int) _idr.size(), (int) _p.size());
+}
+
+void SyntheticH264::next(Units& units) {
+    units.clear();
+    if (_frame++ % _gop == 0) {
+        Unit sps = { &_sps[0], (uint32_t) _sps.size(), SDVR_FRAME_H264_SPS };
+        Unit pps = { &_pps[0], (uint32_t) _pps.size(), SDVR_FRAME_H264_PPS };
+        Unit idr = { &_idr[0], (uint32_t) _idr.size(), SDVR_FRAME_H264_IDR };
+        units.push_back(sps);
+        units.push_back(pps);
+        units.push_back(idr);
+    } else {
+        Unit p = { &_p[0], (uint32_t) _p.size(), SDVR_FRAME_H264_P };
+        units.push_back(p);
+    }
+}
+
+// Units are split at start codes; parameter sets go with the picture after them, slices that carry on
+// the picture before (first_mb_in_slice past that of its last slice) with it. Other NAL units are left out.
+StreamFile::StreamFile(const char* path) : _path(path) {
+    FILE* file = fopen(path, "rb");
+    SBL_THROW_IF(!file, "%s: unable to open, %s", path, strerror(errno));
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    _data.resize(size > 0 ? size : 0);
+    size_t read = _data.empty() ? 0 : fread(&_data[0], 1, _data.size(), file);
+    fclose(file);
+    SBL_THROW_IF(read != _data.size(), "%s: unable to read", path);
+
+    int pending = -1;                               // first parameter set waiting for its picture
+    int last_mb = -1;                               // first macroblock of the last slice
+    const uint8_t* end = _data.empty() ? NULL : &_data[0] + _data.size();
+    const uint8_t* p   = _data.empty() ? NULL : &_data[0];
+    while (p && p + 3 <= end) {
+        if (p[0] != 0 || p[1] != 0 || p[2] != 1) {
+            p++;
+            continue;
+        }
+        const uint8_t* nal = p + 3;
+        const uint8_t* next = nal;
+        while (next + 3 <= end && !(next[0] == 0 && next[1] == 0 && next[2] == 1))
+            next++;
+        if (next + 3 > end)
+            next = end;
+        const uint8_t* last = next;
+        while (last > nal && last[-1] == 0)         // trailing zeros, or the first byte of a 4 byte start code
+            last--;
+        p = next;
+        if (last == nal)
+            continue;
+        Unit unit = { nal, (uint32_t) (last - nal), SDVR_FRAME_H264_P };
+        switch (nal[0] & 0x1f) {
+            case 7:
+            case 8:
+                unit.type = (nal[0] & 0x1f) == 7 ? SDVR_FRAME_H264_SPS : SDVR_FRAME_H264_PPS;
+                if (pending < 0)
+                    pending = _units.size();
+                _units.push_back(unit);
+                break;
+            case 1:
+            case 5:
+            {
+                unit.type = (nal[0] & 0x1f) == 5 ? SDVR_FRAME_H264_IDR : SDVR_FRAME_H264_P;
+                int mb = first_mb(nal, unit.size);
+                bool more = mb > last_mb && last_mb >= 0 && pending < 0 && !_frames.empty();
+                last_mb = mb;
+                if (more) {
+                    _units.push_back(unit);
+                    _frames.back().count++;
+                } else {
+                    Frame frame = { pending < 0 ? (uint32_t) _units.size() : (uint32_t) pending, 0 };
+                    _units.push_back(unit);
+                    frame.count = _units.size() - frame.first;
+                    _frames.push_back(frame);
+                    pending = -1;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    SBL_THROW_IF(_frames.empty(), "%s: no H.264 pictures found", path);
+    SBL_INFO("Loaded %s: %d frames, %d bytes", path, (int) _frames.size(), (int) _data.size());
+}
+
+void FileH264::next(Units& units) {
+    const StreamFile::Frame& frame = _file->frames()[_frame++ % _file->frames().size()];
+    units.assign(_file->units().begin() + frame.first, _file->units().begin() + frame.first + frame.count);
+}
+
+SyntheticJpeg::SyntheticJpeg(int width, int height, int quality, sdvr_frame_type_e type) : _type(type) {
+    if (quality <= 0 || quality > 100)
+        quality = 50;
+    int size = width * height / 4 * quality / 100;
+    _jpeg.assign(size > 1024 ? size : 1024, 0x55);
+    _jpeg[0] = 0xff;                                // SOI
+    _jpeg[1] = 0xd8;
+    _jpeg[_jpeg.size() - 2] = 0xff;                 // EOI
+    _jpeg[_jpeg.size() - 1] = 0xd9;
+}
+
+void SyntheticJpeg::next(Units& units) {
+    Unit jpeg = { &_jpeg[0], (uint32_t) _jpeg.size(), _type };
+    units.assign(1, jpeg);
+}
+
+}
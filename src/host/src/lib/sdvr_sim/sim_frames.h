@@ -0,0 +1,106 @@
+#pragma once
+#ifndef _SIM_FRAMES_H
+#define _SIM_FRAMES_H
+/****************************************************************************\
+*  Copyright C 2013 Stretch, Inc. All rights reserved. Stretch products are  *
+*  protected under numerous U.S. and foreign patents, maskwork rights,       *
+*  copyrights and other intellectual property laws.                          *
+*                                                                            *
+*  This source code and the related tools, software code and documentation,  *
+*  and your use thereof, are subject to and governed by the terms and        *
+*  conditions of the applicable Stretch IDE or SDK and RDK License Agreement *
+*  (either as agreed by you or found at www.stretchinc.com). By using these  *
+*  items, you indicate your acceptance of such terms and conditions between  *
+*  you and Stretch, Inc. In the event that you do not agree with such terms  *
+*  and conditions, you may not use any of these items and must immediately   *
+*  destroy any copies you have made.                                         *
+\****************************************************************************/
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <sdk/sdvr_sdk.h>
+
+//! Messages of the simulator come with the SDK messages of the RTSP library
+#define SBL_MSG_SIM 32
+
+namespace SIM {
+
+//! One buffer worth of an encoded frame, as the board hands it over
+struct Unit {
+    const uint8_t*      data;       //!< without start code
+    uint32_t            size;
+    sdvr_frame_type_e   type;
+};
+typedef std::vector<Unit> Units;
+
+//! Encoded frames of one encoder stream, in presentation order.
+/*! Each call to next() gives the units of one frame; H.264 parameter sets come with the
+    IDR frame they precede, each in its own unit. Units stay valid until the next call. */
+class Frames {
+public:
+    virtual ~Frames() {}
+    //! Units of the next frame, replacing what units held
+    virtual void next(Units& units) = 0;
+};
+
+//! H.264 frames made up to match the encoder settings: a GOP of one IDR and gop - 1 P frames,
+//! sized so that the GOP averages the bitrate. Slices hold filler, only the SPS is real.
+class SyntheticH264 : public Frames {
+public:
+    //! @param  frame_size  average frame size in bytes, 0 to take it from bitrate (kbps) and fps
+    SyntheticH264(int width, int height, int gop, int fps, int bitrate, int frame_size);
+    void next(Units& units);
+    //! SPS of a baseline stream of this size, without start code
+    static void make_sps(int width, int height, std::vector<uint8_t>& sps);
+private:
+    enum { IDR_WEIGHT = 4 };        // IDR frame is this many P frames
+    std::vector<uint8_t>    _sps;
+    std::vector<uint8_t>    _pps;
+    std::vector<uint8_t>    _idr;
+    std::vector<uint8_t>    _p;
+    int                     _gop;
+    unsigned int            _frame;
+};
+
+//! Elementary stream file, loaded once and shared by all the streams playing it
+class StreamFile {
+public:
+    //! A frame: its first unit and the number of units
+    struct Frame {
+        uint32_t    first;
+        uint32_t    count;
+    };
+    //! Load and index an H.264 Annex B file, throws SBL::Exception if there are no frames in it
+    explicit StreamFile(const char* path);
+    const std::string&          path()   const { return _path; }
+    const Units&                units()  const { return _units; }
+    const std::vector<Frame>&   frames() const { return _frames; }
+private:
+    std::string             _path;
+    std::vector<uint8_t>    _data;
+    Units                   _units;
+    std::vector<Frame>      _frames;
+};
+
+//! Frames of a stream file, from the beginning again when it ends
+class FileH264 : public Frames {
+public:
+    explicit FileH264(const StreamFile* file) : _file(file), _frame(0) {}
+    void next(Units& units);
+private:
+    const StreamFile*   _file;
+    unsigned int        _frame;
+};
+
+//! JPEG frames of the encoder picture size, smaller at lower quality; filler between SOI and EOI
+class SyntheticJpeg : public Frames {
+public:
+    SyntheticJpeg(int width, int height, int quality, sdvr_frame_type_e type = SDVR_FRAME_JPEG);
+    void next(Units& units);
+private:
+    std::vector<uint8_t>    _jpeg;
+    sdvr_frame_type_e       _type;
+};
+
+}
+#endif
@@ -0,0 +1,204 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+#include <unistd.h>
+#include <sbl/sbl_logger.h>
+#include <sbl/sbl_thread.h>
+#include <sdk/sdvr_sdk.h>
+
+// What the callback got from a buffer
+struct Frame {
+    sdvr_chan_handle_t  handle;
+    sdvr_frame_type_e   type;
+    unsigned int        stream_id;
+    sx_uint64           timestamp;
+    sx_uint32           frame_number;
+    std::vector<uint8_t> payload;
+};
+
+SBL::Mutex          mutex;
+std::vector<Frame>  frames;
+sdvr_chan_handle_t  channels[2];
+
+// Takes the buffers and gives them back right away, except those of channel 0 stream 1,
+// which are left for the test to take
+void callback(sdvr_chan_handle_t handle, sdvr_frame_type_e frame_type, sx_uint32 stream_id) {
+    if (handle == channels[0] && stream_id == 1 && frame_type != SDVR_FRAME_JPEG_SNAPSHOT)
+        return;
+    sdvr_av_buffer_t* buffer;
+    assert(sdvr_get_stream_buffer(handle, frame_type, stream_id, &buffer) == SDVR_ERR_NONE);
+    Frame frame;
+    frame.handle    = handle;
+    frame.type      = frame_type;
+    frame.stream_id = stream_id;
+    sdvr_get_buffer_timestamp(buffer, &frame.timestamp);
+    sx_uint32 seq_number, drops;
+    sdvr_av_buf_sequence(buffer, &seq_number, &frame.frame_number, &drops);
+    sx_uint8*  payload;
+    sx_uint32  size;
+    sdvr_av_buf_payload(buffer, &payload, &size);
+    frame.payload.assign(payload, payload + size);
+    sdvr_release_av_buffer(buffer);
+    mutex.lock();
+    frames.push_back(frame);
+    mutex.unlock();
+}
+
+std::vector<Frame> take(sdvr_chan_handle_t handle, unsigned int stream_id) {
+    std::vector<Frame> taken;
+    mutex.lock();
+    for (unsigned int n = 0; n < frames.size(); n++)
+        if (frames[n].handle == handle && frames[n].stream_id == stream_id && frames[n].type != SDVR_FRAME_JPEG_SNAPSHOT)
+            taken.push_back(frames[n]);
+    mutex.unlock();
+    return taken;
+}
+
+// Stream file of one GOP: SPS, PPS, IDR, then a P frame of two slices
+const uint8_t FILE_DATA[] = {
+    0, 0, 0, 1, 0x67, 0x42, 0xc0, 0x1e, 0xda,
+    0, 0, 0, 1, 0x68, 0xce, 0x38, 0x80,
+    0, 0, 0, 1, 0x65, 0x88, 0x84, 0x21,
+    0, 0, 0, 1, 0x41, 0x9a, 0x02,
+    0, 0, 1,    0x41, 0x0e, 0x05,
+};
+
+void setup_encoder(sdvr_chan_handle_t handle, unsigned int stream_id, int gop) {
+    sdvr_video_enc_chan_params_t params;
+    memset(&params, 0, sizeof params);
+    params.frame_rate              = sdvr_set_frame_rate(SDVR_FRS_METHOD_NONE, 30);
+    params.res_decimation          = SDVR_VIDEO_RES_DECIMATION_EQUAL;
+    params.encoder.h264.gop         = gop;
+    params.encoder.h264.avg_bitrate = 2000;
+    assert(sdvr_set_chan_video_codec(handle, stream_id, SDVR_VIDEO_ENC_H264) == SDVR_ERR_NONE);
+    assert(sdvr_set_video_encoder_channel_params(handle, stream_id, &params) == SDVR_ERR_NONE);
+    assert(sdvr_enable_encoder(handle, stream_id, true) == SDVR_ERR_NONE);
+}
+
+int main() {
+    const char* path = "/tmp/test_sdvr_sim.264";
+    FILE* file = fopen(path, "wb");
+    assert(file && fwrite(FILE_DATA, 1, sizeof FILE_DATA, file) == sizeof FILE_DATA);
+    fclose(file);
+    setenv("SDVR_SIM_CHANNELS", "2", 1);
+    setenv("SDVR_SIM_FILES", ",/tmp/test_sdvr_sim.264", 1);
+
+    assert(sdvr_sdk_init() == SDVR_ERR_NONE);
+    sdvr_board_config_t config;
+    assert(sdvr_get_board_config(0, &config) == SDVR_ERR_NONE);
+    assert(config.num_encoders_supported == 2 && config.num_video_encoders_per_camera == 4);
+    assert(sutil_vres_width(SDVR_VIDEO_STD_D1_NTSC, SDVR_VIDEO_RES_DECIMATION_CIF) == 360);
+    assert(sutil_vres_height(SDVR_VIDEO_STD_1080P30, SDVR_VIDEO_RES_DECIMATION_EQUAL, false) == 1088);
+    assert(sutil_vstd_frame_rate(SDVR_VIDEO_STD_D1_PAL) == 25);
+
+    sdvr_board_settings_t settings;
+    memset(&settings, 0, sizeof settings);
+    settings.video_std = SDVR_VIDEO_STD_D1_NTSC;
+    assert(sdvr_board_connect_ex(0, &settings) == SDVR_ERR_NONE);
+    sdvr_set_stream_callback(callback);
+
+    sdvr_chan_def_t chan_def;
+    memset(&chan_def, 0, sizeof chan_def);
+    chan_def.chan_type                = SDVR_CHAN_TYPE_ENCODER;
+    chan_def.set_video_encoders_count = 4;
+    chan_def.video_encoders_count     = 4;
+    sdvr_chan_buf_def_t buf_def;
+    memset(&buf_def, 0, sizeof buf_def);
+    buf_def.u1.encoder.video_buf_count = 4;
+    for (chan_def.chan_num = 0; chan_def.chan_num < 2; chan_def.chan_num++) {
+        assert(sdvr_create_chan_ex(&chan_def, &buf_def, &channels[chan_def.chan_num]) == SDVR_ERR_NONE);
+        assert(sdvr_get_chan_num(channels[chan_def.chan_num]) == chan_def.chan_num);
+    }
+    assert(sdvr_create_chan_ex(&chan_def, &buf_def, &channels[0]) == SDVR_ERR_INVALID_CHANNEL);
+    assert(sdvr_enable_encoder(channels[0], 2, true) == SDVR_ERR_WRONG_CODEC);
+    assert(sdvr_set_chan_video_codec(channels[0], 2, SDVR_VIDEO_ENC_MPEG4) == SDVR_ERR_WRONG_CODEC);
+
+    setup_encoder(channels[0], 0, 10);
+    setup_encoder(channels[0], 1, 10);
+    setup_encoder(channels[1], 0, 10);
+    usleep(500000);
+
+    // made up frames: a GOP of 10 at 30 fps, parameter sets before each IDR
+    std::vector<Frame> synthetic = take(channels[0], 0);
+    int pictures = 0;
+    sx_uint64 last = 0;
+    for (unsigned int n = 0; n < synthetic.size(); n++) {
+        const Frame& frame = synthetic[n];
+        assert(frame.payload.size() > 4 && !memcmp(&frame.payload[0], "\0\0\0\1", 4));
+        if (frame.type == SDVR_FRAME_H264_SPS) {
+            assert((frame.frame_number - 1) % 10 == 0);
+            assert(synthetic[n + 1].type == SDVR_FRAME_H264_PPS && synthetic[n + 2].type == SDVR_FRAME_H264_IDR);
+        }
+        if (frame.type != SDVR_FRAME_H264_IDR && frame.type != SDVR_FRAME_H264_P)
+            continue;
+        assert(frame.type == ((frame.frame_number - 1) % 10 ? SDVR_FRAME_H264_P : SDVR_FRAME_H264_IDR));
+        assert(frame.payload[4] == (frame.type == SDVR_FRAME_H264_IDR ? 0x65 : 0x41));
+        if (pictures++)
+            assert(frame.timestamp - last >= 3333 && frame.timestamp - last <= 3334);
+        last = frame.timestamp;
+    }
+    assert(synthetic[0].type == SDVR_FRAME_H264_SPS && synthetic[0].frame_number == 1);
+    assert(pictures >= 12 && pictures <= 18);
+
+    // replayed frames: the file again and again, the two slices of the P frame together
+    std::vector<Frame> replayed = take(channels[1], 0);
+    assert(replayed.size() >= 8);
+    const sdvr_frame_type_e order[] = { SDVR_FRAME_H264_SPS, SDVR_FRAME_H264_PPS, SDVR_FRAME_H264_IDR,
+                                        SDVR_FRAME_H264_P, SDVR_FRAME_H264_P };
+    for (unsigned int n = 0; n < replayed.size(); n++)
+        assert(replayed[n].type == order[n % 5]);
+    assert(replayed[2].payload.size() == 8 && !memcmp(&replayed[2].payload[0], FILE_DATA + 17, 8));
+    assert(replayed[4].payload.size() == 7 && replayed[4].payload[5] == 0x0e);
+    assert(replayed[3].frame_number == replayed[4].frame_number);
+
+    // buffers left to the application: the newest 4 are kept, the rest dropped
+    sdvr_av_buffer_t* held[5];
+    for (int n = 0; n < 4; n++)
+        assert(sdvr_get_stream_buffer(channels[0], SDVR_FRAME_H264_P, 1, &held[n]) == SDVR_ERR_NONE);
+    sx_uint32 seq_number, frame_number, drops;
+    sdvr_av_buf_sequence(held[3], &seq_number, &frame_number, &drops);
+    assert(drops > 0 && seq_number == held[0]->seq_number + 3);
+    sx_uint32 last_seq = seq_number;
+    // with all held, new frames are dropped
+    usleep(100000);
+    assert(sdvr_get_stream_buffer(channels[0], SDVR_FRAME_H264_P, 1, &held[4]) == SDVR_ERR_NOBUF);
+    for (int n = 0; n < 4; n++)
+        sdvr_release_av_buffer(held[n]);
+    usleep(100000);
+    assert(sdvr_get_stream_buffer(channels[0], SDVR_FRAME_H264_P, 1, &held[4]) == SDVR_ERR_NONE);
+    sdvr_av_buf_sequence(held[4], &seq_number, &frame_number, &drops);
+    assert(seq_number > last_seq);
+    sdvr_release_av_buffer(held[4]);
+
+    // snapshot comes by the callback, from the board thread
+    assert(sdvr_snapshot(channels[0], SDVR_VIDEO_RES_DECIMATION_EQUAL) == SDVR_ERR_NONE);
+    bool snapshot = false;
+    for (int n = 0; n < 50 && !snapshot; n++) {
+        usleep(10000);
+        mutex.lock();
+        for (unsigned int f = 0; f < frames.size(); f++)
+            if (frames[f].type == SDVR_FRAME_JPEG_SNAPSHOT) {
+                const std::vector<uint8_t>& jpeg = frames[f].payload;
+                assert(jpeg.size() > 1024 && jpeg[0] == 0xff && jpeg[1] == 0xd8 && jpeg[jpeg.size() - 1] == 0xd9);
+                snapshot = true;
+            }
+        mutex.unlock();
+    }
+    assert(snapshot);
+
+    // settings the board only keeps are read back
+    sdvr_flip_t flip;
+    memset(&flip, 0, sizeof flip);
+    flip.flip_mode = (sdvr_flip_mode_e) 1;
+    assert(sdvr_set_flip_properties(channels[1], &flip) == SDVR_ERR_NONE);
+    memset(&flip, 0, sizeof flip);
+    assert(sdvr_get_flip_properties(channels[1], &flip) == SDVR_ERR_NONE && flip.flip_mode == 1);
+    assert(sdvr_get_flip_properties(0x1234, &flip) == SDVR_ERR_INVALID_CHAN_HANDLE);
+
+    unlink(path);
+    printf("test_sdvr_sim passed\n");
+    return 0;
+}